@@ -492,3 +492,18 @@ void aio_context_setup(AioContext *ctx, Error **errp)
     }
 #endif
 }
+
+void aio_context_setup_after_fork(AioContext *ctx)
+{
+#ifdef CONFIG_EPOLL
+    /* The epoll instance is shared with the parent; closing our reference
+     * leaves its registrations alone. */
+    if (ctx->epoll_enabled) {
+        aio_epoll_disable(ctx);
+    } else if (ctx->epoll_available) {
+        close(ctx->epollfd);
+        ctx->epollfd = epoll_create1(EPOLL_CLOEXEC);
+        ctx->epoll_available = ctx->epollfd != -1;
+    }
+#endif
+}
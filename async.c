@@ -27,6 +27,7 @@
 #include "block/thread-pool.h"
 #include "qemu/main-loop.h"
 #include "qemu/atomic.h"
+#include "qemu/error-report.h"
 
 /***********************************************************/
 /* bottom halves (can be seen as timers which expire ASAP) */
@@ -356,6 +357,28 @@ fail:
     return NULL;
 }
 
+#ifndef _WIN32
+void aio_context_after_fork(AioContext *ctx)
+{
+    aio_context_setup_after_fork(ctx);
+
+    /* A notifier shared with the parent would let either process swallow
+     * the other's wakeups */
+    aio_set_event_notifier(ctx, &ctx->notifier, false, NULL);
+    event_notifier_cleanup(&ctx->notifier);
+    if (event_notifier_init(&ctx->notifier, false) < 0) {
+        error_report("cannot create event notifier after fork");
+        abort();
+    }
+    aio_set_event_notifier(ctx, &ctx->notifier,
+                           false,
+                           (EventNotifierHandler *)
+                           event_notifier_dummy_cb);
+
+    thread_pool_after_fork(ctx->thread_pool);
+}
+#endif
+
 void aio_context_ref(AioContext *ctx)
 {
     g_source_ref(&ctx->source);
@@ -319,6 +319,73 @@ static inline TranslationBlock *tb_find_fast(CPUState *cpu)
     return tb;
 }
 
+/* On targets that build traces, a TB is entered from the main loop only, and
+   its executions counted, until it has run TB_HOT_EXEC_COUNT times.  It is
+   then translated again as a trace, which may extend along the side of its
+   branches that ran more often (see tb_exec_count()).  TBs limited to a
+   number of instructions for I/O are left alone.  */
+static inline bool tb_is_counted(TranslationBlock *tb)
+{
+#ifdef TARGET_HAS_TB_TRACE
+    return !(tb->cflags & (CF_TRACE | CF_COUNT_MASK));
+#else
+    return false;
+#endif
+}
+
+static TranslationBlock *tb_count_exec(CPUState *cpu, TranslationBlock *tb)
+{
+    target_ulong pc = tb->pc, cs_base = tb->cs_base;
+    uint64_t flags = tb->flags;
+    uint32_t cflags = tb->cflags;
+
+    if (++tb->exec_count < TB_HOT_EXEC_COUNT) {
+        return tb;
+    }
+    tb_phys_invalidate(tb, -1);
+    tb = tb_gen_code(cpu, pc, cs_base, flags, cflags | CF_TRACE);
+    cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)] = tb;
+    return tb;
+}
+
+/* Executions counted for the TB at pc so far: TB_HOT_EXEC_COUNT once it is
+   a trace, 0 if it is not in the jump cache.  Only meaningful on targets
+   that build traces.  */
+int tb_exec_count(CPUState *cpu, target_ulong pc, target_ulong cs_base,
+                  uint64_t flags)
+{
+    TranslationBlock *tb = cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)];
+
+    if (!tb || tb->pc != pc || tb->cs_base != cs_base || tb->flags != flags) {
+        return 0;
+    }
+    return tb_is_counted(tb) ? tb->exec_count : TB_HOT_EXEC_COUNT;
+}
+
+/* Called from generated code after an indirect branch to find the host code
+   of the next TB without leaving the code buffer.  Only the jump cache is
+   probed: translating here is not possible because it may flush the buffer
+   we are running from.  On a miss, return the epilogue so that the main
+   loop looks the TB up as it would after exit_tb(0).  */
+void *tb_lookup_ptr(CPUState *cpu)
+{
+    CPUArchState *env = (CPUArchState *)cpu->env_ptr;
+    TranslationBlock *tb;
+    target_ulong cs_base, pc;
+    int flags;
+
+    if (unlikely(qemu_loglevel_mask(CPU_LOG_TB_NOCHAIN))) {
+        return tcg_ctx.code_gen_epilogue;
+    }
+    cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    tb = cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)];
+    if (unlikely(!tb || tb->pc != pc || tb->cs_base != cs_base ||
+                 tb->flags != flags || tb_is_counted(tb))) {
+        return tcg_ctx.code_gen_epilogue;
+    }
+    return tb->tc_ptr;
+}
+
 static void cpu_handle_debug_exception(CPUState *cpu)
 {
     CPUClass *cc = CPU_GET_CLASS(cpu);
@@ -491,6 +558,13 @@ int cpu_exec(CPUState *cpu)
                 }
                 tb_lock();
                 tb = tb_find_fast(cpu);
+                if (tb_is_counted(tb)) {
+                    /* Not chained to, so that every execution is counted;
+                       nor is the trace replacing it, from the TB just run,
+                       which may be the one replaced */
+                    tb = tb_count_exec(cpu, tb);
+                    next_tb = 0;
+                }
                 /* Note: we do it here to avoid a gcc bug on Mac OS X when
                    doing it in tb_find_slow */
                 if (tcg_ctx.tb_ctx.tb_invalidated_flag) {
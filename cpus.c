@@ -116,6 +116,8 @@ static bool all_cpu_threads_idle(void)
 /* Protected by TimersState seqlock */
 
 static bool icount_sleep = true;
+/* Without icount: skip QEMU_CLOCK_VIRTUAL to the next deadline when idle */
+static bool idle_warp;
 static int64_t vm_clock_warp_start = -1;
 /* Conversion factor from emulated instructions to virtual clock ticks.  */
 static int icount_time_shift;
@@ -396,6 +398,36 @@ void qtest_clock_warp(int64_t dest)
     qemu_clock_notify(QEMU_CLOCK_VIRTUAL);
 }
 
+/* Outside icount mode QEMU_CLOCK_VIRTUAL follows the host monotonic clock.
+ * With -idle-warp, move it straight to the next QEMU_CLOCK_VIRTUAL deadline
+ * whenever every CPU is halted, instead of waiting for that time to pass.
+ */
+static void idle_warp_virtual_clock(void)
+{
+    int64_t deadline;
+
+    if (!runstate_is_running() || !all_cpu_threads_idle()) {
+        return;
+    }
+
+    deadline = qemu_clock_deadline_ns_all(QEMU_CLOCK_VIRTUAL);
+    if (deadline < 0) {
+        /* Nothing pending; only an external event can wake the CPU */
+        return;
+    }
+    if (deadline > 0) {
+        seqlock_write_lock(&timers_state.vm_clock_seqlock);
+        timers_state.cpu_clock_offset += deadline;
+        seqlock_write_unlock(&timers_state.vm_clock_seqlock);
+    }
+    qemu_clock_notify(QEMU_CLOCK_VIRTUAL);
+}
+
+void configure_idle_warp(void)
+{
+    idle_warp = true;
+}
+
 void qemu_clock_warp(QEMUClockType type)
 {
     int64_t clock;
@@ -406,7 +438,13 @@ void qemu_clock_warp(QEMUClockType type)
      * applicable to other clocks.  But a clock argument removes the
      * need for if statements all over the place.
      */
-    if (type != QEMU_CLOCK_VIRTUAL || !use_icount) {
+    if (type != QEMU_CLOCK_VIRTUAL) {
+        return;
+    }
+    if (!use_icount) {
+        if (idle_warp) {
+            idle_warp_virtual_clock();
+        }
         return;
     }
 
@@ -1304,37 +1342,76 @@ void resume_all_vcpus(void)
 /* For temporary buffers for forming a name */
 #define VCPU_THREAD_NAME_SIZE 16
 
-static void qemu_tcg_init_vcpu(CPUState *cpu)
+static QemuCond *tcg_halt_cond;
+static QemuThread *tcg_cpu_thread;
+
+static void qemu_tcg_start_thread(CPUState *cpu)
 {
     char thread_name[VCPU_THREAD_NAME_SIZE];
-    static QemuCond *tcg_halt_cond;
-    static QemuThread *tcg_cpu_thread;
 
+    cpu->thread = g_malloc0(sizeof(QemuThread));
+    cpu->halt_cond = g_malloc0(sizeof(QemuCond));
+    qemu_cond_init(cpu->halt_cond);
+    tcg_halt_cond = cpu->halt_cond;
+    snprintf(thread_name, VCPU_THREAD_NAME_SIZE, "CPU %d/TCG",
+             cpu->cpu_index);
+    qemu_thread_create(cpu->thread, thread_name, qemu_tcg_cpu_thread_fn,
+                       cpu, QEMU_THREAD_JOINABLE);
+#ifdef _WIN32
+    cpu->hThread = qemu_thread_get_handle(cpu->thread);
+#endif
+    while (!cpu->created) {
+        qemu_cond_wait(&qemu_cpu_cond, &qemu_global_mutex);
+    }
+    tcg_cpu_thread = cpu->thread;
+}
+
+static void qemu_tcg_init_vcpu(CPUState *cpu)
+{
     tcg_cpu_address_space_init(cpu, cpu->as);
 
     /* share a single thread for all cpus with TCG */
     if (!tcg_cpu_thread) {
-        cpu->thread = g_malloc0(sizeof(QemuThread));
-        cpu->halt_cond = g_malloc0(sizeof(QemuCond));
-        qemu_cond_init(cpu->halt_cond);
-        tcg_halt_cond = cpu->halt_cond;
-        snprintf(thread_name, VCPU_THREAD_NAME_SIZE, "CPU %d/TCG",
-                 cpu->cpu_index);
-        qemu_thread_create(cpu->thread, thread_name, qemu_tcg_cpu_thread_fn,
-                           cpu, QEMU_THREAD_JOINABLE);
-#ifdef _WIN32
-        cpu->hThread = qemu_thread_get_handle(cpu->thread);
-#endif
-        while (!cpu->created) {
-            qemu_cond_wait(&qemu_cpu_cond, &qemu_global_mutex);
-        }
-        tcg_cpu_thread = cpu->thread;
+        qemu_tcg_start_thread(cpu);
     } else {
         cpu->thread = tcg_cpu_thread;
         cpu->halt_cond = tcg_halt_cond;
     }
 }
 
+/*
+ * Only the thread that called fork() survives in the child.  Start a new
+ * TCG thread for the (stopped) vCPUs; it waits for vm_start() like the
+ * original one did after machine creation.  The old thread and condition
+ * objects belong to a thread that no longer exists and are leaked on
+ * purpose.
+ */
+void cpus_after_fork(void)
+{
+    CPUState *cpu;
+
+    if (!tcg_enabled() || !first_cpu) {
+        return;
+    }
+    assert(!runstate_is_running());
+
+    CPU_FOREACH(cpu) {
+        cpu->created = false;
+        cpu->thread_kicked = false;
+    }
+    qemu_cond_init(&qemu_cpu_cond);
+    qemu_cond_init(&qemu_pause_cond);
+    qemu_cond_init(&qemu_work_cond);
+    qemu_cond_init(&qemu_io_proceeded_cond);
+
+    tcg_cpu_thread = NULL;
+    qemu_tcg_start_thread(first_cpu);
+    CPU_FOREACH(cpu) {
+        cpu->thread = tcg_cpu_thread;
+        cpu->halt_cond = tcg_halt_cond;
+    }
+}
+
 static void qemu_kvm_start_vcpu(CPUState *cpu)
 {
     char thread_name[VCPU_THREAD_NAME_SIZE];
@@ -28,6 +28,7 @@
 
 #include "exec/memory-internal.h"
 #include "exec/ram_addr.h"
+#include "qemu/rcu.h"
 #include "tcg/tcg.h"
 
 //#define DEBUG_TLB
@@ -471,6 +472,53 @@ tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong addr)
     return qemu_ram_addr_from_host_nofail(p);
 }
 
+/* Like get_page_addr_code(), for code that is not about to be fetched:
+ * this never raises an exception or fills the TLB, and returns -1 if the
+ * page is not RAM or ROM.  On a TLB miss the page is found with the debug
+ * translation, which does not check execute permission; that is left to
+ * get_page_addr_code() when the code is looked up to run.
+ */
+tb_page_addr_t get_page_addr_code_probe(CPUArchState *env1,
+                                        target_ulong addr)
+{
+    int mmu_idx, page_index, pd;
+    void *p;
+    MemoryRegion *mr;
+    CPUState *cpu = ENV_GET_CPU(env1);
+    hwaddr phys, xlat, len = 1;
+    ram_addr_t ram_addr = -1;
+
+    page_index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    mmu_idx = cpu_mmu_index(env1, true);
+    if (env1->tlb_table[mmu_idx][page_index].addr_code ==
+        (addr & TARGET_PAGE_MASK)) {
+        pd = env1->iotlb[mmu_idx][page_index].addr & ~TARGET_PAGE_MASK;
+        mr = iotlb_to_region(cpu, pd);
+        if (memory_region_is_unassigned(mr)) {
+            return -1;
+        }
+        p = (void *)((uintptr_t)addr +
+                     env1->tlb_table[mmu_idx][page_index].addend);
+        return qemu_ram_addr_from_host_nofail(p);
+    }
+
+    phys = cpu_get_phys_page_debug(cpu, addr & TARGET_PAGE_MASK);
+    if (phys == -1) {
+        return -1;
+    }
+    rcu_read_lock();
+    mr = address_space_translate(cpu->as, phys | (addr & ~TARGET_PAGE_MASK),
+                                 &xlat, &len, false);
+    if (memory_region_is_ram(mr) || memory_region_is_romd(mr)) {
+        p = memory_region_get_ram_ptr(mr) + xlat;
+        if (!qemu_ram_addr_from_host(p, &ram_addr)) {
+            ram_addr = -1;
+        }
+    }
+    rcu_read_unlock();
+    return ram_addr;
+}
+
 #define MMUSUFFIX _mmu
 
 #define SHIFT 0
@@ -2461,6 +2461,13 @@ static void invalidate_and_set_dirty(MemoryRegion *mr, hwaddr addr,
     cpu_physical_memory_set_dirty_range(addr, length, dirty_log_mask);
 }
 
+void cpu_physical_memory_notify_write(MemoryRegion *mr, hwaddr addr,
+                                      hwaddr length)
+{
+    invalidate_and_set_dirty(mr, memory_region_get_ram_addr(mr) + addr,
+                             length);
+}
+
 static int memory_access_size(MemoryRegion *mr, unsigned l, hwaddr addr)
 {
     unsigned access_size_max = mr->ops->valid.max_access_size;
@@ -1786,4 +1786,20 @@ int gdbserver_start(const char *device)
 
     return 0;
 }
+
+/* Disable gdb stub for child processes.  */
+void gdbserver_fork(CPUState *cpu)
+{
+    GDBState *s = gdbserver_state;
+
+    if (!s || !s->chr) {
+        return;
+    }
+    qemu_chr_add_handlers(s->chr, NULL, NULL, NULL, NULL);
+    qemu_chr_delete(s->chr);
+    s->chr = NULL;
+    s->state = RS_INACTIVE;
+    cpu_breakpoint_remove_all(cpu, BP_GDB);
+    cpu_watchpoint_remove_all(cpu, BP_GDB);
+}
 #endif
@@ -274,6 +274,21 @@ STEXI
 @item info mtree
 @findex mtree
 Show memory tree.
+ETEXI
+
+    {
+        .name       = "mmio-profile",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show MMIO access statistics per memory region",
+        .mhandler.cmd = hmp_info_mmio_profile,
+    },
+
+STEXI
+@item info mmio-profile
+@findex mmio-profile
+Show MMIO access counts, volume and host time per memory region, collected
+since profiling was enabled with @code{mmio-profile on}.
 ETEXI
 
     {
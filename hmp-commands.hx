@@ -310,6 +310,59 @@ Open, close, or flush the trace file.  If no argument is given, the status of th
 ETEXI
 #endif
 
+    {
+        .name       = "mmio-profile",
+        .args_type  = "op:s",
+        .params     = "on|off|reset",
+        .help       = "start, stop or reset MMIO access profiling",
+        .mhandler.cmd = hmp_mmio_profile,
+    },
+
+STEXI
+@item mmio-profile on|off|reset
+@findex mmio-profile
+Start or stop counting MMIO accesses per memory region, or discard the
+statistics collected so far.  See @code{info mmio-profile}.
+ETEXI
+
+    {
+        .name       = "guest-profile-start",
+        .args_type  = "icount:-i,period:i,depth:i?,symbols:F?",
+        .params     = "[-i] period [depth] [symbols]",
+        .help       = "start sampling the guest PC every 'period' "
+                      "microseconds (-i: instructions), recording up to "
+                      "'depth' frames, with function symbols from 'symbols'",
+        .mhandler.cmd = hmp_guest_profile_start,
+    },
+
+STEXI
+@item guest-profile-start [-i] @var{period} [@var{depth}] [@var{symbols}]
+@findex guest-profile-start
+Start sampling the guest program counter every @var{period} microseconds
+of virtual time, or every @var{period} instructions with @option{-i} (which
+requires @option{-icount}).  Each sample records up to @var{depth} frames
+(default 8): the PC, the link register and return addresses found on the
+stack.  Function symbols come from the @option{-kernel} image and from the
+ELF file @var{symbols}.
+ETEXI
+
+    {
+        .name       = "guest-profile-stop",
+        .args_type  = "filename:F,format:s?",
+        .params     = "filename [folded|pprof]",
+        .help       = "stop sampling the guest PC and write the profile "
+                      "to 'filename'",
+        .mhandler.cmd = hmp_guest_profile_stop,
+    },
+
+STEXI
+@item guest-profile-stop @var{filename} [folded|pprof]
+@findex guest-profile-stop
+Stop the guest profiler and write the samples to @var{filename}, either as
+folded stacks for @command{flamegraph.pl} (the default) or as a gperftools
+CPU profile for @command{pprof}.
+ETEXI
+
     {
         .name       = "log",
         .args_type  = "items:s",
@@ -2029,6 +2029,75 @@ void hmp_info_iothreads(Monitor *mon, const QDict *qdict)
     qapi_free_IOThreadInfoList(info_list);
 }
 
+void hmp_info_mmio_profile(Monitor *mon, const QDict *qdict)
+{
+    MmioProfileInfoList *info_list = qmp_query_mmio_profile(NULL);
+    MmioProfileInfoList *info;
+
+    monitor_printf(mon, "%-10s %10s %10s %12s %12s %12s  %s\n",
+                   "address", "reads", "writes", "bytes", "read us",
+                   "write us", "region");
+    for (info = info_list; info; info = info->next) {
+        MmioProfileInfo *p = info->value;
+
+        monitor_printf(mon, "0x%08" PRIx64 " %10" PRIu64 " %10" PRIu64
+                       " %12" PRIu64 " %12" PRIu64 " %12" PRIu64 "  %s\n",
+                       p->addr, p->reads, p->writes,
+                       p->read_bytes + p->write_bytes,
+                       p->read_ns / 1000, p->write_ns / 1000, p->name);
+    }
+
+    qapi_free_MmioProfileInfoList(info_list);
+}
+
+void hmp_mmio_profile(Monitor *mon, const QDict *qdict)
+{
+    const char *op = qdict_get_str(qdict, "op");
+
+    if (!strcmp(op, "on")) {
+        qmp_mmio_profile_set_state(true, true, false, false, NULL);
+    } else if (!strcmp(op, "off")) {
+        qmp_mmio_profile_set_state(true, false, false, false, NULL);
+    } else if (!strcmp(op, "reset")) {
+        qmp_mmio_profile_set_state(false, false, true, true, NULL);
+    } else {
+        monitor_printf(mon, "unexpected argument \"%s\"\n", op);
+    }
+}
+
+void hmp_guest_profile_start(Monitor *mon, const QDict *qdict)
+{
+    bool icount = qdict_get_try_bool(qdict, "icount", false);
+    int64_t period = qdict_get_int(qdict, "period");
+    bool has_depth = qdict_haskey(qdict, "depth");
+    int64_t depth = qdict_get_try_int(qdict, "depth", 0);
+    const char *symbols = qdict_get_try_str(qdict, "symbols");
+    Error *err = NULL;
+
+    qmp_guest_profile_start(period, true, icount, has_depth, depth,
+                            !!symbols, symbols, &err);
+    hmp_handle_error(mon, &err);
+}
+
+void hmp_guest_profile_stop(Monitor *mon, const QDict *qdict)
+{
+    const char *filename = qdict_get_str(qdict, "filename");
+    const char *format = qdict_get_try_str(qdict, "format");
+    GuestProfileFormat fmt = GUEST_PROFILE_FORMAT_FOLDED;
+    Error *err = NULL;
+
+    if (format) {
+        fmt = qapi_enum_parse(GuestProfileFormat_lookup, format,
+                              GUEST_PROFILE_FORMAT__MAX, -1, &err);
+        if (err) {
+            hmp_handle_error(mon, &err);
+            return;
+        }
+    }
+    qmp_guest_profile_stop(filename, true, fmt, &err);
+    hmp_handle_error(mon, &err);
+}
+
 void hmp_qom_list(Monitor *mon, const QDict *qdict)
 {
     const char *path = qdict_get_try_str(qdict, "path");
@@ -40,6 +40,10 @@ void hmp_info_pci(Monitor *mon, const QDict *qdict);
 void hmp_info_block_jobs(Monitor *mon, const QDict *qdict);
 void hmp_info_tpm(Monitor *mon, const QDict *qdict);
 void hmp_info_iothreads(Monitor *mon, const QDict *qdict);
+void hmp_info_mmio_profile(Monitor *mon, const QDict *qdict);
+void hmp_mmio_profile(Monitor *mon, const QDict *qdict);
+void hmp_guest_profile_start(Monitor *mon, const QDict *qdict);
+void hmp_guest_profile_stop(Monitor *mon, const QDict *qdict);
 void hmp_quit(Monitor *mon, const QDict *qdict);
 void hmp_stop(Monitor *mon, const QDict *qdict);
 void hmp_system_reset(Monitor *mon, const QDict *qdict);
@@ -11,131 +11,203 @@
 #include "hw/arm/arm.h"
 #include "hw/arm/stm32.h"
 #include "hw/loader.h"
+#include "exec/address-spaces.h"
 #include "elf.h"
 #include "sysemu/qtest.h"
 #include "qemu/error-report.h"
 
 /* Bitbanded IO.  Each word corresponds to a single bit.  */
 
-/* Get the byte address of the real memory for a bitband access.  */
-static inline uint32_t bitband_addr(void * opaque, uint32_t addr)
-{
-    uint32_t res;
+#define TYPE_BITBAND "ARM,bitband-memory"
+#define BITBAND(obj) OBJECT_CHECK(BitBandState, (obj), TYPE_BITBAND)
+
+typedef struct {
+    /*< private >*/
+    SysBusDevice parent_obj;
+    /*< public >*/
+
+    MemoryRegion iomem;
+    uint32_t base;
 
-    res = *(uint32_t *)opaque;
-    res |= (addr & 0x1ffffff) >> 5;
-    return res;
+    /* The region behind the last bit-band target, so that repeated accesses
+     * skip the address space lookup.  [target_start, target_end) is the part
+     * of the address space known to map onto target_mr at target_xlat.
+     * target_host is set when the target can be accessed directly in host
+     * memory.  Dropped whenever the memory map changes.
+     */
+    MemoryListener listener;
+    MemoryRegion *target_mr;
+    hwaddr target_start;
+    hwaddr target_end;
+    hwaddr target_xlat;
+    uint8_t *target_host;
+} BitBandState;
 
+/* Get the byte address of the real memory for a bitband access.  */
+static inline uint32_t bitband_addr(BitBandState *s, uint32_t addr)
+{
+    return s->base | ((addr & 0x1ffffff) >> 5);
 }
 
-static uint32_t bitband_readb(void *opaque, hwaddr offset)
+static void bitband_map_changed(MemoryListener *listener)
 {
-    uint8_t v;
-    cpu_physical_memory_read(bitband_addr(opaque, offset), &v, 1);
-    return (v & (1 << ((offset >> 2) & 7))) != 0;
+    BitBandState *s = container_of(listener, BitBandState, listener);
+
+    s->target_mr = NULL;
 }
 
-static void bitband_writeb(void *opaque, hwaddr offset,
-                           uint32_t value)
+static MemoryRegion *bitband_lookup(BitBandState *s, hwaddr addr,
+                                    unsigned size, hwaddr *offset)
 {
-    uint32_t addr;
-    uint8_t mask;
-    uint8_t v;
-    addr = bitband_addr(opaque, offset);
-    mask = (1 << ((offset >> 2) & 7));
-    cpu_physical_memory_read(addr, &v, 1);
-    if (value & 1)
-        v |= mask;
-    else
-        v &= ~mask;
-    cpu_physical_memory_write(addr, &v, 1);
+    MemoryRegion *mr;
+    hwaddr xlat, len;
+
+    if (!s->target_mr || addr < s->target_start ||
+        addr + size > s->target_end) {
+        /* Cover the rest of the 1MB bit-band target window in one go */
+        len = (s->base | 0xfffff) - addr + 1;
+        rcu_read_lock();
+        mr = address_space_translate(&address_space_memory, addr, &xlat, &len,
+                                     true);
+        rcu_read_unlock();
+        if (len < size) {
+            /* Straddles two regions, leave it to the slow path */
+            s->target_mr = NULL;
+            return NULL;
+        }
+        s->target_mr = mr;
+        s->target_start = addr;
+        s->target_end = addr + len;
+        s->target_xlat = xlat;
+        s->target_host = NULL;
+        if (memory_region_is_ram(mr) && !mr->readonly) {
+            s->target_host = memory_region_get_ram_ptr(mr);
+        }
+    }
+    *offset = s->target_xlat + (addr - s->target_start);
+    return s->target_mr;
 }
 
-static uint32_t bitband_readw(void *opaque, hwaddr offset)
+static uint32_t bitband_target_read(BitBandState *s, hwaddr addr,
+                                    unsigned size)
 {
-    uint32_t addr;
-    uint16_t mask;
-    uint16_t v;
-    addr = bitband_addr(opaque, offset) & ~1;
-    mask = (1 << ((offset >> 2) & 15));
-    mask = tswap16(mask);
-    cpu_physical_memory_read(addr, &v, 2);
-    return (v & mask) != 0;
+    MemoryRegion *mr;
+    hwaddr offset;
+    uint64_t v;
+    uint8_t buf[4];
+
+    mr = bitband_lookup(s, addr, size, &offset);
+    if (mr && s->target_host) {
+        switch (size) {
+        case 1:
+            return ldub_p(s->target_host + offset);
+        case 2:
+            return lduw_p(s->target_host + offset);
+        default:
+            return ldl_p(s->target_host + offset);
+        }
+    }
+    if (mr) {
+        memory_region_dispatch_read(mr, offset, &v, size,
+                                    MEMTXATTRS_UNSPECIFIED);
+        return v;
+    }
+    cpu_physical_memory_read(addr, buf, size);
+    return size == 1 ? ldub_p(buf) : size == 2 ? lduw_p(buf) : ldl_p(buf);
 }
 
-static void bitband_writew(void *opaque, hwaddr offset,
-                           uint32_t value)
+static void bitband_target_write(BitBandState *s, hwaddr addr, unsigned size,
+                                 uint32_t v)
 {
-    uint32_t addr;
-    uint16_t mask;
-    uint16_t v;
-    addr = bitband_addr(opaque, offset) & ~1;
-    mask = (1 << ((offset >> 2) & 15));
-    mask = tswap16(mask);
-    cpu_physical_memory_read(addr, &v, 2);
-    if (value & 1)
-        v |= mask;
-    else
-        v &= ~mask;
-    cpu_physical_memory_write(addr, &v, 2);
+    MemoryRegion *mr;
+    hwaddr offset;
+    uint8_t buf[4];
+
+    mr = bitband_lookup(s, addr, size, &offset);
+    if (mr && s->target_host) {
+        switch (size) {
+        case 1:
+            stb_p(s->target_host + offset, v);
+            break;
+        case 2:
+            stw_p(s->target_host + offset, v);
+            break;
+        default:
+            stl_p(s->target_host + offset, v);
+            break;
+        }
+        cpu_physical_memory_notify_write(mr, offset, size);
+        return;
+    }
+    if (mr) {
+        memory_region_dispatch_write(mr, offset, v, size,
+                                     MEMTXATTRS_UNSPECIFIED);
+        return;
+    }
+    switch (size) {
+    case 1:
+        stb_p(buf, v);
+        break;
+    case 2:
+        stw_p(buf, v);
+        break;
+    default:
+        stl_p(buf, v);
+        break;
+    }
+    cpu_physical_memory_write(addr, buf, size);
 }
 
-static uint32_t bitband_readl(void *opaque, hwaddr offset)
+static uint64_t bitband_read(void *opaque, hwaddr offset, unsigned size)
 {
+    BitBandState *s = opaque;
     uint32_t addr;
     uint32_t mask;
-    uint32_t v;
-    addr = bitband_addr(opaque, offset) & ~3;
-    mask = (1 << ((offset >> 2) & 31));
-    mask = tswap32(mask);
-    cpu_physical_memory_read(addr, &v, 4);
-    return (v & mask) != 0;
+
+    addr = bitband_addr(s, offset) & ~(size - 1);
+    mask = 1u << ((offset >> 2) & (size * 8 - 1));
+    return (bitband_target_read(s, addr, size) & mask) != 0;
 }
 
-static void bitband_writel(void *opaque, hwaddr offset,
-                           uint32_t value)
+static void bitband_write(void *opaque, hwaddr offset, uint64_t value,
+                          unsigned size)
 {
+    BitBandState *s = opaque;
     uint32_t addr;
     uint32_t mask;
     uint32_t v;
-    addr = bitband_addr(opaque, offset) & ~3;
-    mask = (1 << ((offset >> 2) & 31));
-    mask = tswap32(mask);
-    cpu_physical_memory_read(addr, &v, 4);
-    if (value & 1)
+
+    addr = bitband_addr(s, offset) & ~(size - 1);
+    mask = 1u << ((offset >> 2) & (size * 8 - 1));
+    v = bitband_target_read(s, addr, size);
+    if (value & 1) {
         v |= mask;
-    else
+    } else {
         v &= ~mask;
-    cpu_physical_memory_write(addr, &v, 4);
+    }
+    bitband_target_write(s, addr, size, v);
 }
 
 static const MemoryRegionOps bitband_ops = {
-    .old_mmio = {
-        .read = { bitband_readb, bitband_readw, bitband_readl, },
-        .write = { bitband_writeb, bitband_writew, bitband_writel, },
-    },
+    .read = bitband_read,
+    .write = bitband_write,
     .endianness = DEVICE_NATIVE_ENDIAN,
+    .valid.min_access_size = 1,
+    .valid.max_access_size = 4,
+    .impl.min_access_size = 1,
+    .impl.max_access_size = 4,
 };
 
-#define TYPE_BITBAND "ARM,bitband-memory"
-#define BITBAND(obj) OBJECT_CHECK(BitBandState, (obj), TYPE_BITBAND)
-
-typedef struct {
-    /*< private >*/
-    SysBusDevice parent_obj;
-    /*< public >*/
-
-    MemoryRegion iomem;
-    uint32_t base;
-} BitBandState;
-
 static int bitband_init(SysBusDevice *dev)
 {
     BitBandState *s = BITBAND(dev);
 
-    memory_region_init_io(&s->iomem, OBJECT(s), &bitband_ops, &s->base,
+    memory_region_init_io(&s->iomem, OBJECT(s), &bitband_ops, s,
                           "bitband", 0x02000000);
     sysbus_init_mmio(dev, &s->iomem);
+
+    s->listener.commit = bitband_map_changed;
+    memory_listener_register(&s->listener, &address_space_memory);
     return 0;
 }
 
@@ -160,6 +232,26 @@ static void armv7m_bitband_init(Object *parent)
     sysbus_mmio_map(SYS_BUS_DEVICE(dev), 0, 0x42000000);
 }
 
+/* ITM and DWT, in the private peripheral bus below the NVIC */
+static void armv7m_trace_init(Object *parent)
+{
+    DeviceState *dev;
+
+    dev = qdev_create(NULL, "armv7m-itm");
+    if(parent) {
+        object_property_add_child(parent, "itm", OBJECT(dev), NULL);
+    }
+    qdev_init_nofail(dev);
+    sysbus_mmio_map(SYS_BUS_DEVICE(dev), 0, 0xe0000000);
+
+    dev = qdev_create(NULL, "armv7m-dwt");
+    if(parent) {
+        object_property_add_child(parent, "dwt", OBJECT(dev), NULL);
+    }
+    qdev_init_nofail(dev);
+    sysbus_mmio_map(SYS_BUS_DEVICE(dev), 0, 0xe0001000);
+}
+
 /* Board init.  */
 
 static void armv7m_reset(void *opaque)
@@ -272,6 +364,8 @@ DeviceState *armv7m_translated_init(Object *parent, MemoryRegion *system_memory,
     qemu_irq cpu_wakeup_in = qdev_get_gpio_in(DEVICE(cpu), ARM_CPU_WKUP);
     qdev_connect_gpio_out_named(DEVICE(nvic), "wakeup_out", 0, cpu_wakeup_in);
 
+    armv7m_trace_init(parent);
+
 
 
 #ifdef TARGET_WORDS_BIGENDIAN
@@ -0,0 +1,310 @@
+/*
+ * Guest PC sampling profiler for ARMv7M machines.
+ *
+ * A virtual clock timer samples the program counter of the CPU, either
+ * every N microseconds of virtual time or, with -icount, every N executed
+ * instructions.  Each sample is a short call stack: the PC, the link register
+ * and, when function symbols are loaded, the words near the top of the stack
+ * that look like Thumb return addresses into known functions.  Cortex-M code
+ * is normally built without frame pointers, so this is a heuristic and can
+ * report stale frames, but it needs nothing from the firmware.
+ *
+ * Identical stacks are counted together; when profiling stops they are
+ * written out as folded stacks for flamegraph.pl, symbolized with the ELF
+ * symbols loaded for the machine, or as a gperftools CPU profile.
+ *
+ * This code is licensed under the GPL.
+ */
+
+#include "hw/arm/arm.h"
+#include "hw/loader.h"
+#include "disas/disas.h"
+#include "elf.h"
+#include "qemu/timer.h"
+#include "qapi/error.h"
+#include "qmp-commands.h"
+#include "sysemu/sysemu.h"
+
+#define GUEST_PROFILE_MAX_DEPTH     32
+#define GUEST_PROFILE_DEFAULT_DEPTH 8
+/* How much of the stack is searched for return addresses */
+#define GUEST_PROFILE_SCAN_WORDS    64
+
+typedef struct GuestProfileStack {
+    uint64_t count;
+    uint32_t depth;
+    uint32_t frames[];          /* innermost first */
+} GuestProfileStack;
+
+typedef struct GuestProfile {
+    QEMUTimer *timer;
+    int64_t period_ns;
+    int64_t period_us;          /* nominal, for the pprof header */
+    int depth;
+    GHashTable *stacks;
+} GuestProfile;
+
+static GuestProfile *profile;
+/* Symbol files already added to the lookup_symbol() tables */
+static GSList *profile_symbol_files;
+
+static guint guest_profile_stack_hash(gconstpointer key)
+{
+    const GuestProfileStack *st = key;
+    guint h = st->depth;
+    int i;
+
+    for (i = 0; i < st->depth; i++) {
+        h = h * 31 + st->frames[i];
+    }
+    return h;
+}
+
+static gboolean guest_profile_stack_equal(gconstpointer a, gconstpointer b)
+{
+    const GuestProfileStack *sa = a, *sb = b;
+
+    return sa->depth == sb->depth &&
+           !memcmp(sa->frames, sb->frames, sa->depth * sizeof(uint32_t));
+}
+
+/* Whether addr can be a return address: Thumb code, not an EXC_RETURN
+ * value, and inside a known function if there are symbols at all */
+static bool guest_profile_is_return(uint32_t addr)
+{
+    if (!(addr & 1) || addr >= 0xf0000000) {
+        return false;
+    }
+    return !syminfos || lookup_symbol(addr & ~1)[0] != '\0';
+}
+
+static void guest_profile_record(const uint32_t *frames, int depth)
+{
+    GuestProfileStack *key, *st;
+
+    key = g_malloc(sizeof(*key) + depth * sizeof(uint32_t));
+    key->count = 0;
+    key->depth = depth;
+    memcpy(key->frames, frames, depth * sizeof(uint32_t));
+
+    st = g_hash_table_lookup(profile->stacks, key);
+    if (st) {
+        g_free(key);
+    } else {
+        g_hash_table_insert(profile->stacks, key, key);
+        st = key;
+    }
+    st->count++;
+}
+
+static void guest_profile_sample(void *opaque)
+{
+    CPUState *cs = first_cpu;
+    CPUARMState *env = &ARM_CPU(cs)->env;
+    uint32_t frames[GUEST_PROFILE_MAX_DEPTH];
+    uint32_t stack[GUEST_PROFILE_SCAN_WORDS];
+    uint32_t pc, lr, sp, word;
+    int n = 0, words, i;
+
+    pc = env->regs[15];
+    lr = env->regs[14];
+    sp = env->regs[13];
+    frames[n++] = pc;
+
+    /* A link register pointing back into the sampled function is left
+     * over from an earlier call */
+    if (n < profile->depth && guest_profile_is_return(lr) &&
+        (!syminfos || strcmp(lookup_symbol(lr & ~1), lookup_symbol(pc)))) {
+        frames[n++] = lr & ~1;
+    }
+
+    /* Without symbols nearly any odd word would pass for a return address */
+    if (syminfos && n < profile->depth) {
+        words = GUEST_PROFILE_SCAN_WORDS;
+        while (words && cpu_memory_rw_debug(cs, sp, (uint8_t *)stack,
+                                            words * 4, 0) < 0) {
+            /* Close to the end of RAM */
+            words /= 2;
+        }
+        for (i = 0; i < words && n < profile->depth; i++) {
+            word = le32_to_cpu(stack[i]);
+            if (guest_profile_is_return(word) &&
+                (word & ~1) != frames[n - 1]) {
+                frames[n++] = word & ~1;
+            }
+        }
+    }
+
+    guest_profile_record(frames, n);
+    timer_mod(profile->timer,
+              qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + profile->period_ns);
+}
+
+static const char *guest_profile_image(void)
+{
+    if (profile_symbol_files) {
+        return profile_symbol_files->data;
+    }
+    return qemu_opt_get(qemu_get_machine_opts(), "kernel");
+}
+
+static void guest_profile_write_folded(FILE *f)
+{
+    GHashTableIter iter;
+    GuestProfileStack *st;
+    const char *name;
+    int i;
+
+    g_hash_table_iter_init(&iter, profile->stacks);
+    while (g_hash_table_iter_next(&iter, (gpointer *)&st, NULL)) {
+        for (i = st->depth - 1; i >= 0; i--) {
+            name = lookup_symbol(st->frames[i]);
+            if (name[0]) {
+                fprintf(f, "%s", name);
+            } else {
+                fprintf(f, "0x%08" PRIx32, st->frames[i]);
+            }
+            fputc(i ? ';' : ' ', f);
+        }
+        fprintf(f, "%" PRIu64 "\n", st->count);
+    }
+}
+
+static void guest_profile_put_word(FILE *f, uint64_t word)
+{
+    fwrite(&word, sizeof(word), 1, f);
+}
+
+/* The legacy gperftools CPU profile: a header, one record per stack, a
+ * trailer and the mappings needed to symbolize the addresses */
+static void guest_profile_write_pprof(FILE *f)
+{
+    GHashTableIter iter;
+    GuestProfileStack *st;
+    const char *image;
+    int i;
+
+    guest_profile_put_word(f, 0);
+    guest_profile_put_word(f, 3);
+    guest_profile_put_word(f, 0);
+    guest_profile_put_word(f, profile->period_us);
+    guest_profile_put_word(f, 0);
+
+    g_hash_table_iter_init(&iter, profile->stacks);
+    while (g_hash_table_iter_next(&iter, (gpointer *)&st, NULL)) {
+        guest_profile_put_word(f, st->count);
+        guest_profile_put_word(f, st->depth);
+        for (i = 0; i < st->depth; i++) {
+            guest_profile_put_word(f, st->frames[i]);
+        }
+    }
+
+    guest_profile_put_word(f, 0);
+    guest_profile_put_word(f, 1);
+    guest_profile_put_word(f, 0);
+
+    /* The firmware is linked at its run address, a mapping of the whole
+     * address space tells pprof not to relocate it */
+    image = guest_profile_image();
+    if (image) {
+        fprintf(f, "00000000-ffffffffffffffff r-xp 00000000 00:00 0 %s\n",
+                image);
+    }
+}
+
+void qmp_guest_profile_start(int64_t period, bool has_icount, bool icount,
+                             bool has_depth, int64_t depth,
+                             bool has_symbols, const char *symbols,
+                             Error **errp)
+{
+    int64_t period_ns;
+    int ret;
+
+    if (profile) {
+        error_setg(errp, "Guest profiling is already running");
+        return;
+    }
+    if (!first_cpu || !object_dynamic_cast(OBJECT(first_cpu), TYPE_ARM_CPU)) {
+        error_setg(errp, "The machine has no ARM CPU to profile");
+        return;
+    }
+    if (period <= 0) {
+        error_setg(errp, "Parameter 'period' expects a positive value");
+        return;
+    }
+    if (!has_depth) {
+        depth = GUEST_PROFILE_DEFAULT_DEPTH;
+    }
+    if (depth < 1 || depth > GUEST_PROFILE_MAX_DEPTH) {
+        error_setg(errp, "Parameter 'depth' expects a value between 1 and %d",
+                   GUEST_PROFILE_MAX_DEPTH);
+        return;
+    }
+
+    if (has_icount && icount) {
+        if (!use_icount) {
+            error_setg(errp, "Sampling by instruction count requires -icount");
+            return;
+        }
+        period_ns = cpu_icount_to_ns(period);
+    } else {
+        period_ns = period * SCALE_US;
+    }
+
+    if (has_symbols &&
+        !g_slist_find_custom(profile_symbol_files, symbols,
+                             (GCompareFunc)strcmp)) {
+        ret = load_elf_symbols(symbols, 0, EM_ARM, 1);
+        if (ret < 0) {
+            error_setg(errp, "Cannot load symbols from '%s': %s", symbols,
+                       load_elf_strerror(ret));
+            return;
+        }
+        profile_symbol_files = g_slist_prepend(profile_symbol_files,
+                                               g_strdup(symbols));
+    }
+
+    profile = g_new0(GuestProfile, 1);
+    profile->period_ns = period_ns;
+    profile->period_us = MAX(period_ns / SCALE_US, 1);
+    profile->depth = depth;
+    profile->stacks = g_hash_table_new_full(guest_profile_stack_hash,
+                                            guest_profile_stack_equal,
+                                            g_free, NULL);
+    profile->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, guest_profile_sample,
+                                  NULL);
+    timer_mod(profile->timer,
+              qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + period_ns);
+}
+
+void qmp_guest_profile_stop(const char *filename, bool has_format,
+                            GuestProfileFormat format, Error **errp)
+{
+    FILE *f;
+
+    if (!profile) {
+        error_setg(errp, "Guest profiling is not running");
+        return;
+    }
+
+    f = fopen(filename, "w");
+    if (!f) {
+        error_setg_file_open(errp, errno, filename);
+        return;
+    }
+    if (has_format && format == GUEST_PROFILE_FORMAT_PPROF) {
+        guest_profile_write_pprof(f);
+    } else {
+        guest_profile_write_folded(f);
+    }
+    if (fclose(f) != 0) {
+        error_setg_errno(errp, errno, "Cannot write '%s'", filename);
+        return;
+    }
+
+    timer_del(profile->timer);
+    timer_free(profile->timer);
+    g_hash_table_destroy(profile->stacks);
+    g_free(profile);
+    profile = NULL;
+}
@@ -0,0 +1,590 @@
+/*
+ * ARMv7M Instrumentation Trace Macrocell (ITM) and Data Watchpoint and
+ * Trace (DWT) unit.
+ *
+ * The ITM stimulus ports are the usual way for firmware to emit log output
+ * through the debug port.  Here they append straight to a host chardev,
+ * buffered on the host side, so a log write costs the guest a single store
+ * instead of a character paced at the UART baud rate.  By default the raw
+ * bytes written to the stimulus ports are output; with "framed" set, each
+ * write is preceded by the ITM software source packet header so that tools
+ * decoding SWO output can tell the ports apart.
+ *
+ * The DWT provides CYCCNT, derived from the instruction count when running
+ * with -icount and from the virtual clock and the core clock frequency
+ * otherwise.  The other profiling counters read as zero and the comparators
+ * only hold their values.
+ *
+ * Cortex-M3 and M4 units have no software lock, so by default both units
+ * are always writable.  Set "sw-lock" to model one that comes out of reset
+ * locked until the CoreSight key is written to LAR, as on the Cortex-M7.
+ *
+ * This code is licensed under the GPL.
+ */
+
+#include "hw/sysbus.h"
+#include "hw/arm/arm.h"
+#include "sysemu/char.h"
+#include "qemu/host-utils.h"
+#include "qemu/timer.h"
+#include "qemu/log.h"
+
+//#define DEBUG_ARMV7M_TRACE
+#ifdef DEBUG_ARMV7M_TRACE
+#define DPRINTF(fmt, ...)                                       \
+    do { printf("ARMV7M_TRACE: " fmt , ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...)
+#endif
+
+/* CoreSight lock access */
+#define CS_LAR          0xfb0
+#define CS_LSR          0xfb4
+#define CS_LAR_KEY      0xc5acce55
+#define CS_LSR_SLI      (1 << 0)
+#define CS_LSR_SLK      (1 << 1)
+
+/* Component and peripheral ID registers, 0xfd0 to 0xfff */
+#define CS_ID_BASE      0xfd0
+
+/* Shared by both units: CoreSight lock, ID registers */
+static bool armv7m_trace_read_common(hwaddr offset, bool sw_lock, bool locked,
+                                     const uint8_t *pid, uint64_t *val)
+{
+    static const uint8_t cid[] = { 0x0d, 0xe0, 0x05, 0xb1 };
+
+    if (offset == CS_LSR) {
+        *val = sw_lock ? CS_LSR_SLI | (locked ? CS_LSR_SLK : 0) : 0;
+        return true;
+    }
+    if (offset >= CS_ID_BASE && offset <= 0xffc) {
+        /* PID4..PID7, PID0..PID3, CID0..CID3 */
+        int n = (offset - CS_ID_BASE) >> 2;
+        if (n < 4) {
+            *val = n == 0 ? pid[4] : 0;
+        } else if (n < 8) {
+            *val = pid[n - 4];
+        } else {
+            *val = cid[n - 8];
+        }
+        return true;
+    }
+    return false;
+}
+
+
+/* ITM */
+
+#define TYPE_ARMV7M_ITM "armv7m-itm"
+#define ARMV7M_ITM(obj) OBJECT_CHECK(ARMv7MITMState, (obj), TYPE_ARMV7M_ITM)
+
+#define ITM_NUM_PORTS       32
+#define ITM_TER             0xe00
+#define ITM_TPR             0xe40
+#define ITM_TCR             0xe80
+#define ITM_TCR_ITMENA      (1 << 0)
+#define ITM_TCR_MASK        0x00ff0f1f
+
+/* Bytes collected before they are handed to the chardev, and how long they
+ * may sit there */
+#define ITM_BUF_SIZE        4096
+#define ITM_FLUSH_MS        10
+
+typedef struct {
+    /*< private >*/
+    SysBusDevice parent_obj;
+    /*< public >*/
+
+    MemoryRegion iomem;
+    CharDriverState *chr;
+    bool framed;
+    bool sw_lock;
+
+    uint32_t ter;
+    uint32_t tpr;
+    uint32_t tcr;
+    bool locked;
+
+    uint8_t buf[ITM_BUF_SIZE];
+    uint32_t buf_len;
+    QEMUTimer *flush_timer;
+} ARMv7MITMState;
+
+static const uint8_t itm_pid[] = { 0x01, 0xb0, 0x3b, 0x00, 0x04 };
+
+static void itm_flush(ARMv7MITMState *s)
+{
+    if (s->buf_len) {
+        qemu_chr_fe_write_all(s->chr, s->buf, s->buf_len);
+        s->buf_len = 0;
+    }
+    timer_del(s->flush_timer);
+}
+
+static void itm_flush_timer(void *opaque)
+{
+    itm_flush(opaque);
+}
+
+static void itm_stimulus_write(ARMv7MITMState *s, int port, uint32_t value,
+                               unsigned size)
+{
+    if (!s->chr) {
+        return;
+    }
+    if (s->buf_len + size + 1 > ITM_BUF_SIZE) {
+        itm_flush(s);
+    }
+    if (s->framed) {
+        /* Software source packet: port number, payload size 1, 2 or 4 */
+        s->buf[s->buf_len++] = (port << 3) | (size == 4 ? 3 : size);
+    }
+    while (size--) {
+        s->buf[s->buf_len++] = value;
+        value >>= 8;
+    }
+    if (!timer_pending(s->flush_timer)) {
+        timer_mod(s->flush_timer,
+                  qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + ITM_FLUSH_MS);
+    }
+}
+
+static uint64_t itm_read(void *opaque, hwaddr offset, unsigned size)
+{
+    ARMv7MITMState *s = opaque;
+    uint64_t val;
+
+    if (offset < ITM_NUM_PORTS * 4) {
+        /* The stimulus FIFO is never full */
+        return 1;
+    }
+    switch (offset) {
+    case ITM_TER:
+        return s->ter;
+    case ITM_TPR:
+        return s->tpr;
+    case ITM_TCR:
+        return s->tcr;
+    }
+    if (armv7m_trace_read_common(offset, s->sw_lock, s->locked, itm_pid,
+                                 &val)) {
+        return val;
+    }
+    qemu_log_mask(LOG_UNIMP, "ITM: unimplemented read at offset 0x%x\n",
+                  (int)offset);
+    return 0;
+}
+
+static void itm_write(void *opaque, hwaddr offset, uint64_t value,
+                      unsigned size)
+{
+    ARMv7MITMState *s = opaque;
+    int port;
+
+    if (offset < ITM_NUM_PORTS * 4) {
+        port = offset >> 2;
+        if ((s->tcr & ITM_TCR_ITMENA) && (s->ter & (1 << port))) {
+            itm_stimulus_write(s, port, value, size);
+        }
+        return;
+    }
+    if (offset == CS_LAR) {
+        s->locked = s->sw_lock && value != CS_LAR_KEY;
+        return;
+    }
+    if (s->locked) {
+        DPRINTF("write to 0x%x while locked\n", (int)offset);
+        return;
+    }
+    switch (offset) {
+    case ITM_TER:
+        s->ter = value;
+        break;
+    case ITM_TPR:
+        s->tpr = value & 0xf;
+        break;
+    case ITM_TCR:
+        s->tcr = value & ITM_TCR_MASK;
+        break;
+    default:
+        qemu_log_mask(LOG_UNIMP, "ITM: unimplemented write at offset 0x%x\n",
+                      (int)offset);
+    }
+}
+
+static const MemoryRegionOps itm_ops = {
+    .read = itm_read,
+    .write = itm_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .valid.min_access_size = 1,
+    .valid.max_access_size = 4,
+};
+
+static void itm_reset(DeviceState *dev)
+{
+    ARMv7MITMState *s = ARMV7M_ITM(dev);
+
+    itm_flush(s);
+    s->ter = 0;
+    s->tpr = 0;
+    s->tcr = 0;
+    s->locked = s->sw_lock;
+}
+
+static void itm_pre_save(void *opaque)
+{
+    /* Pending output belongs to the host, not to the machine state */
+    itm_flush(opaque);
+}
+
+/* Send stimulus port output to chr from now on and return the previous
+ * chardev.  Output buffered for the old one is dropped, not written to the
+ * new one: a forked clone must not repeat what its parent is about to
+ * flush. */
+CharDriverState *armv7m_itm_set_chr(DeviceState *dev, CharDriverState *chr)
+{
+    ARMv7MITMState *s = ARMV7M_ITM(dev);
+    CharDriverState *old = s->chr;
+
+    timer_del(s->flush_timer);
+    s->buf_len = 0;
+    s->chr = chr;
+    return old;
+}
+
+static int itm_init(SysBusDevice *dev)
+{
+    ARMv7MITMState *s = ARMV7M_ITM(dev);
+
+    memory_region_init_io(&s->iomem, OBJECT(s), &itm_ops, s, "itm", 0x1000);
+    sysbus_init_mmio(dev, &s->iomem);
+    s->flush_timer = timer_new_ms(QEMU_CLOCK_REALTIME, itm_flush_timer, s);
+    return 0;
+}
+
+static const VMStateDescription vmstate_itm = {
+    .name = TYPE_ARMV7M_ITM,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .pre_save = itm_pre_save,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(ter, ARMv7MITMState),
+        VMSTATE_UINT32(tpr, ARMv7MITMState),
+        VMSTATE_UINT32(tcr, ARMv7MITMState),
+        VMSTATE_BOOL(locked, ARMv7MITMState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static Property itm_properties[] = {
+    DEFINE_PROP_CHR("chardev", ARMv7MITMState, chr),
+    DEFINE_PROP_BOOL("framed", ARMv7MITMState, framed, false),
+    DEFINE_PROP_BOOL("sw-lock", ARMv7MITMState, sw_lock, false),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void itm_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+    SysBusDeviceClass *k = SYS_BUS_DEVICE_CLASS(klass);
+
+    k->init = itm_init;
+    dc->reset = itm_reset;
+    dc->vmsd = &vmstate_itm;
+    dc->props = itm_properties;
+}
+
+static const TypeInfo itm_info = {
+    .name          = TYPE_ARMV7M_ITM,
+    .parent        = TYPE_SYS_BUS_DEVICE,
+    .instance_size = sizeof(ARMv7MITMState),
+    .class_init    = itm_class_init,
+};
+
+
+/* DWT */
+
+#define TYPE_ARMV7M_DWT "armv7m-dwt"
+#define ARMV7M_DWT(obj) OBJECT_CHECK(ARMv7MDWTState, (obj), TYPE_ARMV7M_DWT)
+
+#define DWT_CTRL            0x000
+#define DWT_CYCCNT          0x004
+#define DWT_CPICNT          0x008
+#define DWT_EXCCNT          0x00c
+#define DWT_SLEEPCNT        0x010
+#define DWT_LSUCNT          0x014
+#define DWT_FOLDCNT         0x018
+#define DWT_PCSR            0x01c
+#define DWT_COMP_BASE       0x020
+
+#define DWT_NUM_COMP        4
+#define DWT_CTRL_CYCCNTENA  (1 << 0)
+#define DWT_CTRL_NUMCOMP_SHIFT 28
+/* Writable bits: everything below the read-only NOxxx/NUMCOMP fields */
+#define DWT_CTRL_MASK       0x007fffff
+
+typedef struct {
+    /*< private >*/
+    SysBusDevice parent_obj;
+    /*< public >*/
+
+    MemoryRegion iomem;
+    Notifier clock_notifier;
+    bool sw_lock;
+
+    uint32_t ctrl;
+    /* CYCCNT is cyccnt_offset plus the cycles since cyccnt_base while
+     * counting, cyccnt_offset while stopped.  cyccnt_base is in dwt_now()
+     * units and is moved up whenever the core clock changes. */
+    uint32_t cyccnt_offset;
+    int64_t cyccnt_base;
+    uint32_t comp[DWT_NUM_COMP];
+    uint32_t mask[DWT_NUM_COMP];
+    uint32_t function[DWT_NUM_COMP];
+    bool locked;
+} ARMv7MDWTState;
+
+static const uint8_t dwt_pid[] = { 0x02, 0xb0, 0x3b, 0x00, 0x04 };
+
+/* Instructions with -icount, virtual clock nanoseconds otherwise */
+static int64_t dwt_now(void)
+{
+    if (use_icount) {
+        return cpu_get_icount_raw();
+    }
+    return qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+}
+
+/* Core clock cycles in an interval of dwt_now() time */
+static uint64_t dwt_cycles(int64_t delta)
+{
+    if (use_icount) {
+        return delta;
+    }
+    if (system_clock_freq) {
+        return muldiv64(delta, system_clock_freq, get_ticks_per_sec());
+    }
+    return delta / MAX(system_clock_scale, 1);
+}
+
+static uint32_t dwt_cyccnt(ARMv7MDWTState *s)
+{
+    if (!(s->ctrl & DWT_CTRL_CYCCNTENA)) {
+        return s->cyccnt_offset;
+    }
+    return s->cyccnt_offset + (uint32_t)dwt_cycles(dwt_now() - s->cyccnt_base);
+}
+
+static void dwt_set_cyccnt(ARMv7MDWTState *s, uint32_t value)
+{
+    s->cyccnt_offset = value;
+    s->cyccnt_base = dwt_now();
+}
+
+static uint64_t dwt_read(void *opaque, hwaddr offset, unsigned size)
+{
+    ARMv7MDWTState *s = opaque;
+    uint64_t val;
+    int n;
+
+    switch (offset) {
+    case DWT_CTRL:
+        return s->ctrl | (DWT_NUM_COMP << DWT_CTRL_NUMCOMP_SHIFT);
+    case DWT_CYCCNT:
+        return dwt_cyccnt(s);
+    case DWT_CPICNT:
+    case DWT_EXCCNT:
+    case DWT_SLEEPCNT:
+    case DWT_LSUCNT:
+    case DWT_FOLDCNT:
+    case DWT_PCSR:
+        return 0;
+    }
+    if (offset >= DWT_COMP_BASE && offset < DWT_COMP_BASE + DWT_NUM_COMP * 16) {
+        n = (offset - DWT_COMP_BASE) >> 4;
+        switch (offset & 0xf) {
+        case 0x0:
+            return s->comp[n];
+        case 0x4:
+            return s->mask[n];
+        case 0x8:
+            return s->function[n];
+        }
+        return 0;
+    }
+    if (armv7m_trace_read_common(offset, s->sw_lock, s->locked, dwt_pid,
+                                 &val)) {
+        return val;
+    }
+    qemu_log_mask(LOG_UNIMP, "DWT: unimplemented read at offset 0x%x\n",
+                  (int)offset);
+    return 0;
+}
+
+static void dwt_write(void *opaque, hwaddr offset, uint64_t value,
+                      unsigned size)
+{
+    ARMv7MDWTState *s = opaque;
+    uint32_t old_ctrl;
+    int n;
+
+    if (offset == CS_LAR) {
+        s->locked = s->sw_lock && value != CS_LAR_KEY;
+        return;
+    }
+    if (s->locked) {
+        DPRINTF("write to 0x%x while locked\n", (int)offset);
+        return;
+    }
+
+    switch (offset) {
+    case DWT_CTRL:
+        old_ctrl = s->ctrl;
+        if ((value ^ old_ctrl) & DWT_CTRL_CYCCNTENA) {
+            /* Freeze or resume the count where it stands */
+            uint32_t cyccnt = dwt_cyccnt(s);
+            s->ctrl = value & DWT_CTRL_MASK;
+            dwt_set_cyccnt(s, cyccnt);
+        } else {
+            s->ctrl = value & DWT_CTRL_MASK;
+        }
+        return;
+    case DWT_CYCCNT:
+        dwt_set_cyccnt(s, value);
+        return;
+    case DWT_CPICNT:
+    case DWT_EXCCNT:
+    case DWT_SLEEPCNT:
+    case DWT_LSUCNT:
+    case DWT_FOLDCNT:
+        return;
+    }
+    if (offset >= DWT_COMP_BASE && offset < DWT_COMP_BASE + DWT_NUM_COMP * 16) {
+        n = (offset - DWT_COMP_BASE) >> 4;
+        switch (offset & 0xf) {
+        case 0x0:
+            s->comp[n] = value;
+            break;
+        case 0x4:
+            s->mask[n] = value & 0x1f;
+            break;
+        case 0x8:
+            s->function[n] = value;
+            if (value & 0xf) {
+                qemu_log_mask(LOG_UNIMP, "DWT: comparator %d functions are "
+                              "not implemented\n", n);
+            }
+            break;
+        }
+        return;
+    }
+    qemu_log_mask(LOG_UNIMP, "DWT: unimplemented write at offset 0x%x\n",
+                  (int)offset);
+}
+
+static const MemoryRegionOps dwt_ops = {
+    .read = dwt_read,
+    .write = dwt_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .valid.min_access_size = 4,
+    .valid.max_access_size = 4,
+};
+
+static void dwt_reset(DeviceState *dev)
+{
+    ARMv7MDWTState *s = ARMV7M_DWT(dev);
+
+    s->ctrl = 0;
+    dwt_set_cyccnt(s, 0);
+    memset(s->comp, 0, sizeof(s->comp));
+    memset(s->mask, 0, sizeof(s->mask));
+    memset(s->function, 0, sizeof(s->function));
+    s->locked = s->sw_lock;
+}
+
+/* Called before the core clock changes: count the cycles so far at the
+ * old rate and the rest from now on at the new one */
+static void dwt_clock_changed(Notifier *n, void *data)
+{
+    ARMv7MDWTState *s = container_of(n, ARMv7MDWTState, clock_notifier);
+
+    if (s->ctrl & DWT_CTRL_CYCCNTENA) {
+        dwt_set_cyccnt(s, dwt_cyccnt(s));
+    }
+}
+
+static void dwt_pre_save(void *opaque)
+{
+    ARMv7MDWTState *s = opaque;
+
+    /* Migrate the count itself, the clocks restart elsewhere */
+    s->cyccnt_offset = dwt_cyccnt(s);
+    s->cyccnt_base = dwt_now();
+}
+
+static int dwt_post_load(void *opaque, int version_id)
+{
+    ARMv7MDWTState *s = opaque;
+
+    s->cyccnt_base = dwt_now();
+    return 0;
+}
+
+static int dwt_init(SysBusDevice *dev)
+{
+    ARMv7MDWTState *s = ARMV7M_DWT(dev);
+
+    memory_region_init_io(&s->iomem, OBJECT(s), &dwt_ops, s, "dwt", 0x1000);
+    sysbus_init_mmio(dev, &s->iomem);
+    s->clock_notifier.notify = dwt_clock_changed;
+    system_clock_add_change_notifier(&s->clock_notifier);
+    return 0;
+}
+
+static const VMStateDescription vmstate_dwt = {
+    .name = TYPE_ARMV7M_DWT,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .pre_save = dwt_pre_save,
+    .post_load = dwt_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(ctrl, ARMv7MDWTState),
+        VMSTATE_UINT32(cyccnt_offset, ARMv7MDWTState),
+        VMSTATE_UINT32_ARRAY(comp, ARMv7MDWTState, DWT_NUM_COMP),
+        VMSTATE_UINT32_ARRAY(mask, ARMv7MDWTState, DWT_NUM_COMP),
+        VMSTATE_UINT32_ARRAY(function, ARMv7MDWTState, DWT_NUM_COMP),
+        VMSTATE_BOOL(locked, ARMv7MDWTState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static Property dwt_properties[] = {
+    DEFINE_PROP_BOOL("sw-lock", ARMv7MDWTState, sw_lock, false),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void dwt_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+    SysBusDeviceClass *k = SYS_BUS_DEVICE_CLASS(klass);
+
+    k->init = dwt_init;
+    dc->reset = dwt_reset;
+    dc->vmsd = &vmstate_dwt;
+    dc->props = dwt_properties;
+}
+
+static const TypeInfo dwt_info = {
+    .name          = TYPE_ARMV7M_DWT,
+    .parent        = TYPE_SYS_BUS_DEVICE,
+    .instance_size = sizeof(ARMv7MDWTState),
+    .class_init    = dwt_class_init,
+};
+
+static void armv7m_trace_register_types(void)
+{
+    type_register_static(&itm_info);
+    type_register_static(&dwt_info);
+}
+
+type_init(armv7m_trace_register_types)
@@ -26,6 +26,17 @@
 #include "sysemu/sysemu.h"
 #include "sysemu/blockdev.h"
 #include "ui/console.h"
+#include "block/aio.h"
+#include "exec/gdbstub.h"
+#include "monitor/monitor.h"
+#include "qapi/error.h"
+#include "qemu/main-loop.h"
+#include "qemu/rcu.h"
+#include "qmp-commands.h"
+#include "sysemu/char.h"
+#include "sysemu/cpus.h"
+#include "hw/display/ls013b7dh01.h"
+#include "hw/display/pebble_snowy_display.h"
 #include "pebble_control.h"
 #include "pebble.h"
 
@@ -136,6 +147,10 @@ static QEMUTimer *s_button_timer;
 // pebble over uart 2
 static PebbleControl *s_pebble_control;
 
+// The uart connected to the debug serial console (serial_hds[2])
+static Stm32Uart *s_dbgserial_uart;
+static Stm32F7xxUart *s_dbgserial_uart_f7xx;
+
 // The irq callbacks for each button
 static qemu_irq s_button_irq[PBL_NUM_BUTTONS];
 static qemu_irq s_button_wakeup;
@@ -254,7 +269,8 @@ void pebble_connect_uarts(Stm32Uart *uart[], const PblBoardConfig *board_config)
     s_pebble_control = pebble_control_create(serial_hds[1],
                                              uart[board_config->pebble_control_uart_index]);
 
-    stm32_uart_connect(uart[board_config->dbgserial_uart_index], serial_hds[2], 0);
+    s_dbgserial_uart = uart[board_config->dbgserial_uart_index];
+    stm32_uart_connect(s_dbgserial_uart, serial_hds[2], 0);
 }
 
 void pebble_connect_uarts_stm32f7xx(Stm32F7xxUart *uart[], const PblBoardConfig *board_config)
@@ -265,7 +281,8 @@ void pebble_connect_uarts_stm32f7xx(Stm32F7xxUart *uart[], const PblBoardConfig
     s_pebble_control = pebble_control_create_stm32f7xx(serial_hds[1],
             uart[board_config->pebble_control_uart_index]);
 
-    stm32f7xx_uart_connect(uart[board_config->dbgserial_uart_index], serial_hds[2], 0);
+    s_dbgserial_uart_f7xx = uart[board_config->dbgserial_uart_index];
+    stm32f7xx_uart_connect(s_dbgserial_uart_f7xx, serial_hds[2], 0);
 }
 
 
@@ -459,6 +476,11 @@ void pebble_32f439_init(MachineState *machine, const PblBoardConfig *board_confi
                    &stm,
                    &cpu);
 
+    // The STM32F439 uses the F2/F4 DMA request mapping, unlike the F412
+    stm32_dma_connect_requests(stm.dma_dev[0], stm.dma_dev[1],
+                               (DeviceState **)uart, STM32F4XX_UART_COUNT,
+                               stm.spi_dev, STM32F4XX_SPI_COUNT);
+
 
     // Set the Pebble specific QEMU settings on the target
     pebble_set_qemu_settings(rtc_dev);
@@ -557,6 +579,225 @@ void pebble_32f439_init(MachineState *machine, const PblBoardConfig *board_confi
 }
 
 
+// ================================================================================
+// Fork server: clone a booted (typically paused) instance into a new process. The
+// child starts from an exact copy of the machine - RAM and flash are shared
+// copy-on-write with the parent - so a test harness can boot the firmware once and
+// then hand out fresh instances without going through the boot sequence each time.
+//
+// The child gets its own debug serial, control, ITM and (optionally) QMP connections,
+// given in -serial syntax. They are opened by the parent so errors are reported to the
+// caller; omitted ones default to "null". The gdb stub and the monitors of the parent
+// are dropped in the child, and so is the display's shared memory frame ring unless
+// the child is given one of its own. A monitor multiplexed with other frontends
+// (mon:stdio) cannot be dropped, so forking is refused while one exists. The child
+// runs if the parent was running, unless told otherwise. Only TCG is supported.
+#ifdef CONFIG_POSIX
+static unsigned s_fork_count;
+
+static CharDriverState *pebble_fork_chr_new(const char *name, bool has_spec,
+                                            const char *spec, Error **errp)
+{
+    CharDriverState *chr;
+    char *label;
+
+    if (!has_spec) {
+        spec = "null";
+    }
+    // The child keeps these, so labels must not clash when it forks in turn
+    label = g_strdup_printf("pebble-fork%u-%s", s_fork_count, name);
+    chr = qemu_chr_new(label, spec, NULL);
+    g_free(label);
+    if (!chr) {
+        error_setg(errp, "cannot open character device '%s'", spec);
+    }
+    return chr;
+}
+
+// Detach a chardev from its frontend and close it in this process. Multiplexed
+// devices (e.g. mon:stdio) are shared with other frontends and left alone.
+static void pebble_fork_chr_release(CharDriverState *chr)
+{
+    if (!chr || chr->is_mux) {
+        return;
+    }
+    qemu_chr_add_handlers(chr, NULL, NULL, NULL, NULL);
+    if (chr->label) {
+        qemu_chr_delete(chr);
+    }
+}
+
+// Guest RAM is normally excluded from fork(), undo that so the child gets a copy
+static int pebble_fork_ram_block(const char *block_name, void *host_addr,
+                                 ram_addr_t offset, ram_addr_t length, void *opaque)
+{
+    qemu_madvise(host_addr, length, QEMU_MADV_DOFORK);
+    return 0;
+}
+
+static void pebble_fork_child(CharDriverState *serial, CharDriverState *control,
+                              CharDriverState *qmp, CharDriverState *itm,
+                              const char *frame_shm, bool resume)
+{
+    CharDriverState *old;
+    Object *itm_dev, *display_dev;
+
+    // Only this thread survived the fork, restart the ones the machine depends on
+    rcu_after_fork();
+    aio_context_after_fork(qemu_get_aio_context());
+    cpus_after_fork();
+
+    // Stop sharing the parent's flash image and host connections
+    flash_image_after_fork();
+    monitor_after_fork();
+    gdbserver_fork(first_cpu);
+
+    // The parent saves the TB cache file it loaded, not each clone
+    tb_cache_after_fork();
+
+    old = pebble_control_set_chr(s_pebble_control, control);
+    if (old) {
+        pebble_fork_chr_release(old);
+    } else {
+        pebble_fork_chr_release(control);
+    }
+
+    pebble_fork_chr_release(serial_hds[2]);
+    serial_hds[2] = serial;
+    if (s_dbgserial_uart) {
+        stm32_uart_connect(s_dbgserial_uart, serial, 0);
+    } else if (s_dbgserial_uart_f7xx) {
+        stm32f7xx_uart_connect(s_dbgserial_uart_f7xx, serial, 0);
+    }
+
+    itm_dev = object_resolve_path_type("", "armv7m-itm", NULL);
+    if (itm_dev) {
+        pebble_fork_chr_release(armv7m_itm_set_chr(DEVICE(itm_dev), itm));
+    } else {
+        pebble_fork_chr_release(itm);
+    }
+
+    // Frames the parent publishes must not be overwritten by the clone's. A failure to
+    // create the clone's own ring has been reported, the clone just publishes no frames.
+    display_dev = object_resolve_path_type("", "pebble-snowy-display", NULL);
+    if (display_dev) {
+        ps_display_set_frame_shm(DEVICE(display_dev), frame_shm);
+    }
+    display_dev = object_resolve_path_type("", "sm-lcd", NULL);
+    if (display_dev) {
+        sm_lcd_set_frame_shm(DEVICE(display_dev), frame_shm);
+    }
+
+    if (qmp) {
+        monitor_init(qmp, MONITOR_USE_CONTROL);
+    }
+
+    if (resume) {
+        vm_start();
+    }
+}
+
+PebbleForkInfo *qmp_pebble_fork(bool has_serial, const char *serial,
+                                bool has_control, const char *control,
+                                bool has_qmp, const char *qmp,
+                                bool has_itm, const char *itm,
+                                bool has_frame_shm, const char *frame_shm,
+                                bool has_resume, bool resume,
+                                Error **errp)
+{
+    CharDriverState *chr_serial = NULL, *chr_control = NULL, *chr_qmp = NULL;
+    CharDriverState *chr_itm = NULL;
+    PebbleForkInfo *info = NULL;
+    Error *local_err = NULL;
+    bool running;
+    pid_t pid;
+
+    if (!s_pebble_control) {
+        error_setg(errp, "pebble-fork requires a Pebble machine");
+        return NULL;
+    }
+    if (!tcg_enabled()) {
+        error_setg(errp, "pebble-fork is only supported with TCG");
+        return NULL;
+    }
+    if (!flash_image_can_fork(errp) || !monitor_can_fork(errp)) {
+        return NULL;
+    }
+
+    s_fork_count++;
+    chr_serial = pebble_fork_chr_new("serial", has_serial, serial, &local_err);
+    if (!local_err) {
+        chr_control = pebble_fork_chr_new("control", has_control, control,
+                                          &local_err);
+    }
+    if (!local_err) {
+        chr_itm = pebble_fork_chr_new("itm", has_itm, itm, &local_err);
+    }
+    if (!local_err && has_qmp) {
+        chr_qmp = pebble_fork_chr_new("qmp", true, qmp, &local_err);
+    }
+    if (local_err) {
+        error_propagate(errp, local_err);
+        goto out;
+    }
+
+    // The vCPU thread and the block layer must be idle: neither exists in the child
+    running = runstate_is_running();
+    if (!has_resume) {
+        resume = running;
+    }
+    if (running) {
+        vm_stop(RUN_STATE_PAUSED);
+    }
+    bdrv_drain_all();
+    qemu_ram_foreach_block(pebble_fork_ram_block, NULL);
+
+    pid = fork();
+    if (pid == 0) {
+        pebble_fork_child(chr_serial, chr_control, chr_qmp, chr_itm,
+                          has_frame_shm ? frame_shm : NULL, resume);
+
+        // This reply goes to a monitor the child no longer listens on
+        info = g_new0(PebbleForkInfo, 1);
+        return info;
+    }
+
+    if (pid < 0) {
+        error_setg_errno(errp, errno, "cannot fork");
+        info = NULL;
+    } else {
+        // Reap the clone when it exits
+        qemu_add_child_watch(pid);
+        info = g_new0(PebbleForkInfo, 1);
+        info->pid = pid;
+    }
+    if (running) {
+        vm_start();
+    }
+
+out:
+    // The connections belong to the child now
+    pebble_fork_chr_release(chr_serial);
+    pebble_fork_chr_release(chr_control);
+    pebble_fork_chr_release(chr_qmp);
+    pebble_fork_chr_release(chr_itm);
+    return info;
+}
+#else
+PebbleForkInfo *qmp_pebble_fork(bool has_serial, const char *serial,
+                                bool has_control, const char *control,
+                                bool has_qmp, const char *qmp,
+                                bool has_itm, const char *itm,
+                                bool has_frame_shm, const char *frame_shm,
+                                bool has_resume, bool resume,
+                                Error **errp)
+{
+    error_setg(errp, "pebble-fork is not supported on this host");
+    return NULL;
+}
+#endif
+
+
 // ================================================================================
 // Pebble "board" device. Used when we need to fan out a GPIO outputs to one or more other
 // devices/instances
@@ -24,6 +24,7 @@
 #include "hw/arm/stm32.h"
 #include "sysemu/char.h"
 #include "qemu/timer.h"
+#include "qemu/error-report.h"
 #include "qemu/sockets.h"
 
 #include "pebble_control.h"
@@ -149,6 +150,24 @@ typedef struct QEMU_PACKED {
 #define PBLCONTROL_BUF_LEN (QEMU_MAX_DATA_LEN + sizeof(QemuCommChannelHdr) \
                                 + sizeof(QemuCommChannelFooter))
 
+// Accel samples we can hold on the host side, and the default rate we hand them to the
+// target at. The firmware does not tell us the rate it samples at, set the accel-odr
+// property (or PEBBLE_QEMU_ACCEL_ODR) to match it when it is not the default.
+#define PBLCONTROL_ACCEL_FIFO_LEN 4096
+#define PBLCONTROL_ACCEL_ODR_HZ   100
+#define PBLCONTROL_ACCEL_ODR_MAX  1600
+
+// Most samples we pass to the target in one packet (num_samples is 8 bits)
+#define PBLCONTROL_ACCEL_MAX_BATCH 255
+
+// Byte ring used for both directions. Packets are parsed in place and forwarded
+// straight out of the ring, so consuming bytes never has to move the rest around.
+typedef struct PebbleControlRing {
+    uint8_t buf[PBLCONTROL_BUF_LEN];
+    uint32_t head;              // offset of the oldest byte in buf
+    uint32_t bytes;             // number of bytes available, starting at head
+} PebbleControlRing;
+
 struct PebbleControl {
     /* Inherited */
     SysBusDevice busdev;
@@ -170,26 +189,47 @@ struct PebbleControl {
     // We buffer the characters we receive from our qemu_chr receive handler here until
     // we get a complete packet. From there, we can figure out if we should process it
     // directly or pass it onto the target's UART
-    uint8_t rcv_char_buf[PBLCONTROL_BUF_LEN];
-    uint32_t rcv_char_bytes;    /* number of bytes avaialable in rcv_char_buf */
+    PebbleControlRing rcv;
 
 
     // If we are passing a packet onto the target UART, this contains the number of bytes left
     // to transfer. The bytes we are transferring are always at the front of the
-    // rcv_char_buf.
+    // rcv ring.
     uint32_t   target_send_bytes;
 
-    // Timer used to wake us up to pump more data to the target
-    struct QEMUTimer *target_send_timer;
+    // Set while we are pushing bytes into the UART, so that its "space available"
+    // callback doesn't re-enter us
+    bool       forwarding;
+
+    // Resumes forwarding after loading a snapshot, once all devices are restored
+    QEMUBH     *target_send_bh;
 
     // We buffer the characters the UART from the target wants to send out here.
     // We only send it to the front end once we have a complete packet. This insures
     // that packets we went to send out don't interrupt midstream one that the target is
     // sending.
-    uint8_t send_char_buf[PBLCONTROL_BUF_LEN];
-    uint32_t send_char_bytes;    /* number of bytes avaialable in send_char_buf */
+    PebbleControlRing send;
+
+    // Packets we generate for the target ourselves. They go out between the packets we
+    // forward from the host, never in the middle of one.
+    PebbleControlRing inject;
+
+    // Accel samples received from the host, as they came in (network byte order). The
+    // host can push them as fast as it likes; we pass them on to the target in batches
+    // paced at accel_odr samples per second of virtual time, and never more than the
+    // target last said it has room for.
+    uint8_t    accel_fifo[PBLCONTROL_ACCEL_FIFO_LEN * sizeof(QemuProtocolAccelSample)];
+    uint32_t   accel_head;          // index of the oldest sample
+    uint32_t   accel_count;         // number of samples in accel_fifo
+    int32_t    accel_target_space;  // room the target reported, less what we sent
+                                    // since; -1 until it answers
+    uint32_t   accel_odr;
+    QEMUTimer  *accel_timer;
 };
 
+#define TYPE_PEBBLE_CONTROL "pebble-control"
+#define PEBBLE_CONTROL(obj) OBJECT_CHECK(PebbleControl, (obj), TYPE_PEBBLE_CONTROL)
+
 
 // Control channel handlers are defined using this structure
 typedef void (*PebbleControlMessageCallback)(PebbleControl *s, const uint8_t* data,
@@ -218,12 +258,60 @@ static void pebble_control_button_msg_callback(PebbleControl *s, const uint8_t *
 
 
 
+// -----------------------------------------------------------------------------------
+// Tell the host how many more accel samples we can take
+static void pebble_control_send_packet(PebbleControl *s, QemuProtocol protocol, void *data,
+                                uint32_t len);
+
+static void pebble_control_send_accel_space(PebbleControl *s)
+{
+    QemuProtocolAccelResponseHeader hdr = {
+      .avail_space = htons(MIN(PBLCONTROL_ACCEL_FIFO_LEN - s->accel_count, UINT16_MAX))
+    };
+    pebble_control_send_packet(s, QemuProtocol_Accel, &hdr, sizeof(hdr));
+}
+
+static void pebble_control_accel_msg_callback(PebbleControl *s, const uint8_t *data,
+                                              uint32_t len)
+{
+    QemuProtocolAccelHeader *hdr = (QemuProtocolAccelHeader *)data;
+    const size_t sample_size = sizeof(QemuProtocolAccelSample);
+
+    if (len < sizeof(*hdr) || len < sizeof(*hdr) + hdr->num_samples * sample_size) {
+        EPRINTF("%s: invalid packet\n", __func__);
+        return;
+    }
+
+    uint32_t n = MIN(hdr->num_samples, PBLCONTROL_ACCEL_FIFO_LEN - s->accel_count);
+    if (n < hdr->num_samples) {
+        EPRINTF("%s: accel FIFO full, dropped %d samples\n", __func__,
+                hdr->num_samples - n);
+    }
+    DPRINTF("%s: queued %d samples\n", __func__, n);
+
+    uint32_t i;
+    for (i = 0; i < n; i++) {
+        uint32_t slot = (s->accel_head + s->accel_count) % PBLCONTROL_ACCEL_FIFO_LEN;
+        memcpy(&s->accel_fifo[slot * sample_size], &hdr->samples[i], sample_size);
+        s->accel_count++;
+    }
+
+    // Answer straight away instead of waiting for the target to get through them
+    pebble_control_send_accel_space(s);
+
+    if (s->accel_count && !timer_pending(s->accel_timer)) {
+        timer_mod(s->accel_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL));
+    }
+}
+
+
 // -----------------------------------------------------------------------------------------
 // Find handler from s_qemu_endpoints for a given protocol
 static const PebbleControlMessageHandler* pebble_control_find_handler(PebbleControl *s,
                                                              uint16_t protocol_id) {
     static const PebbleControlMessageHandler s_msg_endpoints[] = {
       // IMPORTANT: These must be in sorted order!!
+      { QemuProtocol_Accel, pebble_control_accel_msg_callback },
       { QemuProtocol_Button, pebble_control_button_msg_callback },
     };
 
@@ -245,41 +333,100 @@ static const PebbleControlMessageHandler* pebble_control_find_handler(PebbleCont
 
 
 
+// -----------------------------------------------------------------------------------
+// Ring buffer helpers
+static uint32_t pebble_control_ring_space(PebbleControlRing *r)
+{
+    return PBLCONTROL_BUF_LEN - r->bytes;
+}
+
+// Append n bytes, which must fit
+static void pebble_control_ring_push(PebbleControlRing *r, const uint8_t *buf, uint32_t n)
+{
+    assert(n <= pebble_control_ring_space(r));
+    uint32_t tail = (r->head + r->bytes) % PBLCONTROL_BUF_LEN;
+    uint32_t first = MIN(n, PBLCONTROL_BUF_LEN - tail);
+
+    memcpy(&r->buf[tail], buf, first);
+    memcpy(&r->buf[0], buf + first, n - first);
+    r->bytes += n;
+}
+
+// Copy n bytes starting offset bytes past the head, without consuming them
+static void pebble_control_ring_peek(PebbleControlRing *r, uint32_t offset, void *dst,
+                                     uint32_t n)
+{
+    assert(offset + n <= r->bytes);
+    uint32_t start = (r->head + offset) % PBLCONTROL_BUF_LEN;
+    uint32_t first = MIN(n, PBLCONTROL_BUF_LEN - start);
+
+    memcpy(dst, &r->buf[start], first);
+    memcpy((uint8_t *)dst + first, &r->buf[0], n - first);
+}
+
+// Return the bytes at the head that are contiguous in memory, up to max
+static uint8_t *pebble_control_ring_contig(PebbleControlRing *r, uint32_t max, uint32_t *n)
+{
+    *n = MIN(MIN(max, r->bytes), PBLCONTROL_BUF_LEN - r->head);
+    return &r->buf[r->head];
+}
+
+// Drop the first n bytes
+static void pebble_control_ring_consume(PebbleControlRing *r, uint32_t n)
+{
+    assert(n <= r->bytes);
+    r->bytes -= n;
+    // Restart at the front when empty, so that most packets stay contiguous
+    r->head = r->bytes ? (r->head + n) % PBLCONTROL_BUF_LEN : 0;
+}
+
+
 // -----------------------------------------------------------------------------------
 // Drop the first N bytes out of the beginning of the receive buffer
 static void pebble_control_consume_rcv_bytes(PebbleControl *s, uint32_t n)
 {
-    assert (n <= s->rcv_char_bytes);
-    s->rcv_char_bytes -= n;
-    memmove(&s->rcv_char_buf[0], &s->rcv_char_buf[n], s->rcv_char_bytes);
+    pebble_control_ring_consume(&s->rcv, n);
+
+    // We have room for more, let the front end know
+    qemu_chr_accept_input(s->chr);
 }
 
 
 // -----------------------------------------------------------------------------------
 // Forward the remaining portion of the packet at the front of our receive buffer onto the
-// target
+// target, for as long as the UART has room. The UART calls us back through
+// pebble_control_uart_rcv_space() once it has taken bytes out of its buffer.
 static void pebble_control_forward_to_target(PebbleControl *s)
 {
-    if (s->target_send_bytes == 0) {
+    if ((s->target_send_bytes == 0 && s->inject.bytes == 0) || s->forwarding) {
         return;
     }
     DPRINTF("%s: %d bytes left to send to target\n", __func__, s->target_send_bytes);
 
-    int can_read_bytes = s->uart_chr_can_read(s->uart);
-    if (can_read_bytes > 0) {
-        can_read_bytes = MIN(can_read_bytes, s->target_send_bytes);
-        s->uart_chr_read(s->uart, s->rcv_char_buf, can_read_bytes);
-        pebble_control_consume_rcv_bytes(s, can_read_bytes);
-        s->target_send_bytes -= can_read_bytes;
-        DPRINTF("%s: sent %d bytes to target, %d remaining\n", __func__, can_read_bytes,
-                  s->target_send_bytes);
-    }
-
-    // If more data to send, set a timer so we run again later
-    if (s->target_send_bytes) {
-        DPRINTF("%s: Scheduling pebble_control_forward_to_target timer\n", __func__);
-        timer_mod(s->target_send_timer,  qemu_clock_get_ms(QEMU_CLOCK_HOST) + 1);
+    s->forwarding = true;
+    while (s->target_send_bytes || s->inject.bytes) {
+        int can_read_bytes = s->uart_chr_can_read(s->uart);
+        if (can_read_bytes <= 0) {
+            break;
+        }
+        uint32_t n;
+        uint8_t *data;
+        if (s->target_send_bytes) {
+            // Finish the host packet we started on first
+            data = pebble_control_ring_contig(&s->rcv,
+                                MIN(can_read_bytes, s->target_send_bytes), &n);
+            s->uart_chr_read(s->uart, data, n);
+            pebble_control_consume_rcv_bytes(s, n);
+            s->target_send_bytes -= n;
+        } else {
+            data = pebble_control_ring_contig(&s->inject, can_read_bytes, &n);
+            s->uart_chr_read(s->uart, data, n);
+            pebble_control_ring_consume(&s->inject, n);
+        }
+        DPRINTF("%s: sent %d bytes to target, %d remaining\n", __func__, n,
+                  s->target_send_bytes + s->inject.bytes);
     }
+    s->forwarding = false;
 }
 
 
@@ -288,52 +435,57 @@ static void pebble_control_forward_to_target(PebbleControl *s)
 static void pebble_control_parse_receive_buffer(PebbleControl *s)
 {
     // If we are still forwarding data to the target, finish that first
-    if (s->target_send_bytes) {
+    if (s->target_send_bytes || s->inject.bytes) {
         pebble_control_forward_to_target(s);
-        if (s->target_send_bytes) {
+        if (s->target_send_bytes || s->inject.bytes) {
             return;
         }
     }
 
     // Look for a complete packet
-    while (s->rcv_char_bytes >= sizeof(QemuCommChannelHdr) + sizeof(QemuCommChannelFooter)) {
-        QemuCommChannelHdr *hdr = (QemuCommChannelHdr *)s->rcv_char_buf;
+    while (s->rcv.bytes >= sizeof(QemuCommChannelHdr) + sizeof(QemuCommChannelFooter)) {
+        QemuCommChannelHdr hdr;
+        pebble_control_ring_peek(&s->rcv, 0, &hdr, sizeof(hdr));
 
         // Check the header signature
-        if (ntohs(hdr->signature) != QEMU_HEADER_SIGNATURE) {
+        if (ntohs(hdr.signature) != QEMU_HEADER_SIGNATURE) {
             DPRINTF("%s: invalid packet hdr signature detected\n", __func__);
-            pebble_control_consume_rcv_bytes(s, sizeof(hdr->signature));
+            pebble_control_consume_rcv_bytes(s, sizeof(hdr.signature));
+            continue;
         }
 
         // Validate the length
-        uint16_t data_len = ntohs(hdr->len);
+        uint16_t data_len = ntohs(hdr.len);
         if (data_len > QEMU_MAX_DATA_LEN) {
             DPRINTF("%s: invalid packet hdr len detected\n", __func__);
-            pebble_control_consume_rcv_bytes(s, sizeof(*hdr));
+            pebble_control_consume_rcv_bytes(s, sizeof(hdr));
+            continue;
         }
 
         // If not a complete packet yet, break out
         uint16_t total_size = sizeof(QemuCommChannelHdr) + data_len
                                 + sizeof(QemuCommChannelFooter);
-        if (s->rcv_char_bytes < total_size) {
+        if (s->rcv.bytes < total_size) {
             break;
         }
 
         // We have a complete packet, see if we should process it directly or pass it onto
         // the target
-        uint16_t protocol = ntohs(hdr->protocol);
+        uint16_t protocol = ntohs(hdr.protocol);
         const PebbleControlMessageHandler* handler = pebble_control_find_handler(s, protocol);
         if (!handler) {
             DPRINTF("%s: passing packet with protocol %d onto target\n", __func__, protocol);
             s->target_send_bytes = total_size;
             pebble_control_forward_to_target(s);
             if (s->target_send_bytes) {
-                // If we couldn't pass it all on, break out and wait for the timer callback
-                // to send the rest out
+                // If we couldn't pass it all on, break out and wait for the UART to tell
+                // us it has room for the rest
                 break;
             }
         } else {
-            handler->callback(s, (uint8_t *)(hdr+1), data_len);
+            uint8_t data[QEMU_MAX_DATA_LEN];
+            pebble_control_ring_peek(&s->rcv, sizeof(hdr), data, data_len);
+            handler->callback(s, data, data_len);
             pebble_control_consume_rcv_bytes(s, total_size);
         }
 
@@ -342,6 +494,80 @@ static void pebble_control_parse_receive_buffer(PebbleControl *s)
 }
 
 
+// -----------------------------------------------------------------------------------
+// Called by the UART every time it has taken a byte out of its receive buffer
+static void pebble_control_uart_rcv_space(void *opaque)
+{
+    PebbleControl *s = (PebbleControl *)opaque;
+
+    if (s->target_send_bytes || s->inject.bytes) {
+        pebble_control_parse_receive_buffer(s);
+    }
+}
+
+
+// -----------------------------------------------------------------------------------
+// Hand the next batch of queued accel samples to the target as a regular
+// QemuProtocol_Accel packet, and come back once the target has had the time to
+// consume it at accel_odr. The target answers each packet with the room it has left,
+// which caps the following batches. When it has no room, an empty packet asks it
+// again; should it not answer that, the next batch goes out unchecked.
+static void pebble_control_accel_timer_cb(void *opaque)
+{
+    PebbleControl *s = (PebbleControl *)opaque;
+    const size_t sample_size = sizeof(QemuProtocolAccelSample);
+    uint32_t batch = MIN(MAX(s->accel_odr / 10, 1), PBLCONTROL_ACCEL_MAX_BATCH);
+    uint32_t wait = 1;
+    uint32_t n = 0;
+
+    // Let the previous batch get into the UART first
+    if (s->inject.bytes == 0 && s->accel_count) {
+        uint8_t pkt[PBLCONTROL_BUF_LEN];
+        QemuCommChannelHdr *hdr = (QemuCommChannelHdr *)pkt;
+        QemuProtocolAccelHeader *accel = (QemuProtocolAccelHeader *)(hdr + 1);
+        uint32_t i;
+
+        n = MIN(s->accel_count, batch);
+        if (s->accel_target_space >= 0) {
+            n = MIN(n, s->accel_target_space);
+            s->accel_target_space -= n;
+        }
+        if (n == 0) {
+            s->accel_target_space = -1;
+        }
+        wait = n ? n : batch;
+        accel->num_samples = n;
+        for (i = 0; i < n; i++) {
+            memcpy(&accel->samples[i], &s->accel_fifo[s->accel_head * sample_size],
+                   sample_size);
+            s->accel_head = (s->accel_head + 1) % PBLCONTROL_ACCEL_FIFO_LEN;
+        }
+        s->accel_count -= n;
+
+        uint32_t data_len = sizeof(*accel) + n * sample_size;
+        QemuCommChannelFooter footer = {
+            .signature = htons(QEMU_FOOTER_SIGNATURE)
+        };
+        *hdr = (QemuCommChannelHdr) {
+            .signature = htons(QEMU_HEADER_SIGNATURE),
+            .protocol = htons(QemuProtocol_Accel),
+            .len = htons(data_len)
+        };
+        memcpy(pkt + sizeof(*hdr) + data_len, &footer, sizeof(footer));
+        pebble_control_ring_push(&s->inject, pkt,
+                                 sizeof(*hdr) + data_len + sizeof(footer));
+        DPRINTF("%s: released %d samples, %d left\n", __func__, n, s->accel_count);
+
+        pebble_control_parse_receive_buffer(s);
+    }
+
+    if (s->accel_count) {
+        timer_mod(s->accel_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL)
+                  + NANOSECONDS_PER_SECOND * wait / s->accel_odr);
+    }
+}
+
+
 // -----------------------------------------------------------------------------------
 // Char device receive handlers
 static void pebble_control_event(void *opaque, int event)
@@ -356,7 +582,7 @@ static int pebble_control_can_receive(void *opaque)
     PebbleControl *s = (PebbleControl *)opaque;
 
     /* How much space do we have in our buffer? */
-    return (PBLCONTROL_BUF_LEN - s->rcv_char_bytes);
+    return pebble_control_ring_space(&s->rcv);
 }
 
 static void pebble_control_receive(void *opaque, const uint8_t *buf, int size)
@@ -366,25 +592,13 @@ static void pebble_control_receive(void *opaque, const uint8_t *buf, int size)
     assert(size > 0);
 
     // Copy the characters into our buffer first
-    assert (size <= PBLCONTROL_BUF_LEN - s->rcv_char_bytes);
-    memmove(s->rcv_char_buf + s->rcv_char_bytes, buf, size);
-    s->rcv_char_bytes += size;
+    pebble_control_ring_push(&s->rcv, buf, size);
 
     // Process any complete packets in the receive buffer
     pebble_control_parse_receive_buffer(s);
 }
 
 
-// -----------------------------------------------------------------------------------
-// Drop the first N bytes out of the beginning of the send buffer
-static void pebble_control_consume_send_bytes(PebbleControl *s, uint32_t n)
-{
-    assert (n <= s->send_char_bytes);
-    s->send_char_bytes -= n;
-    memmove(&s->send_char_buf[0], &s->send_char_buf[n], s->send_char_bytes);
-}
-
-
 // -----------------------------------------------------------------------------------
 // This method gets passed to the UART's stm32_uart_set_write_handler(). This way
 //  we can intercept all writes that the UART sends to the front end and insure that
@@ -394,61 +608,82 @@ static int pebble_control_write(void *opaque, const uint8_t *buf, int len) {
 
     while (len) {
         // Copy the new bytes in
-        uint32_t space_left = sizeof(s->send_char_buf) - s->send_char_bytes;
+        uint32_t space_left = pebble_control_ring_space(&s->send);
 
         if (space_left == 0) {
             EPRINTF("%s: overflowed send buffer, aborting queued up data\n", __func__);
-            s->send_char_bytes = 0;
-            space_left = sizeof(s->send_char_buf);
+            pebble_control_ring_consume(&s->send, s->send.bytes);
+            space_left = pebble_control_ring_space(&s->send);
         }
         uint32_t bytes_to_copy = MIN(space_left, len);
-        memmove(&s->send_char_buf[s->send_char_bytes], buf, bytes_to_copy);
-        s->send_char_bytes += bytes_to_copy;
+        pebble_control_ring_push(&s->send, buf, bytes_to_copy);
+        buf += bytes_to_copy;
         len -= bytes_to_copy;
 
 
         // ------------------------------------------------------------------
         // See if we have a complete packet yet
-        if (s->send_char_bytes < sizeof(QemuCommChannelHdr)
-                                 + sizeof(QemuCommChannelFooter)) {
+        if (s->send.bytes < sizeof(QemuCommChannelHdr)
+                            + sizeof(QemuCommChannelFooter)) {
             break;
         }
-        QemuCommChannelHdr *hdr = (QemuCommChannelHdr *)s->send_char_buf;
+        QemuCommChannelHdr hdr;
+        pebble_control_ring_peek(&s->send, 0, &hdr, sizeof(hdr));
 
         // Check the header signature
-        if (ntohs(hdr->signature) != QEMU_HEADER_SIGNATURE) {
+        if (ntohs(hdr.signature) != QEMU_HEADER_SIGNATURE) {
             DPRINTF("%s: invalid packet hdr signature detected\n", __func__);
-            pebble_control_consume_send_bytes(s, sizeof(hdr->signature));
+            pebble_control_ring_consume(&s->send, sizeof(hdr.signature));
+            continue;
         }
 
         // Validate the length
-        uint16_t data_len = ntohs(hdr->len);
+        uint16_t data_len = ntohs(hdr.len);
         if (data_len > QEMU_MAX_DATA_LEN) {
             DPRINTF("%s: invalid packet hdr len detected\n", __func__);
-            pebble_control_consume_send_bytes(s, sizeof(*hdr));
+            pebble_control_ring_consume(&s->send, sizeof(hdr));
+            continue;
         }
 
         // If not a complete packet yet, break out
         uint16_t total_size = sizeof(QemuCommChannelHdr) + data_len
                                 + sizeof(QemuCommChannelFooter);
-        if (s->send_char_bytes < total_size) {
+        if (s->send.bytes < total_size) {
             if (len > 0) {
                 // If we still have not put in all the bytes the caller wanted,
                 // we must be off-frame because we ran out of room.
                 EPRINTF("%s: overflowed send buffer, aborting queued up data\n", __func__);
-                s->send_char_bytes = 0;
+                pebble_control_ring_consume(&s->send, s->send.bytes);
                 continue;
             }
             break;
         }
 
-        // We have a complete packet, send it out the front end
-        int bytes_sent;
+        // The target answers our accel packets with the room it has left, which paces
+        // the next ones (see pebble_control_accel_timer_cb). We answer the host's
+        // ourselves (see pebble_control_accel_msg_callback), the target's view of its
+        // buffer space would only confuse it.
+        if (ntohs(hdr.protocol) == QemuProtocol_Accel) {
+            QemuProtocolAccelResponseHeader rsp;
+
+            if (data_len == sizeof(rsp)) {
+                pebble_control_ring_peek(&s->send, sizeof(hdr), &rsp, sizeof(rsp));
+                s->accel_target_space = ntohs(rsp.avail_space);
+                DPRINTF("%s: target has room for %d samples\n", __func__,
+                        s->accel_target_space);
+            }
+            pebble_control_ring_consume(&s->send, total_size);
+            continue;
+        }
+
+        // We have a complete packet, send it out the front end straight from the ring
         DPRINTF("%s: Sending packet of %d bytes to host\n", __func__, total_size);
         while (total_size) {
-            bytes_sent = qemu_chr_fe_write(s->chr, s->send_char_buf, total_size);
-            total_size -= bytes_sent;
-            pebble_control_consume_send_bytes(s, bytes_sent);
+            uint32_t n;
+            uint8_t *data = pebble_control_ring_contig(&s->send, total_size, &n);
+            qemu_chr_fe_write_all(s->chr, data, n);
+            pebble_control_ring_consume(&s->send, n);
+            total_size -= n;
         }
 
     }
@@ -493,23 +728,183 @@ void pebble_control_send_vibe_notification(PebbleControl *s, bool on)
 }
 
 // -----------------------------------------------------------------------------------
-PebbleControl *pebble_control_create(CharDriverState *chr, Stm32Uart *uart)
+static int pebble_control_post_load(void *opaque, int version_id)
+{
+    PebbleControl *s = (PebbleControl *)opaque;
+
+    if (s->rcv.head >= PBLCONTROL_BUF_LEN || s->rcv.bytes > PBLCONTROL_BUF_LEN
+        || s->send.head >= PBLCONTROL_BUF_LEN || s->send.bytes > PBLCONTROL_BUF_LEN
+        || s->target_send_bytes > s->rcv.bytes
+        || s->inject.head >= PBLCONTROL_BUF_LEN || s->inject.bytes > PBLCONTROL_BUF_LEN
+        || s->accel_head >= PBLCONTROL_ACCEL_FIFO_LEN
+        || s->accel_count > PBLCONTROL_ACCEL_FIFO_LEN
+        || s->accel_target_space < -1 || s->accel_target_space > UINT16_MAX) {
+        return -EINVAL;
+    }
+
+    // Pick up where we left off with any packets that were buffered when we saved. The
+    // UART may not be loaded yet, so do that from the main loop.
+    if (s->rcv.bytes || s->inject.bytes) {
+        qemu_bh_schedule(s->target_send_bh);
+    }
+    return 0;
+}
+
+static void pebble_control_target_send_bh(void *opaque)
+{
+    pebble_control_parse_receive_buffer((PebbleControl *)opaque);
+}
+
+static const VMStateDescription vmstate_pebble_control_ring = {
+    .name = "pebble-control-ring",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT8_ARRAY(buf, PebbleControlRing, PBLCONTROL_BUF_LEN),
+        VMSTATE_UINT32(head, PebbleControlRing),
+        VMSTATE_UINT32(bytes, PebbleControlRing),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_pebble_control = {
+    .name = "pebble-control",
+    .version_id = 4,
+    .minimum_version_id = 2,
+    .post_load = pebble_control_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_STRUCT(rcv, PebbleControl, 1, vmstate_pebble_control_ring,
+                       PebbleControlRing),
+        VMSTATE_UINT32(target_send_bytes, PebbleControl),
+        VMSTATE_STRUCT(send, PebbleControl, 1, vmstate_pebble_control_ring,
+                       PebbleControlRing),
+        VMSTATE_STRUCT(inject, PebbleControl, 3, vmstate_pebble_control_ring,
+                       PebbleControlRing),
+        VMSTATE_UINT8_ARRAY_V(accel_fifo, PebbleControl,
+                              PBLCONTROL_ACCEL_FIFO_LEN * sizeof(QemuProtocolAccelSample),
+                              3),
+        VMSTATE_UINT32_V(accel_head, PebbleControl, 3),
+        VMSTATE_UINT32_V(accel_count, PebbleControl, 3),
+        VMSTATE_TIMER_PTR_V(accel_timer, PebbleControl, 3),
+        VMSTATE_INT32_V(accel_target_space, PebbleControl, 4),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+
+// -----------------------------------------------------------------------------------
+// Move the control connection over to another chardev. Returns the previous one, which
+// no longer has our handlers installed.
+CharDriverState *pebble_control_set_chr(PebbleControl *s, CharDriverState *chr)
+{
+    CharDriverState *old = s->chr;
+
+    assert(chr);
+    if (!old) {
+        // Created without a chardev, the uart is not routed through us
+        return NULL;
+    }
+
+    qemu_chr_add_handlers(old, NULL, NULL, NULL, NULL);
+    s->chr = chr;
+    qemu_chr_add_handlers(
+                    chr,
+                    pebble_control_can_receive,
+                    pebble_control_receive,
+                    pebble_control_event,
+                    (void *)s);
+    return old;
+}
+
+// -----------------------------------------------------------------------------------
+// Rate, in samples per second, at which the target consumes accel samples: the
+// accel-odr property, else PEBBLE_QEMU_ACCEL_ODR, else PBLCONTROL_ACCEL_ODR_HZ
+static void pebble_control_realize(DeviceState *dev, Error **errp)
+{
+    PebbleControl *s = PEBBLE_CONTROL(dev);
+    char *strval;
+
+    if (s->accel_odr > PBLCONTROL_ACCEL_ODR_MAX) {
+        error_setg(errp, "accel-odr must be between 1 and %d",
+                   PBLCONTROL_ACCEL_ODR_MAX);
+        return;
+    }
+    if (s->accel_odr) {
+        return;
+    }
+
+    s->accel_odr = PBLCONTROL_ACCEL_ODR_HZ;
+    strval = getenv("PEBBLE_QEMU_ACCEL_ODR");
+    if (strval) {
+        int odr = atoi(strval);
+        if (odr <= 0 || odr > PBLCONTROL_ACCEL_ODR_MAX) {
+            error_report("PEBBLE_QEMU_ACCEL_ODR must be between 1 and %d, using %d",
+                         PBLCONTROL_ACCEL_ODR_MAX, PBLCONTROL_ACCEL_ODR_HZ);
+        } else {
+            s->accel_odr = odr;
+        }
+    }
+}
+
+static Property pebble_control_properties[] = {
+    DEFINE_PROP_UINT32("accel-odr", PebbleControl, accel_odr, 0),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void pebble_control_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+
+    dc->realize = pebble_control_realize;
+    dc->props = pebble_control_properties;
+}
+
+static const TypeInfo pebble_control_info = {
+    .name          = TYPE_PEBBLE_CONTROL,
+    .parent        = TYPE_SYS_BUS_DEVICE,
+    .instance_size = sizeof(PebbleControl),
+    .class_init    = pebble_control_class_init,
+};
+
+static void pebble_control_register_types(void)
+{
+    type_register_static(&pebble_control_info);
+}
+
+type_init(pebble_control_register_types)
+
+// -----------------------------------------------------------------------------------
+// Create the device, and if there is a chardev, the state common to both UART types
+static PebbleControl *pebble_control_new(CharDriverState *chr, void *uart)
 {
-    PebbleControl *s = malloc(sizeof(PebbleControl));
-    memset(s, 0, sizeof(*s));
+    DeviceState *dev = qdev_create(NULL, TYPE_PEBBLE_CONTROL);
+    PebbleControl *s = PEBBLE_CONTROL(dev);
+
+    qdev_init_nofail(dev);
 
     if (chr) {
         s->chr = chr;
         s->uart = uart;
 
-        // The timer we use to pump more data to the uart
-        s->target_send_timer = timer_new_ms(QEMU_CLOCK_HOST,
-                                  (QEMUTimerCB *)pebble_control_parse_receive_buffer, s);
+        s->target_send_bh = qemu_bh_new(pebble_control_target_send_bh, s);
+        s->accel_target_space = -1;
+        s->accel_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, pebble_control_accel_timer_cb, s);
+    }
+    return s;
+}
 
+// -----------------------------------------------------------------------------------
+PebbleControl *pebble_control_create(CharDriverState *chr, Stm32Uart *uart)
+{
+    PebbleControl *s = pebble_control_new(chr, uart);
 
+    if (chr) {
         // Have the UART send writes to us
         stm32_uart_set_write_handler(uart, s, pebble_control_write);
 
+        // Have the UART tell us when it can take more data
+        stm32_uart_set_rcv_space_handler(uart, s, pebble_control_uart_rcv_space);
+
         // Save away the receive handlers that the uart installed into chr
         stm32_uart_get_rcv_handlers(uart, &s->uart_chr_can_read, &s->uart_chr_read, &s->uart_chr_event);
 
@@ -520,6 +915,10 @@ PebbleControl *pebble_control_create(CharDriverState *chr, Stm32Uart *uart)
                         pebble_control_receive,
                         pebble_control_event,
                         (void *)s);
+
+        // Only a connected instance has state worth saving, register it with savevm
+        // here rather than through the device class
+        vmstate_register(NULL, 0, &vmstate_pebble_control, s);
     }
 
     return s;
@@ -528,21 +927,15 @@ PebbleControl *pebble_control_create(CharDriverState *chr, Stm32Uart *uart)
 // -----------------------------------------------------------------------------------
 PebbleControl *pebble_control_create_stm32f7xx(CharDriverState *chr, Stm32F7xxUart *uart)
 {
-    PebbleControl *s = malloc(sizeof(PebbleControl));
-    memset(s, 0, sizeof(*s));
+    PebbleControl *s = pebble_control_new(chr, uart);
 
     if (chr) {
-        s->chr = chr;
-        s->uart = uart;
-
-        // The timer we use to pump more data to the uart
-        s->target_send_timer = timer_new_ms(QEMU_CLOCK_HOST,
-                                  (QEMUTimerCB *)pebble_control_parse_receive_buffer, s);
-
-
         // Have the UART send writes to us
         stm32f7xx_uart_set_write_handler(uart, s, pebble_control_write);
 
+        // Have the UART tell us when it can take more data
+        stm32f7xx_uart_set_rcv_space_handler(uart, s, pebble_control_uart_rcv_space);
+
         // Save away the receive handlers that the uart installed into chr
         stm32f7xx_uart_get_rcv_handlers(uart, &s->uart_chr_can_read, &s->uart_chr_read, &s->uart_chr_event);
 
@@ -553,6 +946,10 @@ PebbleControl *pebble_control_create_stm32f7xx(CharDriverState *chr, Stm32F7xxUa
                         pebble_control_receive,
                         pebble_control_event,
                         (void *)s);
+
+        // Only a connected instance has state worth saving, register it with savevm
+        // here rather than through the device class
+        vmstate_register(NULL, 0, &vmstate_pebble_control, s);
     }
 
     return s;
@@ -5,6 +5,7 @@ typedef struct PebbleControl PebbleControl;
 
 PebbleControl *pebble_control_create(CharDriverState *chr, Stm32Uart *uart);
 PebbleControl *pebble_control_create_stm32f7xx(CharDriverState *chr, Stm32F7xxUart *uart);
+CharDriverState *pebble_control_set_chr(PebbleControl *s, CharDriverState *chr);
 
 void pebble_control_send_vibe_notification(PebbleControl *s, bool on);
 
@@ -63,6 +63,7 @@ void pebble_32f7xx_init(MachineState *machine, const PblBoardConfig *board_confi
 
     qemu_irq mt25q_cs = qdev_get_gpio_in_named(qspi_flash, SSI_GPIO_CS, 0);
     qdev_connect_gpio_out_named(stm.qspi_dev, "qspi-gpio-cs", 0, mt25q_cs);
+    stm32f412_qspi_set_flash(stm.qspi_dev, mt25q_get_memory(qspi_flash));
 
 
     /* --- Display ------------------------------------------------  */
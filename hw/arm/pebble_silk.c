@@ -65,6 +65,7 @@ void pebble_32f412_init(MachineState *machine, const PblBoardConfig *board_confi
 
     qemu_irq mx25u_cs = qdev_get_gpio_in_named(qspi_flash, SSI_GPIO_CS, 0);
     qdev_connect_gpio_out_named(stm.qspi_dev, "qspi-gpio-cs", 0, mx25u_cs);
+    stm32f412_qspi_set_flash(stm.qspi_dev, mx25u_get_memory(qspi_flash));
 
 
     /* --- Display ------------------------------------------------  */
@@ -62,6 +62,82 @@ void stm32_create_uart_dev(
 }
 
 
+/* DMA request mapping of the F2 and of the F405/F407/F42x/F43x (RM0033
+ * tables 22 and 23, RM0090 tables 42 and 43).  The F412 (RM0402) and the F7
+ * (RM0385) map some requests differently and do not use it.
+ * Peripheral numbers count from 1, and a second stream of -1 means the
+ * request has a single mapping.
+ */
+static const struct {
+    bool spi;
+    uint8_t num;
+    const char *req;
+    uint8_t dma;
+    int8_t stream[2];
+    uint8_t channel[2];
+} stm32_dma_request_desc[] = {
+    {false, 1, "dma-rx", 2, {2, 5}, {4, 4}},
+    {false, 1, "dma-tx", 2, {7, -1}, {4, 0}},
+    {false, 2, "dma-rx", 1, {5, -1}, {4, 0}},
+    {false, 2, "dma-tx", 1, {6, -1}, {4, 0}},
+    {false, 3, "dma-rx", 1, {1, -1}, {4, 0}},
+    {false, 3, "dma-tx", 1, {3, 4}, {4, 7}},
+    {false, 4, "dma-rx", 1, {2, -1}, {4, 0}},
+    {false, 4, "dma-tx", 1, {4, -1}, {4, 0}},
+    {false, 5, "dma-rx", 1, {0, -1}, {4, 0}},
+    {false, 5, "dma-tx", 1, {7, -1}, {4, 0}},
+    {false, 6, "dma-rx", 2, {1, 2}, {5, 5}},
+    {false, 6, "dma-tx", 2, {6, 7}, {5, 5}},
+    {false, 7, "dma-rx", 1, {3, -1}, {5, 0}},
+    {false, 7, "dma-tx", 1, {1, -1}, {5, 0}},
+    {false, 8, "dma-rx", 1, {6, -1}, {5, 0}},
+    {false, 8, "dma-tx", 1, {0, -1}, {5, 0}},
+    {true, 1, "dma-rx", 2, {0, 2}, {3, 3}},
+    {true, 1, "dma-tx", 2, {3, 5}, {3, 3}},
+    {true, 2, "dma-rx", 1, {3, -1}, {0, 0}},
+    {true, 2, "dma-tx", 1, {4, -1}, {0, 0}},
+    {true, 3, "dma-rx", 1, {0, 2}, {0, 0}},
+    {true, 3, "dma-tx", 1, {5, 7}, {0, 0}},
+    {true, 4, "dma-rx", 2, {0, 3}, {4, 5}},
+    {true, 4, "dma-tx", 2, {1, 4}, {4, 5}},
+    {true, 5, "dma-rx", 2, {3, 5}, {2, 7}},
+    {true, 5, "dma-tx", 2, {4, 6}, {2, 7}},
+    {true, 6, "dma-rx", 2, {6, -1}, {1, 0}},
+    {true, 6, "dma-tx", 2, {5, -1}, {1, 0}},
+};
+
+void stm32_dma_connect_requests(DeviceState *dma1, DeviceState *dma2,
+                                DeviceState **uart, int uart_count,
+                                DeviceState **spi, int spi_count)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_LENGTH(stm32_dma_request_desc); i++) {
+        DeviceState *dma = stm32_dma_request_desc[i].dma == 1 ? dma1 : dma2;
+        int num = stm32_dma_request_desc[i].num;
+        DeviceState *dev;
+        qemu_irq req;
+
+        if (stm32_dma_request_desc[i].spi) {
+            dev = num <= spi_count ? spi[num - 1] : NULL;
+        } else {
+            dev = num <= uart_count ? uart[num - 1] : NULL;
+        }
+        if (!dev) {
+            continue;
+        }
+
+        req = f2xx_dma_get_request(dma, stm32_dma_request_desc[i].stream[0],
+                                   stm32_dma_request_desc[i].channel[0]);
+        if (stm32_dma_request_desc[i].stream[1] >= 0) {
+            req = qemu_irq_split(req,
+                    f2xx_dma_get_request(dma, stm32_dma_request_desc[i].stream[1],
+                                         stm32_dma_request_desc[i].channel[1]));
+        }
+        qdev_connect_gpio_out_named(dev, stm32_dma_request_desc[i].req, 0, req);
+    }
+}
+
 /* INITIALIZATION */
 
 /* I copied sysbus_create_varargs and split it into two parts.  This is so that
@@ -367,6 +367,20 @@ static int stm32_exti_init(SysBusDevice *dev)
     return 0;
 }
 
+static const VMStateDescription vmstate_stm32_exti = {
+    .name = "stm32_exti",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(EXTI_IMR, Stm32Exti),
+        VMSTATE_UINT32(EXTI_RTSR, Stm32Exti),
+        VMSTATE_UINT32(EXTI_FTSR, Stm32Exti),
+        VMSTATE_UINT32(EXTI_SWIER, Stm32Exti),
+        VMSTATE_UINT32(EXTI_PR, Stm32Exti),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static Property stm32_exti_properties[] = {
     DEFINE_PROP_PTR("stm32_gpio", Stm32Exti, stm32_gpio_prop),
     DEFINE_PROP_END_OF_LIST()
@@ -380,6 +394,7 @@ static void stm32_exti_class_init(ObjectClass *klass, void *data)
     k->init = stm32_exti_init;
     dc->reset = stm32_exti_reset;
     dc->props = stm32_exti_properties;
+    dc->vmsd = &vmstate_stm32_exti;
 }
 
 static TypeInfo stm32_exti_info = {
@@ -552,7 +552,7 @@ static void stm32_rcc_hclk_upd_irq_handler(void *opaque, int n, int level)
          * (which is an unchanging number independent of the CPU frequency) to
          * system/external clock ticks.
          */
-        system_clock_scale = get_ticks_per_sec() / hclk_freq;
+        system_clock_set_freq(hclk_freq);
     }
 
 #ifdef DEBUG_STM32_RCC
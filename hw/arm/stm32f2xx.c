@@ -380,4 +380,9 @@ void stm32f2xx_init(
     sysbus_connect_irq(SYS_BUS_DEVICE(dma2), 5, qdev_get_gpio_in(nvic, STM32_DMA2_STREAM5_IRQ));
     sysbus_connect_irq(SYS_BUS_DEVICE(dma2), 6, qdev_get_gpio_in(nvic, STM32_DMA2_STREAM6_IRQ));
     sysbus_connect_irq(SYS_BUS_DEVICE(dma2), 7, qdev_get_gpio_in(nvic, STM32_DMA2_STREAM7_IRQ));
+
+    /* DMA requests from the USARTs and SPIs */
+    stm32_dma_connect_requests(dma1, dma2,
+                               (DeviceState **)stm32_uart, STM32F2XX_UART_COUNT,
+                               stm->spi_dev, STM32F2XX_SPI_COUNT);
 }
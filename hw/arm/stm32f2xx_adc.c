@@ -216,6 +216,17 @@ stm32f2xx_adc_init(SysBusDevice *dev)
     return 0;
 }
 
+static const VMStateDescription vmstate_stm32f2xx_adc = {
+    .name = "stm32f2xx_adc",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32_2DARRAY(regs, stm32_adc, 3, R_ADC_MAX),
+        VMSTATE_UINT32(ccr, stm32_adc),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static Property stm32f2xx_adc_properties[] = {
     DEFINE_PROP_END_OF_LIST()
 };
@@ -229,6 +240,7 @@ stm32f2xx_adc_class_init(ObjectClass *klass, void *data)
     sc->init = stm32f2xx_adc_init;
     dc->reset = f2xx_adc_reset;
     dc->props = stm32f2xx_adc_properties;
+    dc->vmsd = &vmstate_stm32f2xx_adc;
 }
 
 static const TypeInfo stm32f2xx_adc_info = {
@@ -23,6 +23,7 @@
  * QEMU crc emulation
  */
 #include "hw/sysbus.h"
+#include "hw/arm/stm32.h"
 
 #define R_CRC_DR            (0x00 / 4)
 #define R_CRC_DR_RESET 0xffffffff
@@ -97,10 +98,53 @@ static unsigned long crctable[256] =
  0xBCB4666DL, 0xB8757BDAL, 0xB5365D03L, 0xB1F740B4L
 };
 
+/* Slicing-by-8 tables: crc_slice[k][i] is the CRC of byte i followed by k
+ * zero bytes, crc_slice[0] is crctable.  Filled in by f2xx_crc_init_tables(). */
+static uint32_t crc_slice[8][256];
+
+static void
+f2xx_crc_init_tables(void)
+{
+    int i, k;
+
+    for (i = 0; i < 256; i++) {
+        crc_slice[0][i] = crctable[i];
+    }
+    for (k = 1; k < 8; k++) {
+        for (i = 0; i < 256; i++) {
+            uint32_t c = crc_slice[k - 1][i];
+            crc_slice[k][i] = (c << 8) ^ crc_slice[0][c >> 24];
+        }
+    }
+}
+
+/* Feed one data register word, most significant byte first. */
 static inline uint32_t
-update_crc(uint32_t crc, uint8_t byte)
+update_crc_word(uint32_t crc, uint32_t data)
 {
-    return crctable[((crc >> 24) ^ byte) & 0xff] ^ (crc << 8);
+    crc ^= data;
+    return crc_slice[3][crc >> 24] ^ crc_slice[2][(crc >> 16) & 0xff] ^
+           crc_slice[1][(crc >> 8) & 0xff] ^ crc_slice[0][crc & 0xff];
+}
+
+/* Feed @count little endian words from @buf, two at a time. */
+static uint32_t
+update_crc_words(uint32_t crc, const uint8_t *buf, int count)
+{
+    uint32_t hi, lo;
+
+    for (; count >= 2; count -= 2, buf += 8) {
+        hi = crc ^ ldl_le_p(buf);
+        lo = ldl_le_p(buf + 4);
+        crc = crc_slice[7][hi >> 24] ^ crc_slice[6][(hi >> 16) & 0xff] ^
+              crc_slice[5][(hi >> 8) & 0xff] ^ crc_slice[4][hi & 0xff] ^
+              crc_slice[3][lo >> 24] ^ crc_slice[2][(lo >> 16) & 0xff] ^
+              crc_slice[1][(lo >> 8) & 0xff] ^ crc_slice[0][lo & 0xff];
+    }
+    if (count) {
+        crc = update_crc_word(crc, ldl_le_p(buf));
+    }
+    return crc;
 }
 
 typedef struct f2xx_crc {
@@ -156,10 +200,7 @@ f2xx_crc_write(void *arg, hwaddr addr, uint64_t data, unsigned int size)
     }
     switch(addr) {
     case R_CRC_DR:
-        s->crc = update_crc(s->crc, (data >> 24) & 0xff);
-        s->crc = update_crc(s->crc, (data >> 16) & 0xff);
-        s->crc = update_crc(s->crc, (data >> 8) & 0xff);
-        s->crc = update_crc(s->crc, data & 0xff);
+        s->crc = update_crc_word(s->crc, data);
         break;
     case R_CRC_IDR:
         s->idr = data;
@@ -172,6 +213,21 @@ f2xx_crc_write(void *arg, hwaddr addr, uint64_t data, unsigned int size)
     }
 }
 
+/* DMA into DR, memory to peripheral or memory to memory with DR as the
+ * fixed destination: checksum the whole buffer in one go. */
+static int
+f2xx_crc_dma_bulk(Object *obj, hwaddr offset, uint8_t *buf, int size,
+                  int count, bool to_periph)
+{
+    f2xx_crc *s = FROM_SYSBUS(f2xx_crc, SYS_BUS_DEVICE(obj));
+
+    if (!to_periph || offset != R_CRC_DR * 4 || size != 4) {
+        return 0;
+    }
+    s->crc = update_crc_words(s->crc, buf, count);
+    return count;
+}
+
 static const MemoryRegionOps f2xx_crc_ops = {
     .read = f2xx_crc_read,
     .write = f2xx_crc_write,
@@ -201,6 +257,17 @@ f2xx_crc_reset(DeviceState *ds)
     s->crc = R_CRC_DR_RESET;
 }
 
+static const VMStateDescription vmstate_f2xx_crc = {
+    .name = "f2xx_crc",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(crc, f2xx_crc),
+        VMSTATE_UINT8(idr, f2xx_crc),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static Property f2xx_crc_properties[] = {
     DEFINE_PROP_END_OF_LIST(),
 };
@@ -210,10 +277,15 @@ f2xx_crc_class_init(ObjectClass *klass, void *data)
 {
     DeviceClass *dc = DEVICE_CLASS(klass);
     SysBusDeviceClass *sc = SYS_BUS_DEVICE_CLASS(klass);
+    Stm32DmaBulkClass *bc = STM32_DMA_BULK_CLASS(klass);
+
+    f2xx_crc_init_tables();
     sc->init = f2xx_crc_init;
+    bc->transfer = f2xx_crc_dma_bulk;
     dc->reset = f2xx_crc_reset;
     //TODO: fix this: dc->no_user = 1;
     dc->props = f2xx_crc_properties;
+    dc->vmsd = &vmstate_f2xx_crc;
 }
 
 static const TypeInfo
@@ -222,6 +294,10 @@ f2xx_crc_info = {
     .parent        = TYPE_SYS_BUS_DEVICE,
     .instance_size = sizeof(f2xx_crc),
     .class_init    = f2xx_crc_class_init,
+    .interfaces    = (InterfaceInfo[]) {
+        { TYPE_STM32_DMA_BULK },
+        { }
+    }
 };
 
 static void
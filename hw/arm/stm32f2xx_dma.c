@@ -21,8 +21,26 @@
  */
 /*
  * QEMU DMA controller device model
+ *
+ * Each stream is either paced by the peripheral request routed to its selected
+ * channel (see f2xx_dma_get_request()), or runs free as soon as it is enabled.
+ * Memory-to-memory streams run free.  So do streams whose channel has no routed
+ * request, but only for a single memory-to-peripheral pass; without a request
+ * there is no telling when a peripheral has data, and a circular transfer would
+ * never end, so other unrouted streams stay idle.  Free-running work, and paced work that exceeds F2XX_DMA_ITEMS_PER_PASS,
+ * is carried out from a QEMU_CLOCK_VIRTUAL timer, so a stream never runs inside
+ * the guest's write to its control register.  Paced items are moved
+ * synchronously when the peripheral raises its request, inside its
+ * qemu_set_irq() and so inside whatever access made it ready.
+ *
+ * The FIFO is modelled as always draining immediately, so FIFO mode and bursts
+ * only change how FCR reads back.
  */
 #include "hw/sysbus.h"
+#include "hw/arm/stm32.h"
+#include "exec/address-spaces.h"
+#include "qemu/bitops.h"
+#include "qemu/timer.h"
 
 //#define DEBUG_STM32F2XX_DMA
 #ifdef DEBUG_STM32F2XX_DMA
@@ -47,22 +65,54 @@
 #define R_DMA_ISR_TIEF     (1 << 3)
 #define R_DMA_ISR_HTIF     (1 << 4)
 #define R_DMA_ISR_TCIF     (1 << 5)
+#define R_DMA_ISR_MASK     0x3d
 
 /* Per-stream registers. */
 #define R_DMA_Sx             (0x10 / 4)
 #define R_DMA_Sx_COUNT           8
 #define R_DMA_Sx_REGS            6
 #define R_DMA_SxCR           (0x00 / 4)
-#define R_DMA_SxCR_EN   0x00000001
+#define R_DMA_SxCR_EN      0x00000001
+#define R_DMA_SxCR_DMEIE   0x00000002
+#define R_DMA_SxCR_TEIE    0x00000004
+#define R_DMA_SxCR_HTIE    0x00000008
+#define R_DMA_SxCR_TCIE    0x00000010
+#define R_DMA_SxCR_DIR_START   6
+#define R_DMA_SxCR_DIR_P2M     0
+#define R_DMA_SxCR_DIR_M2P     1
+#define R_DMA_SxCR_DIR_M2M     2
+#define R_DMA_SxCR_CIRC    0x00000100
+#define R_DMA_SxCR_PINC    0x00000200
+#define R_DMA_SxCR_MINC    0x00000400
+#define R_DMA_SxCR_PSIZE_START 11
+#define R_DMA_SxCR_MSIZE_START 13
+#define R_DMA_SxCR_DBM     0x00040000
+#define R_DMA_SxCR_CT      0x00080000
+#define R_DMA_SxCR_CHSEL_START 25
+#define R_DMA_SxCR_MASK    0x0fefffff
 #define R_DMA_SxNDTR         (0x04 / 4)
-#define R_DMA_SxNDTR_EN 0x00000001
 #define R_DMA_SxPAR          (0x08 / 4)
 #define R_DMA_SxM0AR         (0x0c / 4)
 #define R_DMA_SxM1AR         (0x10 / 4)
 #define R_DMA_SxFCR          (0x14 / 4)
+#define R_DMA_SxFCR_DMDIS  0x00000004
+#define R_DMA_SxFCR_FS_EMPTY   (4 << 3)
+#define R_DMA_SxFCR_FEIE   0x00000080
+#define R_DMA_SxFCR_RESET  0x00000021
+#define R_DMA_SxFCR_MASK   0x00000087
 
 #define R_DMA_MAX            (0xd0 / 4)
 
+#define F2XX_DMA_CHANNELS        8
+
+/* Upper bound on the items a stream moves before yielding back to the vCPU.
+ * This is larger than NDTR can hold, so a normal mode transfer always
+ * completes in one pass; only circular and double-buffer streams yield. */
+#define F2XX_DMA_ITEMS_PER_PASS  0x10000
+
+/* Delay before a stream that yielded is resumed. */
+#define F2XX_DMA_RESUME_NS       10000
+
 typedef struct f2xx_dma_stream {
     qemu_irq irq;
 
@@ -71,19 +121,38 @@ typedef struct f2xx_dma_stream {
     uint32_t par;
     uint32_t m0ar;
     uint32_t m1ar;
+    uint32_t fcr;
     uint8_t isr;
+
+    /* Transfer state, latched when the stream is enabled. */
+    uint16_t ndtr_reload;   /* NDTR value reloaded in circular mode */
+    uint32_t pofs;          /* peripheral port offset of the next item */
+    uint32_t mofs;          /* memory port offset of the next item */
+
+    uint8_t req;            /* request input levels, one bit per channel */
+    bool active;            /* guards against re-entry from the peripheral */
 } f2xx_dma_stream;
 
 static int msize_table[] = {1, 2, 4, 0};
 
+/* Position of each stream's flags in {L,H}ISR and {L,H}IFCR. */
+static const int isr_shift_table[] = {0, 6, 16, 22};
+
 typedef struct f2xx_dma {
     SysBusDevice busdev;
     MemoryRegion iomem;
+    QEMUTimer *timer;
 
     uint32_t ifcr[R_DMA_HIFCR - R_DMA_LIFCR + 1];
-    f2xx_dma_stream stream[R_DMA_Sx_COUNT]; 
+    f2xx_dma_stream stream[R_DMA_Sx_COUNT];
+
+    /* Channels that have a peripheral request routed to them, per stream. */
+    uint8_t paced[R_DMA_Sx_COUNT];
 } f2xx_dma;
 
+#define TYPE_F2XX_DMA "f2xx_dma"
+#define F2XX_DMA(obj) OBJECT_CHECK(f2xx_dma, (obj), TYPE_F2XX_DMA)
+
 /* Pack ISR bits from four streams, for {L,H}ISR. */
 static uint32_t
 f2xx_dma_pack_isr(struct f2xx_dma *s, int start_stream)
@@ -92,11 +161,371 @@ f2xx_dma_pack_isr(struct f2xx_dma *s, int start_stream)
     int i;
 
     for (i = 0; i < 4; i++) {
-        r |= s->stream[i + start_stream].isr << (6 * i);
+        r |= s->stream[i + start_stream].isr << isr_shift_table[i];
     }
     return r;
 }
 
+static inline int
+f2xx_dma_stream_dir(f2xx_dma_stream *s)
+{
+    return extract32(s->cr, R_DMA_SxCR_DIR_START, 2);
+}
+
+static inline int
+f2xx_dma_stream_chsel(f2xx_dma_stream *s)
+{
+    return extract32(s->cr, R_DMA_SxCR_CHSEL_START, 3);
+}
+
+/* Size in bytes of one item.  NDTR counts peripheral sized items, and since
+ * the FIFO drains immediately, packing between PSIZE and MSIZE gives the same
+ * memory image as moving PSIZE items on both ports. */
+static inline int
+f2xx_dma_stream_item_size(f2xx_dma_stream *s)
+{
+    return msize_table[extract32(s->cr, R_DMA_SxCR_PSIZE_START, 2)];
+}
+
+/* Base of the memory buffer currently targeted (M1AR in double buffer mode
+ * when CT is set). */
+static inline uint32_t
+f2xx_dma_stream_mbase(f2xx_dma_stream *s)
+{
+    if ((s->cr & R_DMA_SxCR_DBM) && (s->cr & R_DMA_SxCR_CT)) {
+        return s->m1ar;
+    }
+    return s->m0ar;
+}
+
+static void
+f2xx_dma_stream_update_irq(f2xx_dma_stream *s)
+{
+    int level = ((s->isr & R_DMA_ISR_TCIF) && (s->cr & R_DMA_SxCR_TCIE)) ||
+                ((s->isr & R_DMA_ISR_HTIF) && (s->cr & R_DMA_SxCR_HTIE)) ||
+                ((s->isr & R_DMA_ISR_TIEF) && (s->cr & R_DMA_SxCR_TEIE)) ||
+                ((s->isr & R_DMA_ISR_DMEIF) && (s->cr & R_DMA_SxCR_DMEIE)) ||
+                ((s->isr & R_DMA_ISR_FIEF) && (s->fcr & R_DMA_SxFCR_FEIE));
+
+    qemu_set_irq(s->irq, level);
+}
+
+/* Can a stream whose channel has no routed request run without pacing? */
+static inline bool
+f2xx_dma_stream_can_run_free(f2xx_dma_stream *s)
+{
+    return f2xx_dma_stream_dir(s) == R_DMA_SxCR_DIR_M2P &&
+           !(s->cr & (R_DMA_SxCR_CIRC | R_DMA_SxCR_DBM));
+}
+
+/* Is the stream allowed to move data right now? */
+static bool
+f2xx_dma_stream_requested(f2xx_dma *s, int stream_no)
+{
+    f2xx_dma_stream *st = &s->stream[stream_no];
+    int ch;
+
+    if (!(st->cr & R_DMA_SxCR_EN)) {
+        return false;
+    }
+    if (f2xx_dma_stream_dir(st) == R_DMA_SxCR_DIR_M2M) {
+        return true;
+    }
+    ch = f2xx_dma_stream_chsel(st);
+    if (!(s->paced[stream_no] & (1 << ch))) {
+        return f2xx_dma_stream_can_run_free(st);
+    }
+    return st->req & (1 << ch);
+}
+
+/* Abort the stream on a bus error. */
+static void
+f2xx_dma_stream_error(f2xx_dma_stream *s, int stream_no, hwaddr addr)
+{
+    qemu_log_mask(LOG_GUEST_ERROR, "f2xx dma: stream %d bus error at 0x%08x\n",
+                  stream_no, (uint32_t)addr);
+    s->cr &= ~R_DMA_SxCR_EN;
+    s->isr |= R_DMA_ISR_TIEF;
+    f2xx_dma_stream_update_irq(s);
+}
+
+/* Account for @items items having been moved, handling the half transfer and
+ * transfer complete events. */
+static void
+f2xx_dma_stream_advance(f2xx_dma_stream *s, uint32_t items)
+{
+    uint32_t bytes = items * f2xx_dma_stream_item_size(s);
+    uint16_t half = s->ndtr_reload / 2;
+    uint16_t before = s->ndtr;
+
+    if (s->cr & R_DMA_SxCR_PINC) {
+        s->pofs += bytes;
+    }
+    if (s->cr & R_DMA_SxCR_MINC) {
+        s->mofs += bytes;
+    }
+    s->ndtr -= items;
+
+    if (before > half && s->ndtr <= half) {
+        s->isr |= R_DMA_ISR_HTIF;
+    }
+    if (s->ndtr == 0) {
+        s->isr |= R_DMA_ISR_TCIF;
+        if (s->cr & R_DMA_SxCR_DBM) {
+            /* Swap buffers; double buffer mode implies circular mode. */
+            s->cr ^= R_DMA_SxCR_CT;
+            s->ndtr = s->ndtr_reload;
+            s->pofs = s->mofs = 0;
+        } else if (s->cr & R_DMA_SxCR_CIRC) {
+            s->ndtr = s->ndtr_reload;
+            s->pofs = s->mofs = 0;
+        } else {
+            s->cr &= ~R_DMA_SxCR_EN;
+        }
+    }
+    f2xx_dma_stream_update_irq(s);
+}
+
+/* Copy @len bytes, mapping guest RAM directly where possible and falling back
+ * to bounced accesses for anything that cannot be mapped. */
+static bool
+f2xx_dma_copy(hwaddr dst, hwaddr src, hwaddr len, hwaddr *fault)
+{
+    AddressSpace *as = &address_space_memory;
+    uint8_t buf[256];
+
+    while (len) {
+        hwaddr slen = len, dlen;
+        void *sp, *dp;
+
+        sp = address_space_map(as, src, &slen, false);
+        if (sp) {
+            dlen = slen;
+            dp = address_space_map(as, dst, &dlen, true);
+            if (dp) {
+                memmove(dp, sp, dlen);
+                address_space_unmap(as, dp, dlen, true, dlen);
+                address_space_unmap(as, sp, slen, false, dlen);
+                src += dlen;
+                dst += dlen;
+                len -= dlen;
+                continue;
+            }
+            address_space_unmap(as, sp, slen, false, 0);
+        }
+
+        /* At least one side is MMIO or unmapped: bounce a chunk. */
+        dlen = MIN(len, sizeof(buf));
+        if (address_space_read(as, src, MEMTXATTRS_UNSPECIFIED, buf, dlen)
+                != MEMTX_OK) {
+            *fault = src;
+            return false;
+        }
+        if (address_space_write(as, dst, MEMTXATTRS_UNSPECIFIED, buf, dlen)
+                != MEMTX_OK) {
+            *fault = dst;
+            return false;
+        }
+        src += dlen;
+        dst += dlen;
+        len -= dlen;
+    }
+    return true;
+}
+
+/* Move one item.  The peripheral port is PAR for every direction except
+ * memory-to-peripheral, where it is the destination. */
+static bool
+f2xx_dma_stream_xfer_item(f2xx_dma_stream *s, hwaddr *fault)
+{
+    AddressSpace *as = &address_space_memory;
+    hwaddr paddr = s->par + s->pofs;
+    hwaddr maddr = f2xx_dma_stream_mbase(s) + s->mofs;
+    int size = f2xx_dma_stream_item_size(s);
+    hwaddr src = paddr, dst = maddr;
+    uint8_t buf[4];
+
+    if (f2xx_dma_stream_dir(s) == R_DMA_SxCR_DIR_M2P) {
+        src = maddr;
+        dst = paddr;
+    }
+    if (address_space_read(as, src, MEMTXATTRS_UNSPECIFIED, buf, size) != MEMTX_OK) {
+        *fault = src;
+        return false;
+    }
+    if (address_space_write(as, dst, MEMTXATTRS_UNSPECIFIED, buf, size) != MEMTX_OK) {
+        *fault = dst;
+        return false;
+    }
+    return true;
+}
+
+/* Move whatever is left of the current buffer in one go.  Only valid when
+ * nothing paces the stream and both ports increment. */
+static bool
+f2xx_dma_stream_xfer_bulk(f2xx_dma_stream *s, uint32_t items, hwaddr *fault)
+{
+    hwaddr paddr = s->par + s->pofs;
+    hwaddr maddr = f2xx_dma_stream_mbase(s) + s->mofs;
+    hwaddr len = (hwaddr)items * f2xx_dma_stream_item_size(s);
+
+    if (f2xx_dma_stream_dir(s) == R_DMA_SxCR_DIR_M2P) {
+        return f2xx_dma_copy(paddr, maddr, len, fault);
+    }
+    return f2xx_dma_copy(maddr, paddr, len, fault);
+}
+
+/* Hand the rest of the current buffer to the device at the port that does
+ * not increment, if it implements TYPE_STM32_DMA_BULK.  That is PAR, except
+ * in memory-to-memory mode, where firmware feeds a device such as CRC with
+ * PAR as the source buffer and the fixed M0AR as the destination.  Returns
+ * the number of items the device took. */
+static uint32_t
+f2xx_dma_stream_xfer_periph_bulk(f2xx_dma_stream *s, uint32_t items)
+{
+    AddressSpace *as = &address_space_memory;
+    bool m2m = f2xx_dma_stream_dir(s) == R_DMA_SxCR_DIR_M2M;
+    bool to_periph = m2m || f2xx_dma_stream_dir(s) == R_DMA_SxCR_DIR_M2P;
+    hwaddr dev = s->par;
+    hwaddr mem = f2xx_dma_stream_mbase(s) + s->mofs;
+    int size = f2xx_dma_stream_item_size(s);
+    MemoryRegionSection mrs;
+    Stm32DmaBulkClass *bc;
+    Object *owner;
+    hwaddr len;
+    uint8_t *buf;
+    int done = 0;
+
+    if (m2m) {
+        dev = f2xx_dma_stream_mbase(s);
+        mem = s->par + s->pofs;
+    }
+    mrs = memory_region_find(get_system_memory(), dev, size);
+    if (!mrs.mr) {
+        return 0;
+    }
+    owner = memory_region_owner(mrs.mr);
+    if (owner && object_dynamic_cast(owner, TYPE_STM32_DMA_BULK)) {
+        bc = STM32_DMA_BULK_GET_CLASS(owner);
+        len = (hwaddr)items * size;
+        buf = address_space_map(as, mem, &len, !to_periph);
+        if (buf) {
+            if (len >= size) {
+                done = bc->transfer(owner, mrs.offset_within_region, buf, size,
+                                    len / size, to_periph);
+            }
+            address_space_unmap(as, buf, len, !to_periph, done * size);
+        }
+    }
+    memory_region_unref(mrs.mr);
+    return done;
+}
+
+/* Run a stream for as long as it is requested, moving at most
+ * F2XX_DMA_ITEMS_PER_PASS items.  Returns true if the stream still has work
+ * pending when it yields. */
+static bool
+f2xx_dma_stream_run(f2xx_dma *s, int stream_no)
+{
+    f2xx_dma_stream *st = &s->stream[stream_no];
+    uint32_t budget = F2XX_DMA_ITEMS_PER_PASS;
+    const uint32_t incr = R_DMA_SxCR_PINC | R_DMA_SxCR_MINC;
+    hwaddr fault;
+
+    /* A peripheral we are writing to raised its request again; the loop
+     * below picks that up once the current item is done. */
+    if (st->active) {
+        return false;
+    }
+    st->active = true;
+
+    while (budget && f2xx_dma_stream_requested(s, stream_no)) {
+        bool paced = f2xx_dma_stream_dir(st) != R_DMA_SxCR_DIR_M2M &&
+                     (s->paced[stream_no] & (1 << f2xx_dma_stream_chsel(st)));
+        uint32_t items = 0;
+
+        if ((st->cr & incr) == (f2xx_dma_stream_dir(st) == R_DMA_SxCR_DIR_M2M ?
+                                R_DMA_SxCR_PINC : R_DMA_SxCR_MINC)) {
+            items = f2xx_dma_stream_xfer_periph_bulk(st, MIN(st->ndtr, budget));
+        }
+        if (items) {
+            /* The peripheral took a block of items in one call. */
+        } else if (!paced && (st->cr & incr) == incr) {
+            items = MIN(st->ndtr, budget);
+            if (!f2xx_dma_stream_xfer_bulk(st, items, &fault)) {
+                f2xx_dma_stream_error(st, stream_no, fault);
+                break;
+            }
+        } else {
+            items = 1;
+            if (!f2xx_dma_stream_xfer_item(st, &fault)) {
+                f2xx_dma_stream_error(st, stream_no, fault);
+                break;
+            }
+        }
+        DPRINTF("%s: stream: %d, moved %u item(s), %u left\n", __func__,
+                stream_no, items, st->ndtr - items);
+        f2xx_dma_stream_advance(st, items);
+        budget -= items;
+    }
+
+    st->active = false;
+    return f2xx_dma_stream_requested(s, stream_no);
+}
+
+/* Arm the timer, without pushing back work that is already due sooner. */
+static void
+f2xx_dma_schedule(f2xx_dma *s, int64_t delay_ns)
+{
+    timer_mod_anticipate(s->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + delay_ns);
+}
+
+/* Carry out free-running and deferred stream work. */
+static void
+f2xx_dma_timer(void *opaque)
+{
+    f2xx_dma *s = opaque;
+    bool pending = false;
+    int i;
+
+    for (i = 0; i < R_DMA_Sx_COUNT; i++) {
+        if (s->stream[i].cr & R_DMA_SxCR_EN) {
+            pending |= f2xx_dma_stream_run(s, i);
+        }
+    }
+    if (pending) {
+        f2xx_dma_schedule(s, F2XX_DMA_RESUME_NS);
+    }
+}
+
+/* Peripheral DMA request input.  Line n is channel (n % 8) of stream (n / 8). */
+static void
+f2xx_dma_request(void *opaque, int n, int level)
+{
+    f2xx_dma *s = opaque;
+    int stream_no = n / F2XX_DMA_CHANNELS;
+    int ch = n % F2XX_DMA_CHANNELS;
+    f2xx_dma_stream *st = &s->stream[stream_no];
+
+    st->req = deposit32(st->req, ch, 1, level != 0);
+    if (level && f2xx_dma_stream_chsel(st) == ch && (st->cr & R_DMA_SxCR_EN)) {
+        if (f2xx_dma_stream_run(s, stream_no)) {
+            f2xx_dma_schedule(s, F2XX_DMA_RESUME_NS);
+        }
+    }
+}
+
+qemu_irq
+f2xx_dma_get_request(DeviceState *dma, int stream, int channel)
+{
+    f2xx_dma *s = F2XX_DMA(dma);
+
+    assert(stream < R_DMA_Sx_COUNT && channel < F2XX_DMA_CHANNELS);
+    s->paced[stream] |= 1 << channel;
+    return qdev_get_gpio_in_named(dma, "dma-req",
+                                  stream * F2XX_DMA_CHANNELS + channel);
+}
+
 /* Per-stream read. */
 static uint32_t
 f2xx_dma_stream_read(f2xx_dma_stream *s, int stream_no, uint32_t reg)
@@ -106,25 +535,21 @@ f2xx_dma_stream_read(f2xx_dma_stream *s, int stream_no, uint32_t reg)
         DPRINTF("   %s: stream: %d, register CR\n", __func__, stream_no);
         return s->cr;
     case R_DMA_SxNDTR:
-        DPRINTF("   %s: stream: %d, register NDTR (UNIMPLEMENTED)\n", __func__, stream_no);
-        qemu_log_mask(LOG_UNIMP, "f2xx dma unimp read reg NDTR\n");
-        return 0;
+        DPRINTF("   %s: stream: %d, register NDTR\n", __func__, stream_no);
+        return s->ndtr;
     case R_DMA_SxPAR:
-        DPRINTF("   %s: stream: %d, register PAR (UNIMPLEMENTED)\n", __func__, stream_no);
-        qemu_log_mask(LOG_UNIMP, "f2xx dma unimp read reg PAR\n");
-        return 0;
+        DPRINTF("   %s: stream: %d, register PAR\n", __func__, stream_no);
+        return s->par;
     case R_DMA_SxM0AR:
-        DPRINTF("   %s: stream: %d, register M0AR (UNIMPLEMENTED)\n", __func__, stream_no);
-        qemu_log_mask(LOG_UNIMP, "f2xx dma unimp read reg M0AR\n");
-        return 0;
+        DPRINTF("   %s: stream: %d, register M0AR\n", __func__, stream_no);
+        return s->m0ar;
     case R_DMA_SxM1AR:
-        DPRINTF("   %s: stream: %d, register M1AR (UNIMPLEMENTED)\n", __func__, stream_no);
-        qemu_log_mask(LOG_UNIMP, "f2xx dma unimp read reg M1AR\n");
-        return 0;
+        DPRINTF("   %s: stream: %d, register M1AR\n", __func__, stream_no);
+        return s->m1ar;
     case R_DMA_SxFCR:
-        DPRINTF("   %s: stream: %d, register FCR (UNIMPLEMENTED)\n", __func__, stream_no);
-        qemu_log_mask(LOG_UNIMP, "f2xx dma unimp read reg FCR\n");
-        return 0;
+        DPRINTF("   %s: stream: %d, register FCR\n", __func__, stream_no);
+        /* The FIFO drains immediately, so it always reads back as empty. */
+        return s->fcr | R_DMA_SxFCR_FS_EMPTY;
     default:
         DPRINTF("   %s: stream: %d, register 0x%02x\n", __func__, stream_no, reg<<2);
         qemu_log_mask(LOG_UNIMP, "f2xx dma unimp read stream reg 0x%02x\n",
@@ -143,7 +568,7 @@ f2xx_dma_read(void *arg, hwaddr addr, unsigned int size)
     DPRINTF("%s: addr: 0x%llx, size:%d...\n", __func__, addr, size);
 
     if (size != 4) {
-        qemu_log_mask(LOG_UNIMP, "f2xx crc only supports 4-byte reads\n");
+        qemu_log_mask(LOG_UNIMP, "f2xx dma only supports 4-byte reads\n");
         return 0;
     }
 
@@ -184,79 +609,142 @@ f2xx_dma_read(void *arg, hwaddr addr, unsigned int size)
     return result;
 }
 
-/* Start a DMA transfer for a given stream. */
+/* Latch the transfer state for a stream that is being enabled. */
 static void
-f2xx_dma_stream_start(f2xx_dma_stream *s, int stream_no)
+f2xx_dma_stream_start(f2xx_dma *s, int stream_no)
 {
-    uint8_t buf[4];
-    int msize = msize_table[(s->cr >> 13) & 0x3];
+    f2xx_dma_stream *st = &s->stream[stream_no];
 
-    DPRINTF("%s: stream: %d\n", __func__, stream_no);
+    DPRINTF("%s: stream: %d, %d item(s) between 0x%08x and 0x%08x\n", __func__,
+            stream_no, st->ndtr, st->par, f2xx_dma_stream_mbase(st));
 
-    if (msize == 0) {
-        qemu_log_mask(LOG_GUEST_ERROR, "f2xx dma: invalid MSIZE\n");
+    if (msize_table[extract32(st->cr, R_DMA_SxCR_MSIZE_START, 2)] == 0 ||
+        f2xx_dma_stream_item_size(st) == 0) {
+        qemu_log_mask(LOG_GUEST_ERROR, "f2xx dma: invalid MSIZE/PSIZE\n");
+        st->cr &= ~R_DMA_SxCR_EN;
         return;
     }
-    /* XXX Skip USART, as pacing control is not yet in place. */
-    if (s->par == 0x40011004) {
-        qemu_log_mask(LOG_UNIMP, "f2xx dma: skipping USART\n");
+    if (f2xx_dma_stream_dir(st) == 3) {
+        qemu_log_mask(LOG_GUEST_ERROR, "f2xx dma: invalid DIR\n");
+        st->cr &= ~R_DMA_SxCR_EN;
         return;
     }
+    if (st->ndtr == 0) {
+        qemu_log_mask(LOG_GUEST_ERROR, "f2xx dma: stream %d enabled with "
+                      "NDTR 0\n", stream_no);
+        st->cr &= ~R_DMA_SxCR_EN;
+        return;
+    }
+
+    st->ndtr_reload = st->ndtr;
+    st->pofs = 0;
+    st->mofs = 0;
+
+    if (f2xx_dma_stream_dir(st) != R_DMA_SxCR_DIR_M2M &&
+        !(s->paced[stream_no] & (1 << f2xx_dma_stream_chsel(st))) &&
+        !f2xx_dma_stream_can_run_free(st)) {
+        qemu_log_mask(LOG_UNIMP, "f2xx dma: stream %d channel %d has no "
+                      "request routed to it, left idle\n", stream_no,
+                      f2xx_dma_stream_chsel(st));
+    }
 
-    /* XXX hack do the entire transfer here for now. */
-    DPRINTF("%s: transferring %d x %d byte(s) from 0x%08x to 0x%08x\n", __func__, s->ndtr,
-              msize, s->m0ar, s->par);
-    while (s->ndtr--) {
-        cpu_physical_memory_read(s->m0ar, buf, msize);
-        cpu_physical_memory_write(s->par, buf, msize);
-        s->m0ar += msize;
+    /* Defer the first item to the timer: even a stream whose request is
+     * already asserted should not run inside the guest's register write. */
+    if (f2xx_dma_stream_requested(s, stream_no)) {
+        f2xx_dma_schedule(s, 0);
     }
-    /* Transfer complete. */
-    s->cr &= ~R_DMA_SxCR_EN;
-    s->isr |= R_DMA_ISR_TCIF;
-    qemu_set_irq(s->irq, 1);
 }
 
 /* Per-stream register write. */
 static void
-f2xx_dma_stream_write(f2xx_dma_stream *s, int stream_no, uint32_t addr, uint32_t data)
+f2xx_dma_stream_write(f2xx_dma *s, int stream_no, uint32_t addr, uint32_t data)
 {
+    f2xx_dma_stream *st = &s->stream[stream_no];
+    bool enabled = st->cr & R_DMA_SxCR_EN;
+
     switch (addr) {
     case R_DMA_SxCR:
         DPRINTF("%s: stream: %d, register CR, data:0x%x\n", __func__, stream_no, data);
-        if ((s->cr & R_DMA_SxCR_EN) == 0 && (data & R_DMA_SxCR_EN) != 0) {
+        if (enabled) {
+            /* While enabled, only EN itself can be changed.  A transfer
+             * stopped by software completes like one that ran to the end:
+             * the remaining items are left in NDTR and TCIF is set. */
+            if (!(data & R_DMA_SxCR_EN)) {
+                st->cr &= ~R_DMA_SxCR_EN;
+                st->isr |= R_DMA_ISR_TCIF;
+                f2xx_dma_stream_update_irq(st);
+            }
+            break;
+        }
+        st->cr = data & R_DMA_SxCR_MASK;
+        if (st->cr & R_DMA_SxCR_EN) {
             f2xx_dma_stream_start(s, stream_no);
         }
-        s->cr = data;
+        f2xx_dma_stream_update_irq(st);
         break;
     case R_DMA_SxNDTR:
         DPRINTF("%s: stream: %d, register NDTR, data:0x%x\n", __func__, stream_no, data);
-        if (s->cr & R_DMA_SxNDTR_EN) {
+        if (enabled) {
             qemu_log_mask(LOG_GUEST_ERROR, "f2xx dma write to NDTR while enabled\n");
             return;
         }
-        s->ndtr = data;
+        st->ndtr = data;
         break;
     case R_DMA_SxPAR:
         DPRINTF("%s: stream: %d, register PAR, data:0x%x\n", __func__, stream_no, data);
-        s->par = data;
+        if (enabled) {
+            qemu_log_mask(LOG_GUEST_ERROR, "f2xx dma write to PAR while enabled\n");
+            return;
+        }
+        st->par = data;
         break;
     case R_DMA_SxM0AR:
         DPRINTF("%s: stream: %d, register M0AR, data:0x%x\n", __func__, stream_no, data);
-        s->m0ar = data;
+        /* In double buffer mode the idle buffer may be reprogrammed. */
+        if (enabled && !((st->cr & R_DMA_SxCR_DBM) && (st->cr & R_DMA_SxCR_CT))) {
+            qemu_log_mask(LOG_GUEST_ERROR, "f2xx dma write to M0AR while in use\n");
+            return;
+        }
+        st->m0ar = data;
         break;
     case R_DMA_SxM1AR:
         DPRINTF("%s: stream: %d, register M1AR, data:0x%x\n", __func__, stream_no, data);
-        s->m1ar = data;
+        if (enabled && (st->cr & R_DMA_SxCR_CT)) {
+            qemu_log_mask(LOG_GUEST_ERROR, "f2xx dma write to M1AR while in use\n");
+            return;
+        }
+        st->m1ar = data;
         break;
     case R_DMA_SxFCR:
-        DPRINTF("%s: stream: %d, register FCR (UINIMPLEMENTED), data:0x%x\n", __func__,
+        DPRINTF("%s: stream: %d, register FCR, data:0x%x\n", __func__,
                         stream_no, data);
-        qemu_log_mask(LOG_UNIMP, "f2xx dma SxFCR unimplemented\n");
+        if (enabled) {
+            qemu_log_mask(LOG_GUEST_ERROR, "f2xx dma write to FCR while enabled\n");
+            return;
+        }
+        st->fcr = data & R_DMA_SxFCR_MASK;
+        f2xx_dma_stream_update_irq(st);
         break;
     }
 }
 
+/* Clear the interrupt flags of four streams, for {L,H}IFCR. */
+static void
+f2xx_dma_clear_isr(f2xx_dma *s, int start_stream, uint32_t data)
+{
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        f2xx_dma_stream *st = &s->stream[i + start_stream];
+        uint8_t clear = (data >> isr_shift_table[i]) & R_DMA_ISR_MASK;
+
+        if (clear) {
+            st->isr &= ~clear;
+            f2xx_dma_stream_update_irq(st);
+        }
+    }
+}
+
 /* Register write. */
 static void
 f2xx_dma_write(void *arg, hwaddr addr, uint64_t data, unsigned int size)
@@ -280,8 +768,7 @@ f2xx_dma_write(void *arg, hwaddr addr, uint64_t data, unsigned int size)
     }
     if (addr >= R_DMA_Sx && addr <= 0xcc) {
         int num = (addr - R_DMA_Sx) / R_DMA_Sx_REGS;
-        f2xx_dma_stream_write(&s->stream[num], num,
-          (addr - R_DMA_Sx) % R_DMA_Sx_REGS, data);
+        f2xx_dma_stream_write(s, num, (addr - R_DMA_Sx) % R_DMA_Sx_REGS, data);
         return;
     }
     switch(addr) {
@@ -295,45 +782,13 @@ f2xx_dma_write(void *arg, hwaddr addr, uint64_t data, unsigned int size)
         break;
     case R_DMA_LIFCR:
         DPRINTF("%s: register LIFCR, data: 0x%llx\n", __func__, data);
-        // Any interrupt clear write to stream x clears all interrupts for that stream
         s->ifcr[addr - R_DMA_LIFCR] = data;
-        if (data & 0x0f400000) {
-            s->stream[3].isr = 0;
-            qemu_set_irq(s->stream[3].irq, 0);
-        }
-        if (data & 0x003d0000) {
-            s->stream[2].isr = 0;
-            qemu_set_irq(s->stream[2].irq, 0);
-        }
-        if (data & 0x00000f40) {
-            s->stream[1].isr = 0;
-            qemu_set_irq(s->stream[1].irq, 0);
-        }
-        if (data & 0x0000003d) {
-            s->stream[0].isr = 0;
-            qemu_set_irq(s->stream[0].irq, 0);
-        }
+        f2xx_dma_clear_isr(s, 0, data);
         break;
     case R_DMA_HIFCR:
         DPRINTF("%s: register HIFCR, data: 0x%llx\n", __func__, data);
-        // Any interrupt clear write to stream x clears all interrupts for that stream
         s->ifcr[addr - R_DMA_LIFCR] = data;
-        if (data & 0x0f400000) {
-            s->stream[7].isr = 0;
-            qemu_set_irq(s->stream[7].irq, 0);
-        }
-        if (data & 0x003d0000) {
-            s->stream[6].isr = 0;
-            qemu_set_irq(s->stream[6].irq, 0);
-        }
-        if (data & 0x00000f40) {
-            s->stream[5].isr = 0;
-            qemu_set_irq(s->stream[5].irq, 0);
-        }
-        if (data & 0x0000003d) {
-            s->stream[4].isr = 0;
-            qemu_set_irq(s->stream[4].irq, 0);
-        }
+        f2xx_dma_clear_isr(s, 4, data);
         break;
     default:
         qemu_log_mask(LOG_UNIMP, "f2xx dma unimpl write reg 0x%02x\n",
@@ -363,6 +818,10 @@ f2xx_dma_init(SysBusDevice *dev)
     for (i = 0; i < R_DMA_Sx_COUNT; i++) {
         sysbus_init_irq(dev, &s->stream[i].irq);
     }
+    qdev_init_gpio_in_named(DEVICE(dev), f2xx_dma_request, "dma-req",
+                            R_DMA_Sx_COUNT * F2XX_DMA_CHANNELS);
+
+    s->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, f2xx_dma_timer, s);
 
     return 0;
 }
@@ -373,15 +832,53 @@ f2xx_dma_reset(DeviceState *ds)
     f2xx_dma *s = FROM_SYSBUS(f2xx_dma, SYS_BUS_DEVICE(ds));
 
     memset(&s->ifcr, 0, sizeof(s->ifcr));
+    timer_del(s->timer);
 
     int i;
     for (i=0; i<R_DMA_Sx_COUNT; i++) {
+        /* The request inputs mirror the peripherals' outputs, keep them. */
         qemu_irq save = s->stream[i].irq;
+        uint8_t req = s->stream[i].req;
         memset(&s->stream[i], 0, sizeof(f2xx_dma_stream));
         s->stream[i].irq = save;
+        s->stream[i].req = req;
+        s->stream[i].fcr = R_DMA_SxFCR_RESET;
     }
 }
 
+static const VMStateDescription vmstate_f2xx_dma_stream = {
+    .name = "f2xx_dma_stream",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(cr, f2xx_dma_stream),
+        VMSTATE_UINT16(ndtr, f2xx_dma_stream),
+        VMSTATE_UINT32(par, f2xx_dma_stream),
+        VMSTATE_UINT32(m0ar, f2xx_dma_stream),
+        VMSTATE_UINT32(m1ar, f2xx_dma_stream),
+        VMSTATE_UINT32(fcr, f2xx_dma_stream),
+        VMSTATE_UINT8(isr, f2xx_dma_stream),
+        VMSTATE_UINT16(ndtr_reload, f2xx_dma_stream),
+        VMSTATE_UINT32(pofs, f2xx_dma_stream),
+        VMSTATE_UINT32(mofs, f2xx_dma_stream),
+        VMSTATE_UINT8(req, f2xx_dma_stream),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_f2xx_dma = {
+    .name = TYPE_F2XX_DMA,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_TIMER_PTR(timer, f2xx_dma),
+        VMSTATE_UINT32_ARRAY(ifcr, f2xx_dma, R_DMA_HIFCR - R_DMA_LIFCR + 1),
+        VMSTATE_STRUCT_ARRAY(stream, f2xx_dma, R_DMA_Sx_COUNT, 1,
+                             vmstate_f2xx_dma_stream, f2xx_dma_stream),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static Property f2xx_dma_properties[] = {
     DEFINE_PROP_END_OF_LIST(),
 };
@@ -395,20 +892,29 @@ f2xx_dma_class_init(ObjectClass *klass, void *data)
     dc->reset = f2xx_dma_reset;
     //TODO: fix this: dc->no_user = 1;
     dc->props = f2xx_dma_properties;
+    dc->vmsd = &vmstate_f2xx_dma;
 }
 
 static const TypeInfo
 f2xx_dma_info = {
-    .name          = "f2xx_dma",
+    .name          = TYPE_F2XX_DMA,
     .parent        = TYPE_SYS_BUS_DEVICE,
     .instance_size = sizeof(f2xx_dma),
     .class_init    = f2xx_dma_class_init,
 };
 
+static const TypeInfo
+stm32_dma_bulk_info = {
+    .name          = TYPE_STM32_DMA_BULK,
+    .parent        = TYPE_INTERFACE,
+    .class_size    = sizeof(Stm32DmaBulkClass),
+};
+
 static void
 f2xx_dma_register_types(void)
 {
     type_register_static(&f2xx_dma_info);
+    type_register_static(&stm32_dma_bulk_info);
 }
 
 type_init(f2xx_dma_register_types)
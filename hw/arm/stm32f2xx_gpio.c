@@ -252,6 +252,17 @@ stm32f2xx_gpio_init(SysBusDevice *dev)
     return 0;
 }
 
+static const VMStateDescription vmstate_stm32f2xx_gpio = {
+    .name = "stm32f2xx_gpio",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32_ARRAY(regs, stm32f2xx_gpio, R_GPIO_MAX),
+        VMSTATE_UINT32(ccr, stm32f2xx_gpio),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static Property stm32f2xx_gpio_properties[] = {
     DEFINE_PROP_INT32("periph", stm32f2xx_gpio, periph, -1),
     DEFINE_PROP_UINT32("idr-mask", stm32f2xx_gpio, idr_mask, 0),
@@ -267,6 +278,7 @@ stm32f2xx_gpio_class_init(ObjectClass *klass, void *data)
     sc->init = stm32f2xx_gpio_init;
     dc->reset = stm32f2xx_gpio_reset;
     dc->props = stm32f2xx_gpio_properties;
+    dc->vmsd = &vmstate_stm32f2xx_gpio;
 }
 
 static const TypeInfo stm32f2xx_gpio_info = {
@@ -260,6 +260,18 @@ f2xx_i2c_init(SysBusDevice *dev)
 }
 
 
+static const VMStateDescription vmstate_f2xx_i2c = {
+    .name = "f2xx_i2c",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_INT32(rx, f2xx_i2c),
+        VMSTATE_INT32(rx_full, f2xx_i2c),
+        VMSTATE_UINT16_ARRAY(regs, f2xx_i2c, R_I2C_MAX),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static Property f2xx_i2c_properties[] = {
     DEFINE_PROP_INT32("periph", struct f2xx_i2c, periph, -1),
     DEFINE_PROP_END_OF_LIST()
@@ -274,6 +286,7 @@ f2xx_i2c_class_init(ObjectClass *c, void *data)
     sc->init = f2xx_i2c_init;
     dc->reset = f2xx_i2c_reset;
     dc->props = f2xx_i2c_properties;
+    dc->vmsd = &vmstate_f2xx_i2c;
 }
 
 static const TypeInfo f2xx_i2c_info = {
@@ -160,6 +160,16 @@ f2xx_pwr_init(SysBusDevice *dev)
     return 0;
 }
 
+static const VMStateDescription vmstate_f2xx_pwr = {
+    .name = "f2xx_pwr",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32_ARRAY(regs, f2xx_pwr, R_PWR_MAX),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static Property f2xx_pwr_properties[] = {
     DEFINE_PROP_END_OF_LIST(),
 };
@@ -172,6 +182,7 @@ f2xx_pwr_class_init(ObjectClass *klass, void *data)
     sc->init = f2xx_pwr_init;
     dc->reset = f2xx_pwr_reset;
     dc->props = f2xx_pwr_properties;
+    dc->vmsd = &vmstate_f2xx_pwr;
 }
 
 static const TypeInfo
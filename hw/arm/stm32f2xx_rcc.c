@@ -952,7 +952,7 @@ static void stm32_rcc_hclk_upd_irq_handler(void *opaque, int n, int level)
          * (which is an unchanging number independent of the CPU frequency) to
          * system/external clock ticks.
          */
-        system_clock_scale = get_ticks_per_sec() / hclk_freq;
+        system_clock_set_freq(hclk_freq);
     }
 
 #ifdef DEBUG_STM32_RCC
@@ -1102,6 +1102,65 @@ static int stm32_rcc_init(SysBusDevice *dev)
 }
 
 
+static void stm32_rcc_pre_save(void *opaque)
+{
+    Stm32f2xxRcc *s = (Stm32f2xxRcc *)opaque;
+
+    s->vmstate_CR = stm32_rcc_RCC_CR_read(s);
+    s->vmstate_CFGR = stm32_rcc_RCC_CFGR_read(s);
+    s->vmstate_BDCR = stm32_rcc_RCC_BDCR_read(s);
+    s->vmstate_CSR = stm32_rcc_RCC_CSR_read(s);
+}
+
+/* Rebuild the clock tree by replaying the register writes in reset order.
+ * The peripherals are told about their new clock frequencies along the way. */
+static int stm32_rcc_post_load(void *opaque, int version_id)
+{
+    Stm32f2xxRcc *s = (Stm32f2xxRcc *)opaque;
+
+    /* CR checks the oscillators it turns off against the selected SYSCLK */
+    s->RCC_CFGR_SW = (s->vmstate_CFGR & RCC_CFGR_SW_MASK) >> RCC_CFGR_SW_START;
+
+    stm32_rcc_RCC_CR_write(s, s->vmstate_CR, true);
+    stm32_rcc_RCC_PLLCFGR_write(s, s->RCC_PLLCFGR, true);
+    if (s->RCC_PLLI2SCFGR) {
+        stm32_rcc_RCC_PLLI2SCFGR_write(s, s->RCC_PLLI2SCFGR, true);
+    }
+    stm32_rcc_RCC_CFGR_write(s, s->vmstate_CFGR, true);
+    stm32_rcc_RCC_AHB1ENR_write(s, s->RCC_AHB1ENR, true);
+    stm32_rcc_RCC_AHB2ENR_write(s, s->RCC_AHB2ENR, true);
+    stm32_rcc_RCC_AHB3ENR_write(s, s->RCC_AHB3ENR, true);
+    stm32_rcc_RCC_APB2ENR_write(s, s->RCC_APB2ENR, true);
+    stm32_rcc_RCC_APB1ENR_write(s, s->RCC_APB1ENR, true);
+    stm32_rcc_RCC_BDCR_write(s, s->vmstate_BDCR, true);
+    stm32_rcc_RCC_CSR_write(s, s->vmstate_CSR, true);
+    return 0;
+}
+
+static const VMStateDescription vmstate_stm32_rcc = {
+    .name = "stm32f2xx_rcc",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .pre_save = stm32_rcc_pre_save,
+    .post_load = stm32_rcc_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(vmstate_CR, Stm32f2xxRcc),
+        VMSTATE_UINT32(RCC_PLLCFGR, Stm32f2xxRcc),
+        VMSTATE_UINT32(RCC_PLLI2SCFGR, Stm32f2xxRcc),
+        VMSTATE_UINT32(vmstate_CFGR, Stm32f2xxRcc),
+        VMSTATE_UINT32(RCC_CIR, Stm32f2xxRcc),
+        VMSTATE_UINT32(RCC_AHB1ENR, Stm32f2xxRcc),
+        VMSTATE_UINT32(RCC_AHB2ENR, Stm32f2xxRcc),
+        VMSTATE_UINT32(RCC_AHB3ENR, Stm32f2xxRcc),
+        VMSTATE_UINT32(RCC_APB2ENR, Stm32f2xxRcc),
+        VMSTATE_UINT32(RCC_APB1ENR, Stm32f2xxRcc),
+        VMSTATE_UINT32(vmstate_BDCR, Stm32f2xxRcc),
+        VMSTATE_UINT32(vmstate_CSR, Stm32f2xxRcc),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+
 static Property stm32_rcc_properties[] = {
     DEFINE_PROP_UINT32("osc_freq", Stm32f2xxRcc, osc_freq, 0),
     DEFINE_PROP_UINT32("osc32_freq", Stm32f2xxRcc, osc32_freq, 0),
@@ -1117,6 +1176,7 @@ static void stm32_rcc_class_init(ObjectClass *klass, void *data)
     k->init = stm32_rcc_init;
     dc->reset = stm32_rcc_reset;
     dc->props = stm32_rcc_properties;
+    dc->vmsd = &vmstate_stm32_rcc;
 }
 
 static TypeInfo stm32_rcc_info = {
@@ -75,4 +75,12 @@ typedef struct Stm32f2xxRcc {
     uint16_t
     RCC_PLLI2SCFGR_PLLN;
 
+    /* Registers that are only held in the clock tree, captured for
+     * savevm and replayed on loadvm. */
+    uint32_t
+    vmstate_CR,
+    vmstate_CFGR,
+    vmstate_BDCR,
+    vmstate_CSR;
+
 } Stm32f2xxRcc;
@@ -22,9 +22,9 @@
 /*
  * QEMU stm32f2xx RTC emulation
  */
-#include <sys/time.h>
 #include "hw/sysbus.h"
 #include "qemu/timer.h"
+#include "sysemu/sysemu.h"
 #include "hw/arm/stm32.h"
 
 // Define this to add extra BKUP registers past the normal ones implemented by the STM.
@@ -48,6 +48,7 @@
 #define R_RTC_DR     (0x04 / 4)
 #define R_RTC_CR     (0x08 / 4)
 #define R_RTC_CR_ALRAE_BIT 8
+#define R_RTC_CR_ALR_MASK  (3 << R_RTC_CR_ALRAE_BIT)
 #define R_RTC_CR_WUTE   0x00000400
 #define R_RTC_CR_WUTIE  0x00004000
 
@@ -89,6 +90,16 @@ typedef struct f2xx_rtc {
     qemu_irq      irq[2];
     qemu_irq      wut_irq;
 
+    // Clocks driving the tick and wake up timers. The "host" time used below is
+    // read from tick_clock, which follows -rtc clock=. With clock=vm the RTC runs
+    // on the virtual clock and is fully deterministic under -icount.
+    QEMUClockType tick_clock;
+    QEMUClockType wu_clock;
+
+    // If not 0, the RTC starts at this UTC time (seconds since 1970) instead of
+    // the -rtc base= date
+    uint64_t      epoch;
+
     // target_us = host_us + host_to_target_offset_us
     int64_t       host_to_target_offset_us;
 
@@ -122,6 +133,14 @@ f2xx_clock_period_ns(f2xx_rtc *s)
 }
 
 
+// Current "host" time in microseconds, as read from the clock the RTC follows
+static int64_t
+f2xx_rtc_host_time_us(f2xx_rtc *s)
+{
+    return qemu_clock_get_us(s->tick_clock);
+}
+
+
 // Compute the period for the wakeup timer in nanoseconds if the WUT counter is set to the
 // given value
 static uint64_t
@@ -183,9 +202,7 @@ f2xx_rtc_compute_target_time_from_host_time(f2xx_rtc *s, uint64_t rtc_period_ns,
                                             struct tm *target_tm)
 {
     // Get the host time in microseconds
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    int64_t host_time_us = tv.tv_sec * 1000000LL + (tv.tv_usec);
+    int64_t host_time_us = f2xx_rtc_host_time_us(s);
 
     // Compute the target time by adding the offset
     int64_t target_time_us = host_time_us + s->host_to_target_offset_us;
@@ -244,9 +261,7 @@ f2xx_rtc_compute_host_to_target_offset(f2xx_rtc *s, int64_t period_ns, time_t ta
     int64_t target_time_us = target_ticks * period_ns / 1000;
 
     // Get the host time in microseconds
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    int64_t host_time_us = tv.tv_sec * 1000000LL + (tv.tv_usec);
+    int64_t host_time_us = f2xx_rtc_host_time_us(s);
 
     // Get the host to target offset in micro seconds
     return target_time_us - host_time_us;
@@ -296,9 +311,7 @@ f2xx_rtc_read(void *arg, hwaddr addr, unsigned int size)
         uint64_t full_cycle_us = f2xx_clock_period_ns(s) / 1000;
 
         // What fraction of a full cycle are we in?
-        struct timeval tv;
-        gettimeofday(&tv, NULL);
-        int64_t host_time_us = tv.tv_sec * 1000000LL + (tv.tv_usec);
+        int64_t host_time_us = f2xx_rtc_host_time_us(s);
         host_time_us += s->host_to_target_offset_us;
 
         int64_t host_mod = host_time_us % full_cycle_us;
@@ -335,6 +348,7 @@ f2xx_rtc_write(void *arg, hwaddr addr, uint64_t data, unsigned int size)
     int offset = addr & 0x3;
     bool    compute_new_target_offset = false;
     bool    update_wut = false;
+    bool    update_alarms = false;
 
     DPRINTF("%s: addr: 0x%llx, data: 0x%llx, size: %d\n", __func__, addr, data, size);
 
@@ -393,6 +407,11 @@ f2xx_rtc_write(void *arg, hwaddr addr, uint64_t data, unsigned int size)
         if ((data & R_RTC_CR_WUTE) != (s->regs[R_RTC_CR] & R_RTC_CR_WUTE)) {
             update_wut = true;
         }
+        if ((data & R_RTC_CR_ALR_MASK) != (s->regs[R_RTC_CR] & R_RTC_CR_ALR_MASK)) {
+            // Catch up using the old alarm enables before they change
+            f2xx_update_current_date_and_time(s);
+            update_alarms = true;
+        }
         break;
     case R_RTC_ISR:
         if ((data & 1<<8) == 0 && (s->regs[R_RTC_ISR] & 1<<8) != 0) {
@@ -441,12 +460,21 @@ f2xx_rtc_write(void *arg, hwaddr addr, uint64_t data, unsigned int size)
         								f2xx_clock_period_ns(s), s->ticks);
     }
 
+    // Start or stop the per tick alarm check
+    if (update_alarms) {
+        if (s->regs[R_RTC_CR] & R_RTC_CR_ALR_MASK) {
+            timer_mod(s->timer, qemu_clock_get_ns(s->tick_clock) + f2xx_clock_period_ns(s));
+        } else {
+            timer_del(s->timer);
+        }
+    }
+
     // Do we need to update the timer for the wake-up-timer?
     if (update_wut) {
         if (s->regs[R_RTC_CR] & R_RTC_CR_WUTE) {
             int64_t elapsed = f2xx_wut_period_ns(s, s->regs[R_RTC_WUTR]);
             DPRINTF("%s: scheduling WUT to fire in %f ms\n", __func__, (float)elapsed/1000000.0);
-            timer_mod(s->wu_timer, qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + elapsed);
+            timer_mod(s->wu_timer, qemu_clock_get_ns(s->wu_clock) + elapsed);
         } else {
             DPRINTF("%s: Cancelling WUT\n", __func__);
             qemu_set_irq(s->wut_irq, 0);
@@ -525,8 +553,13 @@ f2xx_update_current_date_and_time(void *arg)
     // check for an alarm at each tick. But, if the clocks got too far off (host or target
     // changed time), just jam in the new target time without checking alarms
     int delta = new_target_ticks - s->ticks;
+    bool alarms_enabled = (s->regs[R_RTC_CR] & R_RTC_CR_ALR_MASK) != 0;
     //DPRINTF("%s: advancing target by %d ticks\n", __func__, delta);
-    if (delta < 0 || delta > 1000) {
+    if (!alarms_enabled) {
+        // Nothing to check on the way, the registers only need to be current
+        s->ticks = new_target_ticks;
+        f2xx_rtc_set_time_and_date_registers(s, &new_target_tm);
+    } else if (delta < 0 || delta > 1000) {
         printf("DEBUG_STM32F2XX_RTC %s: detected %d mismatch between host and target ticks, "
               "jamming new host time into RTC without checking for alarms\n", __func__, delta);
         s->ticks = new_target_ticks;
@@ -542,8 +575,15 @@ f2xx_update_current_date_and_time(void *arg)
         }
     }
 
-    // Reschedule tick timer to run one tick from now to check for alarms again
-    timer_mod(s->timer, qemu_clock_get_ns(QEMU_CLOCK_HOST) + period_ns);
+    // Reschedule tick timer to run one tick from now to check for alarms again. With no
+    // alarm enabled the registers are brought up to date lazily when read, so the timer
+    // is not needed; that keeps an idle guest from waking up (or, with -idle-warp,
+    // the virtual clock from stepping) once per tick.
+    if (alarms_enabled) {
+        timer_mod(s->timer, qemu_clock_get_ns(s->tick_clock) + period_ns);
+    } else {
+        timer_del(s->timer);
+    }
 }
 
 
@@ -584,7 +624,7 @@ f2xx_wu_timer(void *arg)
 
     // Reschedule again
     int64_t elapsed = f2xx_wut_period_ns(s, s->regs[R_RTC_WUTR]);
-    timer_mod(s->wu_timer, qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + elapsed);
+    timer_mod(s->wu_timer, qemu_clock_get_ns(s->wu_clock) + elapsed);
 }
 
 
@@ -636,10 +676,22 @@ f2xx_rtc_init(SysBusDevice *dev)
     uint32_t period_ns = f2xx_clock_period_ns(s);
     DPRINTF("%s: period: %d ns\n", __func__, period_ns);
 
-    // Init the time and date registers from the time on the host as the default
+    // The wake up timer keeps using the monotonic real time clock unless the RTC
+    // follows the virtual clock
+    s->tick_clock = rtc_clock;
+    s->wu_clock = rtc_clock == QEMU_CLOCK_VIRTUAL ? QEMU_CLOCK_VIRTUAL
+                                                  : QEMU_CLOCK_REALTIME;
+
+    // Init the time and date registers from the time on the host as the default,
+    // or from the epoch property if one was given
     s->host_to_target_offset_us = 0;
     struct tm now;
-    qemu_get_timedate(&now, 0);
+    if (s->epoch) {
+        time_t epoch = s->epoch;
+        gmtime_r(&epoch, &now);
+    } else {
+        qemu_get_timedate(&now, 0);
+    }
 
     // Set time and date registers from the now struct
     f2xx_rtc_set_time_and_date_registers(s, &now);
@@ -649,14 +701,41 @@ f2xx_rtc_init(SysBusDevice *dev)
     s->host_to_target_offset_us = f2xx_rtc_compute_host_to_target_offset(s,
                                         f2xx_clock_period_ns(s), s->ticks);
 
-    s->timer = timer_new_ns(QEMU_CLOCK_HOST, f2xx_timer, s);
-    timer_mod(s->timer, qemu_clock_get_ns(QEMU_CLOCK_HOST) + period_ns);
+    s->timer = timer_new_ns(s->tick_clock, f2xx_timer, s);
+    timer_mod(s->timer, qemu_clock_get_ns(s->tick_clock) + period_ns);
+
+    s->wu_timer = timer_new_ns(s->wu_clock, f2xx_wu_timer, s);
+    return 0;
+}
+
+static int
+f2xx_rtc_post_load(void *opaque, int version_id)
+{
+    f2xx_rtc *s = opaque;
+    struct tm target_tm;
 
-    s->wu_timer = timer_new_ns(QEMU_CLOCK_REALTIME, f2xx_wu_timer, s);
+    // ticks always tracks the TR and DR registers, so rederive it from them
+    s->ticks = f2xx_rtc_get_current_target_time(s, &target_tm);
     return 0;
 }
 
+static const VMStateDescription vmstate_f2xx_rtc = {
+    .name = "f2xx_rtc",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .post_load = f2xx_rtc_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_TIMER_PTR(timer, f2xx_rtc),
+        VMSTATE_TIMER_PTR(wu_timer, f2xx_rtc),
+        VMSTATE_INT64(host_to_target_offset_us, f2xx_rtc),
+        VMSTATE_UINT32_ARRAY(regs, f2xx_rtc, R_RTC_MAX),
+        VMSTATE_INT32(wp_count, f2xx_rtc),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static Property f2xx_rtc_properties[] = {
+    DEFINE_PROP_UINT64("epoch", f2xx_rtc, epoch, 0),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -669,6 +748,7 @@ f2xx_rtc_class_init(ObjectClass *klass, void *data)
     //TODO: fix this: dc->no_user = 1;
     dc->props = f2xx_rtc_properties;
     dc->reset = f2xx_rtc_reset;
+    dc->vmsd = &vmstate_f2xx_rtc;
 }
 
 static const TypeInfo
@@ -61,6 +61,10 @@ typedef struct {
         USART3_REMAP,
         SYSCFG_MEMRMP,
         SYSCFG_EXTICR[SYSCFG_EXTICR_COUNT];
+
+    /* EXTICR routing in effect before a loadvm, so post_load can move the
+     * EXTI lines over to the incoming configuration. */
+    uint32_t loadvm_EXTICR[SYSCFG_EXTICR_COUNT];
 } Stm32Syscfg;
 
 
@@ -227,6 +231,47 @@ static void stm32_syscfg_reset(DeviceState *dev)
 
 
 
+/* MIGRATION */
+
+static int stm32_syscfg_pre_load(void *opaque)
+{
+    Stm32Syscfg *s = (Stm32Syscfg *)opaque;
+
+    memcpy(s->loadvm_EXTICR, s->SYSCFG_EXTICR, sizeof(s->SYSCFG_EXTICR));
+    return 0;
+}
+
+static int stm32_syscfg_post_load(void *opaque, int version_id)
+{
+    Stm32Syscfg *s = (Stm32Syscfg *)opaque;
+    uint32_t new_value;
+    int i;
+
+    /* The GPIO to EXTI wiring lives in the GPIO modules, so replay the
+     * EXTICR writes against the routing that was in place before loading. */
+    for(i = 0; i < SYSCFG_EXTICR_COUNT; i++) {
+        new_value = s->SYSCFG_EXTICR[i];
+        s->SYSCFG_EXTICR[i] = s->loadvm_EXTICR[i];
+        stm32_syscfg_SYSCFG_EXTICR_write(s, i, new_value, false);
+    }
+    return 0;
+}
+
+static const VMStateDescription vmstate_stm32_syscfg = {
+    .name = "stm32f2xx_syscfg",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .pre_load = stm32_syscfg_pre_load,
+    .post_load = stm32_syscfg_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(SYSCFG_MEMRMP, Stm32Syscfg),
+        VMSTATE_UINT32_ARRAY(SYSCFG_EXTICR, Stm32Syscfg, SYSCFG_EXTICR_COUNT),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+
+
 /* DEVICE INITIALIZATION */
 
 static int stm32_syscfg_init(SysBusDevice *dev)
@@ -259,6 +304,7 @@ static void stm32_syscfg_class_init(ObjectClass *klass, void *data)
     k->init = stm32_syscfg_init;
     dc->reset = stm32_syscfg_reset;
     dc->props = stm32_syscfg_properties;
+    dc->vmsd = &vmstate_stm32_syscfg;
 }
 
 static TypeInfo stm32_syscfg_info = {
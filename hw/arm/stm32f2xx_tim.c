@@ -299,6 +299,17 @@ f2xx_tim_init(SysBusDevice *dev)
     return 0;
 }
 
+static const VMStateDescription vmstate_f2xx_tim = {
+    .name = "f2xx_tim",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_TIMER_PTR(timer, f2xx_tim),
+        VMSTATE_UINT32_ARRAY(regs, f2xx_tim, R_TIM_MAX),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static Property f2xx_tim_properties[] = {
     DEFINE_PROP_END_OF_LIST(),
 };
@@ -311,6 +322,7 @@ f2xx_tim_class_init(ObjectClass *klass, void *data)
     sc->init = f2xx_tim_init;
     //TODO: fix this: dc->no_user = 1;
     dc->props = f2xx_tim_properties;
+    dc->vmsd = &vmstate_f2xx_tim;
     dc->reset = f2xx_tim_reset;
 }
 
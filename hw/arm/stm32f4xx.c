@@ -282,6 +282,7 @@ void stm32f4xx_init(
     stm->qspi_dev = qdev_create(NULL, "stm32f412_qspi");
     stm->qspi_dev->id = stm32f4xx_periph_name_arr[STM32_QSPI];
     stm32_init_periph(stm->qspi_dev, STM32_QSPI, 0xA0001000, qdev_get_gpio_in(nvic, STM32_QSPI_IRQ));
+    sysbus_mmio_map(SYS_BUS_DEVICE(stm->qspi_dev), 1, 0x90000000);
 
     /* ADC */
     DeviceState *adc_dev = qdev_create(NULL, "stm32f2xx_adc");
@@ -422,5 +423,10 @@ void stm32f4xx_init(
     sysbus_connect_irq(SYS_BUS_DEVICE(dma2), 5, qdev_get_gpio_in(nvic, STM32_DMA2_STREAM5_IRQ));
     sysbus_connect_irq(SYS_BUS_DEVICE(dma2), 6, qdev_get_gpio_in(nvic, STM32_DMA2_STREAM6_IRQ));
     sysbus_connect_irq(SYS_BUS_DEVICE(dma2), 7, qdev_get_gpio_in(nvic, STM32_DMA2_STREAM7_IRQ));
+
+    /* The DMA request mapping differs between the F4 parts this models, the
+     * board connects the one that applies (see stm32_dma_connect_requests) */
+    stm->dma_dev[0] = dma1;
+    stm->dma_dev[1] = dma2;
 }
 
@@ -275,6 +275,7 @@ void stm32f7xx_init(
     stm->qspi_dev = qdev_create(NULL, "stm32f412_qspi");
     stm->qspi_dev->id = stm32f7xx_periph_name_arr[STM32_QSPI];
     stm32_init_periph(stm->qspi_dev, STM32_QSPI, 0xA0001000, qdev_get_gpio_in(nvic, STM32_QSPI_IRQ));
+    sysbus_mmio_map(SYS_BUS_DEVICE(stm->qspi_dev), 1, 0x90000000);
 
     /* ADC */
     DeviceState *adc_dev = qdev_create(NULL, "stm32f2xx_adc");
@@ -419,5 +420,8 @@ void stm32f7xx_init(
     sysbus_connect_irq(SYS_BUS_DEVICE(dma2), 5, qdev_get_gpio_in(nvic, STM32_DMA2_STREAM5_IRQ));
     sysbus_connect_irq(SYS_BUS_DEVICE(dma2), 6, qdev_get_gpio_in(nvic, STM32_DMA2_STREAM6_IRQ));
     sysbus_connect_irq(SYS_BUS_DEVICE(dma2), 7, qdev_get_gpio_in(nvic, STM32_DMA2_STREAM7_IRQ));
+
+    /* No DMA request mapping for the F7 (RM0385) yet: only normal mode
+     * memory-to-peripheral streams run, as soon as they are enabled */
 }
 
@@ -222,6 +222,18 @@ static int stm32f7xx_i2c_init(SysBusDevice *dev)
 }
 
 
+static const VMStateDescription vmstate_stm32f7xx_i2c = {
+    .name = "stm32f7xx_i2c",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_INT32(rx, stm32f7xx_i2c),
+        VMSTATE_INT32(rx_full, stm32f7xx_i2c),
+        VMSTATE_UINT16_ARRAY(regs, stm32f7xx_i2c, R_I2C_MAX),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static Property stm32f7xx_i2c_properties[] = {
     DEFINE_PROP_INT32("periph", struct stm32f7xx_i2c, periph, -1),
     DEFINE_PROP_END_OF_LIST()
@@ -235,6 +247,7 @@ static void stm32f7xx_i2c_class_init(ObjectClass *c, void *data)
     sc->init = stm32f7xx_i2c_init;
     dc->reset = stm32f7xx_i2c_reset;
     dc->props = stm32f7xx_i2c_properties;
+    dc->vmsd = &vmstate_stm32f7xx_i2c;
 }
 
 static const TypeInfo stm32f7xx_i2c_info = {
@@ -214,6 +214,17 @@ static int f7xx_lptim_init(SysBusDevice *dev) {
     return 0;
 }
 
+static const VMStateDescription vmstate_f7xx_lptim = {
+    .name = "f7xx_lptim",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_TIMER_PTR(timer, f7xx_lptim),
+        VMSTATE_UINT32_ARRAY(regs, f7xx_lptim, R_LPTIM_MAX),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static Property f7xx_lptim_properties[] = {
     DEFINE_PROP_END_OF_LIST(),
 };
@@ -224,6 +235,7 @@ static void f7xx_lptim_class_init(ObjectClass *klass, void *data) {
     sc->init = f7xx_lptim_init;
     //TODO: fix this: dc->no_user = 1;
     dc->props = f7xx_lptim_properties;
+    dc->vmsd = &vmstate_f7xx_lptim;
     dc->reset = f7xx_lptim_reset;
 }
 
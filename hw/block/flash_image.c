@@ -0,0 +1,317 @@
+/*
+ * Backing store for the Pebble flash models.
+ *
+ * By default the drive contents are copied into a ROM device region.  For a
+ * raw image on a POSIX host the image can instead be mmap()ed, so pages are
+ * only faulted in when the guest touches them and several instances can
+ * share the clean pages of one image.  A private (copy-on-write) mapping
+ * keeps guest writes in memory until they are written back through the block
+ * layer; a shared mapping writes straight into the image file.
+ *
+ * Flash models report modified ranges with flash_image_mark_dirty().  Dirty
+ * sectors are written back in batches from a timer rather than on every
+ * program or erase operation.
+ *
+ * A forked clone of the machine keeps a copy-on-write view of the flash
+ * contents but never writes anything back; the image belongs to the parent.
+ * Machines whose writable images are mapped cannot be forked.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "hw/hw.h"
+#include "hw/block/flash.h"
+#include "block/block_int.h"
+#include "sysemu/block-backend.h"
+#include "qemu/bitmap.h"
+#include "qemu/error-report.h"
+#include "qemu/timer.h"
+#include "qapi/error.h"
+
+/* How long dirty sectors are allowed to accumulate before write back */
+#define FLASH_IMAGE_FLUSH_DELAY_MS 100
+
+static QLIST_HEAD(, FlashImage) flash_images =
+    QLIST_HEAD_INITIALIZER(flash_images);
+
+typedef struct FlashImageWrite {
+    FlashImage *img;
+    QEMUIOVector qiov;
+} FlashImageWrite;
+
+static void flash_image_write_complete(void *opaque, int ret)
+{
+    FlashImageWrite *req = opaque;
+    FlashImage *img = req->img;
+
+    if (ret < 0) {
+        error_report("%s: flash write back failed: %s", img->name,
+                     strerror(-ret));
+    }
+    qemu_iovec_destroy(&req->qiov);
+    g_free(req);
+    img->inflight--;
+}
+
+static void flash_image_write_back(FlashImage *img, bool sync)
+{
+    int64_t start, end;
+    FlashImageWrite *req;
+    int ret;
+
+    start = find_first_bit(img->dirty, img->nb_sectors);
+    while (start < img->nb_sectors) {
+        end = find_next_zero_bit(img->dirty, img->nb_sectors, start);
+        bitmap_clear(img->dirty, start, end - start);
+
+        if (sync) {
+            ret = blk_write(img->blk, start,
+                            img->storage + start * BDRV_SECTOR_SIZE,
+                            end - start);
+            if (ret < 0) {
+                error_report("%s: flash write back failed: %s", img->name,
+                             strerror(-ret));
+                /* Still to be written */
+                bitmap_set(img->dirty, start, end - start);
+            }
+        } else {
+            req = g_new(FlashImageWrite, 1);
+            req->img = img;
+            qemu_iovec_init(&req->qiov, 1);
+            qemu_iovec_add(&req->qiov, img->storage + start * BDRV_SECTOR_SIZE,
+                           (end - start) * BDRV_SECTOR_SIZE);
+            img->inflight++;
+            blk_aio_writev(img->blk, start, &req->qiov, end - start,
+                           flash_image_write_complete, req);
+        }
+        start = find_next_bit(img->dirty, img->nb_sectors, end);
+    }
+}
+
+void flash_image_flush(FlashImage *img)
+{
+    if (!img->flush_timer) {
+        return;
+    }
+    timer_del(img->flush_timer);
+
+#ifdef CONFIG_POSIX
+    if (img->mode == FLASH_IMAGE_MMAP_SHARED) {
+        /* The kernel tracks which pages are dirty */
+        msync(img->storage, img->size, MS_ASYNC);
+        return;
+    }
+#endif
+
+    if (img->inflight) {
+        /* Keep write back ordered: let the previous batch land first so an
+         * older copy of a sector can never overwrite a newer one. */
+        timer_mod(img->flush_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+                  FLASH_IMAGE_FLUSH_DELAY_MS);
+        return;
+    }
+    flash_image_write_back(img, false);
+}
+
+void flash_image_mark_dirty(FlashImage *img, uint64_t offset, uint64_t len)
+{
+    if (!img->flush_timer || !len) {
+        return;
+    }
+    if (img->dirty) {
+        int64_t first = offset / BDRV_SECTOR_SIZE;
+        int64_t last = (offset + len - 1) / BDRV_SECTOR_SIZE;
+
+        bitmap_set(img->dirty, first, last - first + 1);
+    }
+    if (!timer_pending(img->flush_timer)) {
+        timer_mod(img->flush_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+                  FLASH_IMAGE_FLUSH_DELAY_MS);
+    }
+}
+
+static void flash_image_flush_timer(void *opaque)
+{
+    flash_image_flush(opaque);
+}
+
+/* Called while the drive is being closed, after in flight requests have
+ * drained but before the image goes away: write back whatever is left.
+ * Flash drives cannot be removed, so this only happens as QEMU exits and
+ * the mapping of the image can go too. */
+static void flash_image_close(Notifier *n, void *data)
+{
+    FlashImage *img = container_of(n, FlashImage, close_notifier);
+
+    if (img->flush_timer) {
+        timer_del(img->flush_timer);
+    }
+#ifdef CONFIG_POSIX
+    if (img->mode == FLASH_IMAGE_MMAP_SHARED &&
+        msync(img->storage, img->size, MS_SYNC) < 0) {
+        error_report("%s: flash write back failed: %s", img->name,
+                     strerror(errno));
+    }
+#endif
+    if (img->dirty) {
+        flash_image_write_back(img, true);
+    }
+#ifdef CONFIG_POSIX
+    if (img->mode != FLASH_IMAGE_COPY) {
+        munmap(img->storage, img->size);
+        img->storage = NULL;
+    }
+#endif
+}
+
+#ifdef CONFIG_POSIX
+static void *flash_image_map(FlashImage *img, bool shared)
+{
+    BlockDriverState *bs = blk_bs(img->blk);
+    BlockDriverState *file;
+    struct stat st;
+    void *ptr;
+    int fd;
+
+    /* Only a raw image on a plain file keeps the flash contents verbatim at
+     * the start of a file we can map */
+    if (!bs || !bs->drv || strcmp(bdrv_get_format_name(bs), "raw") ||
+        !bs->file) {
+        return NULL;
+    }
+    file = bs->file->bs;
+    if (!file->drv || !file->drv->protocol_name ||
+        strcmp(file->drv->protocol_name, "file")) {
+        return NULL;
+    }
+
+    fd = qemu_open(file->filename, shared ? O_RDWR : O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < img->size) {
+        qemu_close(fd);
+        return NULL;
+    }
+    ptr = mmap(NULL, img->size, PROT_READ | PROT_WRITE,
+               shared ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    qemu_close(fd);
+
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+#endif
+
+void flash_image_init(FlashImage *img, MemoryRegion *mr, Object *owner,
+                      const MemoryRegionOps *ops, void *opaque,
+                      const char *name, uint64_t size, BlockBackend *blk,
+                      bool map, bool shared, Error **errp)
+{
+    Error *local_err = NULL;
+    void *ptr = NULL;
+    bool writable;
+
+    img->name = name;
+    img->blk = blk;
+    img->size = size;
+    img->mode = FLASH_IMAGE_COPY;
+    writable = blk && !blk_is_read_only(blk);
+    QLIST_INSERT_HEAD(&flash_images, img, next);
+
+#ifdef CONFIG_POSIX
+    if (blk && map) {
+        /* A read-only drive must not see guest writes, keep those private */
+        shared = shared && writable;
+        ptr = flash_image_map(img, shared);
+        if (ptr) {
+            img->mode = shared ? FLASH_IMAGE_MMAP_SHARED : FLASH_IMAGE_MMAP_COW;
+        } else {
+            error_report("%s: cannot map the drive image, copying it instead",
+                         name);
+        }
+    }
+#endif
+
+    if (ptr) {
+        memory_region_init_rom_device_ptr(mr, owner, ops, opaque, name, size,
+                                          ptr);
+        img->storage = ptr;
+    } else {
+        memory_region_init_rom_device(mr, owner, ops, opaque, name, size,
+                                      &local_err);
+        if (local_err) {
+            error_propagate(errp, local_err);
+            return;
+        }
+        img->storage = memory_region_get_ram_ptr(mr);
+
+        if (blk) {
+            if (blk_read(blk, 0, img->storage,
+                         DIV_ROUND_UP(size, BDRV_SECTOR_SIZE)) < 0) {
+                error_setg(errp, "%s: failed to read the initial flash content",
+                           name);
+                return;
+            }
+        } else {
+            memset(img->storage, 0xff, size);
+        }
+    }
+
+    if (writable) {
+        if (img->mode != FLASH_IMAGE_MMAP_SHARED) {
+            img->nb_sectors = DIV_ROUND_UP(size, BDRV_SECTOR_SIZE);
+            img->dirty = bitmap_new(img->nb_sectors);
+        }
+        img->flush_timer = timer_new_ms(QEMU_CLOCK_REALTIME,
+                                        flash_image_flush_timer, img);
+    }
+    if (writable || img->mode != FLASH_IMAGE_COPY) {
+        /* Write back what is left and unmap the image */
+        img->close_notifier.notify = flash_image_close;
+        blk_add_close_notifier(blk, &img->close_notifier);
+    }
+}
+
+/* A forked child must not see the parent's flash change under it.  A shared
+ * mapping would let the child write straight into the parent's image file.
+ * A private mapping of a writable drive is no better: the parent writes back
+ * into the same file, and every page the child has not written yet is still
+ * the page cache page of that file. */
+bool flash_image_can_fork(Error **errp)
+{
+    FlashImage *img;
+
+    QLIST_FOREACH(img, &flash_images, next) {
+        if (img->mode == FLASH_IMAGE_MMAP_SHARED) {
+            error_setg(errp, "%s: a flash image mapped shared cannot be forked",
+                       img->name);
+            return false;
+        }
+        if (img->mode == FLASH_IMAGE_MMAP_COW && img->flush_timer) {
+            error_setg(errp, "%s: a writable flash image that is mapped "
+                       "cannot be forked", img->name);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Called in a forked child: keep the in-memory contents, stop writing them
+ * back to the image. */
+void flash_image_after_fork(void)
+{
+    FlashImage *img;
+
+    QLIST_FOREACH(img, &flash_images, next) {
+        if (!img->flush_timer) {
+            continue;
+        }
+        timer_del(img->flush_timer);
+        timer_free(img->flush_timer);
+        img->flush_timer = NULL;
+        notifier_remove(&img->close_notifier);
+        g_free(img->dirty);
+        img->dirty = NULL;
+        img->inflight = 0;
+    }
+}
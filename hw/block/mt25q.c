@@ -7,6 +7,9 @@
 #include "sysemu/block-backend.h"
 #include "sysemu/blockdev.h"
 #include "hw/ssi.h"
+#include "hw/block/flash.h"
+#include "qapi/error.h"
+#include "qemu/error-report.h"
 
 
 // TODO: These should be made configurable to support different flash parts
@@ -81,12 +84,15 @@ typedef struct {
     SSISlave parent_obj;
 
     //--- Storage ---
-    BlockBackend *blk;
+    FlashImage image;           //! Backing image and write back state
+    MemoryRegion mem;           //! ROM device view of storage, for XIP
+    AddressSpace mem_as;        //! Used to update storage from the flash side
     uint8_t *storage;
     uint32_t size;
     int page_size;
 
-    int64_t dirty_page;
+    bool map_image;             //! mmap the drive instead of copying it
+    bool map_shared;            //! with map_image, write into the file directly
 
     //--- Registers ---
     uint8_t EVCR;
@@ -94,8 +100,8 @@ typedef struct {
     uint8_t FLAG_STATUS_REG;
 
     //--- Command state ---
-    CMDState state;
-    FlashCmd cmd_in_progress;
+    uint8_t state;           //! CMDState
+    uint8_t cmd_in_progress; //! FlashCmd
     uint8_t cmd_data[4]; //! Commands can require up to 4 bytes of additional data
     uint8_t cmd_bytes;   //! Number of bytes required by command [0,4]
     uint32_t len;
@@ -120,58 +126,50 @@ typedef struct {
 #define MT25Q_GET_CLASS(obj) \
      OBJECT_GET_CLASS(MT25QClass, (obj), TYPE_MT25Q)
 
-static void blk_sync_complete(void *opaque, int ret)
+/* Storage is only modified through mem_as so that code translated from the
+ * memory mapped (XIP) view of the flash gets invalidated. */
+static void mt25q_storage_write(Flash *s, uint32_t offset, const uint8_t *buf, int len)
 {
-    /* do nothing. Masters do not directly interact with the backing store,
-     * only the working copy so no mutexing required.
-     */
+    cpu_physical_memory_write_rom(&s->mem_as, offset, buf, len);
+    flash_image_mark_dirty(&s->image, offset, len);
 }
 
-static void mt25q_flash_sync_page(Flash *s, int page)
+static void mt25q_storage_erase(Flash *s, uint32_t offset, uint32_t len)
 {
-    int blk_sector, nb_sectors;
-    QEMUIOVector iov;
-
-    if (!s->blk || blk_is_read_only(s->blk)) {
-        return;
+    uint8_t ff[FLASH_PAGE_SIZE];
+    uint32_t n;
+
+    memset(ff, 0xff, sizeof(ff));
+    while (len) {
+        n = MIN(len, sizeof(ff));
+        mt25q_storage_write(s, offset, ff, n);
+        offset += n;
+        len -= n;
     }
-
-    blk_sector = (page * s->page_size) / BDRV_SECTOR_SIZE;
-    nb_sectors = DIV_ROUND_UP(s->page_size, BDRV_SECTOR_SIZE);
-    qemu_iovec_init(&iov, 1);
-    qemu_iovec_add(&iov, s->storage + blk_sector * BDRV_SECTOR_SIZE,
-                   nb_sectors * BDRV_SECTOR_SIZE);
-    blk_aio_writev(s->blk, blk_sector, &iov, nb_sectors, blk_sync_complete,
-                   NULL);
 }
 
-static inline void mt25q_flash_sync_area(Flash *s, int64_t off, int64_t len)
+static uint64_t mt25q_mem_read(void *opaque, hwaddr addr, unsigned size)
 {
-    int64_t start, end, nb_sectors;
-    QEMUIOVector iov;
-
-    if (!s->blk || blk_is_read_only(s->blk)) {
-        return;
-    }
+    Flash *s = opaque;
+    uint64_t r = 0;
 
-    assert(!(len % BDRV_SECTOR_SIZE));
-    start = off / BDRV_SECTOR_SIZE;
-    end = (off + len) / BDRV_SECTOR_SIZE;
-    nb_sectors = end - start;
-    qemu_iovec_init(&iov, 1);
-    qemu_iovec_add(&iov, s->storage + (start * BDRV_SECTOR_SIZE),
-                                        nb_sectors * BDRV_SECTOR_SIZE);
-    blk_aio_writev(s->blk, start, &iov, nb_sectors, blk_sync_complete, NULL);
+    memcpy(&r, s->storage + addr, size);
+    return r;
 }
 
-static inline void flash_sync_dirty(Flash *s, int64_t newpage)
+/* Writes through the memory mapped view are not possible on the real part. */
+static void mt25q_mem_write(void *opaque, hwaddr addr, uint64_t value, unsigned size)
 {
-    if (s->dirty_page >= 0 && s->dirty_page != newpage) {
-        mt25q_flash_sync_page(s, s->dirty_page);
-        s->dirty_page = newpage;
-    }
+    qemu_log_mask(LOG_GUEST_ERROR, "MT25Q: write to memory mapped flash at 0x%"
+                  HWADDR_PRIx "\n", addr);
 }
 
+static const MemoryRegionOps mt25q_mem_ops = {
+    .read = mt25q_mem_read,
+    .write = mt25q_mem_write,
+    .endianness = DEVICE_LITTLE_ENDIAN,
+};
+
 static void mt25q_flash_erase(Flash *s, uint32_t offset, FlashCmd cmd)
 {
   uint32_t len;
@@ -195,8 +193,7 @@ static void mt25q_flash_erase(Flash *s, uint32_t offset, FlashCmd cmd)
     return;
   }
 
-  memset(s->storage + offset, 0xff, len);
-  mt25q_flash_sync_area(s, offset, len);
+  mt25q_storage_erase(s, offset, len);
 }
 
 static void mt25q_decode_new_cmd(Flash *s, uint32_t value)
@@ -335,8 +332,6 @@ static void mt25q_handle_cmd_data(Flash *s)
 
 static void mt25q_write8(Flash *s, uint8_t value)
 {
-    int64_t page = s->current_address / s->page_size;
-
     // TODO: Write protection
 
     uint8_t current = s->storage[s->current_address];
@@ -348,10 +343,7 @@ static void mt25q_write8(Flash *s, uint8_t value)
         value &= current;
     }
     DB_PRINT_L(2, "Write 0x%"PRIx8" = 0x%"PRIx64, (uint8_t)value, s->current_address);
-    s->storage[s->current_address] = (uint8_t)value;
-
-    flash_sync_dirty(s, page);
-    s->dirty_page = page;
+    mt25q_storage_write(s, s->current_address, &value, 1);
 }
 
 static uint32_t mt25q_transfer8(SSISlave *ss, uint32_t tx)
@@ -415,12 +407,13 @@ static uint32_t mt25q_transfer8(SSISlave *ss, uint32_t tx)
 static int mt25q_init(SSISlave *ss)
 {
     DriveInfo *dinfo;
+    BlockBackend *blk = NULL;
+    Error *err = NULL;
     Flash *s = MT25Q(ss);
 
     s->state = STATE_IDLE;
     s->size = FLASH_SECTOR_SIZE * FLASH_NUM_SECTORS;
     s->page_size = FLASH_PAGE_SIZE;
-    s->dirty_page = -1;
     s->STATUS_REG = 0;
 
     /* FIXME use a qdev drive property instead of drive_get() */
@@ -428,24 +421,30 @@ static int mt25q_init(SSISlave *ss)
 
     if (dinfo) {
         DB_PRINT_L(0, "Binding to IF_MTD drive");
-        s->blk = blk_by_legacy_dinfo(dinfo);
-        blk_attach_dev_nofail(s->blk, s);
-
-        s->storage = blk_blockalign(s->blk, s->size);
-
-        int r = blk_read(s->blk, 0, s->storage, DIV_ROUND_UP(s->size, BDRV_SECTOR_SIZE));
-        if (r < 0) {
-            fprintf(stderr, "Failed to initialize SPI flash (%d)!\n", r);
-            return 1;
-        }
+        blk = blk_by_legacy_dinfo(dinfo);
+        blk_attach_dev_nofail(blk, s);
     } else {
         DB_PRINT_L(-1, "No BDRV - binding to RAM");
-        s->storage = blk_blockalign(NULL, s->size);
-        memset(s->storage, 0xFF, s->size);
     }
+
+    flash_image_init(&s->image, &s->mem, OBJECT(s), &mt25q_mem_ops, s,
+                     "mt25q.mem", s->size, blk, s->map_image, s->map_shared,
+                     &err);
+    if (err) {
+        error_report_err(err);
+        return 1;
+    }
+    vmstate_register_ram(&s->mem, DEVICE(s));
+    address_space_init(&s->mem_as, &s->mem, "mt25q.mem");
+    s->storage = s->image.storage;
     return 0;
 }
 
+MemoryRegion * mt25q_get_memory(DeviceState *dev)
+{
+    return &MT25Q(dev)->mem;
+}
+
 static int mt25q_cs(SSISlave *ss, bool select)
 {
     Flash *s = MT25Q(ss);
@@ -454,7 +453,6 @@ static int mt25q_cs(SSISlave *ss, bool select)
         s->len = 0;
         s->pos = 0;
         s->state = STATE_IDLE;
-        flash_sync_dirty(s, -1);
     }
 
     DB_PRINT_L(2, "CS %s", select ? "HIGH" : "LOW");
@@ -464,19 +462,67 @@ static int mt25q_cs(SSISlave *ss, bool select)
 
 static void mt25q_pre_save(void *opaque)
 {
-    flash_sync_dirty((Flash *)opaque, -1);
+    Flash *s = opaque;
+
+    flash_image_flush(&s->image);
+}
+
+static int mt25q_post_load(void *opaque, int version_id)
+{
+    Flash *s = opaque;
+
+    // current_register points into the device state, so rebuild it from the
+    // command that selected it
+    s->current_register = NULL;
+    if (s->state == STATE_READ_REGISTER) {
+        switch (s->cmd_in_progress) {
+        case READ_EVCR:
+            s->current_register = &s->EVCR;
+            break;
+        case READ_STATUS_REG:
+            s->current_register = &s->STATUS_REG;
+            break;
+        case READ_FLAG_STATUS_REG:
+            s->current_register = &s->FLAG_STATUS_REG;
+            break;
+        default:
+            s->state = STATE_IDLE;
+            break;
+        }
+    }
+    return 0;
 }
 
 static const VMStateDescription vmstate_mt25q = {
     .name = "mt25q",
-    .version_id = 1,
-    .minimum_version_id = 1,
+    .version_id = 2,
+    .minimum_version_id = 2,
     .pre_save = mt25q_pre_save,
+    .post_load = mt25q_post_load,
     .fields = (VMStateField[]) {
+        VMSTATE_SSI_SLAVE(parent_obj, Flash),
+        VMSTATE_UINT8(EVCR, Flash),
+        VMSTATE_UINT8(STATUS_REG, Flash),
+        VMSTATE_UINT8(FLAG_STATUS_REG, Flash),
+        VMSTATE_UINT8(state, Flash),
+        VMSTATE_UINT8(cmd_in_progress, Flash),
+        VMSTATE_UINT8_ARRAY(cmd_data, Flash, 4),
+        VMSTATE_UINT8(cmd_bytes, Flash),
+        VMSTATE_UINT32(len, Flash),
+        VMSTATE_UINT32(pos, Flash),
+        VMSTATE_UINT64(current_address, Flash),
+        VMSTATE_UINT8(register_read_mask, Flash),
+        VMSTATE_BOOL(reset_enabled, Flash),
         VMSTATE_END_OF_LIST()
     }
 };
 
+static Property mt25q_properties[] = {
+    DEFINE_PROP_BOOL("mmap", Flash, map_image, false),
+    DEFINE_PROP_BOOL("mmap-shared", Flash, map_shared, false),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
 static void mt25q_class_init(ObjectClass *class, void *data)
 {
     DeviceClass *dc = DEVICE_CLASS(class);
@@ -487,6 +533,7 @@ static void mt25q_class_init(ObjectClass *class, void *data)
     c->set_cs = mt25q_cs;
     c->cs_polarity = SSI_CS_LOW;
     dc->vmsd = &vmstate_mt25q;
+    dc->props = mt25q_properties;
 }
 
 static const TypeInfo mt25q_info = {
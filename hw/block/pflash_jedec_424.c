@@ -96,15 +96,26 @@ struct pflash_t {
     uint64_t counter;
     unsigned int writeblock_size;
     MemoryRegion mem;
+    FlashImage image;
+    bool map_image;
+    bool map_shared;
     char *name;
     void *storage;
     uint16_t configuration_register;
 };
 
+static void pflash_pre_save(void *opaque)
+{
+    pflash_t *pfl = opaque;
+
+    flash_image_flush(&pfl->image);
+}
+
 static const VMStateDescription vmstate_pflash = {
     .name = "pflash_jedec_424",
     .version_id = 2,
     .minimum_version_id = 2,
+    .pre_save = pflash_pre_save,
     .fields = (VMStateField[]) {
         VMSTATE_UINT8_ARRAY(wcycle, pflash_t, PFLASH_MAX_BANKS),
         VMSTATE_UINT8_ARRAY(cmd, pflash_t, PFLASH_MAX_BANKS),
@@ -396,15 +407,7 @@ static uint32_t pflash_read (pflash_t *pfl, hwaddr offset,
 static void pflash_update(pflash_t *pfl, int offset,
                           int size)
 {
-    int offset_end;
-    if (pfl->blk) {
-        offset_end = offset + size;
-        /* round to sectors */
-        offset = offset >> 9;
-        offset_end = (offset_end + 511) >> 9;
-        blk_write(pfl->blk, offset, pfl->storage + (offset << 9),
-                   offset_end - offset);
-    }
+    flash_image_mark_dirty(&pfl->image, offset, size);
 }
 
 static inline void pflash_data_write(pflash_t *pfl, hwaddr offset,
@@ -832,7 +835,7 @@ static void pflash_jedec_realize(DeviceState *dev, Error **errp)
 {
     pflash_t *pfl = CFI_PFLASH_JEDEC(dev);
     uint64_t total_len;
-    int ret;
+    Error *local_err = NULL;
     uint64_t blocks_per_device, device_len;
     int num_devices;
 
@@ -845,25 +848,18 @@ static void pflash_jedec_realize(DeviceState *dev, Error **errp)
     blocks_per_device = pfl->nb_blocs / num_devices;
     device_len = pfl->sector_len * blocks_per_device;
 
-    memory_region_init_rom_device(
-        &pfl->mem, OBJECT(dev),
-        pfl->be ? &pflash_jedec_ops_be : &pflash_jedec_ops_le, pfl,
-        pfl->name, total_len, errp);
+    flash_image_init(&pfl->image, &pfl->mem, OBJECT(dev),
+                     pfl->be ? &pflash_jedec_ops_be : &pflash_jedec_ops_le,
+                     pfl, pfl->name, total_len, pfl->blk,
+                     pfl->map_image, pfl->map_shared, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        return;
+    }
     vmstate_register_ram(&pfl->mem, DEVICE(pfl));
-    pfl->storage = memory_region_get_ram_ptr(&pfl->mem);
+    pfl->storage = pfl->image.storage;
     sysbus_init_mmio(SYS_BUS_DEVICE(dev), &pfl->mem);
 
-    if (pfl->blk) {
-        /* read the initial flash content */
-        ret = blk_read(pfl->blk, 0, pfl->storage, total_len >> 9);
-
-        if (ret < 0) {
-            vmstate_unregister_ram(&pfl->mem, DEVICE(pfl));
-            error_setg(errp, "failed to read the initial flash content");
-            return;
-        }
-    }
-
     if (pfl->blk) {
         pfl->ro = blk_is_read_only(pfl->blk);
     } else {
@@ -1010,6 +1006,11 @@ static Property pflash_jedec_properties[] = {
     DEFINE_PROP_UINT16("id2", struct pflash_t, ident2, 0),
     DEFINE_PROP_UINT16("id3", struct pflash_t, ident3, 0),
     DEFINE_PROP_STRING("name", struct pflash_t, name),
+    /* mmap the drive image instead of copying it into RAM; with mmap-shared
+     * guest writes go straight into the image file.
+     */
+    DEFINE_PROP_BOOL("mmap", struct pflash_t, map_image, false),
+    DEFINE_PROP_BOOL("mmap-shared", struct pflash_t, map_shared, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -34,6 +34,12 @@
 //#define STM32_UART_NO_BAUD_DELAY
 //#define STM32_UART_ENABLE_OVERRUN
 
+#ifdef STM32_UART_NO_BAUD_DELAY
+#define STM32_UART_BAUD_DELAY_DEFAULT false
+#else
+#define STM32_UART_BAUD_DELAY_DEFAULT true
+#endif
+
 #ifdef DEBUG_STM32_UART
 #define DPRINTF(fmt, ...)                                       \
     do { printf("STM32F7XX_UART: " fmt , ## __VA_ARGS__); } while (0)
@@ -52,6 +58,8 @@
 #define USART_CR2_OFFSET 0x04
 
 #define USART_CR3_OFFSET 0x08
+#define USART_CR3_DMAT_BIT 7
+#define USART_CR3_DMAR_BIT 6
 
 #define USART_BRR_OFFSET 0x0C
 
@@ -137,6 +145,11 @@ struct Stm32F7xxUart {
     void *chr_write_obj;
     int (*chr_write)(void *chr_write_obj, const uint8_t *buf, int len);
 
+    /* Told whenever a byte leaves rcv_char_buf, so a producer feeding us through
+     * the receive handlers can push more without polling. */
+    void *rcv_space_obj;
+    void (*rcv_space)(void *rcv_space_obj);
+
     /* Stores the USART pin mapping used by the board.  This is used to check
      * the AFIO's USARTx_REMAP register to make sure the software has set
      * the correct mapping.
@@ -146,12 +159,23 @@ struct Stm32F7xxUart {
     qemu_irq irq;
     int curr_irq_level;
 
+    /* DMA request lines, driven from TXE/RXNE when DMAT/DMAR are set. */
+    qemu_irq dma_tx;
+    qemu_irq dma_rx;
+
     /* We buffer the characters we receive from our qemu_chr receive handler in here
      * to increase our overall throughput. This allows us to tell the target that
      * another character is ready immediately after it does a read.
+     * rcv_char_buf is a ring starting at rcv_char_head.
      */
     uint8_t rcv_char_buf[USART_RCV_BUF_LEN];
+    uint32_t rcv_char_head;
     uint32_t rcv_char_bytes;    /* number of bytes avaialable in rcv_char_buf */
+
+    /* Pace transmit and receive at the programmed baud rate.  When off, the
+     * next received byte is presented as soon as the target drains the data
+     * register, and receive DMA takes whatever is buffered in one go. */
+    bool baud_delay;
 };
 
 
@@ -218,6 +242,11 @@ static void stm32f7xx_uart_update_irq(Stm32F7xxUart *s) {
         qemu_set_irq(s->irq, new_irq_level);
         s->curr_irq_level = new_irq_level;
     }
+
+    qemu_set_irq(s->dma_tx, extract32(s->USART_CR3, USART_CR3_DMAT_BIT, 1) &
+                            s->USART_ISR_TXE);
+    qemu_set_irq(s->dma_rx, extract32(s->USART_CR3, USART_CR3_DMAR_BIT, 1) &
+                            s->USART_ISR_RXNE);
 }
 
 
@@ -233,11 +262,12 @@ static void stm32f7xx_uart_tx_complete(Stm32F7xxUart *s)
         stm32f7xx_uart_update_irq(s);
     } else {
         /* Otherwise, mark the transmit buffer as empty and
-         * start transmitting the value stored there.
+         * start transmitting the value stored there.  The IRQ update comes
+         * last, as a DMA request may refill TDR straight away.
          */
         s->USART_ISR_TXE = 1;
-        stm32f7xx_uart_update_irq(s);
         stm32f7xx_uart_start_tx(s, s->USART_TDR);
+        stm32f7xx_uart_update_irq(s);
     }
 }
 
@@ -255,18 +285,28 @@ static void stm32f7xx_uart_start_tx(Stm32F7xxUart *s, uint32_t value)
     if (s->chr_write_obj) {
         s->chr_write(s->chr_write_obj, &ch, 1);
     }
-#ifdef STM32_UART_NO_BAUD_DELAY
-    /* If BAUD delays are not being simulated, then immediately mark the
-     * transmission as complete.
-     */
-    stm32f7xx_uart_tx_complete(s);
-#else
-    /* Otherwise, start the transmit delay timer. */
-    timer_mod(s->tx_timer,  qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + s->ns_per_char);
-#endif
+    if (!s->baud_delay) {
+        /* If BAUD delays are not being simulated, then immediately mark the
+         * transmission as complete.
+         */
+        stm32f7xx_uart_tx_complete(s);
+    } else {
+        /* Otherwise, start the transmit delay timer. */
+        timer_mod(s->tx_timer,  qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + s->ns_per_char);
+    }
 }
 
 
+/* Take the oldest byte out of rcv_char_buf, which must not be empty. */
+static uint8_t stm32f7xx_uart_rcv_pop(Stm32F7xxUart *s)
+{
+    uint8_t byte = s->rcv_char_buf[s->rcv_char_head];
+
+    s->rcv_char_head = (s->rcv_char_head + 1) % USART_RCV_BUF_LEN;
+    s->rcv_char_bytes--;
+    return byte;
+}
+
 /* Put byte into the receive data register, if we have one and the target is ready for it. */
 static void stm32f7xx_uart_fill_receive_data_register(Stm32F7xxUart *s)
 {
@@ -286,8 +326,7 @@ static void stm32f7xx_uart_fill_receive_data_register(Stm32F7xxUart *s)
 #endif
 
     /* Pull the byte out of our buffer */
-    uint8_t byte = s->rcv_char_buf[0];
-    memmove(&s->rcv_char_buf[0], &s->rcv_char_buf[1], --(s->rcv_char_bytes));
+    uint8_t byte = stm32f7xx_uart_rcv_pop(s);
 
     /* Only handle the received character if the module is enabled, */
     if (enabled) {
@@ -303,11 +342,16 @@ static void stm32f7xx_uart_fill_receive_data_register(Stm32F7xxUart *s)
         stm32f7xx_uart_update_irq(s);
     }
 
-#ifndef STM32_UART_NO_BAUD_DELAY
-    /* Indicate the module is receiving and start the delay. */
-    s->receiving = true;
-    timer_mod(s->rx_timer,  qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + s->ns_per_char);
-#endif
+    if (s->baud_delay) {
+        /* Indicate the module is receiving and start the delay. */
+        s->receiving = true;
+        timer_mod(s->rx_timer,  qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + s->ns_per_char);
+    }
+
+    /* There is room in rcv_char_buf again */
+    if (s->rcv_space) {
+        s->rcv_space(s->rcv_space_obj);
+    }
 }
 
 
@@ -356,12 +400,17 @@ static void stm32f7xx_uart_event(void *opaque, int event)
 static void stm32f7xx_uart_receive(void *opaque, const uint8_t *buf, int size)
 {
     Stm32F7xxUart *s = (Stm32F7xxUart *)opaque;
+    uint32_t tail;
+    int chunk;
 
     assert(size > 0);
 
-    /* Copy the characters into our buffer first */
+    /* Copy the characters into our buffer first, wrapping around its end */
     assert (size <= USART_RCV_BUF_LEN - s->rcv_char_bytes);
-    memmove(s->rcv_char_buf + s->rcv_char_bytes, buf, size);
+    tail = (s->rcv_char_head + s->rcv_char_bytes) % USART_RCV_BUF_LEN;
+    chunk = MIN(size, USART_RCV_BUF_LEN - tail);
+    memcpy(s->rcv_char_buf + tail, buf, chunk);
+    memcpy(s->rcv_char_buf, buf + chunk, size - chunk);
     s->rcv_char_bytes += size;
 
     /* Put next byte into RDR if the target is ready for it */
@@ -504,6 +553,8 @@ static void stm32f7xx_uart_USART_CR2_write(Stm32F7xxUart *s, uint32_t new_value,
 static void stm32f7xx_uart_USART_CR3_write(Stm32F7xxUart *s, uint32_t new_value, bool init)
 {
     s->USART_CR3 = new_value & 0x0000e7ff;
+
+    stm32f7xx_uart_update_irq(s);
 }
 
 static void stm32f7xx_uart_reset(DeviceState *dev)
@@ -626,6 +677,42 @@ static const MemoryRegionOps stm32f7xx_uart_ops = {
 
 
 
+/* DMA HANDLERS */
+
+/* Receive DMA out of the data register.  Without baud pacing there is no
+ * reason to hand the buffered bytes over one DMA request at a time, so take
+ * the byte in the data register and as much of rcv_char_buf as fits. */
+static int stm32f7xx_uart_dma_bulk(Object *obj, hwaddr offset, uint8_t *buf,
+                                   int size, int count, bool to_periph)
+{
+    Stm32F7xxUart *s = STM32F7XX_UART(obj);
+    int n;
+
+    if (to_periph || offset != USART_RDR_OFFSET || size != 1 ||
+            s->baud_delay || !s->USART_CR1_UE || !s->USART_CR1_RE ||
+            !s->USART_ISR_RXNE || s->USART_ISR_ORE) {
+        return 0;
+    }
+
+    buf[0] = s->USART_RDR;
+    for (n = 1; n < count && s->rcv_char_bytes; n++) {
+        buf[n] = stm32f7xx_uart_rcv_pop(s);
+    }
+    s->USART_ISR_RXNE = 0;
+
+    /* Present the next byte, if any, and let the producer refill us */
+    stm32f7xx_uart_fill_receive_data_register(s);
+    stm32f7xx_uart_update_irq(s);
+    if (n > 1 && s->rcv_space) {
+        s->rcv_space(s->rcv_space_obj);
+    }
+    return n;
+}
+
+
+
+
+
 /* PUBLIC FUNCTIONS */
 
 void stm32f7xx_uart_set_write_handler(Stm32F7xxUart *s, void *obj,
@@ -636,6 +723,14 @@ void stm32f7xx_uart_set_write_handler(Stm32F7xxUart *s, void *obj,
 }
 
 
+void stm32f7xx_uart_set_rcv_space_handler(Stm32F7xxUart *s, void *obj,
+        void (*rcv_space_handler)(void *rcv_space_obj))
+{
+    s->rcv_space_obj = obj;
+    s->rcv_space = rcv_space_handler;
+}
+
+
 void stm32f7xx_uart_get_rcv_handlers(Stm32F7xxUart *s, IOCanReadHandler **can_read,
                                  IOReadHandler **read, IOEventHandler **event)
 {
@@ -686,6 +781,8 @@ static int stm32f7xx_uart_init(SysBusDevice *dev)
     sysbus_init_mmio(dev, &s->iomem);
 
     sysbus_init_irq(dev, &s->irq);
+    qdev_init_gpio_out_named(DEVICE(dev), &s->dma_tx, "dma-tx", 1);
+    qdev_init_gpio_out_named(DEVICE(dev), &s->dma_rx, "dma-rx", 1);
 
     s->rx_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
                                (QEMUTimerCB *)stm32f7xx_uart_rx_timer_expire, s);
@@ -696,6 +793,7 @@ static int stm32f7xx_uart_init(SysBusDevice *dev)
     clk_irq = qemu_allocate_irqs(stm32f7xx_uart_clk_irq_handler, (void *)s, 1);
     stm32_rcc_set_periph_clk_irq(s->stm32_rcc, s->periph, clk_irq[0]);
 
+    s->rcv_char_head = 0;
     s->rcv_char_bytes = 0;
 
     stm32f7xx_uart_reset((DeviceState *)s);
@@ -703,12 +801,64 @@ static int stm32f7xx_uart_init(SysBusDevice *dev)
     return 0;
 }
 
+static int stm32f7xx_uart_post_load(void *opaque, int version_id)
+{
+    Stm32F7xxUart *s = (Stm32F7xxUart *)opaque;
+
+    if (version_id < 2) {
+        /* Older streams kept the buffer linear */
+        s->rcv_char_head = 0;
+    }
+    if (s->rcv_char_bytes > USART_RCV_BUF_LEN ||
+        s->rcv_char_head >= USART_RCV_BUF_LEN) {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static const VMStateDescription vmstate_stm32f7xx_uart = {
+    .name = "stm32f7xx-uart",
+    .version_id = 2,
+    .minimum_version_id = 1,
+    .post_load = stm32f7xx_uart_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(bits_per_sec, Stm32F7xxUart),
+        VMSTATE_INT64(ns_per_char, Stm32F7xxUart),
+        VMSTATE_UINT32(USART_RDR, Stm32F7xxUart),
+        VMSTATE_UINT32(USART_TDR, Stm32F7xxUart),
+        VMSTATE_UINT32(USART_BRR, Stm32F7xxUart),
+        VMSTATE_UINT32(USART_CR1, Stm32F7xxUart),
+        VMSTATE_UINT32(USART_CR2, Stm32F7xxUart),
+        VMSTATE_UINT32(USART_CR3, Stm32F7xxUart),
+        VMSTATE_UINT32(USART_ISR_TXE, Stm32F7xxUart),
+        VMSTATE_UINT32(USART_ISR_TC, Stm32F7xxUart),
+        VMSTATE_UINT32(USART_ISR_RXNE, Stm32F7xxUart),
+        VMSTATE_UINT32(USART_ISR_ORE, Stm32F7xxUart),
+        VMSTATE_UINT32(USART_CR1_UE, Stm32F7xxUart),
+        VMSTATE_UINT32(USART_CR1_TXEIE, Stm32F7xxUart),
+        VMSTATE_UINT32(USART_CR1_TCIE, Stm32F7xxUart),
+        VMSTATE_UINT32(USART_CR1_RXNEIE, Stm32F7xxUart),
+        VMSTATE_UINT32(USART_CR1_TE, Stm32F7xxUart),
+        VMSTATE_UINT32(USART_CR1_RE, Stm32F7xxUart),
+        VMSTATE_BOOL(receiving, Stm32F7xxUart),
+        VMSTATE_TIMER_PTR(rx_timer, Stm32F7xxUart),
+        VMSTATE_TIMER_PTR(tx_timer, Stm32F7xxUart),
+        VMSTATE_INT32(curr_irq_level, Stm32F7xxUart),
+        VMSTATE_UINT8_ARRAY(rcv_char_buf, Stm32F7xxUart, USART_RCV_BUF_LEN),
+        VMSTATE_UINT32(rcv_char_bytes, Stm32F7xxUart),
+        VMSTATE_UINT32_V(rcv_char_head, Stm32F7xxUart, 2),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static Property stm32f7xx_uart_properties[] = {
     DEFINE_PROP_PERIPH_T("periph", Stm32F7xxUart, periph, STM32_PERIPH_UNDEFINED),
     DEFINE_PROP_PTR("stm32_rcc", Stm32F7xxUart, stm32_rcc_prop),
     DEFINE_PROP_PTR("stm32_gpio", Stm32F7xxUart, stm32_gpio_prop),
     DEFINE_PROP_PTR("stm32_afio", Stm32F7xxUart, stm32_afio_prop),
     DEFINE_PROP_PTR("stm32_check_tx_pin_callback", Stm32F7xxUart, check_tx_pin_prop),
+    DEFINE_PROP_BOOL("baud-delay", Stm32F7xxUart, baud_delay,
+                     STM32_UART_BAUD_DELAY_DEFAULT),
     DEFINE_PROP_END_OF_LIST()
 };
 
@@ -716,17 +866,24 @@ static void stm32f7xx_uart_class_init(ObjectClass *klass, void *data)
 {
     DeviceClass *dc = DEVICE_CLASS(klass);
     SysBusDeviceClass *k = SYS_BUS_DEVICE_CLASS(klass);
+    Stm32DmaBulkClass *bc = STM32_DMA_BULK_CLASS(klass);
 
     k->init = stm32f7xx_uart_init;
+    bc->transfer = stm32f7xx_uart_dma_bulk;
     dc->reset = stm32f7xx_uart_reset;
     dc->props = stm32f7xx_uart_properties;
+    dc->vmsd = &vmstate_stm32f7xx_uart;
 }
 
 static TypeInfo stm32f7xx_uart_info = {
     .name  = "stm32f7xx-uart",
     .parent = TYPE_SYS_BUS_DEVICE,
     .instance_size  = sizeof(Stm32F7xxUart),
-    .class_init = stm32f7xx_uart_class_init
+    .class_init = stm32f7xx_uart_class_init,
+    .interfaces = (InterfaceInfo[]) {
+        { TYPE_STM32_DMA_BULK },
+        { }
+    }
 };
 
 static void stm32f7xx_uart_register_types(void)
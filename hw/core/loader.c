@@ -333,12 +333,12 @@ const char *load_elf_strerror(int error)
     }
 }
 
-/* return < 0 if error, otherwise the number of bytes loaded in memory */
-int load_elf(const char *filename, uint64_t (*translate_fn)(void *, uint64_t),
-             void *translate_opaque, uint64_t *pentry, uint64_t *lowaddr,
-             uint64_t *highaddr, int big_endian, int elf_machine, int clear_lsb)
+/* Open an ELF file and check that it suits the target.  Returns the file
+ * descriptor, rewound, or an ELF_LOAD_* error. */
+static int elf_open(const char *filename, int big_endian, int *must_swab,
+                    int *elf_class)
 {
-    int fd, data_order, target_data_order, must_swab, ret = ELF_LOAD_FAILED;
+    int fd, data_order, target_data_order, ret = ELF_LOAD_FAILED;
     uint8_t e_ident[EI_NIDENT];
 
     fd = open(filename, O_RDONLY | O_BINARY);
@@ -360,7 +360,7 @@ int load_elf(const char *filename, uint64_t (*translate_fn)(void *, uint64_t),
 #else
     data_order = ELFDATA2LSB;
 #endif
-    must_swab = data_order != e_ident[EI_DATA];
+    *must_swab = data_order != e_ident[EI_DATA];
     if (big_endian) {
         target_data_order = ELFDATA2MSB;
     } else {
@@ -372,8 +372,27 @@ int load_elf(const char *filename, uint64_t (*translate_fn)(void *, uint64_t),
         goto fail;
     }
 
+    *elf_class = e_ident[EI_CLASS];
     lseek(fd, 0, SEEK_SET);
-    if (e_ident[EI_CLASS] == ELFCLASS64) {
+    return fd;
+
+ fail:
+    close(fd);
+    return ret;
+}
+
+/* return < 0 if error, otherwise the number of bytes loaded in memory */
+int load_elf(const char *filename, uint64_t (*translate_fn)(void *, uint64_t),
+             void *translate_opaque, uint64_t *pentry, uint64_t *lowaddr,
+             uint64_t *highaddr, int big_endian, int elf_machine, int clear_lsb)
+{
+    int fd, must_swab, elf_class, ret;
+
+    fd = elf_open(filename, big_endian, &must_swab, &elf_class);
+    if (fd < 0) {
+        return fd;
+    }
+    if (elf_class == ELFCLASS64) {
         ret = load_elf64(filename, fd, translate_fn, translate_opaque, must_swab,
                          pentry, lowaddr, highaddr, elf_machine, clear_lsb);
     } else {
@@ -381,7 +400,27 @@ int load_elf(const char *filename, uint64_t (*translate_fn)(void *, uint64_t),
                          pentry, lowaddr, highaddr, elf_machine, clear_lsb);
     }
 
- fail:
+    close(fd);
+    return ret;
+}
+
+/* Load only the function symbols of an ELF file, for lookup_symbol().
+ * return < 0 if error */
+int load_elf_symbols(const char *filename, int big_endian, int elf_machine,
+                     int clear_lsb)
+{
+    int fd, must_swab, elf_class, ret;
+
+    fd = elf_open(filename, big_endian, &must_swab, &elf_class);
+    if (fd < 0) {
+        return fd;
+    }
+    if (elf_class == ELFCLASS64) {
+        ret = load_elf_symbols64(fd, must_swab, elf_machine, clear_lsb);
+    } else {
+        ret = load_elf_symbols32(fd, must_swab, elf_machine, clear_lsb);
+    }
+
     close(fd);
     return ret;
 }
@@ -36,6 +36,9 @@
 #include "ui/console.h"
 #include "ui/pixel_ops.h"
 #include "hw/ssi.h"
+#include "qemu/bitmap.h"
+#include "ls013b7dh01.h"
+#include "pebble_display_frames.h"
 
 #define NUM_ROWS 168
 #define NUM_COLS 144 // 18 bytes
@@ -51,12 +54,14 @@ typedef enum {
 typedef struct {
     SSISlave ssidev;
     QemuConsole *con;
-    bool redraw;
+    bool redraw;        /* repaint everything on the next update */
+    DECLARE_BITMAP(dirty_lines, NUM_ROWS);  /* lines written since last update */
     uint8_t framebuffer[NUM_ROWS * NUM_COL_BYTES];
     int fbindex;
-    xfer_state_t state;
+    uint8_t state;      /* xfer_state_t */
 
     bool   backlight_enabled;
+    int32_t backlight_level;    /* last PWM level, 0 to 255 */
     float  brightness;
 
     bool   vibrate_on;
@@ -68,6 +73,17 @@ typedef struct {
      * Use the "rotate_display" property to flip it.
      */
     bool rotate_display;
+
+    /* Frame export, see pebble_display_frames.h. Frames are published
+     * as displayed, one byte per pixel, after each Write Line command.
+     */
+    char *frame_shm;
+    uint32_t frame_shm_slots;
+    bool frame_events;
+    PebbleDisplayFrames frames;
+    bool frame_stale;   /* frame no longer matches published */
+    uint8_t published[NUM_ROWS * NUM_COL_BYTES];
+    uint8_t frame[NUM_ROWS * NUM_COLS];
 } lcd_state;
 
 static uint8_t
@@ -76,6 +92,36 @@ bitswap(uint8_t val)
     return ((val * 0x0802LU & 0x22110LU) | (val * 0x8020LU & 0x88440LU)) * 0x10101LU >> 16;
 }
 
+/* Publish the framebuffer as it stands, which is a complete frame since the
+ * controller has no notion of one: the firmware rewrites all the lines that
+ * changed in one Write Line command. */
+static void
+sm_lcd_publish_frame(lcd_state *s)
+{
+    bool changed;
+    int x, y;
+
+    if (!s->frames.shm && !s->frame_events) {
+        return;
+    }
+
+    changed = memcmp(s->published, s->framebuffer, sizeof(s->framebuffer)) != 0;
+    if (changed || s->frame_stale) {
+        memcpy(s->published, s->framebuffer, sizeof(s->framebuffer));
+        for (y = 0; y < NUM_ROWS; y++) {
+            for (x = 0; x < NUM_COLS; x++) {
+                int xr = (s->rotate_display) ? NUM_COLS - 1 - x : x;
+                int yr = (s->rotate_display) ? NUM_ROWS - 1 - y : y;
+                bool on = s->framebuffer[yr * NUM_COL_BYTES + xr / 8] & 1 << (xr % 8);
+                s->frame[y * NUM_COLS + x] = on ? 0xff : 0x00;
+            }
+        }
+        changed |= s->frame_stale;
+        s->frame_stale = false;
+    }
+    pebble_display_frames_publish(&s->frames, s->frame_events, s->frame, changed);
+}
+
 static uint32_t
 sm_lcd_transfer(SSISlave *dev, uint32_t data)
 {
@@ -93,6 +139,7 @@ sm_lcd_transfer(SSISlave *dev, uint32_t data)
         case 0x04: /* Clear Screen */
             memset(s->framebuffer, 0, sizeof(*s->framebuffer));
             s->redraw = true;
+            sm_lcd_publish_frame(s);
             break;
         case 0x00: /* Toggle VCOM */
             break;
@@ -100,12 +147,18 @@ sm_lcd_transfer(SSISlave *dev, uint32_t data)
             /* Simulate confused display controller. */
             memset(s->framebuffer, 0x55, sizeof(*s->framebuffer));
             s->redraw = true;
+            sm_lcd_publish_frame(s);
             break;
         }
         break;
     case LINENO:
         if (data == 0) {
             s->state = COMMAND;
+            sm_lcd_publish_frame(s);
+        } else if (data > NUM_ROWS) {
+            qemu_log_mask(LOG_GUEST_ERROR,
+              "ls013 memory lcd received invalid line number %u\n", data);
+            s->state = COMMAND;
         } else {
             s->fbindex = (data - 1) * NUM_COL_BYTES;
             s->state = DATA;
@@ -123,7 +176,11 @@ sm_lcd_transfer(SSISlave *dev, uint32_t data)
               "ls013 memory lcd received non-zero data in TRAILER\n");
         }
         s->state = LINENO;
-        s->redraw = true;
+        /* fbindex is one past the last byte of the line just written */
+        if (s->fbindex - 1 >= 0 &&
+            s->fbindex - 1 < (int)sizeof(s->framebuffer)) {
+            set_bit((s->fbindex - 1) / NUM_COL_BYTES, s->dirty_lines);
+        }
         break;
     }
     return 0;
@@ -136,6 +193,7 @@ static void sm_lcd_update_display(void *arg)
     uint8_t *d;
     uint32_t colour_on, colour_off, colour;
     int x, y, bpp;
+    unsigned long first, last;
 
     DisplaySurface *surface = qemu_console_surface(s->con);
     bpp = surface_bits_per_pixel(surface);
@@ -174,7 +232,9 @@ static void sm_lcd_update_display(void *arg)
         return;
     }
 
-    if (!s->redraw) {
+    if (s->redraw) {
+        bitmap_fill(s->dirty_lines, NUM_ROWS);
+    } else if (bitmap_empty(s->dirty_lines, NUM_ROWS)) {
         return;
     }
 
@@ -209,34 +269,45 @@ static void sm_lcd_update_display(void *arg)
         return;
     }
 
-    for (y = 0; y < NUM_ROWS; y++) {
-        for (x = 0; x < NUM_COLS; x++) {
-            /* Rotate the display if necessary */
-            int xr = (s->rotate_display) ? NUM_COLS - 1 - x : x;
-            int yr = (s->rotate_display) ? NUM_ROWS - 1 - y : y;
-            bool on = s->framebuffer[yr * NUM_COL_BYTES + xr / 8] & 1 << (xr % 8);
-            colour = on ? colour_on : colour_off;
-            switch(bpp) {
-                case 8:
-                    *((uint8_t *)d) = colour;
-                    d++;
-                    break;
-                case 15:
-                case 16:
-                    *((uint16_t *)d) = colour;
-                    d += 2;
-                    break;
-                case 24:
-                    abort();
-                case 32:
-                    *((uint32_t *)d) = colour;
-                    d += 4;
-                    break;
+    /* Repaint and report each band of consecutive dirty lines, in surface
+     * rows, which run backwards when the display is rotated. */
+    first = find_first_bit(s->dirty_lines, NUM_ROWS);
+    while (first < NUM_ROWS) {
+        last = find_next_zero_bit(s->dirty_lines, NUM_ROWS, first);
+        int y0 = (s->rotate_display) ? NUM_ROWS - last : first;
+        int y1 = (s->rotate_display) ? NUM_ROWS - first : last;
+        d = surface_data(surface) + y0 * surface_stride(surface);
+        for (y = y0; y < y1; y++) {
+            for (x = 0; x < NUM_COLS; x++) {
+                /* Rotate the display if necessary */
+                int xr = (s->rotate_display) ? NUM_COLS - 1 - x : x;
+                int yr = (s->rotate_display) ? NUM_ROWS - 1 - y : y;
+                bool on = s->framebuffer[yr * NUM_COL_BYTES + xr / 8] & 1 << (xr % 8);
+                colour = on ? colour_on : colour_off;
+                switch(bpp) {
+                    case 8:
+                        *((uint8_t *)d) = colour;
+                        d++;
+                        break;
+                    case 15:
+                    case 16:
+                        *((uint16_t *)d) = colour;
+                        d += 2;
+                        break;
+                    case 24:
+                        abort();
+                    case 32:
+                        *((uint32_t *)d) = colour;
+                        d += 4;
+                        break;
+                }
             }
         }
+        dpy_gfx_update(s->con, 0, y0, NUM_COLS, y1 - y0);
+        first = find_next_bit(s->dirty_lines, NUM_ROWS, last);
     }
 
-    dpy_gfx_update(s->con, 0, 0, NUM_COLS, NUM_ROWS);
+    bitmap_zero(s->dirty_lines, NUM_ROWS);
     s->redraw = false;
 }
 
@@ -261,6 +332,16 @@ static void sm_lcd_backlight_enable_cb(void *opaque, int n, int level)
 }
 
 
+// -----------------------------------------------------------------------------
+static float sm_lcd_level_to_brightness(int level)
+{
+    float bright_f = (float)level / 255;
+
+    // Temp hack - the Pebble sets the PWM to 25% for max brightness
+    return MIN(1.0, bright_f * 4);
+}
+
+
 // -----------------------------------------------------------------------------
 // Set brightness, from 0 to 255
 static void sm_lcd_set_backlight_level_cb(void *opaque, int n, int level)
@@ -268,12 +349,10 @@ static void sm_lcd_set_backlight_level_cb(void *opaque, int n, int level)
     lcd_state *s = (lcd_state *)opaque;
     assert(n == 0);
 
-    float bright_f = (float)level / 255;
-
-    // Temp hack - the Pebble sets the PWM to 25% for max brightness
-    float new_setting = MIN(1.0, bright_f * 4);
+    float new_setting = sm_lcd_level_to_brightness(level);
+    s->backlight_level = level;
     if (new_setting != s->brightness) {
-        s->brightness = MIN(1.0, bright_f * 4);
+        s->brightness = new_setting;
         if (s->backlight_enabled) {
             s->redraw = true;
         }
@@ -300,6 +379,7 @@ static void sm_lcd_power_ctl(void *opaque, int n, int level)
         memset(&s->framebuffer, 0, sizeof(s->framebuffer));
         s->redraw = true;
         s->power_on = false;
+        sm_lcd_publish_frame(s);
     }
     s->power_on = !!level;
 }
@@ -319,12 +399,38 @@ static const GraphicHwOps sm_lcd_ops = {
     .invalidate = sm_lcd_invalidate_display,
 };
 
+// -----------------------------------------------------------------------------
+// Stop publishing into the current frame ring and, if name is not NULL, publish into a
+// new one instead. Used by forked clones, which inherit the ring of their parent.
+int sm_lcd_set_frame_shm(DeviceState *dev, const char *name)
+{
+    lcd_state *s = FROM_SSI_SLAVE(lcd_state, SSI_SLAVE(dev));
+
+    pebble_display_frames_close(&s->frames);
+    g_free(s->frame_shm);
+    s->frame_shm = g_strdup(name);
+    if (s->frame_shm &&
+        pebble_display_frames_open(&s->frames, "sm-lcd", s->frame_shm,
+                                   s->frame_shm_slots, NUM_COLS, NUM_ROWS) < 0) {
+        g_free(s->frame_shm);
+        s->frame_shm = NULL;
+        return -1;
+    }
+    return 0;
+}
+
 static int sm_lcd_init(SSISlave *dev)
 {
     lcd_state *s = FROM_SSI_SLAVE(lcd_state, dev);
 
     s->brightness = 0.0;
 
+    if (s->frame_shm &&
+        pebble_display_frames_open(&s->frames, "sm-lcd", s->frame_shm,
+                                   s->frame_shm_slots, NUM_COLS, NUM_ROWS) < 0) {
+        return -1;
+    }
+
     s->con = graphic_console_init(DEVICE(dev), 0, &sm_lcd_ops, s);
     qemu_console_resize(s->con, NUM_COLS, NUM_ROWS);
 
@@ -347,8 +453,46 @@ static int sm_lcd_init(SSISlave *dev)
     return 0;
 }
 
+static int sm_lcd_post_load(void *opaque, int version_id)
+{
+    lcd_state *s = opaque;
+
+    if (s->fbindex < 0 || s->fbindex > sizeof(s->framebuffer)) {
+        return -EINVAL;
+    }
+    s->brightness = sm_lcd_level_to_brightness(s->backlight_level);
+    s->redraw = true;
+    s->frame_stale = true;
+    return 0;
+}
+
+static const VMStateDescription vmstate_sm_lcd = {
+    .name = "sm-lcd",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .post_load = sm_lcd_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_SSI_SLAVE(ssidev, lcd_state),
+        VMSTATE_UINT8_ARRAY(framebuffer, lcd_state, NUM_ROWS * NUM_COL_BYTES),
+        VMSTATE_INT32(fbindex, lcd_state),
+        VMSTATE_UINT8(state, lcd_state),
+        VMSTATE_BOOL(backlight_enabled, lcd_state),
+        VMSTATE_INT32(backlight_level, lcd_state),
+        VMSTATE_BOOL(vibrate_on, lcd_state),
+        VMSTATE_INT32(vibrate_offset, lcd_state),
+        VMSTATE_BOOL(power_on, lcd_state),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static Property sm_lcd_init_properties[] = {
     DEFINE_PROP_BOOL("rotate_display", lcd_state, rotate_display, true),
+
+    // Publish every completed frame into a POSIX shared memory ring (see
+    // pebble_display_frames.h) and/or as a PEBBLE_DISPLAY_FRAME QMP event
+    DEFINE_PROP_STRING("frame-shm", lcd_state, frame_shm),
+    DEFINE_PROP_UINT32("frame-shm-slots", lcd_state, frame_shm_slots, 8),
+    DEFINE_PROP_BOOL("frame-events", lcd_state, frame_events, false),
     DEFINE_PROP_END_OF_LIST()
 };
 
@@ -362,6 +506,7 @@ static void sm_lcd_class_init(ObjectClass *klass, void *data)
     k->cs_polarity = SSI_CS_LOW;
     k->parent_class.reset = sm_lcd_reset;
     dc->props = sm_lcd_init_properties;
+    dc->vmsd = &vmstate_sm_lcd;
 }
 
 static const TypeInfo sm_lcd_info = {
@@ -0,0 +1,6 @@
+#pragma once
+
+#include "qemu-common.h"
+
+// Replace the shared memory frame ring, NULL to stop publishing frames into one
+int sm_lcd_set_frame_shm(DeviceState *dev, const char *name);
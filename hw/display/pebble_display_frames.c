@@ -0,0 +1,143 @@
+/*-
+ * Copyright (c) 2014
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Publishing of completed Pebble display frames, see pebble_display_frames.h
+ */
+
+#ifdef CONFIG_POSIX
+#include <sys/mman.h>
+#endif
+
+#include "qemu-common.h"
+#include "qemu/atomic.h"
+#include "qemu/error-report.h"
+#include "qemu/timer.h"
+#include "qapi/error.h"
+#include "qapi-event.h"
+#include "pebble_display_frames.h"
+
+// -----------------------------------------------------------------------------
+int pebble_display_frames_open(PebbleDisplayFrames *f, const char *owner,
+                               const char *name, uint32_t num_slots,
+                               uint32_t width, uint32_t height)
+{
+#ifdef CONFIG_POSIX
+    PebbleFrameShmHeader *hdr;
+    void *ptr;
+    int fd;
+
+    if (num_slots == 0) {
+        error_report("%s: frame-shm-slots must not be 0", owner);
+        return -1;
+    }
+    f->num_slots = num_slots;
+    f->frame_size = width * height;
+    f->slot_size = ROUND_UP(sizeof(PebbleFrameShmSlot) + f->frame_size, 64);
+    f->shm_size = PEBBLE_FRAME_SHM_SLOTS_OFFSET + (size_t)num_slots * f->slot_size;
+
+    fd = shm_open(name, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        error_report("%s: cannot open shared memory object %s: %s",
+                     owner, name, strerror(errno));
+        return -1;
+    }
+    if (ftruncate(fd, f->shm_size) < 0) {
+        error_report("%s: cannot resize shared memory object %s: %s",
+                     owner, name, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    ptr = mmap(NULL, f->shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        error_report("%s: cannot map shared memory object %s: %s",
+                     owner, name, strerror(errno));
+        return -1;
+    }
+
+    f->shm = ptr;
+    memset(f->shm, 0, f->shm_size);
+    hdr = (PebbleFrameShmHeader *)f->shm;
+    hdr->version = PEBBLE_FRAME_SHM_VERSION;
+    hdr->num_slots = num_slots;
+    hdr->slot_size = f->slot_size;
+    hdr->width = width;
+    hdr->height = height;
+    smp_wmb();
+    atomic_set(&hdr->magic, PEBBLE_FRAME_SHM_MAGIC);
+    return 0;
+#else
+    error_report("%s: frame-shm is not supported on this host", owner);
+    return -1;
+#endif
+}
+
+
+// -----------------------------------------------------------------------------
+void pebble_display_frames_close(PebbleDisplayFrames *f)
+{
+#ifdef CONFIG_POSIX
+    if (f->shm) {
+        munmap(f->shm, f->shm_size);
+        f->shm = NULL;
+    }
+#endif
+}
+
+
+// -----------------------------------------------------------------------------
+// Copy the frame into the next slot of the ring and let QMP clients know about it. See
+// PebbleFrameShmHeader for how readers detect a slot that is being rewritten underneath
+// them.
+void pebble_display_frames_publish(PebbleDisplayFrames *f, bool events,
+                                   const uint8_t *frame, bool changed)
+{
+    PebbleFrameShmHeader *hdr;
+    PebbleFrameShmSlot *slot;
+    int64_t now;
+
+    if (!f->shm && !events) {
+        return;
+    }
+
+    now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    f->seq++;
+
+    if (f->shm) {
+        hdr = (PebbleFrameShmHeader *)f->shm;
+        slot = (PebbleFrameShmSlot *)(f->shm + PEBBLE_FRAME_SHM_SLOTS_OFFSET +
+                   (f->seq % f->num_slots) * f->slot_size);
+
+        atomic_set(&slot->seq, 0);
+        smp_wmb();
+        memcpy(slot + 1, frame, f->frame_size);
+        slot->timestamp_ns = now;
+        smp_wmb();
+        atomic_set(&slot->seq, f->seq);
+        atomic_set(&hdr->seq, f->seq);
+    }
+
+    if (events) {
+        qapi_event_send_pebble_display_frame(f->seq, now, changed, &error_abort);
+    }
+}
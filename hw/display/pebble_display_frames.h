@@ -0,0 +1,59 @@
+#pragma once
+
+#include "qemu-common.h"
+
+// Frame export shared by the Pebble displays (pebble-snowy-display and sm-lcd).
+//
+// Layout of the shared memory frame ring published when a display's "frame-shm" property
+// names a POSIX shared memory object. A PebbleFrameShmHeader at offset 0 is followed,
+// starting at PEBBLE_FRAME_SHM_SLOTS_OFFSET, by num_slots slots of slot_size bytes. Each
+// slot is a PebbleFrameShmSlot followed by height rows of width bytes, one byte per pixel
+// in the color display's framebuffer format (2 bits each of red, green and blue, from the
+// top bit down). The 1-bit sm-lcd publishes 0xff for white and 0x00 for black.
+//
+// Frame number seq goes into slot (seq % num_slots). A reader takes seq from the header,
+// copies the slot out and then checks that the slot's seq still matches; it is cleared
+// while the slot is being rewritten.
+#define PEBBLE_FRAME_SHM_MAGIC         0x464c4250    // "PBLF"
+#define PEBBLE_FRAME_SHM_VERSION       1
+#define PEBBLE_FRAME_SHM_SLOTS_OFFSET  64
+
+typedef struct {
+  uint32_t magic;           // written last, once the rest of the header is valid
+  uint32_t version;
+  uint32_t num_slots;
+  uint32_t slot_size;
+  uint32_t width;
+  uint32_t height;
+  uint64_t seq;             // latest complete frame, 0 before the first one
+} PebbleFrameShmHeader;
+
+typedef struct {
+  uint64_t seq;             // frame number, 0 while the slot is being written
+  int64_t  timestamp_ns;    // QEMU_CLOCK_VIRTUAL when the frame completed
+} PebbleFrameShmSlot;
+
+
+// Per display export state, embedded in the device
+typedef struct {
+  uint64_t seq;             // last frame published
+  uint8_t  *shm;            // PebbleFrameShmHeader, then the slots; NULL if no ring
+  size_t   shm_size;
+  uint32_t num_slots;
+  uint32_t slot_size;
+  uint32_t frame_size;
+} PebbleDisplayFrames;
+
+// Map the ring named name, creating it if needed, for frames of width x height bytes.
+// Errors are reported on behalf of the device called owner.
+int pebble_display_frames_open(PebbleDisplayFrames *f, const char *owner,
+                               const char *name, uint32_t num_slots,
+                               uint32_t width, uint32_t height);
+
+// Stop publishing into the ring, if any
+void pebble_display_frames_close(PebbleDisplayFrames *f);
+
+// Number the complete frame, copy it into the ring if there is one and, if events is
+// set, emit a PEBBLE_DISPLAY_FRAME QMP event for it
+void pebble_display_frames_publish(PebbleDisplayFrames *f, bool events,
+                                   const uint8_t *frame, bool changed);
@@ -57,6 +57,7 @@
 #include "qemu-common.h"
 #include "ui/console.h"
 #include "ui/pixel_ops.h"
+#include "qemu/bitmap.h"
 #include "hw/ssi.h"
 #include "pebble_snowy_display.h"
 #include "pebble_snowy_display_overlays.h"
@@ -137,6 +138,13 @@ typedef enum {
 } PDisplayScene;
 
 
+// Per pixel blend factors: out = (over + dest_factor * in) / 255, per component. Pixels
+// that are neither masked nor covered by the overlay have dest_factor 255 and over 0.
+typedef struct {
+    uint16_t red, green, blue;
+    uint8_t  dest_factor;
+} PSDisplayBlend;
+
 typedef struct {
     SSISlave ssidev;
 
@@ -162,11 +170,15 @@ typedef struct {
     uint8_t row_inverted;
     uint8_t col_inverted;
     uint8_t round_mask;
+    char *frame_shm;                    // POSIX shm object to publish frames into
+    uint32_t frame_shm_slots;
+    bool frame_events;                  // emit PEBBLE_DISPLAY_FRAME per frame
 
     // -------------------------------------------------------------------
     // Other state variables
     QemuConsole   *con;
-    bool          redraw;
+    bool          redraw;               // repaint everything on the next update
+    unsigned long *dirty_rows;          // rows of framebuffer_copy not yet repainted
     uint32_t      bytes_per_row;
     uint32_t      bytes_per_frame;
     uint8_t       *framebuffer;
@@ -174,15 +186,16 @@ typedef struct {
     int           col_index;
     int           row_index;
     bool          backlight_enabled;
+    int32_t       backlight_level;      // last PWM level, 0 to 255
     float         brightness;
     bool          power_on;
 
     /* State variables */
-    PSDisplayState  state;
+    uint8_t         state;              // PSDisplayState
     uint8_t         cmd;
     uint32_t        parameter;
     uint32_t        parameter_byte_offset;
-    PDisplayScene   scene;
+    uint8_t         scene;              // PDisplayScene
 
     bool      sclk_value;
     bool      cs_value;                 // low means asserted
@@ -196,7 +209,21 @@ typedef struct {
     uint32_t      prog_byte_offset;
 
     // Which command set we are emulating
-    PDisplayCmdSet cmd_set;
+    uint8_t       cmd_set;              // PDisplayCmdSet
+
+    // Pixel conversion tables, rebuilt when the surface format or the brightness changes.
+    // See ps_display_update_lut()
+    int                 lut_bpp;
+    int                 lut_max_val;
+    PSDisplayPixelColor lut_rgb[256];   // framebuffer byte -> brightness adjusted color
+    uint32_t            lut[256];       // framebuffer byte -> surface pixel
+    uint32_t            *row;           // num_cols surface pixels being repainted
+
+    // Round mask and overlay folded into one plane, NULL when neither applies
+    PSDisplayBlend      *blend;
+
+    // Frame export, see pebble_display_frames.h
+    PebbleDisplayFrames frames;
 
 } PSDisplayGlobals;
 
@@ -216,9 +243,24 @@ static void ps_set_state(PSDisplayGlobals *s, PSDisplayState new_state) {
 }
 
 // -----------------------------------------------------------------------------
+// Publish the framebuffer for display. Frames are always sent in full, so rather than
+// tracking which rows were written we compare against what was last published and only
+// mark the rows that actually changed.
 static void ps_set_redraw(PSDisplayGlobals *s) {
-    s->redraw = true;
-    memmove(s->framebuffer_copy, s->framebuffer, s->bytes_per_frame);
+    bool changed = false;
+    int y;
+
+    for (y = 0; y < s->num_rows; y++) {
+        uint32_t offset = y * s->bytes_per_row;
+        if (memcmp(s->framebuffer_copy + offset, s->framebuffer + offset, s->bytes_per_row)) {
+            memcpy(s->framebuffer_copy + offset, s->framebuffer + offset, s->bytes_per_row);
+            set_bit(y, s->dirty_rows);
+            changed = true;
+        }
+    }
+
+    pebble_display_frames_publish(&s->frames, s->frame_events, s->framebuffer_copy,
+                                  changed);
 }
 
 
@@ -585,6 +627,58 @@ static void ps_display_cmd_set_2_unscramble_row(PSDisplayGlobals *s, uint32_t ro
 
 static bool newdisp = true;
 
+// -----------------------------------------------------------------------------
+// Called for the data of the current frame before it is stored, notes the start of a
+// new frame. The end of the frame is handled by ps_display_end_of_row/column().
+static void ps_display_frame_data(PSDisplayGlobals *s, uint32_t data)
+{
+    if (newdisp) {
+        DPRINTF("New frame?  -- 0x%02X,  row %d, col %d -- bytes: %u -- cs: %s\n", data, s->row_index, s->col_index, display_bytes, s->cs_value ? "Not CS" : "CS");
+        newdisp = false;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Reached end of row, unscramble the one we just received and go onto the next row
+static void ps_display_end_of_row(PSDisplayGlobals *s)
+{
+    ps_display_cmd_set_2_unscramble_row(s, s->row_index);
+    s->col_index = s->num_border_cols;
+    bool got_last_byte;
+    if (s->row_inverted) {
+        s->row_index--;
+        got_last_byte = (s->row_index < s->num_border_rows);
+    } else {
+        s->row_index++;
+        got_last_byte = (s->row_index >= s->num_rows - s->num_border_rows);
+    }
+    if (got_last_byte) {
+        DPRINTF("Got last byte in frame (row) row %d, col %d -- bytes: %u\n",
+                s->row_index, s->col_index, display_bytes);
+        ps_set_state(s, PSDISPLAYSTATE_ACCEPTING_CMD);
+        ps_set_redraw(s);
+        newdisp = true;
+        ++frameno;
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// Reached top of column, unscramble the one we just received and go onto the next column
+static void ps_display_end_of_column(PSDisplayGlobals *s)
+{
+    ps_display_cmd_set_2_unscramble_column(s, s->col_index);
+    s->row_index = s->num_rows - s->num_border_rows - 1;
+    s->col_index += 1;
+    if (s->col_index >= s->num_cols - s->num_border_cols) {
+        DPRINTF("Got last byte in frame (col) row %d, col %d\n", s->row_index, s->col_index);
+        ps_set_state(s, PSDISPLAYSTATE_ACCEPTING_CMD);
+        ps_set_redraw(s);
+        newdisp = true;
+        ++frameno;
+    }
+}
+
 // -----------------------------------------------------------------------------
 static uint32_t ps_display_transfer(SSISlave *dev, uint32_t data)
 {
@@ -658,52 +752,19 @@ static uint32_t ps_display_transfer(SSISlave *dev, uint32_t data)
         break;
 
     case PSDISPLAYSTATE_ACCEPTING_FRAME_DATA:
-        if (newdisp) {
-            DPRINTF("New frame?  -- 0x%02X,  row %d, col %d -- bytes: %u -- cs: %s\n", data, s->row_index, s->col_index, display_bytes, s->cs_value ? "Not CS" : "CS");
-            newdisp = false;
-        }
+        ps_display_frame_data(s, data);
         s->framebuffer[s->row_index * s->bytes_per_row + s->col_index] = data;
         if (s->row_major) {
             // We get sent one row at a time
             s->col_index++;
             if (s->col_index >= s->num_cols - s->num_border_cols) {
-                // Reached end of row, unscramble the one we just received and go onto the
-                // next row
-                ps_display_cmd_set_2_unscramble_row(s, s->row_index);
-                s->col_index = s->num_border_cols;
-                bool got_last_byte;
-                if (s->row_inverted) {
-                    s->row_index--;
-                    got_last_byte = (s->row_index < s->num_border_rows);
-                } else {
-                    s->row_index++;
-                    got_last_byte = (s->row_index >= s->num_rows - s->num_border_rows);
-                }
-                if (got_last_byte) {
-                    DPRINTF("Got last byte in frame (row) row %d, col %d -- bytes: %u\n",
-                            s->row_index, s->col_index, display_bytes);
-                    ps_set_state(s, PSDISPLAYSTATE_ACCEPTING_CMD);
-                    ps_set_redraw(s);
-                    newdisp = true;
-                    ++frameno;
-                }
+                ps_display_end_of_row(s);
             }
         } else {
           // We get sent one column at a time
           s->row_index--;
           if (s->row_index < s->num_border_rows) {
-              // Reached top of column, unscramble the one we just received and go onto the
-              // next column
-              ps_display_cmd_set_2_unscramble_column(s, s->col_index);
-              s->row_index = s->num_rows - s->num_border_rows - 1;
-              s->col_index += 1;
-              if (s->col_index >= s->num_cols - s->num_border_cols) {
-                  DPRINTF("Got last byte in frame (col) row %d, col %d\n", s->row_index, s->col_index);
-                  ps_set_state(s, PSDISPLAYSTATE_ACCEPTING_CMD);
-                  ps_set_redraw(s);
-                  newdisp = true;
-                  ++frameno;
-              }
+              ps_display_end_of_column(s);
           }
         }
         break;
@@ -712,6 +773,47 @@ static uint32_t ps_display_transfer(SSISlave *dev, uint32_t data)
 }
 
 
+// -----------------------------------------------------------------------------
+// Frame data arrives from DMA as one large SPI block. Copy it a row (or column) at a
+// time instead of going through the byte-wise state machine; everything else, including
+// the commands in between frames, is handed to ps_display_transfer().
+static void ps_display_transfer_bulk(SSISlave *dev, const uint8_t *buf, int len)
+{
+    PSDisplayGlobals *s = FROM_SSI_SLAVE(PSDisplayGlobals, dev);
+    int n, i;
+
+    while (len > 0) {
+        if (s->cs_value || s->state != PSDISPLAYSTATE_ACCEPTING_FRAME_DATA) {
+            ps_display_transfer(dev, *buf++);
+            len--;
+            continue;
+        }
+
+        ps_display_frame_data(s, *buf);
+        if (s->row_major) {
+            n = MIN(len, s->num_cols - s->num_border_cols - s->col_index);
+            memcpy(&s->framebuffer[s->row_index * s->bytes_per_row + s->col_index], buf, n);
+            s->col_index += n;
+            if (s->col_index >= s->num_cols - s->num_border_cols) {
+                ps_display_end_of_row(s);
+            }
+        } else {
+            n = MIN(len, s->row_index - s->num_border_rows + 1);
+            for (i = 0; i < n; i++) {
+                s->framebuffer[(s->row_index - i) * s->bytes_per_row + s->col_index] = buf[i];
+            }
+            s->row_index -= n;
+            if (s->row_index < s->num_border_rows) {
+                ps_display_end_of_column(s);
+            }
+        }
+        display_bytes += n;
+        buf += n;
+        len -= n;
+    }
+}
+
+
 // -----------------------------------------------------------------------------
 // This function maps an 8 bit value from the frame buffer into red, green, and blue
 // components
@@ -743,12 +845,144 @@ static PSDisplayPixelColor ps_display_get_rgb(PSDisplayGlobals *s, uint8_t pixel
 }
 
 
+// -----------------------------------------------------------------------------
+static uint32_t ps_display_pack_pixel(PSDisplayPixelColor c, int bpp)
+{
+    switch (bpp) {
+    case 8:
+        return rgb_to_pixel8(c.red, c.green, c.blue);
+    case 15:
+        return rgb_to_pixel15(c.red, c.green, c.blue);
+    case 16:
+        return rgb_to_pixel16(c.red, c.green, c.blue);
+    case 24:
+        return rgb_to_pixel24(c.red, c.green, c.blue);
+    case 32:
+        return rgb_to_pixel32(c.red, c.green, c.blue);
+    }
+    return 0;
+}
+
+
+// -----------------------------------------------------------------------------
+// Only the top 6 bits of a framebuffer byte carry color, so the whole conversion for a
+// given brightness and surface format fits in a 256 entry table.
+static void ps_display_update_lut(PSDisplayGlobals *s, int bpp)
+{
+    float brightness = s->backlight_enabled ? s->brightness : 0.0;
+    int max_val = 170 + (255 - 170) * brightness;
+    int i;
+
+    if (s->lut_bpp == bpp && s->lut_max_val == max_val) {
+        return;
+    }
+    for (i = 0; i < 256; i++) {
+        s->lut_rgb[i] = ps_display_get_rgb(s, i);
+        s->lut[i] = ps_display_pack_pixel(s->lut_rgb[i], bpp);
+    }
+    s->lut_bpp = bpp;
+    s->lut_max_val = max_val;
+}
+
+
+// -----------------------------------------------------------------------------
+// Fold the round mask and the spalding overlay into a single plane of blend factors.
+// A masked pixel is black, so it blends like a pixel whose own color does not count.
+static void ps_display_init_blend(PSDisplayGlobals *s)
+{
+    const PSDisplayPixelColorWithAlpha *overlay = g_spalding_overlay;
+    uint8_t *pixel_mask = get_pixel_mask();
+    int x, y;
+
+    if (!s->round_mask) {
+        return;
+    }
+
+    s->blend = g_new(PSDisplayBlend, s->num_rows * s->num_cols);
+    for (y = 0; y < s->num_rows; y++) {
+        // Compute the vertical distance from top or bottom edge, whichever is closest
+        int vert_distance = y;
+        if (vert_distance >= s->num_rows/2) {
+          vert_distance = s->num_rows - 1 - y ;
+        }
+        int mask_width = pixel_mask[vert_distance];
+
+        for (x = 0; x < s->num_cols; x++) {
+            const PSDisplayPixelColorWithAlpha o = overlay[y * s->bytes_per_row + x];
+            PSDisplayBlend *b = &s->blend[y * s->num_cols + x];
+            b->red = o.alpha * o.color.red;
+            b->green = o.alpha * o.color.green;
+            b->blue = o.alpha * o.color.blue;
+            b->dest_factor = 255 - o.alpha;
+            if (x < mask_width || x >= s->num_cols - mask_width) {
+                b->dest_factor = 0;
+            }
+        }
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+static void ps_display_blend_row(PSDisplayGlobals *s, uint32_t *row, const uint8_t *src,
+                                 const PSDisplayBlend *blend, int bpp)
+{
+    int x;
+
+    for (x = 0; x < s->num_cols; x++) {
+        const PSDisplayBlend *b = &blend[x];
+        if (b->dest_factor == 255) {
+            row[x] = s->lut[src[x]];
+        } else {
+            const PSDisplayPixelColor in = s->lut_rgb[src[x]];
+            PSDisplayPixelColor c;
+            c.red = MIN(255, (b->red + b->dest_factor * in.red) / 255);
+            c.green = MIN(255, (b->green + b->dest_factor * in.green) / 255);
+            c.blue = MIN(255, (b->blue + b->dest_factor * in.blue) / 255);
+            row[x] = ps_display_pack_pixel(c, bpp);
+        }
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// Write a row of packed pixels to the surface. The format switch is outside the pixel
+// loops so that each of them is a plain narrowing copy the compiler can vectorize.
+static void ps_display_store_row(uint8_t *d, const uint32_t *row, int n, int bpp)
+{
+    int x;
+
+    switch (bpp) {
+    case 8:
+        for (x = 0; x < n; x++) {
+            d[x] = row[x];
+        }
+        break;
+    case 15:
+    case 16:
+        for (x = 0; x < n; x++) {
+            ((uint16_t *)d)[x] = row[x];
+        }
+        break;
+    case 24:
+        for (x = 0; x < n; x++) {
+            *d++ = (row[x] & 0x00FF0000) >> 16;
+            *d++ = (row[x] & 0x0000FF00) >> 8;
+            *d++ = (row[x] & 0x000000FF);
+        }
+        break;
+    case 32:
+        memcpy(d, row, n * sizeof(uint32_t));
+        break;
+    }
+}
+
+
 // -----------------------------------------------------------------------------
 static void ps_display_update_display(void *arg)
 {
     PSDisplayGlobals *s = arg;
     uint8_t *d;
-    int x, y, bpp, rgb_value;
+    int x, y, bpp;
 
     DisplaySurface *surface = qemu_console_surface(s->con);
     bpp = surface_bits_per_pixel(surface);
@@ -787,67 +1021,35 @@ static void ps_display_update_display(void *arg)
         return;
     }
 
-    if (!s->redraw) {
+    if (s->redraw) {
+        bitmap_fill(s->dirty_rows, s->num_rows);
+    } else if (bitmap_empty(s->dirty_rows, s->num_rows)) {
         return;
     }
 
-    const bool is_spalding =  s->round_mask;
-    const PSDisplayPixelColorWithAlpha *overlay = is_spalding ? g_spalding_overlay : NULL;
-    uint8_t *pixel_mask = get_pixel_mask();
-    for (y = 0; y < s->num_rows; y++) {
-        for (x = 0; x < s->num_cols; x++) {
-          uint32_t offset = y * s->bytes_per_row + x;
-          uint8_t pixel = s->framebuffer_copy[offset];
-            if (s->round_mask) {
-                // Compute the vertical distance from top or bottom edge, whichever is closest
-                int vert_distance = y;
-                if (vert_distance >= s->num_rows/2) {
-                  vert_distance = s->num_rows - 1 - y ;
-                }
-                int mask_width = pixel_mask[vert_distance];
-                if (x < mask_width || x >= s->num_cols - mask_width) {
-                  pixel = 0;
+    ps_display_update_lut(s, bpp);
+
+    // Repaint and report each band of consecutive dirty rows
+    uint32_t *row = s->row;
+    int first = find_first_bit(s->dirty_rows, s->num_rows);
+    while (first < s->num_rows) {
+        int last = find_next_zero_bit(s->dirty_rows, s->num_rows, first);
+        for (y = first; y < last; y++) {
+            const uint8_t *src = &s->framebuffer_copy[y * s->bytes_per_row];
+            if (s->blend) {
+                ps_display_blend_row(s, row, src, &s->blend[y * s->num_cols], bpp);
+            } else {
+                for (x = 0; x < s->num_cols; x++) {
+                    row[x] = s->lut[src[x]];
                 }
             }
-
-            PSDisplayPixelColor color = ps_display_get_rgb(s, pixel);
-            if (overlay) {
-              const PSDisplayPixelColorWithAlpha blend_color = overlay[offset];
-              const int32_t factor_over = blend_color.alpha;
-              const int32_t factor_dest = 255 - blend_color.alpha;
-              color.red = MIN(255, (factor_over * blend_color.color.red + factor_dest * color.red) / 255);
-              color.green = MIN(255,(factor_over * blend_color.color.green + factor_dest * color.green) / 255);
-              color.blue = MIN(255, (factor_over * blend_color.color.blue + factor_dest * color.blue) / 255);
-            }
-
-            switch(bpp) {
-            case 8:
-                *((uint8_t *)d) = rgb_to_pixel8(color.red, color.green, color.blue);
-                d++;
-                break;
-            case 15:
-                *((uint16_t *)d) = rgb_to_pixel15(color.red, color.green, color.blue);;
-                d += 2;
-                break;
-            case 16:
-                *((uint16_t *)d) = rgb_to_pixel16(color.red, color.green, color.blue);;
-                d += 2;
-                break;
-            case 24:
-                rgb_value = rgb_to_pixel24(color.red, color.green, color.blue);
-                *d++ = (rgb_value & 0x00FF0000) >> 16;
-                *d++ = (rgb_value & 0x0000FF00) >> 8;
-                *d++ = (rgb_value & 0x000000FF);
-                break;
-            case 32:
-                *((uint32_t *)d) = rgb_to_pixel32(color.red, color.green, color.blue);;
-                d += 4;
-                break;
-            }
+            ps_display_store_row(d + y * surface_stride(surface), row, s->num_cols, bpp);
         }
+        dpy_gfx_update(s->con, 0, first, s->num_cols, last - first);
+        first = find_next_bit(s->dirty_rows, s->num_rows, last);
     }
 
-    dpy_gfx_update(s->con, 0, 0, s->num_cols, s->num_rows);
+    bitmap_zero(s->dirty_rows, s->num_rows);
     s->redraw = false;
 }
 
@@ -940,6 +1142,16 @@ static void ps_display_backlight_enable_cb(void *opaque, int n, int level)
 }
 
 
+// -----------------------------------------------------------------------------
+static float ps_display_level_to_brightness(int level)
+{
+    float bright_f = (float)level / 255;
+
+    // Temp hack - the Pebble sets the PWM to 25% for max brightness
+    return MIN(1.0, bright_f * 4);
+}
+
+
 // -----------------------------------------------------------------------------
 // Set brightness, from 0 to 255
 static void ps_display_set_backlight_level_cb(void *opaque, int n, int level)
@@ -947,12 +1159,10 @@ static void ps_display_set_backlight_level_cb(void *opaque, int n, int level)
     PSDisplayGlobals *s = (PSDisplayGlobals *)opaque;
     assert(n == 0);
 
-    float bright_f = (float)level / 255;
-
-    // Temp hack - the Pebble sets the PWM to 25% for max brightness
-    float new_setting = MIN(1.0, bright_f * 4);
+    float new_setting = ps_display_level_to_brightness(level);
+    s->backlight_level = level;
     if (new_setting != s->brightness) {
-        s->brightness = MIN(1.0, bright_f * 4);
+        s->brightness = new_setting;
         if (s->backlight_enabled) {
             s->redraw = true;
         }
@@ -994,6 +1204,27 @@ static void ps_display_reset(DeviceState *dev)
 }
 
 
+// -----------------------------------------------------------------------------
+// Stop publishing into the current frame ring and, if name is not NULL, publish into a
+// new one instead. Used by forked clones, which inherit the ring of their parent.
+int ps_display_set_frame_shm(DeviceState *dev, const char *name)
+{
+    PSDisplayGlobals *s = FROM_SSI_SLAVE(PSDisplayGlobals, SSI_SLAVE(dev));
+
+    pebble_display_frames_close(&s->frames);
+    g_free(s->frame_shm);
+    s->frame_shm = g_strdup(name);
+    if (s->frame_shm &&
+        pebble_display_frames_open(&s->frames, "pebble-snowy-display", s->frame_shm,
+                                   s->frame_shm_slots, s->num_cols, s->num_rows) < 0) {
+        g_free(s->frame_shm);
+        s->frame_shm = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+
 // -----------------------------------------------------------------------------
 static int ps_display_init(SSISlave *dev)
 {
@@ -1007,8 +1238,18 @@ static int ps_display_init(SSISlave *dev)
     // Allocate the frame buffer
     s->bytes_per_row = s->num_cols;
     s->bytes_per_frame = s->bytes_per_row * s->num_rows;
-    s->framebuffer = g_malloc(s->num_rows * s->bytes_per_row);
-    s->framebuffer_copy = g_malloc(s->num_rows * s->bytes_per_row);
+    s->framebuffer = g_malloc0(s->num_rows * s->bytes_per_row);
+    s->framebuffer_copy = g_malloc0(s->num_rows * s->bytes_per_row);
+    s->dirty_rows = bitmap_new(s->num_rows);
+    s->row = g_new(uint32_t, s->num_cols);
+
+    ps_display_init_blend(s);
+
+    if (s->frame_shm &&
+        pebble_display_frames_open(&s->frames, "pebble-snowy-display", s->frame_shm,
+                                   s->frame_shm_slots, s->num_cols, s->num_rows) < 0) {
+        return -1;
+    }
 
     s->con = graphic_console_init(DEVICE(dev), 0, &ps_display_ops, s);
     qemu_console_resize(s->con, s->num_cols, s->num_rows);
@@ -1040,6 +1281,54 @@ static int ps_display_init(SSISlave *dev)
     return 0;
 }
 
+// -----------------------------------------------------------------------------
+static int ps_display_post_load(void *opaque, int version_id)
+{
+    PSDisplayGlobals *s = opaque;
+
+    if (s->prog_byte_offset > sizeof(s->prog_header)) {
+        return -EINVAL;
+    }
+    s->brightness = ps_display_level_to_brightness(s->backlight_level);
+
+    // framebuffer_copy holds what was on screen when the state was saved
+    s->redraw = true;
+    return 0;
+}
+
+static const VMStateDescription vmstate_ps_display = {
+    .name = "pebble-snowy-display",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .post_load = ps_display_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_SSI_SLAVE(ssidev, PSDisplayGlobals),
+        VMSTATE_VBUFFER_UINT32(framebuffer, PSDisplayGlobals, 1, NULL, 0,
+                               bytes_per_frame),
+        VMSTATE_VBUFFER_UINT32(framebuffer_copy, PSDisplayGlobals, 1, NULL, 0,
+                               bytes_per_frame),
+        VMSTATE_INT32(col_index, PSDisplayGlobals),
+        VMSTATE_INT32(row_index, PSDisplayGlobals),
+        VMSTATE_BOOL(backlight_enabled, PSDisplayGlobals),
+        VMSTATE_INT32(backlight_level, PSDisplayGlobals),
+        VMSTATE_BOOL(power_on, PSDisplayGlobals),
+        VMSTATE_UINT8(state, PSDisplayGlobals),
+        VMSTATE_UINT8(cmd, PSDisplayGlobals),
+        VMSTATE_UINT32(parameter, PSDisplayGlobals),
+        VMSTATE_UINT32(parameter_byte_offset, PSDisplayGlobals),
+        VMSTATE_UINT8(scene, PSDisplayGlobals),
+        VMSTATE_BOOL(sclk_value, PSDisplayGlobals),
+        VMSTATE_BOOL(cs_value, PSDisplayGlobals),
+        VMSTATE_BOOL(vibrate_on, PSDisplayGlobals),
+        VMSTATE_INT32(vibrate_offset, PSDisplayGlobals),
+        VMSTATE_UINT8_ARRAY(prog_header, PSDisplayGlobals, 256),
+        VMSTATE_UINT32(prog_byte_offset, PSDisplayGlobals),
+        VMSTATE_UINT8(cmd_set, PSDisplayGlobals),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+
 // -----------------------------------------------------------------------------
 static Property ps_display_init_properties[] = {
     DEFINE_PROP_PTR("done_output", PSDisplayGlobals, vdone_output),
@@ -1057,6 +1346,12 @@ static Property ps_display_init_properties[] = {
     DEFINE_PROP_UINT8("col_inverted", PSDisplayGlobals, col_inverted, 0),
     DEFINE_PROP_UINT8("round_mask", PSDisplayGlobals, round_mask, 0),
 
+    // Publish every completed frame into a POSIX shared memory ring (see
+    // pebble_display_frames.h) and/or as a PEBBLE_DISPLAY_FRAME QMP event
+    DEFINE_PROP_STRING("frame-shm", PSDisplayGlobals, frame_shm),
+    DEFINE_PROP_UINT32("frame-shm-slots", PSDisplayGlobals, frame_shm_slots, 8),
+    DEFINE_PROP_BOOL("frame-events", PSDisplayGlobals, frame_events, false),
+
     DEFINE_PROP_END_OF_LIST()
 };
 
@@ -1068,8 +1363,10 @@ static void ps_display_class_init(ObjectClass *klass, void *data)
     SSISlaveClass *k = SSI_SLAVE_CLASS(klass);
 
     dc->props = ps_display_init_properties;
+    dc->vmsd = &vmstate_ps_display;
     k->init = ps_display_init;
     k->transfer = ps_display_transfer;
+    k->transfer_bulk = ps_display_transfer_bulk;
     k->cs_polarity = SSI_CS_LOW;
     k->set_cs = ps_display_set_cs;
     k->parent_class.reset = ps_display_reset;
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "qemu-common.h"
+#include "pebble_display_frames.h"
 
 typedef struct {
   uint8_t red, green, blue;
@@ -10,3 +11,7 @@ typedef struct {
   uint8_t alpha;
   PSDisplayPixelColor color;
 } PSDisplayPixelColorWithAlpha;
+
+
+// Replace the shared memory frame ring, NULL to stop publishing frames into one
+int ps_display_set_frame_shm(DeviceState *dev, const char *name);
@@ -51,7 +51,6 @@ static inline bool gic_has_groups(GICState *s)
     return s->revision == 2 || s->security_extn;
 }
 
-/* TODO: Many places that call this routine could be optimized.  */
 /* Update interrupt status after enabled or pending bits have been changed.  */
 void gic_update(GICState *s)
 {
@@ -73,14 +72,28 @@ void gic_update(GICState *s)
         }
         best_prio = 0x100;
         best_irq = 1023;
-        for (irq = 0; irq < s->num_irq; irq++) {
-            if (GIC_TEST_ENABLED(irq, cm) && gic_test_pending(s, irq, cm) &&
-                (irq < GIC_INTERNAL || GIC_TARGET(irq) & cm)) {
+        if (s->revision == REV_NVIC) {
+            /* Uniprocessor, and nvic_ready already holds exactly the lines
+             * that are enabled and pending: usually zero or one of them.
+             */
+            for (irq = find_first_bit(s->nvic_ready, s->num_irq);
+                 irq < s->num_irq;
+                 irq = find_next_bit(s->nvic_ready, s->num_irq, irq + 1)) {
                 if (GIC_GET_PRIORITY(irq, cpu) < best_prio) {
                     best_prio = GIC_GET_PRIORITY(irq, cpu);
                     best_irq = irq;
                 }
             }
+        } else {
+            for (irq = 0; irq < s->num_irq; irq++) {
+                if (GIC_TEST_ENABLED(irq, cm) && gic_test_pending(s, irq, cm) &&
+                    (irq < GIC_INTERNAL || GIC_TARGET(irq) & cm)) {
+                    if (GIC_GET_PRIORITY(irq, cpu) < best_prio) {
+                        best_prio = GIC_GET_PRIORITY(irq, cpu);
+                        best_irq = irq;
+                    }
+                }
+            }
         }
 
         irq_level = fiq_level = 0;
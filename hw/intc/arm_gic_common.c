@@ -20,6 +20,7 @@
 
 #include "gic_internal.h"
 #include "hw/arm/linux-boot-if.h"
+#include "qemu/bitmap.h"
 
 static void gic_pre_save(void *opaque)
 {
@@ -31,11 +32,22 @@ static void gic_pre_save(void *opaque)
     }
 }
 
+static void gic_nvic_rebuild_ready(GICState *s)
+{
+    int i;
+
+    bitmap_zero(s->nvic_ready, GIC_MAXIRQ);
+    for (i = 0; i < s->num_irq; i++) {
+        gic_nvic_sync_ready(s, i);
+    }
+}
+
 static int gic_post_load(void *opaque, int version_id)
 {
     GICState *s = (GICState *)opaque;
     ARMGICCommonClass *c = ARM_GIC_COMMON_GET_CLASS(s);
 
+    gic_nvic_rebuild_ready(s);
     if (c->post_load) {
         c->post_load(s);
     }
@@ -181,6 +193,7 @@ static void arm_gic_common_reset(DeviceState *dev)
     }
 
     memset(s->irq_state, 0, GIC_MAXIRQ * sizeof(gic_irq_state));
+    bitmap_zero(s->nvic_ready, GIC_MAXIRQ);
     for (i = 0 ; i < s->num_cpu; i++) {
         if (s->revision == REV_11MPCORE) {
             s->priority_mask[i] = 0xf0;
@@ -45,6 +45,7 @@ typedef struct {
     uint32_t num_irq;
     qemu_irq sysresetreq;
     uint32_t scr_reg;      /* contents of SCR register */
+    uint32_t demcr;        /* contents of DEMCR register */
     /* set true if we executed a WFI instruction with the SLEEPDEEP bit set in the SCR */
     bool in_deep_sleep;
     // Set true if we execute a WFI instruction with both SLEEPDEEP bit set in the SCR
@@ -95,6 +96,21 @@ static const uint8_t nvic_id[] = {
 #define SYSTICK_COUNTFLAG (1 << 16)
 
 int system_clock_scale;
+uint32_t system_clock_freq;
+static NotifierList system_clock_notifiers =
+    NOTIFIER_LIST_INITIALIZER(system_clock_notifiers);
+
+void system_clock_set_freq(uint32_t freq)
+{
+    notifier_list_notify(&system_clock_notifiers, &freq);
+    system_clock_freq = freq;
+    system_clock_scale = get_ticks_per_sec() / freq;
+}
+
+void system_clock_add_change_notifier(Notifier *n)
+{
+    notifier_list_add(&system_clock_notifiers, n);
+}
 
 /* Conversion factor from qemu timer to SysTick frequencies.  */
 static inline int64_t systick_scale(nvic_state *s)
@@ -142,6 +158,23 @@ static void systick_timer_tick(void * opaque)
     }
 }
 
+/* The SysTick clock is gated in deep sleep. Not keeping its timer armed also
+ * leaves the wake up source as the next virtual clock deadline, which is what
+ * -idle-warp skips to. */
+static void nvic_enter_deep_sleep(nvic_state *s)
+{
+    s->in_deep_sleep = true;
+    timer_del(s->systick.timer);
+}
+
+static void nvic_exit_deep_sleep(nvic_state *s)
+{
+    if (s->in_deep_sleep) {
+        s->in_deep_sleep = false;
+        systick_reload(s, 1);
+    }
+}
+
 static void systick_reset(nvic_state *s)
 {
     s->systick.control = 0;
@@ -187,7 +220,7 @@ int armv7m_nvic_acknowledge_irq(void *opaque)
      * not or masked due to BASEPRI. This would involved moving this reset of deep sleep
      * mode higher up the call chain, perhaps in arm_gic.c, where we get notification of
      * interrupts that change to pending state.  */
-    s->in_deep_sleep = false;
+    nvic_exit_deep_sleep(s);
     if (s->in_standby) {
         qemu_set_irq(s->power_out, true);
         s->in_standby = false;
@@ -215,7 +248,7 @@ void armv7m_nvic_cpu_executed_wfi(void *opaque)
 {
     nvic_state *s = (nvic_state *)opaque;
     if ((s->scr_reg & SCR_REG_SLEEPDEEP) != 0) {
-        s->in_deep_sleep = true;
+        nvic_enter_deep_sleep(s);
         if (s->stm32_pwr_prop && f2xx_pwr_powerdown_deepsleep(s->stm32_pwr_prop)) {
             s->in_standby = true;
             // For now, this is an easy way to disable nearly all interrupts from waking up
@@ -238,7 +271,7 @@ static void nvic_wakeup_in_cb(void *opaque, int n, int level)
     // If we are in standby mode, wake up the CPU
     if (level && s->in_standby) {
         s->in_standby = false;
-        s->in_deep_sleep = false;
+        nvic_exit_deep_sleep(s);
         qemu_set_irq(s->power_out, true);
         qemu_set_irq(s->cpu_wakeup_out, level);
     } else if (!level) {
@@ -419,7 +452,9 @@ static uint32_t nvic_readl(nvic_state *s, uint32_t offset)
         val <<= 16;
         val |= cpu->env.pmsav7.drsr[cpu->env.cp15.c6_rgnr];
         return val;
-        /* TODO: Implement debug registers.  */
+    case 0xdfc: /* Debug Exception and Monitor Control.  */
+        return s->demcr;
+        /* TODO: Implement the other debug registers.  */
     default:
         qemu_log_mask(LOG_GUEST_ERROR, "NVIC: Bad read offset 0x%x\n", offset);
         return 0;
@@ -471,12 +506,14 @@ static void nvic_writel(nvic_state *s, uint32_t offset, uint32_t value)
             armv7m_nvic_set_pending(s, ARMV7M_EXCP_PENDSV);
         } else if (value & (1 << 27)) {
             s->gic.irq_state[ARMV7M_EXCP_PENDSV].pending = 0;
+            gic_nvic_sync_ready(&s->gic, ARMV7M_EXCP_PENDSV);
             gic_update(&s->gic);
         }
         if (value & (1 << 26)) {
             armv7m_nvic_set_pending(s, ARMV7M_EXCP_SYSTICK);
         } else if (value & (1 << 25)) {
             s->gic.irq_state[ARMV7M_EXCP_SYSTICK].pending = 0;
+            gic_nvic_sync_ready(&s->gic, ARMV7M_EXCP_SYSTICK);
             gic_update(&s->gic);
         }
         break;
@@ -511,6 +548,9 @@ static void nvic_writel(nvic_state *s, uint32_t offset, uint32_t value)
         s->gic.irq_state[ARMV7M_EXCP_MEM].enabled = (value & (1 << 16)) != 0;
         s->gic.irq_state[ARMV7M_EXCP_BUS].enabled = (value & (1 << 17)) != 0;
         s->gic.irq_state[ARMV7M_EXCP_USAGE].enabled = (value & (1 << 18)) != 0;
+        gic_nvic_sync_ready(&s->gic, ARMV7M_EXCP_MEM);
+        gic_nvic_sync_ready(&s->gic, ARMV7M_EXCP_BUS);
+        gic_nvic_sync_ready(&s->gic, ARMV7M_EXCP_USAGE);
         break;
     case 0xd28: /* Configurable Fault Status.  */
         cpu = ARM_CPU(current_cpu);
@@ -559,10 +599,10 @@ static void nvic_writel(nvic_state *s, uint32_t offset, uint32_t value)
         } else {
             cpu->env.cp15.sctlr_ns &= ~SCTLR_BR;
         }
-        /* This may enable/disable the MMU, so do a TLB flush.  */
+        /* This may enable/disable the MMU, so the TLB needs a flush.  */
         DPRINTF("writel:mpu_ctrl now: %08X\n", cpu->env.v7m.mpu_ctrl);
         DPRINTF("writel:sctlr_ns now: %016llX\n", cpu->env.cp15.sctlr_ns);
-        tlb_flush(CPU(cpu), 1);
+        arm_v7m_mpu_changed(cpu);
         break;
     case 0xd98: /* MPU_RNR.  */
         cpu = ARM_CPU(current_cpu);
@@ -592,7 +632,7 @@ static void nvic_writel(nvic_state *s, uint32_t offset, uint32_t value)
         value &= ~0x1f;
         cpu->env.pmsav7.drbar[cpu->env.cp15.c6_rgnr] = value;
         DPRINTF("writel:mpu_rbar (%04X), region(%u) now %08X\n", offset, cpu->env.cp15.c6_rgnr, cpu->env.pmsav7.drbar[cpu->env.cp15.c6_rgnr]);
-        tlb_flush(CPU(cpu), 1); /* Mappings may have changed - purge! */
+        arm_v7m_mpu_changed(cpu); /* Mappings may have changed */
         break;
     case 0xda0: /* MPU_RSAR: MPU region attribute and size register.  */
     case 0xda8: /* MPU_RSAR_A1.  */
@@ -607,7 +647,12 @@ static void nvic_writel(nvic_state *s, uint32_t offset, uint32_t value)
         cpu->env.pmsav7.drsr[cpu->env.cp15.c6_rgnr] = value & 0xffff;
         DPRINTF("writel:mpu_rsar (%04X), region(%u), dracr now %04X\n", offset, cpu->env.cp15.c6_rgnr, cpu->env.pmsav7.dracr[cpu->env.cp15.c6_rgnr]);
         DPRINTF("writel:mpu_rsar (%04X), region(%u), drsr now %04X\n", offset, cpu->env.cp15.c6_rgnr, cpu->env.pmsav7.drsr[cpu->env.cp15.c6_rgnr]);
-        tlb_flush(CPU(cpu), 1); /* Mappings may have changed - purge! */
+        arm_v7m_mpu_changed(cpu); /* Mappings may have changed */
+        break;
+    case 0xdfc: /* Debug Exception and Monitor Control.  */
+        /* Only stored: TRCENA does not gate the ITM and DWT, and the vector
+         * catch and debug monitor bits have no effect. */
+        s->demcr = value & 0x010f07f1;
         break;
     case 0xf00: /* Software Triggered Interrupt Register */
         if ((value & 0x1ff) < s->num_irq) {
@@ -733,13 +778,14 @@ static const MemoryRegionOps nvic_sysreg_ops = {
 
 static const VMStateDescription vmstate_nvic = {
     .name = "armv7m_nvic",
-    .version_id = 1,
+    .version_id = 2,
     .minimum_version_id = 1,
     .fields = (VMStateField[]) {
         VMSTATE_UINT32(systick.control, nvic_state),
         VMSTATE_UINT32(systick.reload, nvic_state),
         VMSTATE_INT64(systick.tick, nvic_state),
         VMSTATE_TIMER_PTR(systick.timer, nvic_state),
+        VMSTATE_UINT32_V(demcr, nvic_state, 2),
         VMSTATE_END_OF_LIST()
     }
 };
@@ -761,6 +807,7 @@ static void armv7m_nvic_reset(DeviceState *dev)
     systick_reset(s);
 
     s->scr_reg = 0;
+    s->demcr = 0;
     s->in_deep_sleep = false;
     s->in_standby = false;
     qemu_set_irq(s->power_out, true);
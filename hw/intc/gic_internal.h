@@ -29,11 +29,23 @@
    through the normal GIC interface.  */
 #define GIC_BASE_IRQ ((s->revision == REV_NVIC) ? 32 : 0)
 
-#define GIC_SET_ENABLED(irq, cm) s->irq_state[irq].enabled |= (cm)
-#define GIC_CLEAR_ENABLED(irq, cm) s->irq_state[irq].enabled &= ~(cm)
+#define GIC_SET_ENABLED(irq, cm) do {                                  \
+        s->irq_state[irq].enabled |= (cm);                              \
+        gic_nvic_sync_ready(s, irq);                                    \
+    } while (0)
+#define GIC_CLEAR_ENABLED(irq, cm) do {                                 \
+        s->irq_state[irq].enabled &= ~(cm);                             \
+        gic_nvic_sync_ready(s, irq);                                    \
+    } while (0)
 #define GIC_TEST_ENABLED(irq, cm) ((s->irq_state[irq].enabled & (cm)) != 0)
-#define GIC_SET_PENDING(irq, cm) s->irq_state[irq].pending |= (cm)
-#define GIC_CLEAR_PENDING(irq, cm) s->irq_state[irq].pending &= ~(cm)
+#define GIC_SET_PENDING(irq, cm) do {                                   \
+        s->irq_state[irq].pending |= (cm);                              \
+        gic_nvic_sync_ready(s, irq);                                    \
+    } while (0)
+#define GIC_CLEAR_PENDING(irq, cm) do {                                 \
+        s->irq_state[irq].pending &= ~(cm);                             \
+        gic_nvic_sync_ready(s, irq);                                    \
+    } while (0)
 #define GIC_SET_ACTIVE(irq, cm) s->irq_state[irq].active |= (cm)
 #define GIC_CLEAR_ACTIVE(irq, cm) s->irq_state[irq].active &= ~(cm)
 #define GIC_TEST_ACTIVE(irq, cm) ((s->irq_state[irq].active & (cm)) != 0)
@@ -77,6 +89,22 @@
 #define REV_11MPCORE 0
 #define REV_NVIC 0xffffffff
 
+/* Track whether an NVIC line is both enabled and pending.  Must be called
+ * whenever either bit changes; the GIC_SET/CLEAR_ENABLED/PENDING macros do
+ * this for you.
+ */
+static inline void gic_nvic_sync_ready(GICState *s, int irq)
+{
+    if (s->revision != REV_NVIC) {
+        return;
+    }
+    if (s->irq_state[irq].enabled & s->irq_state[irq].pending & 1) {
+        set_bit(irq, s->nvic_ready);
+    } else {
+        clear_bit(irq, s->nvic_ready);
+    }
+}
+
 void gic_set_pending_private(GICState *s, int cpu, int irq);
 uint32_t gic_acknowledge_irq(GICState *s, int cpu, MemTxAttrs attrs);
 void gic_complete_irq(GICState *s, int cpu, int irq, MemTxAttrs attrs);
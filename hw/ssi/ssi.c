@@ -41,13 +41,18 @@ static void ssi_cs_default(void *opaque, int n, int level)
     s->cs = cs;
 }
 
+static bool ssi_slave_selected(SSISlave *dev, SSISlaveClass *ssc)
+{
+    return (dev->cs && ssc->cs_polarity == SSI_CS_HIGH) ||
+           (!dev->cs && ssc->cs_polarity == SSI_CS_LOW) ||
+           ssc->cs_polarity == SSI_CS_NONE;
+}
+
 static uint32_t ssi_transfer_raw_default(SSISlave *dev, uint32_t val)
 {
     SSISlaveClass *ssc = SSI_SLAVE_GET_CLASS(dev);
 
-    if ((dev->cs && ssc->cs_polarity == SSI_CS_HIGH) ||
-            (!dev->cs && ssc->cs_polarity == SSI_CS_LOW) ||
-            ssc->cs_polarity == SSI_CS_NONE) {
+    if (ssi_slave_selected(dev, ssc)) {
         return ssc->transfer(dev, val);
     }
     return 0;
@@ -122,6 +127,37 @@ uint32_t ssi_transfer(SSIBus *bus, uint32_t val)
     return r;
 }
 
+uint32_t ssi_transfer_bulk(SSIBus *bus, const uint8_t *buf, int len)
+{
+    BusState *b = BUS(bus);
+    BusChild *kid;
+    SSISlaveClass *ssc;
+    uint32_t r = 0;
+    int i;
+
+    if (len <= 0) {
+        return 0;
+    }
+
+    QTAILQ_FOREACH(kid, &b->children, sibling) {
+        SSISlave *slave = SSI_SLAVE(kid->child);
+        ssc = SSI_SLAVE_GET_CLASS(slave);
+        if (ssc->transfer_bulk &&
+                ssc->transfer_raw == ssi_transfer_raw_default) {
+            if (ssi_slave_selected(slave, ssc)) {
+                ssc->transfer_bulk(slave, buf, len);
+            }
+            continue;
+        }
+        for (i = 0; i < len - 1; i++) {
+            ssc->transfer_raw(slave, buf[i]);
+        }
+        r |= ssc->transfer_raw(slave, buf[len - 1]);
+    }
+
+    return r;
+}
+
 const VMStateDescription vmstate_ssi_slave = {
     .name = "SSISlave",
     .version_id = 1,
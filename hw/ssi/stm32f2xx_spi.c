@@ -32,6 +32,8 @@
 #define	R_CR1_LSBFIRST (1 <<  7)
 #define	R_CR1_SPE      (1 <<  6)
 #define	R_CR2             (0x04 / 4)
+#define	R_CR2_TXDMAEN  (1 <<  1)
+#define	R_CR2_RXDMAEN  (1 <<  0)
 
 #define	R_SR       (0x08 / 4)
 #define	R_SR_RESET    0x0002
@@ -54,6 +56,8 @@ typedef struct stm32f2xx_spi_s {
     SysBusDevice busdev;
     MemoryRegion iomem;
     qemu_irq irq;
+    qemu_irq dma_tx;
+    qemu_irq dma_rx;
 
     SSIBus *spi;
 
@@ -64,6 +68,16 @@ typedef struct stm32f2xx_spi_s {
     uint16_t regs[R_MAX];
 } Stm32Spi;
 
+/* Drive the DMA request lines from TXE/RXNE and the DMA enables in CR2. */
+static void
+stm32f2xx_spi_update_dma(Stm32Spi *s)
+{
+    qemu_set_irq(s->dma_tx, (s->regs[R_CR2] & R_CR2_TXDMAEN) &&
+                            (s->regs[R_SR] & R_SR_TXE));
+    qemu_set_irq(s->dma_rx, (s->regs[R_CR2] & R_CR2_RXDMAEN) &&
+                            (s->regs[R_SR] & R_SR_RXNE));
+}
+
 static uint64_t
 stm32f2xx_spi_read(void *arg, hwaddr offset, unsigned size)
 {
@@ -82,6 +96,7 @@ stm32f2xx_spi_read(void *arg, hwaddr offset, unsigned size)
     switch (offset) {
     case R_DR:
         s->regs[R_SR] &= ~R_SR_RXNE;
+        stm32f2xx_spi_update_dma(s);
     }
     return r;
 }
@@ -136,6 +151,11 @@ stm32f2xx_spi_write(void *arg, hwaddr addr, uint64_t data, unsigned size)
         
         s->regs[R_SR] |= R_SR_RXNE;
         s->regs[R_SR] |= R_SR_TXE;
+        stm32f2xx_spi_update_dma(s);
+        break;
+    case R_CR2:
+        s->regs[R_CR2] = data;
+        stm32f2xx_spi_update_dma(s);
         break;
     default:
         if (addr < ARRAY_SIZE(s->regs)) {
@@ -146,6 +166,30 @@ stm32f2xx_spi_write(void *arg, hwaddr addr, uint64_t data, unsigned size)
     }
 }
 
+/* TX DMA into DR.  Frames are shifted out in one SSI bulk transfer, leaving SR
+ * as it would be after the last DR write; full duplex and LSB first transfers
+ * go through DR one byte at a time. */
+static int
+stm32f2xx_spi_dma_bulk(Object *obj, hwaddr offset, uint8_t *buf, int size,
+                       int count, bool to_periph)
+{
+    Stm32Spi *s = FROM_SYSBUS(Stm32Spi, SYS_BUS_DEVICE(obj));
+
+    if (!to_periph || offset != R_DR * 4 || size != 1 ||
+            (s->regs[R_CR2] & R_CR2_RXDMAEN) ||
+            (s->regs[R_CR1] & (R_CR1_LSBFIRST | R_CR1_DFF))) {
+        return 0;
+    }
+
+    if ((s->regs[R_SR] & R_SR_RXNE) || count > 1) {
+        s->regs[R_SR] |= R_SR_OVR;
+    }
+    s->regs[R_DR] = ssi_transfer_bulk(s->spi, buf, count);
+    s->regs[R_SR] |= R_SR_RXNE | R_SR_TXE;
+    stm32f2xx_spi_update_dma(s);
+    return count;
+}
+
 static const MemoryRegionOps stm32f2xx_spi_ops = {
     .read = stm32f2xx_spi_read,
     .write = stm32f2xx_spi_write,
@@ -159,6 +203,8 @@ stm32f2xx_spi_reset(DeviceState *dev)
       SYS_BUS_DEVICE(dev));
 
     s->regs[R_SR] = R_SR_RESET;
+    s->regs[R_CR2] = 0;
+    stm32f2xx_spi_update_dma(s);
     switch (s->periph) {
     case 0:
         break;
@@ -174,14 +220,27 @@ stm32f2xx_spi_init(SysBusDevice *dev)
 {
     struct stm32f2xx_spi_s *s = FROM_SYSBUS(struct stm32f2xx_spi_s, dev);
 
-    memory_region_init_io(&s->iomem, NULL, &stm32f2xx_spi_ops, s, "spi", 0x3ff);
+    memory_region_init_io(&s->iomem, OBJECT(s), &stm32f2xx_spi_ops, s, "spi", 0x3ff);
     sysbus_init_mmio(dev, &s->iomem);
     sysbus_init_irq(dev, &s->irq);
+    qdev_init_gpio_out_named(DEVICE(dev), &s->dma_tx, "dma-tx", 1);
+    qdev_init_gpio_out_named(DEVICE(dev), &s->dma_rx, "dma-rx", 1);
     s->spi = ssi_create_bus(DEVICE(dev), "ssi");
 
     return 0;
 }
 
+static const VMStateDescription vmstate_stm32f2xx_spi = {
+    .name = "stm32f2xx_spi",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_INT32(rx, Stm32Spi),
+        VMSTATE_INT32(rx_full, Stm32Spi),
+        VMSTATE_UINT16_ARRAY(regs, Stm32Spi, R_MAX),
+        VMSTATE_END_OF_LIST()
+    }
+};
 
 static Property stm32f2xx_spi_properties[] = {
     DEFINE_PROP_INT32("periph", struct stm32f2xx_spi_s, periph, -1),
@@ -193,17 +252,24 @@ stm32f2xx_spi_class_init(ObjectClass *c, void *data)
 {
     DeviceClass *dc = DEVICE_CLASS(c);
     SysBusDeviceClass *sc = SYS_BUS_DEVICE_CLASS(c);
+    Stm32DmaBulkClass *bc = STM32_DMA_BULK_CLASS(c);
 
     sc->init = stm32f2xx_spi_init;
+    bc->transfer = stm32f2xx_spi_dma_bulk;
     dc->reset = stm32f2xx_spi_reset;
     dc->props = stm32f2xx_spi_properties;
+    dc->vmsd = &vmstate_stm32f2xx_spi;
 }
 
 static const TypeInfo stm32f2xx_spi_info = {
     .name = "stm32f2xx_spi",
     .parent = TYPE_SYS_BUS_DEVICE,
     .instance_size = sizeof(struct stm32f2xx_spi_s),
-    .class_init = stm32f2xx_spi_class_init
+    .class_init = stm32f2xx_spi_class_init,
+    .interfaces = (InterfaceInfo[]) {
+        { TYPE_STM32_DMA_BULK },
+        { }
+    }
 };
 
 static void
@@ -19,6 +19,7 @@
 // Control
 #define R_CR (0x00 / 4)
 #define CR_MATCH_MODE_MASK (0x01 << 23)
+#define CR_ABORT (0x01 << 1)
 
 // Device configure
 #define R_DCR (0x04 / 4)
@@ -93,6 +94,9 @@
 
 #define R_MAX (0x34 / 4)
 
+// Size of the memory mapped window at 0x90000000
+#define QSPI_MMAP_SIZE 0x10000000
+
 typedef enum {
   STATE_IDLE,
   STATE_WRITE,
@@ -112,10 +116,17 @@ typedef struct stm32f412_qspi_s {
 
     SSIBus *qspi;
 
+    // Memory mapped mode: the flash contents are aliased into the window
+    // directly, so reads never go through the SSI bus
+    MemoryRegion mmap;
+    MemoryRegion flash_alias;
+    MemoryRegion *flash;
+    bool mem_mapped;
+
     uint32_t regs[R_MAX];
 
     qemu_irq cs_irq;
-    CsState cs_state;
+    uint8_t cs_state; // CsState
 
     int64_t tx_remaining;
 } Stm32f412Qspi;
@@ -154,6 +165,15 @@ stm32f412_set_cs(Stm32f412Qspi *s, CsState state)
     }
 }
 
+static void
+stm32f412_set_mem_mapped(Stm32f412Qspi *s, bool mapped)
+{
+    s->mem_mapped = mapped;
+    if (s->flash) {
+      memory_region_set_enabled(&s->flash_alias, mapped);
+    }
+}
+
 static uint64_t
 stm32f412_qspi_read(void *arg, hwaddr offset, unsigned size)
 {
@@ -206,6 +226,19 @@ stm32f412_qspi_read(void *arg, hwaddr offset, unsigned size)
 static void
 stm32f412_CCR_write(Stm32f412Qspi *s, uint32_t CCR, unsigned size)
 {
+    if ((CCR & CCR_MODE_MASK) == CCR_MODE_MEMORY_MAPPED) {
+        DB_PRINT_L(1, "Memory mapped mode, command 0x%x", CCR & CCR_INSTR_MASK);
+        if (!s->flash) {
+            qemu_log_mask(LOG_UNIMP, "QSPI: memory mapped mode without a flash\n");
+        }
+        stm32f412_set_cs(s, CS_STATE_HIGH);
+        s->tx_remaining = 0;
+        s->regs[R_CCR] = CCR;
+        stm32f412_set_mem_mapped(s, true);
+        return;
+    }
+    stm32f412_set_mem_mapped(s, false);
+
     if ((CCR & CCR_ADMODE_MASK) != CCR_ADMODE_NONE) {
         uint8_t addrsize = ((CCR & CCR_ADSIZE_MASK) >> 12) + 1;
         DB_PRINT_L(1, "Adding %"PRIu8" for address", addrsize);
@@ -261,6 +294,16 @@ stm32f412_qspi_write(void *arg, hwaddr addr, uint64_t data, unsigned size)
         DB_PRINT_L(1, "Set DLR to %"PRIu64" + 1", data);
         break;
     case R_CR:
+        if (data & CR_ABORT) {
+            // Abort is the only way out of memory mapped mode
+            DB_PRINT_L(1, "Abort");
+            stm32f412_set_cs(s, CS_STATE_HIGH);
+            s->tx_remaining = 0;
+            stm32f412_set_mem_mapped(s, false);
+            data &= ~CR_ABORT;
+        }
+        s->regs[R_CR] = data;
+        break;
     case R_DCR:
     case R_SR:
     case R_ABR:
@@ -296,6 +339,7 @@ stm32f412_qspi_reset(DeviceState *dev)
     //s->regs[R_SR] = R_SR_RESET;
     s->cs_state = CS_STATE_HIGH;
     s->tx_remaining = 0;
+    stm32f412_set_mem_mapped(s, false);
 }
 
 static int
@@ -303,8 +347,10 @@ stm32f412_qspi_init(SysBusDevice *dev)
 {
     struct stm32f412_qspi_s *s = FROM_SYSBUS(struct stm32f412_qspi_s, dev);
 
-    memory_region_init_io(&s->iomem, NULL, &stm32f412_qspi_ops, s, "qspi", 0x3ff);
+    memory_region_init_io(&s->iomem, OBJECT(s), &stm32f412_qspi_ops, s, "qspi", 0x3ff);
     sysbus_init_mmio(dev, &s->iomem);
+    memory_region_init(&s->mmap, OBJECT(s), "qspi.mmap", QSPI_MMAP_SIZE);
+    sysbus_init_mmio(dev, &s->mmap);
     sysbus_init_irq(dev, &s->irq);
     s->qspi = ssi_create_bus(DEVICE(dev), "ssi");
 
@@ -316,6 +362,42 @@ stm32f412_qspi_init(SysBusDevice *dev)
     return 0;
 }
 
+void
+stm32f412_qspi_set_flash(DeviceState *dev, MemoryRegion *flash)
+{
+    Stm32f412Qspi *s = FROM_SYSBUS(Stm32f412Qspi, SYS_BUS_DEVICE(dev));
+
+    assert(!s->flash);
+    s->flash = flash;
+    memory_region_init_alias(&s->flash_alias, OBJECT(s), "qspi.flash", flash, 0,
+                             MIN(memory_region_size(flash), QSPI_MMAP_SIZE));
+    memory_region_add_subregion(&s->mmap, 0, &s->flash_alias);
+    memory_region_set_enabled(&s->flash_alias, s->mem_mapped);
+}
+
+static int
+stm32f412_qspi_post_load(void *opaque, int version_id)
+{
+    Stm32f412Qspi *s = opaque;
+
+    stm32f412_set_mem_mapped(s, s->mem_mapped);
+    return 0;
+}
+
+static const VMStateDescription vmstate_stm32f412_qspi = {
+    .name = "stm32f412_qspi",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .post_load = stm32f412_qspi_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32_ARRAY(regs, Stm32f412Qspi, R_MAX),
+        VMSTATE_BOOL(mem_mapped, Stm32f412Qspi),
+        VMSTATE_UINT8(cs_state, Stm32f412Qspi),
+        VMSTATE_INT64(tx_remaining, Stm32f412Qspi),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static Property stm32f412_qspi_properties[] = {
     DEFINE_PROP_END_OF_LIST()
 };
@@ -329,6 +411,7 @@ stm32f412_qspi_class_init(ObjectClass *c, void *data)
     sc->init = stm32f412_qspi_init;
     dc->reset = stm32f412_qspi_reset;
     dc->props = stm32f412_qspi_properties;
+    dc->vmsd = &vmstate_stm32f412_qspi;
 }
 
 static const TypeInfo stm32f412_qspi_info = {
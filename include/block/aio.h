@@ -442,4 +442,23 @@ static inline bool aio_node_check(AioContext *ctx, bool is_external)
  */
 void aio_context_setup(AioContext *ctx, Error **errp);
 
+/**
+ * aio_context_after_fork:
+ * @ctx: the aio context
+ *
+ * Called in a forked child process.  Stop sharing the notifier, the
+ * polling state and the worker threads of @ctx with the parent; the
+ * context must have been idle when fork() was called.
+ */
+void aio_context_after_fork(AioContext *ctx);
+
+/**
+ * aio_context_setup_after_fork:
+ * @ctx: the aio context
+ *
+ * The part of aio_context_after_fork() that depends on the host polling
+ * implementation.
+ */
+void aio_context_setup_after_fork(AioContext *ctx);
+
 #endif
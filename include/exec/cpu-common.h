@@ -92,6 +92,11 @@ void cpu_register_map_client(QEMUBH *bh);
 void cpu_unregister_map_client(QEMUBH *bh);
 
 bool cpu_physical_memory_is_io(hwaddr phys_addr);
+/* Call after writing @length bytes at offset @addr of RAM region @mr through
+ * a host pointer: invalidates translated code and updates the dirty bitmaps.
+ */
+void cpu_physical_memory_notify_write(MemoryRegion *mr, hwaddr addr,
+                                      hwaddr length);
 
 /* Coalesced MMIO regions are areas where write operations can be reordered.
  * This usually implies that write operations are side-effect free.  This allows
@@ -184,12 +184,14 @@ struct TranslationBlock {
     uint16_t size;      /* size of target code for this block (1 <=
                            size <= TARGET_PAGE_SIZE) */
     uint16_t icount;
+    uint16_t exec_count; /* executions counted before it is a trace */
     uint32_t cflags;    /* compile flags */
 #define CF_COUNT_MASK  0x7fff
 #define CF_LAST_IO     0x8000 /* Last insn may be an IO access.  */
 #define CF_NOCACHE     0x10000 /* To be freed after execution */
 #define CF_USE_ICOUNT  0x20000
 #define CF_IGNORE_ICOUNT 0x40000 /* Do not generate icount code */
+#define CF_TRACE       0x80000 /* Translated again after running hot */
 
     void *tc_ptr;    /* pointer to the translated code */
     uint8_t *tc_search;  /* pointer to search data */
@@ -240,6 +242,22 @@ struct TBContext {
 void tb_free(TranslationBlock *tb);
 void tb_flush(CPUState *cpu);
 void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr);
+void *tb_lookup_ptr(CPUState *cpu);
+
+/* Executions after which a TB is translated again as a trace, on targets
+   that define TARGET_HAS_TB_TRACE */
+#define TB_HOT_EXEC_COUNT 64
+
+int tb_exec_count(CPUState *cpu, target_ulong pc, target_ulong cs_base,
+                  uint64_t flags);
+
+TranslationBlock *tb_alloc_restored(target_ulong pc, size_t code_size);
+void tb_link_restored(TranslationBlock *tb, tb_page_addr_t phys_pc,
+                      tb_page_addr_t phys_page2);
+
+/* tb-cache.c */
+extern bool tb_cache_enabled;
+void tb_cache_record(CPUState *cpu, TranslationBlock *tb);
 
 #if defined(USE_DIRECT_JUMP)
 
@@ -379,6 +397,8 @@ static inline void mmap_unlock(void) {}
 
 /* cputlb.c */
 tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong addr);
+tb_page_addr_t get_page_addr_code_probe(CPUArchState *env1,
+                                        target_ulong addr);
 
 void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length);
 void tlb_set_dirty(CPUState *cpu, target_ulong vaddr);
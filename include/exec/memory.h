@@ -44,6 +44,7 @@
 
 typedef struct MemoryRegionOps MemoryRegionOps;
 typedef struct MemoryRegionMmio MemoryRegionMmio;
+typedef struct MemoryRegionProfile MemoryRegionProfile;
 
 struct MemoryRegionMmio {
     CPUReadMemoryFunc *read[3];
@@ -193,6 +194,7 @@ struct MemoryRegion {
     unsigned ioeventfd_nb;
     MemoryRegionIoeventfd *ioeventfds;
     NotifierList iommu_notify;
+    MemoryRegionProfile *profile;   /* MMIO profiling counters, if any */
 };
 
 /**
@@ -455,6 +457,29 @@ void memory_region_init_rom_device(MemoryRegion *mr,
                                    uint64_t size,
                                    Error **errp);
 
+/**
+ * memory_region_init_rom_device_ptr:  Initialize a ROM device memory region
+ *                                     backed by caller-provided memory.
+ *
+ * Like memory_region_init_rom_device(), but the ROM contents live in @ptr
+ * (for example a mapping of the backing image) instead of freshly allocated
+ * guest RAM.
+ *
+ * @mr: the #MemoryRegion to be initialized.
+ * @owner: the object that tracks the region's reference count
+ * @ops: callbacks for write access handling.
+ * @name: the name of the region.
+ * @size: size of the region.
+ * @ptr: memory to be mapped; must contain at least @size bytes.
+ */
+void memory_region_init_rom_device_ptr(MemoryRegion *mr,
+                                       struct Object *owner,
+                                       const MemoryRegionOps *ops,
+                                       void *opaque,
+                                       const char *name,
+                                       uint64_t size,
+                                       void *ptr);
+
 /**
  * memory_region_init_reservation: Initialize a memory region that reserves
  *                                 I/O space.
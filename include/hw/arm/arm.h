@@ -29,6 +29,9 @@ DeviceState *armv7m_translated_init(Object *parent, MemoryRegion *system_memory,
                                  const char *cpu_model,
                                  ARMCPU **cpu_device);
 
+/* armv7m_trace.c */
+CharDriverState *armv7m_itm_set_chr(DeviceState *dev, CharDriverState *chr);
+
 /*
  * struct used as a parameter of the arm_load_kernel machine init
  * done notifier
@@ -135,4 +138,12 @@ void arm_load_kernel(ARMCPU *cpu, struct arm_boot_info *info);
    ticks.  */
 extern int system_clock_scale;
 
+/* System clock frequency in Hz, 0 if the board only sets system_clock_scale */
+extern uint32_t system_clock_freq;
+
+/* Set the system clock frequency and system_clock_scale from it.  The
+   change notifiers run before the new frequency takes effect. */
+void system_clock_set_freq(uint32_t freq);
+void system_clock_add_change_notifier(Notifier *n);
+
 #endif /* !ARM_MISC_H */
@@ -359,6 +359,45 @@ void f2xx_gpio_wake_set(stm32f2xx_gpio *, unsigned, qemu_irq);
 
 
 
+/* DMA - f2xx */
+/* Returns the request input for channel @channel of stream @stream of an
+ * f2xx_dma controller.  A stream whose selected channel has a request routed
+ * to it moves one item each time the request is asserted; streams without
+ * one run as soon as they are enabled. */
+qemu_irq f2xx_dma_get_request(DeviceState *dma, int stream, int channel);
+
+/* Interface for peripherals that can take a whole DMA buffer in one call
+ * instead of one item per request.  The DMA controller looks it up on the
+ * owner of the memory region at PAR for streams with a fixed peripheral
+ * address and an incrementing memory address. */
+#define TYPE_STM32_DMA_BULK "stm32-dma-bulk"
+#define STM32_DMA_BULK_CLASS(klass) \
+     OBJECT_CLASS_CHECK(Stm32DmaBulkClass, (klass), TYPE_STM32_DMA_BULK)
+#define STM32_DMA_BULK_GET_CLASS(obj) \
+     OBJECT_GET_CLASS(Stm32DmaBulkClass, (obj), TYPE_STM32_DMA_BULK)
+
+typedef struct Stm32DmaBulkClass {
+    InterfaceClass parent_class;
+
+    /* Write the @count items of @size bytes in @buf to the register at
+     * @offset (@to_periph), or read @count items from it into @buf.  Returns
+     * the number of items handled; 0 makes the DMA fall back to moving one
+     * item per request. */
+    int (*transfer)(Object *obj, hwaddr offset, uint8_t *buf, int size,
+                    int count, bool to_periph);
+} Stm32DmaBulkClass;
+
+
+
+
+/* QSPI - f412 */
+/* Backs the memory mapped mode window (sysbus region 1) with @flash, the
+ * storage of the flash part on the QSPI bus. */
+void stm32f412_qspi_set_flash(DeviceState *dev, MemoryRegion *flash);
+
+
+
+
 /* RCC */
 typedef struct Stm32Rcc Stm32Rcc;
 
@@ -413,6 +452,10 @@ void stm32_uart_connect(Stm32Uart *s, CharDriverState *chr,
  * if not connecting to a CharDriverState instance. */
 void stm32_uart_set_write_handler(Stm32Uart *s, void *obj,
         int (*chr_write_handler)(void *chr_write_obj, const uint8_t *buf, int len));
+/* Register a callback run each time the UART takes a byte out of its receive
+ * buffer, i.e. whenever the can_read handler would report more space. */
+void stm32_uart_set_rcv_space_handler(Stm32Uart *s, void *obj,
+        void (*rcv_space_handler)(void *rcv_space_obj));
 void stm32_uart_get_rcv_handlers(Stm32Uart *s, IOCanReadHandler **can_read,
                                  IOReadHandler **read, IOEventHandler **event);
 
@@ -447,6 +490,10 @@ void stm32f7xx_uart_connect(Stm32F7xxUart *s, CharDriverState *chr,
  * if not connecting to a CharDriverState instance. */
 void stm32f7xx_uart_set_write_handler(Stm32F7xxUart *s, void *obj,
         int (*chr_write_handler)(void *chr_write_obj, const uint8_t *buf, int len));
+/* Register a callback run each time the UART takes a byte out of its receive
+ * buffer, i.e. whenever the can_read handler would report more space. */
+void stm32f7xx_uart_set_rcv_space_handler(Stm32F7xxUart *s, void *obj,
+        void (*rcv_space_handler)(void *rcv_space_obj));
 void stm32f7xx_uart_get_rcv_handlers(Stm32F7xxUart *s, IOCanReadHandler **can_read,
                                  IOReadHandler **read, IOEventHandler **event);
 
@@ -491,6 +538,14 @@ void stm32_afio_uart_check_tx_pin_callback(Stm32Uart *s);
 DeviceState *stm32_init_periph(DeviceState *dev, stm32_periph_t periph,
                                hwaddr addr, qemu_irq irq);
 
+/* Routes the DMA requests of the USARTs and SPIs to the two f2xx_dma
+ * controllers, using the mapping of the F2 and the F405/F407/F42x/F43x
+ * only.  @uart and @spi are indexed from USART1/SPI1; NULL entries and
+ * entries past the counts are skipped. */
+void stm32_dma_connect_requests(DeviceState *dma1, DeviceState *dma2,
+                                DeviceState **uart, int uart_count,
+                                DeviceState **spi, int spi_count);
+
 
 /* STM32 MICROCONTROLLER - GENERAL */
 typedef struct Stm32 Stm32;
@@ -4,6 +4,8 @@
 /* NOR flash devices */
 
 #include "exec/memory.h"
+#include "qemu/notify.h"
+#include "qemu/queue.h"
 
 typedef struct pflash_t pflash_t;
 
@@ -39,6 +41,37 @@ pflash_t *pflash_jedec_424_register(hwaddr base,
 MemoryRegion *pflash_cfi01_get_memory(pflash_t *fl);
 MemoryRegion *pflash_jedec_424_get_memory(pflash_t *fl);
 
+/* flash_image.c */
+typedef enum {
+    FLASH_IMAGE_COPY,           /* image copied into RAM, written back via blk */
+    FLASH_IMAGE_MMAP_COW,       /* private mapping, written back via blk */
+    FLASH_IMAGE_MMAP_SHARED,    /* shared mapping, writes land in the file */
+} FlashImageMode;
+
+typedef struct FlashImage {
+    const char *name;
+    BlockBackend *blk;
+    uint8_t *storage;
+    uint64_t size;
+    FlashImageMode mode;
+
+    unsigned long *dirty;       /* one bit per BDRV_SECTOR_SIZE sector */
+    int64_t nb_sectors;
+    int inflight;               /* outstanding write back requests */
+    QEMUTimer *flush_timer;
+    Notifier close_notifier;
+    QLIST_ENTRY(FlashImage) next;
+} FlashImage;
+
+void flash_image_init(FlashImage *img, MemoryRegion *mr, Object *owner,
+                      const MemoryRegionOps *ops, void *opaque,
+                      const char *name, uint64_t size, BlockBackend *blk,
+                      bool map, bool shared, Error **errp);
+void flash_image_mark_dirty(FlashImage *img, uint64_t offset, uint64_t len);
+void flash_image_flush(FlashImage *img);
+bool flash_image_can_fork(Error **errp);
+void flash_image_after_fork(void);
+
 /* nand.c */
 DeviceState *nand_init(BlockBackend *blk, int manf_id, int chip_id);
 void nand_setpins(DeviceState *dev, uint8_t cle, uint8_t ale,
@@ -258,6 +258,26 @@ fail:
     return ret;
 }
 
+static int glue(load_elf_symbols, SZ)(int fd, int must_swab, int elf_machine,
+                                      int clear_lsb)
+{
+    struct elfhdr ehdr;
+
+    if (read(fd, &ehdr, sizeof(ehdr)) != sizeof(ehdr)) {
+        return ELF_LOAD_FAILED;
+    }
+    if (must_swab) {
+        glue(bswap_ehdr, SZ)(&ehdr);
+    }
+    if (ehdr.e_machine != elf_machine) {
+        return ELF_LOAD_WRONG_ARCH;
+    }
+    if (glue(load_symbols, SZ)(&ehdr, fd, must_swab, clear_lsb) < 0) {
+        return ELF_LOAD_FAILED;
+    }
+    return 0;
+}
+
 static int glue(load_elf, SZ)(const char *name, int fd,
                               uint64_t (*translate_fn)(void *, uint64_t),
                               void *translate_opaque,
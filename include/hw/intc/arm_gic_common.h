@@ -22,6 +22,7 @@
 #define HW_ARM_GIC_COMMON_H
 
 #include "hw/sysbus.h"
+#include "qemu/bitops.h"
 
 /* Maximum number of possible interrupts, determined by the GIC architecture */
 #define GIC_MAXIRQ 1020
@@ -76,6 +77,12 @@ typedef struct GICState {
      */
     uint8_t sgi_pending[GIC_NR_SGIS][GIC_NCPU];
 
+    /* NVIC only: one bit per line that is both enabled and pending, kept in
+     * sync by the enable/pending accessors so gic_update() only has to look
+     * at the lines that can actually be taken.  Derived state, not migrated.
+     */
+    unsigned long nvic_ready[BITS_TO_LONGS(GIC_MAXIRQ)];
+
     uint16_t priority_mask[GIC_NCPU];
     uint16_t running_priority[GIC_NCPU];
     uint16_t current_pending[GIC_NCPU];
@@ -55,6 +55,13 @@ typedef struct SSISlaveClass {
      * always be called for the device for every txrx access to the parent bus
      */
     uint32_t (*transfer_raw)(SSISlave *dev, uint32_t val);
+
+    /* Optional. Consume a block of len 8-bit words in one call, as if
+     * transfer had been called for each of them. Only used for devices with
+     * standard CS behaviour and only while the device is selected; the words
+     * shifted back to the master are discarded (read as zero).
+     */
+    void (*transfer_bulk)(SSISlave *dev, const uint8_t *buf, int len);
 } SSISlaveClass;
 
 struct SSISlave {
@@ -84,10 +91,20 @@ SSIBus *ssi_create_bus(DeviceState *parent, const char *name);
 
 uint32_t ssi_transfer(SSIBus *bus, uint32_t val);
 
+/* Shift out a block of 8-bit words. Slaves implementing transfer_bulk get the
+ * whole block at once, all others see one transfer per word. Returns the word
+ * shifted back for the last one.  */
+uint32_t ssi_transfer_bulk(SSIBus *bus, const uint8_t *buf, int len);
+
 /* Automatically connect all children nodes a spi controller as slaves */
 void ssi_auto_connect_slaves(DeviceState *parent, qemu_irq *cs_lines,
                              SSIBus *bus);
 
+/* mt25q.c, mx25u.c: ROM device view of the flash contents, for memory mapped
+ * (XIP) access by the controller */
+MemoryRegion *mt25q_get_memory(DeviceState *dev);
+MemoryRegion *mx25u_get_memory(DeviceState *dev);
+
 /* max111x.c */
 void max111x_set_input(DeviceState *dev, int line, uint8_t value);
 
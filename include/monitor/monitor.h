@@ -17,6 +17,8 @@ extern Monitor *cur_mon;
 bool monitor_cur_is_qmp(void);
 
 void monitor_init(CharDriverState *chr, int flags);
+bool monitor_can_fork(Error **errp);
+void monitor_after_fork(void);
 
 int monitor_suspend(Monitor *mon);
 void monitor_resume(Monitor *mon);
@@ -39,6 +39,7 @@ void cpu_ticks_init(void);
 
 /* icount */
 void configure_icount(QemuOpts *opts, Error **errp);
+void configure_idle_warp(void);
 extern int use_icount;
 extern int icount_align_option;
 /* drift information for info jit command */
@@ -327,6 +328,8 @@ typedef struct PCIHostDeviceAddress {
 } PCIHostDeviceAddress;
 
 void tcg_exec_init(unsigned long tb_size);
+void tb_cache_init(const char *filename);
+void tb_cache_after_fork(void);
 bool tcg_enabled(void);
 
 void cpu_exec_init_all(void);
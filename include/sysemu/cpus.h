@@ -7,6 +7,7 @@ void qemu_init_cpu_loop(void);
 void resume_all_vcpus(void);
 void pause_all_vcpus(void);
 void cpu_stop_current(void);
+void cpus_after_fork(void);
 
 void cpu_synchronize_all_states(void);
 void cpu_synchronize_all_post_reset(void);
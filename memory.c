@@ -18,7 +18,9 @@
 #include "exec/ioport.h"
 #include "qapi/visitor.h"
 #include "qemu/bitops.h"
+#include "qemu/timer.h"
 #include "qom/object.h"
+#include "qmp-commands.h"
 #include "trace.h"
 #include <assert.h>
 
@@ -869,6 +871,11 @@ static void memory_region_destructor_rom_device(MemoryRegion *mr)
     qemu_ram_free(mr->ram_addr & TARGET_PAGE_MASK);
 }
 
+static void memory_region_destructor_rom_device_from_ptr(MemoryRegion *mr)
+{
+    qemu_ram_free_from_ptr(mr->ram_addr & TARGET_PAGE_MASK);
+}
+
 static bool memory_region_need_escape(char c)
 {
     return c == '/' || c == '[' || c == '\\' || c == ']';
@@ -1123,12 +1130,56 @@ static MemTxResult memory_region_dispatch_read1(MemoryRegion *mr,
     }
 }
 
+/* MMIO profiling: per region access counts, byte volume and host time spent
+ * in the device callbacks.  A region gets its counters on its first access
+ * made while profiling is enabled; when disabled, the dispatch functions only
+ * test mmio_profile_enabled.  Everything here runs under the BQL.
+ */
+struct MemoryRegionProfile {
+    MemoryRegion *mr;
+    uint64_t count[2];          /* indexed by is_write */
+    uint64_t bytes[2];
+    uint64_t ns[2];
+    QTAILQ_ENTRY(MemoryRegionProfile) link;
+};
+
+static bool mmio_profile_enabled;
+static QTAILQ_HEAD(, MemoryRegionProfile) mmio_profiles =
+    QTAILQ_HEAD_INITIALIZER(mmio_profiles);
+
+static void memory_region_profile_access(MemoryRegion *mr, bool is_write,
+                                         unsigned size, int64_t start)
+{
+    MemoryRegionProfile *p = mr->profile;
+
+    if (!p) {
+        p = g_new0(MemoryRegionProfile, 1);
+        p->mr = mr;
+        mr->profile = p;
+        QTAILQ_INSERT_TAIL(&mmio_profiles, p, link);
+    }
+    p->count[is_write]++;
+    p->bytes[is_write] += size;
+    p->ns[is_write] += get_clock() - start;
+}
+
+static void memory_region_profile_free(MemoryRegion *mr)
+{
+    if (mr->profile) {
+        QTAILQ_REMOVE(&mmio_profiles, mr->profile, link);
+        g_free(mr->profile);
+        mr->profile = NULL;
+    }
+}
+
 MemTxResult memory_region_dispatch_read(MemoryRegion *mr,
                                         hwaddr addr,
                                         uint64_t *pval,
                                         unsigned size,
                                         MemTxAttrs attrs)
 {
+    bool profile = mmio_profile_enabled;
+    int64_t start = 0;
     MemTxResult r;
 
     if (!memory_region_access_valid(mr, addr, size, false)) {
@@ -1136,24 +1187,23 @@ MemTxResult memory_region_dispatch_read(MemoryRegion *mr,
         return MEMTX_DECODE_ERROR;
     }
 
+    if (unlikely(profile)) {
+        start = get_clock();
+    }
     r = memory_region_dispatch_read1(mr, addr, pval, size, attrs);
     adjust_endianness(mr, pval, size);
+    if (unlikely(profile)) {
+        memory_region_profile_access(mr, false, size, start);
+    }
     return r;
 }
 
-MemTxResult memory_region_dispatch_write(MemoryRegion *mr,
-                                         hwaddr addr,
-                                         uint64_t data,
-                                         unsigned size,
-                                         MemTxAttrs attrs)
+static MemTxResult memory_region_dispatch_write1(MemoryRegion *mr,
+                                                 hwaddr addr,
+                                                 uint64_t data,
+                                                 unsigned size,
+                                                 MemTxAttrs attrs)
 {
-    if (!memory_region_access_valid(mr, addr, size, true)) {
-        unassigned_mem_write(mr, addr, data, size);
-        return MEMTX_DECODE_ERROR;
-    }
-
-    adjust_endianness(mr, &data, size);
-
     if (mr->ops->write) {
         return access_with_adjusted_size(addr, &data, size,
                                          mr->ops->impl.min_access_size,
@@ -1174,6 +1224,32 @@ MemTxResult memory_region_dispatch_write(MemoryRegion *mr,
     }
 }
 
+MemTxResult memory_region_dispatch_write(MemoryRegion *mr,
+                                         hwaddr addr,
+                                         uint64_t data,
+                                         unsigned size,
+                                         MemTxAttrs attrs)
+{
+    bool profile = mmio_profile_enabled;
+    int64_t start = 0;
+    MemTxResult r;
+
+    if (!memory_region_access_valid(mr, addr, size, true)) {
+        unassigned_mem_write(mr, addr, data, size);
+        return MEMTX_DECODE_ERROR;
+    }
+
+    if (unlikely(profile)) {
+        start = get_clock();
+    }
+    adjust_endianness(mr, &data, size);
+    r = memory_region_dispatch_write1(mr, addr, data, size, attrs);
+    if (unlikely(profile)) {
+        memory_region_profile_access(mr, true, size, start);
+    }
+    return r;
+}
+
 void memory_region_init_io(MemoryRegion *mr,
                            Object *owner,
                            const MemoryRegionOps *ops,
@@ -1288,6 +1364,26 @@ void memory_region_init_rom_device(MemoryRegion *mr,
     mr->ram_addr = qemu_ram_alloc(size, mr, errp);
 }
 
+void memory_region_init_rom_device_ptr(MemoryRegion *mr,
+                                       Object *owner,
+                                       const MemoryRegionOps *ops,
+                                       void *opaque,
+                                       const char *name,
+                                       uint64_t size,
+                                       void *ptr)
+{
+    memory_region_init(mr, owner, name, size);
+    mr->ops = ops;
+    mr->opaque = opaque;
+    mr->terminates = true;
+    mr->rom_device = true;
+    mr->destructor = memory_region_destructor_rom_device_from_ptr;
+
+    /* qemu_ram_alloc_from_ptr cannot fail with ptr != NULL.  */
+    assert(ptr != NULL);
+    mr->ram_addr = qemu_ram_alloc_from_ptr(size, ptr, mr, &error_fatal);
+}
+
 void memory_region_init_iommu(MemoryRegion *mr,
                               Object *owner,
                               const MemoryRegionIOMMUOps *ops,
@@ -1322,6 +1418,7 @@ static void memory_region_finalize(Object *obj)
 
     mr->destructor(mr);
     memory_region_clear_coalescing(mr);
+    memory_region_profile_free(mr);
     g_free((char *)mr->name);
     g_free(mr->ioeventfds);
 }
@@ -2260,6 +2357,74 @@ static void mtree_print_mr(fprintf_function mon_printf, void *f,
     }
 }
 
+void qmp_mmio_profile_set_state(bool has_enable, bool enable,
+                                bool has_reset, bool reset, Error **errp)
+{
+    MemoryRegionProfile *p, *next;
+
+    if (has_reset && reset) {
+        QTAILQ_FOREACH_SAFE(p, &mmio_profiles, link, next) {
+            memory_region_profile_free(p->mr);
+        }
+    }
+    if (has_enable) {
+        mmio_profile_enabled = enable;
+    }
+}
+
+static int mmio_profile_compare(const void *a, const void *b)
+{
+    const MemoryRegionProfile *pa = *(const MemoryRegionProfile **)a;
+    const MemoryRegionProfile *pb = *(const MemoryRegionProfile **)b;
+    uint64_t ta = pa->ns[0] + pa->ns[1];
+    uint64_t tb = pb->ns[0] + pb->ns[1];
+
+    return ta < tb ? 1 : ta > tb ? -1 : 0;
+}
+
+/* Sorted by the total time spent in the region's callbacks, busiest first */
+MmioProfileInfoList *qmp_query_mmio_profile(Error **errp)
+{
+    MmioProfileInfoList *head = NULL, *entry;
+    MemoryRegionProfile **sorted, *p;
+    MmioProfileInfo *info;
+    MemoryRegion *mr;
+    int n = 0, i;
+
+    QTAILQ_FOREACH(p, &mmio_profiles, link) {
+        n++;
+    }
+    sorted = g_new(MemoryRegionProfile *, n);
+    i = 0;
+    QTAILQ_FOREACH(p, &mmio_profiles, link) {
+        sorted[i++] = p;
+    }
+    qsort(sorted, n, sizeof(*sorted), mmio_profile_compare);
+
+    for (i = n - 1; i >= 0; i--) {
+        p = sorted[i];
+        info = g_new0(MmioProfileInfo, 1);
+        info->name = g_strdup(memory_region_name(p->mr));
+        /* Where the region sits in its root, e.g. the system address space */
+        for (mr = p->mr; mr; mr = mr->container) {
+            info->addr += mr->addr;
+        }
+        info->reads = p->count[0];
+        info->writes = p->count[1];
+        info->read_bytes = p->bytes[0];
+        info->write_bytes = p->bytes[1];
+        info->read_ns = p->ns[0];
+        info->write_ns = p->ns[1];
+
+        entry = g_new0(MmioProfileInfoList, 1);
+        entry->value = info;
+        entry->next = head;
+        head = entry;
+    }
+    g_free(sorted);
+    return head;
+}
+
 void mtree_info(fprintf_function mon_printf, void *f)
 {
     MemoryRegionListHead ml_head;
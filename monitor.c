@@ -197,6 +197,7 @@ struct Monitor {
     int flags;
     int suspend_cnt;
     bool skip_flush;
+    bool forked;        /* inherited across pebble-fork, ignores input */
 
     QemuMutex out_lock;
     QString *outbuf;
@@ -3861,6 +3862,11 @@ static void handle_qmp_command(JSONMessageParser *parser, GQueue *tokens)
     data = NULL;
 
     obj = json_parser_parse(tokens, NULL);
+    if (mon->forked) {
+        /* Commands sent after pebble-fork are the parent's */
+        qobject_decref(obj);
+        return;
+    }
     if (!obj) {
         // FIXME: should be triggered in json_parser_parse()
         error_setg(&local_err, QERR_JSON_PARSING);
@@ -4138,6 +4144,92 @@ void monitor_init(CharDriverState *chr, int flags)
     qemu_mutex_unlock(&monitor_lock);
 }
 
+/*
+ * Monitors on multiplexed character devices share them with other
+ * frontends, so a forked child could not let go of them: parent and child
+ * would both read the same input.
+ */
+bool monitor_can_fork(Error **errp)
+{
+    Monitor *mon;
+    bool ok = true;
+
+    qemu_mutex_lock(&monitor_lock);
+    QLIST_FOREACH(mon, &mon_list, entry) {
+        if (mon->chr && mon->chr->is_mux) {
+            error_setg(errp, "cannot fork with a monitor on a multiplexed "
+                       "character device (%s)",
+                       mon->chr->label ? mon->chr->label : "unnamed");
+            ok = false;
+            break;
+        }
+    }
+    qemu_mutex_unlock(&monitor_lock);
+    return ok;
+}
+
+static QLIST_HEAD(, Monitor) forked_mon_list;
+static QEMUBH *forked_mon_bh;
+
+static void monitor_after_fork_bh(void *opaque)
+{
+    Monitor *mon, *next;
+    CharDriverState *chr;
+
+    QLIST_FOREACH_SAFE(mon, &forked_mon_list, entry, next) {
+        QLIST_REMOVE(mon, entry);
+        chr = mon->chr;
+        mon->chr = NULL;
+        if (monitor_is_qmp(mon)) {
+            json_message_parser_destroy(&mon->qmp.parser);
+        }
+        qemu_chr_add_handlers(chr, NULL, NULL, NULL, NULL);
+        if (chr->label) {
+            qemu_chr_delete(chr);
+        }
+    }
+}
+
+/*
+ * Called in a forked child process: let go of the monitors inherited from
+ * the parent so the child neither reads the parent's commands nor answers
+ * on its connections.  The command that forked is still running on one of
+ * them and the rest of its input buffer may hold more commands, so the
+ * monitors only stop reading and ignore those commands here; the character
+ * devices are closed from a bottom half once the command has returned.
+ * The monitors stay allocated, replies to them are discarded.
+ */
+void monitor_after_fork(void)
+{
+    Monitor *mon, *next;
+
+    qemu_mutex_lock(&monitor_lock);
+    QLIST_FOREACH_SAFE(mon, &mon_list, entry, next) {
+        if (!mon->chr) {
+            continue;
+        }
+        QLIST_REMOVE(mon, entry);
+        QLIST_INSERT_HEAD(&forked_mon_list, mon, entry);
+
+        qemu_mutex_lock(&mon->out_lock);
+        if (mon->out_watch) {
+            g_source_remove(mon->out_watch);
+            mon->out_watch = 0;
+        }
+        mon->skip_flush = true;
+        qemu_mutex_unlock(&mon->out_lock);
+
+        mon->forked = true;
+        mon->suspend_cnt++;
+    }
+    qemu_mutex_unlock(&monitor_lock);
+
+    if (!forked_mon_bh) {
+        forked_mon_bh = qemu_bh_new(monitor_after_fork_bh, NULL);
+    }
+    qemu_bh_schedule(forked_mon_bh);
+}
+
 static void bdrv_password_cb(void *opaque, const char *password,
                              void *readline_opaque)
 {
@@ -4236,6 +4328,34 @@ void qmp_rtc_reset_reinjection(Error **errp)
 }
 #endif
 
+#ifndef TARGET_ARM
+PebbleForkInfo *qmp_pebble_fork(bool has_serial, const char *serial,
+                                bool has_control, const char *control,
+                                bool has_qmp, const char *qmp,
+                                bool has_itm, const char *itm,
+                                bool has_frame_shm, const char *frame_shm,
+                                bool has_resume, bool resume,
+                                Error **errp)
+{
+    error_setg(errp, QERR_FEATURE_DISABLED, "pebble-fork");
+    return NULL;
+}
+
+void qmp_guest_profile_start(int64_t period, bool has_icount, bool icount,
+                             bool has_depth, int64_t depth,
+                             bool has_symbols, const char *symbols,
+                             Error **errp)
+{
+    error_setg(errp, QERR_FEATURE_DISABLED, "guest-profile-start");
+}
+
+void qmp_guest_profile_stop(const char *filename, bool has_format,
+                            GuestProfileFormat format, Error **errp)
+{
+    error_setg(errp, QERR_FEATURE_DISABLED, "guest-profile-stop");
+}
+#endif
+
 #ifndef TARGET_S390X
 void qmp_dump_skeys(const char *filename, Error **errp)
 {
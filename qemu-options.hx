@@ -3197,6 +3197,23 @@ Replay log is written into @var{filename} file in record mode and
 read from this file in replay mode.
 ETEXI
 
+DEF("idle-warp", 0, QEMU_OPTION_idle_warp, \
+    "-idle-warp      advance the virtual clock straight to the next timer\n" \
+    "                deadline whenever all virtual cpus are halted\n", QEMU_ARCH_ALL)
+STEXI
+@item -idle-warp
+@findex -idle-warp
+Without @option{-icount}, the virtual clock follows the host clock, so a
+guest that sleeps until its next timer interrupt still has to wait that time
+out.  With @option{-idle-warp}, whenever all virtual cpus are halted with no
+pending interrupt the virtual clock jumps directly to the earliest pending
+timer deadline.  Busy periods still run at full speed, idle periods take no
+time at all.
+
+This option implies @option{-rtc clock=vm}; a later @option{-rtc clock=}
+overrides that.  In @option{-icount} mode use @option{sleep=no} instead.
+ETEXI
+
 DEF("watchdog", HAS_ARG, QEMU_OPTION_watchdog, \
     "-watchdog model\n" \
     "                enable virtual hardware watchdog [default=none]\n",
@@ -3307,6 +3324,25 @@ STEXI
 Set TB size.
 ETEXI
 
+DEF("tb-cache", HAS_ARG, QEMU_OPTION_tb_cache, \
+    "-tb-cache file  save the code translated from flash in file and load it\n" \
+    "                again when the machine starts\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -tb-cache @var{file}
+@findex -tb-cache
+Save the host code of every translation block whose guest code lies in
+flash (read-only RAM or a ROM device) to @var{file} when QEMU exits,
+together with that guest code.  On the next run of the same QEMU binary
+(same GNU build ID, or the same executable if it has none), on a host with
+the same CPU features and with the same CPU model, the
+blocks whose guest code is unchanged are loaded into the code buffer
+before the virtual CPU starts executing, instead of being translated
+again.  Blocks whose checksum does not match are not loaded.  Instances
+cloned with @code{pebble-fork} inherit the loaded code
+and leave the file to their parent.  Only supported on x86-64 Linux hosts.
+ETEXI
+
 DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "-incoming tcp:[host]:port[,to=maxport][,ipv4][,ipv6]\n" \
     "-incoming rdma:host:port[,ipv4][,ipv6]\n" \
@@ -4512,6 +4512,151 @@ Example:
 
 -> { "execute": "rtc-reset-reinjection" }
 <- { "return": {} }
+EQMP
+
+    {
+        .name       = "pebble-fork",
+        .args_type  = "serial:s?,control:s?,qmp:s?,itm:s?,frame-shm:s?,resume:b?",
+        .mhandler.cmd_new = qmp_marshal_pebble_fork,
+    },
+
+SQMP
+pebble-fork
+-----------
+
+Clone the Pebble machine into a new process that continues from the current
+machine state.  Guest RAM and flash are shared copy-on-write; the clone never
+writes back to the flash image.  Flash images that are writable and mapped
+with "mmap" or "mmap-shared" cannot be forked, nor can an instance with a
+monitor on a multiplexed character device (e.g. "mon:stdio").
+
+Arguments:
+
+- "serial": debug serial port of the clone, in -serial syntax (json-string, optional)
+- "control": control port of the clone, in -serial syntax (json-string, optional)
+- "qmp": QMP monitor of the clone, in -serial syntax (json-string, optional)
+- "itm": ITM stimulus port output of the clone, in -serial syntax
+  (json-string, optional)
+- "frame-shm": shared memory object for the display frames of the clone
+  (json-string, optional)
+- "resume": whether the clone runs; defaults to the run state of the forked
+  instance (json-bool, optional)
+
+Example:
+
+-> { "execute": "pebble-fork",
+     "arguments": { "serial": "tcp::12345,server,nowait",
+                    "control": "tcp::12346,server,nowait",
+                    "qmp": "unix:/tmp/clone-qmp.sock,server,nowait" } }
+<- { "return": { "pid": 4242 } }
+
+EQMP
+
+    {
+        .name       = "mmio-profile-set-state",
+        .args_type  = "enable:b?,reset:b?",
+        .mhandler.cmd_new = qmp_marshal_mmio_profile_set_state,
+    },
+
+SQMP
+mmio-profile-set-state
+----------------------
+
+Enable, disable or reset counting of MMIO accesses per memory region.
+
+Arguments:
+
+- "enable": whether to collect statistics (json-bool, optional)
+- "reset": discard the statistics collected so far (json-bool, optional)
+
+Example:
+
+-> { "execute": "mmio-profile-set-state",
+     "arguments": { "enable": true, "reset": true } }
+<- { "return": {} }
+
+EQMP
+
+    {
+        .name       = "query-mmio-profile",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_query_mmio_profile,
+    },
+
+SQMP
+query-mmio-profile
+------------------
+
+Show the MMIO access statistics of each memory region accessed while
+profiling was enabled, sorted by host time spent in the region's callbacks.
+
+Example:
+
+-> { "execute": "query-mmio-profile" }
+<- { "return": [ { "name": "stm32f2xx-spi", "addr": 1073754112,
+                   "reads": 120345, "writes": 98231,
+                   "read-bytes": 240690, "write-bytes": 196462,
+                   "read-ns": 5123456, "write-ns": 4312345 } ] }
+
+EQMP
+
+    {
+        .name       = "guest-profile-start",
+        .args_type  = "period:i,icount:b?,depth:i?,symbols:s?",
+        .mhandler.cmd_new = qmp_marshal_guest_profile_start,
+    },
+
+SQMP
+guest-profile-start
+-------------------
+
+Start sampling the guest program counter.  Each sample also records the
+link register and, when function symbols are available, return addresses
+found near the top of the stack.
+
+Arguments:
+
+- "period": sampling period in microseconds of virtual time, or in
+            instructions with "icount" (json-int)
+- "icount": count the period in instructions, requires -icount
+            (json-bool, optional)
+- "depth": maximum number of frames per sample, 1 to 32, default 8
+           (json-int, optional)
+- "symbols": ELF file to take function symbols from, in addition to the
+             -kernel image (json-string, optional)
+
+Example:
+
+-> { "execute": "guest-profile-start",
+     "arguments": { "period": 100, "symbols": "build/src/fw/tintin_fw.elf" } }
+<- { "return": {} }
+
+EQMP
+
+    {
+        .name       = "guest-profile-stop",
+        .args_type  = "filename:s,format:s?",
+        .mhandler.cmd_new = qmp_marshal_guest_profile_stop,
+    },
+
+SQMP
+guest-profile-stop
+------------------
+
+Stop the guest profiler and write out the samples collected.
+
+Arguments:
+
+- "filename": file to write the profile to (json-string)
+- "format": "folded" for flamegraph.pl folded stacks (the default) or
+            "pprof" for a gperftools CPU profile (json-string, optional)
+
+Example:
+
+-> { "execute": "guest-profile-stop",
+     "arguments": { "filename": "fw.folded" } }
+<- { "return": {} }
+
 EQMP
 
     {
@@ -214,6 +214,10 @@ static void arm_cpu_reset(CPUState *s)
     set_float_detect_tininess(float_tininess_before_rounding,
                               &env->vfp.standard_fp_status);
     tlb_flush(s, 1);
+    env->pmsav7.map_valid = false;
+#ifndef CONFIG_USER_ONLY
+    arm_v7m_mpu_synced(cpu);
+#endif
     /* Reset is a state change for some CPUARMState fields which we
      * bake assumptions about into translated code, so we need to
      * tb_flush().
@@ -682,6 +686,11 @@ static void arm_cpu_realizefn(DeviceState *dev, Error **errp)
             env->pmsav7.drbar = g_new0(uint32_t, nr);
             env->pmsav7.drsr = g_new0(uint32_t, nr);
             env->pmsav7.dracr = g_new0(uint32_t, nr);
+            env->pmsav7.synced_drbar = g_new0(uint32_t, nr);
+            env->pmsav7.synced_drsr = g_new0(uint32_t, nr);
+            env->pmsav7.synced_dracr = g_new0(uint32_t, nr);
+            /* Each region has up to 9 subregion boundaries */
+            env->pmsav7.map = g_new0(PMSAv7Interval, nr * 9 + 1);
         }
     }
 
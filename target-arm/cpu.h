@@ -127,6 +127,13 @@ typedef struct {
     uint32_t base_mask;
 } TCR;
 
+/* An address range in which the same PMSAv7 region (or none, -1) decides
+ * the access permissions.  It extends up to the start of the next one. */
+typedef struct PMSAv7Interval {
+    uint32_t start;
+    int region;
+} PMSAv7Interval;
+
 typedef struct CPUARMState {
     /* Regs for current mode.  */
     uint32_t regs[16];
@@ -512,6 +519,18 @@ typedef struct CPUARMState {
         uint32_t *drbar;
         uint32_t *drsr;
         uint32_t *dracr;
+        /* The configuration the TLB was last brought up to date with, and
+         * whether it has been changed since (M profile only). */
+        uint32_t *synced_drbar;
+        uint32_t *synced_drsr;
+        uint32_t *synced_dracr;
+        uint32_t synced_ctrl;
+        bool dirty;
+        /* The regions resolved into a sorted list of intervals, rebuilt
+         * on the next lookup once map_valid is cleared. */
+        PMSAv7Interval *map;
+        uint32_t map_len;
+        bool map_valid;
     } pmsav7;
 
     void *nvic;
@@ -1098,6 +1117,17 @@ void armv7m_nvic_complete_irq(void *opaque, int irq);
 void armv7m_nvic_set_base_priority(void *opaque, unsigned int priority);
 void armv7m_nvic_cpu_executed_wfi(void *opaque);
 
+/* The M profile MPU registers have changed; the TLB is brought up to date
+ * at the next context synchronization event (ISB, DSB, exception entry or
+ * return) rather than on every register write. */
+static inline void arm_v7m_mpu_changed(ARMCPU *cpu)
+{
+    cpu->env.pmsav7.dirty = true;
+    cpu->env.pmsav7.map_valid = false;
+}
+void arm_v7m_mpu_sync(CPUARMState *env);
+void arm_v7m_mpu_synced(ARMCPU *cpu);
+
 /* Interface between interrupt controller and power controller */
 bool f2xx_pwr_powerdown_deepsleep(void *opaqe);
 
@@ -1578,6 +1608,11 @@ bool write_cpustate_to_list(ARMCPU *cpu);
 #define TARGET_PAGE_BITS 10
 #endif
 
+#if !defined(CONFIG_USER_ONLY)
+/* Hot TBs are translated again as traces (CF_TRACE), see gen_trace_jmp() */
+#define TARGET_HAS_TB_TRACE
+#endif
+
 #if defined(TARGET_AARCH64)
 #  define TARGET_PHYS_ADDR_SPACE_BITS 48
 #  define TARGET_VIRT_ADDR_SPACE_BITS 64
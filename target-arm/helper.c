@@ -2057,6 +2057,7 @@ static void pmsav7_write(CPUARMState *env, const ARMCPRegInfo *ri,
     u32p += env->cp15.c6_rgnr;
     tlb_flush(CPU(cpu), 1); /* Mappings may have changed - purge! */
     *u32p = value;
+    env->pmsav7.map_valid = false;
 }
 
 static void pmsav7_reset(CPUARMState *env, const ARMCPRegInfo *ri)
@@ -2069,6 +2070,7 @@ static void pmsav7_reset(CPUARMState *env, const ARMCPRegInfo *ri)
     }
 
     memset(u32p, 0, sizeof(*u32p) * cpu->pmsav7_dregion);
+    env->pmsav7.map_valid = false;
 }
 
 static void pmsav7_rgnr_write(CPUARMState *env, const ARMCPRegInfo *ri,
@@ -5162,6 +5164,10 @@ uint32_t HELPER(v7m_mrs)(CPUARMState *env, uint32_t reg)
     return 0;
 }
 
+void HELPER(v7m_mpu_sync)(CPUARMState *env)
+{
+}
+
 void switch_mode(CPUARMState *env, int mode)
 {
     ARMCPU *cpu = arm_env_get_cpu(env);
@@ -5429,6 +5435,100 @@ static void do_v7m_exception_exit(CPUARMState *env)
        pointer.  */
 }
 
+/* More pages than this are cheaper to drop with a full TLB flush */
+#define V7M_MPU_FLUSH_MAX_PAGES 256
+
+/* The address range [*start, *end) of an enabled PMSAv7 region, widened
+ * to whole pages */
+static bool pmsav7_region_extent(uint32_t drbar, uint32_t drsr,
+                                 uint64_t *start, uint64_t *end)
+{
+    if (!(drsr & 1)) {
+        return false;
+    }
+    *start = drbar & TARGET_PAGE_MASK;
+    *end = MIN((uint64_t)drbar + (2ull << extract32(drsr, 1, 5)),
+               1ull << 32);
+    return true;
+}
+
+/* Visit the old and new extents of the regions changed since the last
+ * sync.  With @cs, flush their pages from the TLB.  Returns the number of
+ * pages covered. */
+static uint64_t v7m_mpu_changed_pages(CPUARMState *env, CPUState *cs)
+{
+    ARMCPU *cpu = arm_env_get_cpu(env);
+    uint64_t start, end, addr, pages = 0;
+    int i;
+
+    for (i = 0; i < cpu->pmsav7_dregion; i++) {
+        if (env->pmsav7.synced_drbar[i] == env->pmsav7.drbar[i] &&
+            env->pmsav7.synced_drsr[i] == env->pmsav7.drsr[i] &&
+            env->pmsav7.synced_dracr[i] == env->pmsav7.dracr[i]) {
+            continue;
+        }
+        if (pmsav7_region_extent(env->pmsav7.synced_drbar[i],
+                                 env->pmsav7.synced_drsr[i], &start, &end)) {
+            pages += (end - start + TARGET_PAGE_SIZE - 1) >> TARGET_PAGE_BITS;
+            for (addr = start; cs && addr < end; addr += TARGET_PAGE_SIZE) {
+                tlb_flush_page(cs, addr);
+            }
+        }
+        if (pmsav7_region_extent(env->pmsav7.drbar[i],
+                                 env->pmsav7.drsr[i], &start, &end)) {
+            pages += (end - start + TARGET_PAGE_SIZE - 1) >> TARGET_PAGE_BITS;
+            for (addr = start; cs && addr < end; addr += TARGET_PAGE_SIZE) {
+                tlb_flush_page(cs, addr);
+            }
+        }
+    }
+    return pages;
+}
+
+/* Record the current MPU configuration as the one the TLB reflects.  Also
+ * used after the TLB has been flushed for other reasons, e.g. reset. */
+void arm_v7m_mpu_synced(ARMCPU *cpu)
+{
+    CPUARMState *env = &cpu->env;
+    size_t len = cpu->pmsav7_dregion * sizeof(uint32_t);
+
+    env->pmsav7.dirty = false;
+    env->pmsav7.synced_ctrl = env->v7m.mpu_ctrl;
+    if (len) {
+        memcpy(env->pmsav7.synced_drbar, env->pmsav7.drbar, len);
+        memcpy(env->pmsav7.synced_drsr, env->pmsav7.drsr, len);
+        memcpy(env->pmsav7.synced_dracr, env->pmsav7.dracr, len);
+    }
+}
+
+/* Bring the TLB up to date with MPU register writes made since the last
+ * call.  Only addresses inside the old or new extent of a changed region
+ * can translate differently, so only their pages are flushed, and nothing
+ * at all while the MPU stays disabled.  Writes to MPU_CTRL flush
+ * everything. */
+void arm_v7m_mpu_sync(CPUARMState *env)
+{
+    ARMCPU *cpu = arm_env_get_cpu(env);
+    CPUState *cs = CPU(cpu);
+
+    if (!env->pmsav7.dirty) {
+        return;
+    }
+
+    if (env->pmsav7.synced_ctrl != env->v7m.mpu_ctrl ||
+        v7m_mpu_changed_pages(env, NULL) > V7M_MPU_FLUSH_MAX_PAGES) {
+        tlb_flush(cs, 1);
+    } else if (env->v7m.mpu_ctrl & MPU_CTRL_ENABLE) {
+        v7m_mpu_changed_pages(env, cs);
+    }
+    arm_v7m_mpu_synced(cpu);
+}
+
+void HELPER(v7m_mpu_sync)(CPUARMState *env)
+{
+    arm_v7m_mpu_sync(env);
+}
+
 void arm_v7m_cpu_do_interrupt(CPUState *cs)
 {
     ARMCPU *cpu = ARM_CPU(cs);
@@ -5437,6 +5537,9 @@ void arm_v7m_cpu_do_interrupt(CPUState *cs)
     uint32_t lr;
     uint32_t addr;
 
+    /* Exception entry and return are context synchronization events */
+    arm_v7m_mpu_sync(env);
+
     arm_log_exception(cs->exception_index);
 
     lr = 0xfffffff1;
@@ -7010,36 +7113,113 @@ static inline void get_phys_addr_v7m_default(CPUARMState *env,
 }
 
 #if 1
-static bool get_phys_addr_pmsav7_regions(CPUARMState *env, uint32_t address,
-                                         ARMMMUIdx mmu_idx, int *prot)
+/* The region that decides the permissions at @address: the highest
+ * numbered enabled region containing it, skipping regions whose subregion
+ * at @address is disabled.  -1 if there is none. */
+static int pmsav7_region_at(CPUARMState *env, uint64_t address)
 {
     ARMCPU *cpu = arm_env_get_cpu(env);
-    bool is_user = regime_is_user(env, mmu_idx);
-    int match = -1;
-    for (int n = 0; n < cpu->pmsav7_dregion; ++n) {
-        /* region search */
-        uint32_t base = env->pmsav7.drbar[n];
-        uint32_t rsizebits = extract32(env->pmsav7.drsr[n], 1, 5);
-        uint32_t rsize = 1 << (rsizebits + 1);
-        bool enabled = (env->pmsav7.drsr[n] & 0x1);
-        bool outside_range = (address < base) || (address >= (base + rsize));
-        if (!enabled) {
-            continue;
-        }
-        if (outside_range) {
+    int n;
+
+    for (n = (int)cpu->pmsav7_dregion - 1; n >= 0; n--) {
+        uint64_t base = env->pmsav7.drbar[n];
+        uint64_t rsize = 2ull << extract32(env->pmsav7.drsr[n], 1, 5);
+
+        if (!(env->pmsav7.drsr[n] & 0x1) ||
+            address < base || address >= base + rsize) {
             continue;
         }
         if (rsize >= 256) { /* subregions only if region is big enough */
-            uint32_t region_size = rsize / 8;
-            uint32_t region = (address - base) / region_size;
-            uint8_t srdis = extract32(env->pmsav7.drsr[n], 8, 8);
-            if (srdis & (1 << region)) { /* disabled - not really a match */
+            int sub = (address - base) / (rsize / 8);
+            if (extract32(env->pmsav7.drsr[n], sub + 8, 1)) {
                 continue;
-            } else {
             }
         }
-        match = n;
+        return n;
+    }
+    return -1;
+}
+
+static int pmsav7_interval_cmp(const void *a, const void *b)
+{
+    const PMSAv7Interval *ia = a, *ib = b;
+
+    return ia->start < ib->start ? -1 : ia->start > ib->start;
+}
+
+/* Resolve the regions into intervals.  Between two consecutive region or
+ * subregion boundaries every address has the same outcome, so each is
+ * evaluated once, and neighbours with the same outcome are merged. */
+static void pmsav7_build_map(CPUARMState *env)
+{
+    ARMCPU *cpu = arm_env_get_cpu(env);
+    PMSAv7Interval *map = env->pmsav7.map;
+    uint32_t len = 0, out = 0, i;
+    int n, k, steps, region;
+
+    map[len++].start = 0;
+    for (n = 0; n < cpu->pmsav7_dregion; n++) {
+        uint64_t base = env->pmsav7.drbar[n];
+        uint64_t rsize = 2ull << extract32(env->pmsav7.drsr[n], 1, 5);
+
+        if (!(env->pmsav7.drsr[n] & 0x1)) {
+            continue;
+        }
+        steps = rsize >= 256 ? 8 : 1;
+        for (k = 0; k <= steps; k++) {
+            uint64_t bound = base + k * (rsize / steps);
+            if (bound < (1ull << 32)) {
+                map[len++].start = bound;
+            }
+        }
+    }
+    qsort(map, len, sizeof(*map), pmsav7_interval_cmp);
+
+    for (i = 0; i < len; i++) {
+        region = pmsav7_region_at(env, map[i].start);
+        if (out && map[out - 1].region == region) {
+            continue;
+        }
+        map[out].start = map[i].start;
+        map[out].region = region;
+        out++;
+    }
+    env->pmsav7.map_len = out;
+    env->pmsav7.map_valid = true;
+}
+
+static int pmsav7_lookup(CPUARMState *env, uint32_t address)
+{
+    PMSAv7Interval *map;
+    uint32_t lo = 0, hi, mid;
+
+    if (!env->pmsav7.map_valid) {
+        pmsav7_build_map(env);
+    }
+    map = env->pmsav7.map;
+    hi = env->pmsav7.map_len;
+    /* map[0] starts at 0; find the last interval starting at or below */
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        if (map[mid].start <= address) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return map[lo].region;
+}
+
+static bool get_phys_addr_pmsav7_regions(CPUARMState *env, uint32_t address,
+                                         ARMMMUIdx mmu_idx, int *prot)
+{
+    bool is_user = regime_is_user(env, mmu_idx);
+    int match;
+
+    if (!arm_env_get_cpu(env)->pmsav7_dregion) {
+        return false;
     }
+    match = pmsav7_lookup(env, address);
     if (match == -1) {
         return false; /* we didn't match a region or subregion... */
     }
@@ -276,6 +276,11 @@ static int cpu_post_load(void *opaque, int version_id)
     hw_breakpoint_update_all(cpu);
     hw_watchpoint_update_all(cpu);
 
+    /* The TLB may hold entries for an MPU configuration that is gone */
+    tlb_flush(CPU(cpu), 1);
+    cpu->env.pmsav7.map_valid = false;
+    arm_v7m_mpu_synced(cpu);
+
     return 0;
 }
 
@@ -357,6 +357,14 @@ void HELPER(yield)(CPUARMState *env)
     cpu_loop_exit(cs);
 }
 
+/* Host code to continue at after an indirect branch: the next TB if it is
+ * in the jump cache, otherwise the epilogue back to the main loop.
+ */
+void *HELPER(lookup_tb_ptr)(CPUARMState *env)
+{
+    return tb_lookup_ptr(CPU(arm_env_get_cpu(env)));
+}
+
 /* Raise an internal-to-QEMU exception. This is limited to only
  * those EXCP values which are special cases for QEMU to interrupt
  * execution and not to be used for exceptions which are passed to
@@ -1374,7 +1374,7 @@ static void handle_sys(DisasContext *s, uint32_t insn, bool isread,
         uint32_t syndrome;
 
         gen_a64_set_pc_im(s->pc - 4);
-        tmpptr = tcg_const_ptr(ri);
+        tmpptr = tcg_const_host_ptr(ri);
         syndrome = syn_aa64_sysregtrap(op0, op1, op2, crn, crm, rt, isread);
         tcg_syn = tcg_const_i32(syndrome);
         gen_helper_access_check_cp_reg(cpu_env, tmpptr, tcg_syn);
@@ -1421,7 +1421,7 @@ static void handle_sys(DisasContext *s, uint32_t insn, bool isread,
             tcg_gen_movi_i64(tcg_rt, ri->resetvalue);
         } else if (ri->readfn) {
             TCGv_ptr tmpptr;
-            tmpptr = tcg_const_ptr(ri);
+            tmpptr = tcg_const_host_ptr(ri);
             gen_helper_get_cp_reg64(tcg_rt, cpu_env, tmpptr);
             tcg_temp_free_ptr(tmpptr);
         } else {
@@ -1433,7 +1433,7 @@ static void handle_sys(DisasContext *s, uint32_t insn, bool isread,
             return;
         } else if (ri->writefn) {
             TCGv_ptr tmpptr;
-            tmpptr = tcg_const_ptr(ri);
+            tmpptr = tcg_const_host_ptr(ri);
             gen_helper_set_cp_reg64(cpu_env, tmpptr, tcg_rt);
             tcg_temp_free_ptr(tmpptr);
         } else {
@@ -883,7 +883,7 @@ static inline void gen_bx_im(DisasContext *s, uint32_t addr)
 /* Set PC and Thumb state from var.  var is marked as dead.  */
 static inline void gen_bx(DisasContext *s, TCGv_i32 var)
 {
-    s->is_jmp = DISAS_JUMP;
+    s->is_jmp = DISAS_BX;
     tcg_gen_andi_i32(cpu_R[15], var, ~1);
     tcg_gen_andi_i32(var, var, 1);
     store_cpu_field(var, thumb);
@@ -1058,6 +1058,25 @@ static void gen_exception_insn(DisasContext *s, int offset, int excp,
     s->is_jmp = DISAS_JUMP;
 }
 
+/* Jump to the TB for the PC and Thumb state in env, looking it up from
+ * the generated code when the host backend supports it.  Only used after
+ * plain branches: pending interrupts are not rechecked on the way, exactly
+ * as with chained TBs.
+ */
+static void gen_goto_ptr(void)
+{
+    TCGv_ptr ptr;
+
+    if (!TCG_TARGET_HAS_goto_ptr) {
+        tcg_gen_exit_tb(0);
+        return;
+    }
+    ptr = tcg_temp_new_ptr();
+    gen_helper_lookup_tb_ptr(ptr, cpu_env);
+    tcg_gen_goto_ptr(ptr);
+    tcg_temp_free_ptr(ptr);
+}
+
 /* Force a TB lookup after an instruction that changes the CPU state.  */
 static inline void gen_lookup_tb(DisasContext *s)
 {
@@ -3977,19 +3996,88 @@ static int disas_vfp_insn(DisasContext *s, uint32_t insn)
     return 0;
 }
 
+/* Each of the two goto_tb slots of a TB can be used once.  A trace may have
+ * more exits than that; those past the second look the next TB up with
+ * goto_ptr instead.  */
 static inline void gen_goto_tb(DisasContext *s, int n, target_ulong dest)
 {
     TranslationBlock *tb;
 
     tb = s->tb;
-    if ((tb->pc & TARGET_PAGE_MASK) == (dest & TARGET_PAGE_MASK)) {
-        tcg_gen_goto_tb(n);
+    if (s->tb_exits & (1 << n)) {
+        n ^= 1;
+    }
+    if ((tb->pc & TARGET_PAGE_MASK) != (dest & TARGET_PAGE_MASK)) {
         gen_set_pc_im(s, dest);
-        tcg_gen_exit_tb((uintptr_t)tb + n);
+        tcg_gen_exit_tb(0);
+    } else if (s->tb_exits & (1 << n)) {
+        gen_set_pc_im(s, dest);
+        gen_goto_ptr();
     } else {
+        s->tb_exits |= 1 << n;
+        tcg_gen_goto_tb(n);
         gen_set_pc_im(s, dest);
-        tcg_gen_exit_tb(0);
+        tcg_gen_exit_tb((uintptr_t)tb + n);
+    }
+}
+
+/* Whether an unconditional direct branch to dest can be followed inside
+ * the current TB, translating the target as if it came right after the
+ * branch.  The TB then holds the code on both sides of the branch as one
+ * block, so TCG can drop flag and register values that are dead across it
+ * instead of writing them back at a TB boundary.  Only forward branches
+ * within the first page of the TB qualify: the TB still covers a single
+ * range [pc, pc + size) for invalidation, and loops keep using goto_tb.
+ */
+static inline bool can_follow_jmp(DisasContext *s, uint32_t dest)
+{
+    target_ulong page_end = (s->tb->pc & TARGET_PAGE_MASK) + TARGET_PAGE_SIZE;
+
+    return !s->condjmp && !s->condexec_mask &&
+           dest >= s->pc && dest < page_end;
+}
+
+/* A TB that ran TB_HOT_EXEC_COUNT times is translated again as a trace,
+ * which need not end at a conditional branch.  Translation goes on along the
+ * side of the branch whose TB ran more often so far, as counted by the main
+ * loop, and the other side leaves the trace through a side exit.  The taken
+ * side is only followed forward on the first page of the TB, for the same
+ * reasons as in can_follow_jmp().  The trace runs without TB exits and entry
+ * checks between its parts.  TCG still writes flags and registers back at
+ * each conditional branch, where its basic block ends, since a side exit may
+ * need them; between branches, dead values are dropped as with
+ * can_follow_jmp().  With icount, which charges all instructions of a TB at
+ * its start, traces are not extended.
+ * Returns false if the branch ends the TB as usual.
+ */
+static bool gen_trace_jmp(DisasContext *s, uint32_t dest)
+{
+    target_ulong page_end = (s->tb->pc & TARGET_PAGE_MASK) + TARGET_PAGE_SIZE;
+    uint64_t flags = s->tb->flags & ~ARM_TBFLAG_CONDEXEC_MASK;
+    int taken, skipped;
+
+    if (!s->trace_cpu || !s->condjmp || s->condexec_mask) {
+        return false;
+    }
+    taken = tb_exec_count(s->trace_cpu, dest, s->tb->cs_base, flags);
+    skipped = tb_exec_count(s->trace_cpu, s->pc, s->tb->cs_base, flags);
+
+    if (taken > skipped && dest >= s->pc && dest < page_end &&
+        s->trace_exits < ARRAY_SIZE(s->trace_exit)) {
+        /* Leave for the next insn from the branch's skip label */
+        s->trace_exit[s->trace_exits].label = s->condlabel;
+        s->trace_exit[s->trace_exits].dest = s->pc;
+        s->trace_exits++;
+        s->condjmp = 0;
+        s->pc = dest;
+        return true;
     }
+    if (skipped > 0 && skipped >= taken) {
+        /* Leave for the target here, the skip label is set after the insn */
+        gen_goto_tb(s, 0, dest);
+        return true;
+    }
+    return false;
 }
 
 static inline void gen_jmp (DisasContext *s, uint32_t dest)
@@ -3999,6 +4087,11 @@ static inline void gen_jmp (DisasContext *s, uint32_t dest)
         if (s->thumb)
             dest |= 1;
         gen_bx_im(s, dest);
+    } else if (can_follow_jmp(s, dest)) {
+        /* Continue decoding at the target */
+        s->pc = dest;
+    } else if (gen_trace_jmp(s, dest)) {
+        /* Continue decoding along the trace */
     } else {
         gen_goto_tb(s, 0, dest);
         s->is_jmp = DISAS_TB_JUMP;
@@ -7212,7 +7305,7 @@ static int disas_coproc_insn(DisasContext *s, uint32_t insn)
 
             gen_set_condexec(s);
             gen_set_pc_im(s, s->pc - 4);
-            tmpptr = tcg_const_ptr(ri);
+            tmpptr = tcg_const_host_ptr(ri);
             tcg_syn = tcg_const_i32(syndrome);
             gen_helper_access_check_cp_reg(cpu_env, tmpptr, tcg_syn);
             tcg_temp_free_ptr(tmpptr);
@@ -7248,7 +7341,7 @@ static int disas_coproc_insn(DisasContext *s, uint32_t insn)
                 } else if (ri->readfn) {
                     TCGv_ptr tmpptr;
                     tmp64 = tcg_temp_new_i64();
-                    tmpptr = tcg_const_ptr(ri);
+                    tmpptr = tcg_const_host_ptr(ri);
                     gen_helper_get_cp_reg64(tmp64, cpu_env, tmpptr);
                     tcg_temp_free_ptr(tmpptr);
                 } else {
@@ -7270,7 +7363,7 @@ static int disas_coproc_insn(DisasContext *s, uint32_t insn)
                 } else if (ri->readfn) {
                     TCGv_ptr tmpptr;
                     tmp = tcg_temp_new_i32();
-                    tmpptr = tcg_const_ptr(ri);
+                    tmpptr = tcg_const_host_ptr(ri);
                     gen_helper_get_cp_reg(tmp, cpu_env, tmpptr);
                     tcg_temp_free_ptr(tmpptr);
                 } else {
@@ -7302,7 +7395,7 @@ static int disas_coproc_insn(DisasContext *s, uint32_t insn)
                 tcg_temp_free_i32(tmplo);
                 tcg_temp_free_i32(tmphi);
                 if (ri->writefn) {
-                    TCGv_ptr tmpptr = tcg_const_ptr(ri);
+                    TCGv_ptr tmpptr = tcg_const_host_ptr(ri);
                     gen_helper_set_cp_reg64(cpu_env, tmpptr, tmp64);
                     tcg_temp_free_ptr(tmpptr);
                 } else {
@@ -7314,7 +7407,7 @@ static int disas_coproc_insn(DisasContext *s, uint32_t insn)
                     TCGv_i32 tmp;
                     TCGv_ptr tmpptr;
                     tmp = load_reg(s, rt);
-                    tmpptr = tcg_const_ptr(ri);
+                    tmpptr = tcg_const_host_ptr(ri);
                     gen_helper_set_cp_reg(cpu_env, tmpptr, tmp);
                     tcg_temp_free_ptr(tmpptr);
                     tcg_temp_free_i32(tmp);
@@ -10036,8 +10129,13 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                             gen_clrex(s);
                             break;
                         case 4: /* dsb */
+                            /* Makes M profile MPU changes visible.  */
+                            if (arm_dc_feature(s, ARM_FEATURE_M)) {
+                                gen_helper_v7m_mpu_sync(cpu_env);
+                            }
+                            break;
                         case 5: /* dmb */
-                            /* These execute as NOPs.  */
+                            /* This executes as a NOP.  */
                             break;
                         case 6: /* isb */
                             /* We need to break the TB after this insn
@@ -10045,6 +10143,9 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                              * and also to take any pending interrupts
                              * immediately.
                              */
+                            if (arm_dc_feature(s, ARM_FEATURE_M)) {
+                                gen_helper_v7m_mpu_sync(cpu_env);
+                            }
                             gen_lookup_tb(s);
                             break;
                         default:
@@ -11219,6 +11320,7 @@ void gen_intermediate_code(CPUARMState *env, TranslationBlock *tb)
     target_ulong pc_start;
     target_ulong next_page_start;
     int num_insns;
+    int i;
     int max_insns;
     bool end_of_page;
 
@@ -11235,6 +11337,12 @@ void gen_intermediate_code(CPUARMState *env, TranslationBlock *tb)
     pc_start = tb->pc;
 
     dc->tb = tb;
+    dc->tb_exits = 0;
+    dc->trace_cpu = NULL;
+    if ((tb->cflags & (CF_TRACE | CF_USE_ICOUNT)) == CF_TRACE) {
+        dc->trace_cpu = cs;
+    }
+    dc->trace_exits = 0;
 
     dc->is_jmp = DISAS_NEXT;
     dc->pc = pc_start;
@@ -11545,6 +11653,9 @@ void gen_intermediate_code(CPUARMState *env, TranslationBlock *tb)
             /* indicate that the hash table must be used to find the next TB */
             tcg_gen_exit_tb(0);
             break;
+        case DISAS_BX:
+            gen_goto_ptr();
+            break;
         case DISAS_TB_JUMP:
             /* nothing more to generate */
             break;
@@ -11581,6 +11692,10 @@ void gen_intermediate_code(CPUARMState *env, TranslationBlock *tb)
     }
 
 done_generating:
+    for (i = 0; i < dc->trace_exits; i++) {
+        gen_set_label(dc->trace_exit[i].label);
+        gen_goto_tb(dc, 1, dc->trace_exit[i].dest);
+    }
     gen_tb_end(tb, num_insns);
 
 #ifdef DEBUG_DISAS
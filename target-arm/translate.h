@@ -14,6 +14,17 @@ typedef struct DisasContext {
     int condexec_mask;
     int condexec_cond;
     struct TranslationBlock *tb;
+    /* goto_tb slots (1 << n) already used by the TB.  */
+    int tb_exits;
+    /* Set while translating a trace (CF_TRACE), see gen_trace_jmp().  */
+    CPUState *trace_cpu;
+    /* Side exits of the conditional branches a trace went on past, taken
+     * from their label and emitted after the end of the TB.  */
+    int trace_exits;
+    struct {
+        TCGLabel *label;
+        uint32_t dest;
+    } trace_exit[4];
     int singlestep_enabled;
     int thumb;
     int bswap_code;
@@ -119,6 +130,10 @@ static inline int default_exception_el(DisasContext *s)
 #define DISAS_HVC 8
 #define DISAS_SMC 9
 #define DISAS_YIELD 10
+/* An indirect branch which only changed the PC and Thumb bit: the next TB
+ * can be looked up from generated code without going back to the main loop.
+ */
+#define DISAS_BX 11
 
 #ifdef TARGET_AARCH64
 void a64_translate_init(void);
@@ -0,0 +1,763 @@
+/*
+ * Persistent translated code.
+ *
+ * With -tb-cache, the host code of every block translated from the flash
+ * of the machine (read-only RAM, or a ROM device in ROMD mode) is kept
+ * together with the guest code it was translated from, and written out
+ * when QEMU exits.  The next run with the same file loads the code into
+ * the code buffer when the virtual CPU first starts, so the guest does not
+ * stall on the translator the first time it reaches each function.
+ * Blocks whose guest code has changed since, for a new firmware build,
+ * are dropped.
+ *
+ * Generated code embeds host addresses: helpers and the code buffer
+ * epilogue, the TB itself for exit_tb, and return addresses within the
+ * block.  While the cache is enabled the backend records these (see
+ * tcg_note_host_reloc), and they are saved relative to the QEMU
+ * executable, the prologue, the TB or its code so that they can be
+ * patched on load.  The file is tied to the QEMU binary, by its GNU
+ * build ID or else a hash of the executable, and to the host CPU features
+ * the backend used.  Blocks that embed any other pointer, such as a
+ * coprocessor register descriptor, are not kept.  Each block carries a
+ * CRC that is checked before its code is copied into the code buffer.
+ *
+ * Only the x86-64 backend records its relocations.
+ *
+ * This code is licensed under the GPL.
+ */
+
+#include "config.h"
+#include "qemu-common.h"
+#include "cpu.h"
+#include "exec/exec-all.h"
+#include "exec/memory.h"
+#include "exec/tb-hash.h"
+#include "qemu/crc32c.h"
+#include "qemu/error-report.h"
+#include "qemu/rcu.h"
+#include "sysemu/sysemu.h"
+#include "tcg.h"
+
+bool tb_cache_enabled;
+
+#if defined(CONFIG_LINUX) && defined(__x86_64__) && \
+    !defined(CONFIG_TCG_INTERPRETER)
+
+#include <link.h>
+#include "elf.h"
+
+#ifndef NT_GNU_BUILD_ID
+#define NT_GNU_BUILD_ID 3
+#endif
+
+/* Bounds of the QEMU executable, from the linker */
+extern char __executable_start[], _end[];
+
+#define TB_CACHE_MAGIC          "QEMUTBC3"
+#define TB_CACHE_MAGIC_LEN      8
+
+/* What a saved host address is relative to */
+enum {
+    TB_CACHE_BASE_CODE,         /* the host code of the block */
+    TB_CACHE_BASE_TB,           /* its TranslationBlock */
+    TB_CACHE_BASE_PROLOGUE,     /* the prologue of the code buffer */
+    TB_CACHE_BASE_IMAGE,        /* the QEMU executable */
+};
+
+/*
+ * A block, serialized as in the file, all little endian:
+ *
+ *   u64 pc, u64 cs_base, u64 flags, u32 cflags, u16 size, u16 icount,
+ *   u16 tb_next_offset[2], u16 tb_jmp_offset[2],
+ *   u32 code_len, u32 search_offset, u32 nb_relocs,
+ *   guest code [size], host code [code_len],
+ *   nb_relocs * { u32 offset, u8 type, u8 base, u16 0, u64 addend },
+ *   u32 crc32c of all of the above
+ */
+typedef struct TBCacheEntry {
+    uint64_t pc;
+    uint64_t cs_base;
+    uint64_t flags;
+    GByteArray *data;
+} TBCacheEntry;
+
+typedef struct TBCacheReader {
+    const uint8_t *p;
+    size_t left;
+    bool error;
+} TBCacheReader;
+
+static const char *tb_cache_file;
+/* Blocks translated or loaded in this run, saved at exit */
+static GHashTable *tb_cache_entries;
+static VMChangeStateEntry *tb_cache_vmstate;
+static Notifier tb_cache_exit_notifier;
+/* Whether the file was read, only then is it safe to replace it */
+static bool tb_cache_loaded;
+/* Identifies the QEMU executable, see tb_cache_binary_id() */
+static GByteArray *tb_cache_binary;
+
+static guint tb_cache_entry_hash(gconstpointer key)
+{
+    const TBCacheEntry *e = key;
+
+    return e->pc ^ (e->pc >> 32) ^ e->cs_base ^ e->flags;
+}
+
+static gboolean tb_cache_entry_equal(gconstpointer a, gconstpointer b)
+{
+    const TBCacheEntry *ea = a, *eb = b;
+
+    return ea->pc == eb->pc && ea->cs_base == eb->cs_base &&
+           ea->flags == eb->flags;
+}
+
+static void tb_cache_entry_free(gpointer p)
+{
+    TBCacheEntry *e = p;
+
+    g_byte_array_free(e->data, TRUE);
+    g_free(e);
+}
+
+static void tb_cache_put(GByteArray *b, uint64_t v, int bytes)
+{
+    uint8_t buf[8];
+    int i;
+
+    for (i = 0; i < bytes; i++) {
+        buf[i] = v >> (i * 8);
+    }
+    g_byte_array_append(b, buf, bytes);
+}
+
+static const uint8_t *tb_cache_get_bytes(TBCacheReader *r, size_t n)
+{
+    const uint8_t *p = r->p;
+
+    if (r->error || r->left < n) {
+        r->error = true;
+        return NULL;
+    }
+    r->p += n;
+    r->left -= n;
+    return p;
+}
+
+static uint64_t tb_cache_get(TBCacheReader *r, int bytes)
+{
+    const uint8_t *p = tb_cache_get_bytes(r, bytes);
+    uint64_t v = 0;
+    int i;
+
+    for (i = 0; p && i < bytes; i++) {
+        v |= (uint64_t)p[i] << (i * 8);
+    }
+    return v;
+}
+
+/* Host pointer to the guest page PAGE, provided it is flash: read-only
+ * RAM, or a ROM device such as a QSPI flash in ROMD mode.  Code anywhere
+ * else is likely to be loaded or generated at run time and is not worth
+ * keeping.  Called with the RCU read lock held. */
+static uint8_t *tb_cache_code_page(CPUState *cpu, target_ulong page)
+{
+    MemoryRegion *mr;
+    hwaddr phys, xlat, len = TARGET_PAGE_SIZE;
+
+    phys = cpu_get_phys_page_debug(cpu, page);
+    if (phys == -1) {
+        return NULL;
+    }
+    mr = address_space_translate(cpu->as, phys, &xlat, &len, false);
+    if (len < TARGET_PAGE_SIZE) {
+        return NULL;
+    }
+    if (!(memory_region_is_ram(mr) && mr->readonly) &&
+        !memory_region_is_romd(mr)) {
+        return NULL;
+    }
+    return memory_region_get_ram_ptr(mr) + xlat;
+}
+
+/* Copy the guest code [pc, pc + size) to BUF, if it is all flash */
+static bool tb_cache_read_code(CPUState *cpu, target_ulong pc, uint32_t size,
+                               uint8_t *buf)
+{
+    target_ulong page;
+    uint32_t n;
+    uint8_t *p;
+    bool ok = true;
+
+    rcu_read_lock();
+    while (size) {
+        page = pc & TARGET_PAGE_MASK;
+        n = MIN(size, page + TARGET_PAGE_SIZE - pc);
+        p = tb_cache_code_page(cpu, page);
+        if (!p) {
+            ok = false;
+            break;
+        }
+        memcpy(buf, p + (pc - page), n);
+        pc += n;
+        buf += n;
+        size -= n;
+    }
+    rcu_read_unlock();
+    return ok;
+}
+
+/* Find what TARGET, embedded in the code of TB, is relative to */
+static int tb_cache_reloc_base(TranslationBlock *tb, size_t code_len,
+                               uintptr_t target, uint64_t *addend)
+{
+    uintptr_t code = (uintptr_t)tb->tc_ptr;
+    uintptr_t prologue = (uintptr_t)tcg_ctx.code_gen_prologue;
+    uintptr_t image = (uintptr_t)__executable_start;
+
+    if (target - code < code_len) {
+        *addend = target - code;
+        return TB_CACHE_BASE_CODE;
+    }
+    if (target - (uintptr_t)tb < 4) {
+        /* exit_tb returns the TB with the exit index in the low bits */
+        *addend = target - (uintptr_t)tb;
+        return TB_CACHE_BASE_TB;
+    }
+    if (target - prologue < (uintptr_t)tcg_ctx.code_gen_buffer - prologue) {
+        *addend = target - prologue;
+        return TB_CACHE_BASE_PROLOGUE;
+    }
+    if (target - image < (uintptr_t)_end - image) {
+        *addend = target - image;
+        return TB_CACHE_BASE_IMAGE;
+    }
+    return -1;
+}
+
+void tb_cache_record(CPUState *cpu, TranslationBlock *tb)
+{
+    size_t code_len = tcg_ctx.code_gen_ptr - (void *)tb->tc_ptr;
+    TBCacheEntry *e;
+    GByteArray *d;
+    size_t guest, nb_relocs_off;
+    uint32_t nb_relocs = 0;
+    uint64_t addend;
+    int i, base;
+
+    /* Blocks cut short for I/O or single use are not the normal ones, and
+     * breakpoints or single stepping change the code */
+    if (tb->cflags & (CF_COUNT_MASK | CF_LAST_IO | CF_NOCACHE)) {
+        return;
+    }
+    if (tcg_ctx.host_code_uncacheable || tb->size == 0 ||
+        cpu->singlestep_enabled || !QTAILQ_EMPTY(&cpu->breakpoints)) {
+        return;
+    }
+
+    d = g_byte_array_new();
+    tb_cache_put(d, tb->pc, 8);
+    tb_cache_put(d, tb->cs_base, 8);
+    tb_cache_put(d, tb->flags, 8);
+    tb_cache_put(d, tb->cflags, 4);
+    tb_cache_put(d, tb->size, 2);
+    tb_cache_put(d, tb->icount, 2);
+    for (i = 0; i < 2; i++) {
+        tb_cache_put(d, tb->tb_next_offset[i], 2);
+    }
+    for (i = 0; i < 2; i++) {
+        tb_cache_put(d, tb->tb_jmp_offset[i], 2);
+    }
+    tb_cache_put(d, code_len, 4);
+    tb_cache_put(d, tb->tc_search - (uint8_t *)tb->tc_ptr, 4);
+    nb_relocs_off = d->len;
+    tb_cache_put(d, 0, 4);
+
+    guest = d->len;
+    g_byte_array_set_size(d, guest + tb->size);
+    if (!tb_cache_read_code(cpu, tb->pc, tb->size, d->data + guest)) {
+        goto drop;
+    }
+    g_byte_array_append(d, tb->tc_ptr, code_len);
+
+    for (i = 0; i < tcg_ctx.nb_host_relocs; i++) {
+        TCGHostReloc *r = &tcg_ctx.host_relocs[i];
+
+        base = tb_cache_reloc_base(tb, code_len, r->target, &addend);
+        if (base < 0) {
+            goto drop;
+        }
+        if (base == TB_CACHE_BASE_CODE && r->type == TCG_HOST_RELOC_REL32) {
+            /* Moves with the code */
+            continue;
+        }
+        tb_cache_put(d, r->offset, 4);
+        tb_cache_put(d, r->type, 1);
+        tb_cache_put(d, base, 1);
+        tb_cache_put(d, 0, 2);
+        tb_cache_put(d, addend, 8);
+        nb_relocs++;
+    }
+    stl_le_p(d->data + nb_relocs_off, nb_relocs);
+    tb_cache_put(d, crc32c(0xffffffff, d->data, d->len), 4);
+
+    e = g_new(TBCacheEntry, 1);
+    e->pc = tb->pc;
+    e->cs_base = tb->cs_base;
+    e->flags = tb->flags;
+    e->data = d;
+    g_hash_table_replace(tb_cache_entries, e, e);
+    return;
+
+drop:
+    g_byte_array_free(d, TRUE);
+}
+
+static int tb_cache_find_build_id(struct dl_phdr_info *info, size_t size,
+                                  void *opaque)
+{
+    GByteArray *id = opaque;
+    const ElfW(Nhdr) *nhdr;
+    const uint8_t *p, *end;
+    int i;
+
+    /* The executable comes first */
+    for (i = 0; i < info->dlpi_phnum; i++) {
+        if (info->dlpi_phdr[i].p_type != PT_NOTE) {
+            continue;
+        }
+        p = (const uint8_t *)(info->dlpi_addr + info->dlpi_phdr[i].p_vaddr);
+        end = p + info->dlpi_phdr[i].p_memsz;
+        while (p + sizeof(*nhdr) <= end) {
+            nhdr = (const ElfW(Nhdr) *)p;
+            p += sizeof(*nhdr) + ROUND_UP(nhdr->n_namesz, 4);
+            if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4 &&
+                !memcmp(nhdr + 1, "GNU", 4) && p + nhdr->n_descsz <= end) {
+                g_byte_array_append(id, p, nhdr->n_descsz);
+                return 1;
+            }
+            p += ROUND_UP(nhdr->n_descsz, 4);
+        }
+    }
+    return 1;
+}
+
+/* The GNU build ID of the QEMU executable or, if it was linked without
+ * one, a SHA-256 of the executable.  Saved code calls into the helpers of
+ * exactly this binary.  NULL if neither can be had. */
+static GByteArray *tb_cache_binary_id(void)
+{
+    GMappedFile *exe;
+    GChecksum *sum;
+    GError *err = NULL;
+    gsize len;
+
+    if (tb_cache_binary) {
+        return tb_cache_binary;
+    }
+
+    tb_cache_binary = g_byte_array_new();
+    g_byte_array_append(tb_cache_binary, (const guint8 *)"B", 1);
+    dl_iterate_phdr(tb_cache_find_build_id, tb_cache_binary);
+    if (tb_cache_binary->len > 1) {
+        return tb_cache_binary;
+    }
+
+    exe = g_mapped_file_new("/proc/self/exe", FALSE, &err);
+    if (!exe) {
+        error_report("TB cache disabled, cannot read the QEMU executable: %s",
+                     err->message);
+        g_error_free(err);
+        g_byte_array_free(tb_cache_binary, TRUE);
+        tb_cache_binary = NULL;
+        tb_cache_file = NULL;
+        return NULL;
+    }
+    sum = g_checksum_new(G_CHECKSUM_SHA256);
+    g_checksum_update(sum, (const guchar *)g_mapped_file_get_contents(exe),
+                      g_mapped_file_get_length(exe));
+    g_mapped_file_unref(exe);
+    g_byte_array_set_size(tb_cache_binary, 1 + 32);
+    tb_cache_binary->data[0] = 'H';
+    len = 32;
+    g_checksum_get_digest(sum, tb_cache_binary->data + 1, &len);
+    g_checksum_free(sum);
+    return tb_cache_binary;
+}
+
+/* What the saved code depends on besides the guest code: the QEMU
+ * executable, the host CPU features and the guest CPU model.  NULL if the
+ * executable cannot be identified. */
+static GByteArray *tb_cache_header(CPUState *cpu)
+{
+    const char *model = object_get_typename(OBJECT(cpu));
+    GByteArray *binary = tb_cache_binary_id();
+    GByteArray *h;
+
+    if (!binary) {
+        return NULL;
+    }
+    h = g_byte_array_new();
+    g_byte_array_append(h, (const guint8 *)TB_CACHE_MAGIC,
+                        TB_CACHE_MAGIC_LEN);
+    tb_cache_put(h, TARGET_PAGE_BITS, 4);
+    tb_cache_put(h, tcg_ctx.code_gen_buffer -
+                    tcg_ctx.code_gen_prologue, 4);
+    tb_cache_put(h, tcg_ctx.host_code_features, 4);
+    tb_cache_put(h, binary->len, 4);
+    g_byte_array_append(h, binary->data, binary->len);
+    tb_cache_put(h, strlen(QEMU_VERSION), 4);
+    g_byte_array_append(h, (const guint8 *)QEMU_VERSION,
+                        strlen(QEMU_VERSION));
+    tb_cache_put(h, strlen(model), 4);
+    g_byte_array_append(h, (const guint8 *)model, strlen(model));
+    return h;
+}
+
+static bool tb_cache_exists(tb_page_addr_t phys_pc, target_ulong pc,
+                            target_ulong cs_base, uint64_t flags)
+{
+    TranslationBlock *tb;
+
+    tb = tcg_ctx.tb_ctx.tb_phys_hash[tb_phys_hash_func(phys_pc)];
+    for (; tb; tb = tb->phys_hash_next) {
+        if (tb->pc == pc && tb->page_addr[0] == (phys_pc & TARGET_PAGE_MASK) &&
+            tb->cs_base == cs_base && tb->flags == flags) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool tb_cache_relocate(TranslationBlock *tb, const uint8_t *relocs,
+                              uint32_t nb_relocs, uint32_t code_len)
+{
+    uint8_t *code = tb->tc_ptr;
+    uintptr_t target;
+    intptr_t disp;
+    uint32_t i, offset;
+    int type;
+
+    for (i = 0; i < nb_relocs; i++, relocs += 16) {
+        offset = ldl_le_p(relocs);
+        type = relocs[4];
+        target = ldq_le_p(relocs + 8);
+        switch (relocs[5]) {
+        case TB_CACHE_BASE_CODE:
+            target += (uintptr_t)code;
+            break;
+        case TB_CACHE_BASE_TB:
+            target += (uintptr_t)tb;
+            break;
+        case TB_CACHE_BASE_PROLOGUE:
+            target += (uintptr_t)tcg_ctx.code_gen_prologue;
+            break;
+        case TB_CACHE_BASE_IMAGE:
+            target += (uintptr_t)__executable_start;
+            break;
+        default:
+            return false;
+        }
+
+        if (type == TCG_HOST_RELOC_ABS64 &&
+            (uint64_t)offset + 8 <= code_len) {
+            stq_he_p(code + offset, target);
+        } else if (type == TCG_HOST_RELOC_REL32 &&
+                   (uint64_t)offset + 4 <= code_len) {
+            /* The code buffer may have landed too far from the helpers */
+            disp = target - (uintptr_t)(code + offset + 4);
+            if (disp != (int32_t)disp) {
+                return false;
+            }
+            stl_he_p(code + offset, disp);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* A block as read from the file */
+typedef struct TBCacheBlock {
+    uint32_t cflags;
+    uint16_t size;
+    uint16_t icount;
+    uint16_t next_offset[2];
+    uint16_t jmp_offset[2];
+    uint32_t code_len;
+    uint32_t search_offset;
+    uint32_t nb_relocs;
+    const uint8_t *guest;
+    const uint8_t *code;
+    const uint8_t *relocs;
+} TBCacheBlock;
+
+/* Read one block, false if the file is truncated or the block is damaged */
+static bool tb_cache_parse(TBCacheReader *r, TBCacheEntry *e,
+                           TBCacheBlock *b)
+{
+    const uint8_t *start = r->p;
+    uint32_t crc;
+    int i;
+
+    e->pc = tb_cache_get(r, 8);
+    e->cs_base = tb_cache_get(r, 8);
+    e->flags = tb_cache_get(r, 8);
+    b->cflags = tb_cache_get(r, 4);
+    b->size = tb_cache_get(r, 2);
+    b->icount = tb_cache_get(r, 2);
+    for (i = 0; i < 2; i++) {
+        b->next_offset[i] = tb_cache_get(r, 2);
+    }
+    for (i = 0; i < 2; i++) {
+        b->jmp_offset[i] = tb_cache_get(r, 2);
+    }
+    b->code_len = tb_cache_get(r, 4);
+    b->search_offset = tb_cache_get(r, 4);
+    b->nb_relocs = tb_cache_get(r, 4);
+    b->guest = tb_cache_get_bytes(r, b->size);
+    b->code = tb_cache_get_bytes(r, b->code_len);
+    b->relocs = tb_cache_get_bytes(r, (size_t)b->nb_relocs * 16);
+    if (r->error) {
+        return false;
+    }
+    crc = crc32c(0xffffffff, start, r->p - start);
+    return tb_cache_get(r, 4) == crc && !r->error;
+}
+
+enum {
+    TB_CACHE_LOADED,
+    TB_CACHE_SKIPPED,           /* kept for another run */
+    TB_CACHE_STALE,             /* dropped */
+    TB_CACHE_FULL,
+};
+
+/* Load one block into the code buffer */
+static int tb_cache_load_one(CPUState *cpu, const TBCacheEntry *e,
+                             const TBCacheBlock *b)
+{
+    CPUArchState *env = cpu->env_ptr;
+    TranslationBlock *tb;
+    tb_page_addr_t phys_pc, phys_page2 = -1;
+    target_ulong virt_page2;
+    uint8_t *buf;
+    bool same;
+    int i;
+
+    if (b->size == 0 || b->search_offset > b->code_len ||
+        !!(b->cflags & CF_USE_ICOUNT) != !!use_icount) {
+        return TB_CACHE_STALE;
+    }
+
+    buf = g_malloc(b->size);
+    same = tb_cache_read_code(cpu, e->pc, b->size, buf) &&
+           !memcmp(buf, b->guest, b->size);
+    g_free(buf);
+    if (!same) {
+        return TB_CACHE_STALE;
+    }
+
+    /* The pages were readable above, this does not fault */
+    phys_pc = get_page_addr_code_probe(env, e->pc);
+    virt_page2 = (e->pc + b->size - 1) & TARGET_PAGE_MASK;
+    if ((e->pc & TARGET_PAGE_MASK) != virt_page2) {
+        phys_page2 = get_page_addr_code_probe(env, virt_page2);
+        if (phys_page2 == -1) {
+            return TB_CACHE_STALE;
+        }
+    }
+    if (phys_pc == -1) {
+        return TB_CACHE_STALE;
+    }
+    if (tb_cache_exists(phys_pc, e->pc, e->cs_base, e->flags)) {
+        return TB_CACHE_SKIPPED;
+    }
+
+    tb = tb_alloc_restored(e->pc, b->code_len);
+    if (!tb) {
+        return TB_CACHE_FULL;
+    }
+    memcpy(tb->tc_ptr, b->code, b->code_len);
+    if (!tb_cache_relocate(tb, b->relocs, b->nb_relocs, b->code_len)) {
+        tb_free(tb);
+        return TB_CACHE_SKIPPED;
+    }
+    tb->cs_base = e->cs_base;
+    tb->flags = e->flags;
+    tb->cflags = b->cflags;
+    tb->size = b->size;
+    tb->icount = b->icount;
+    tb->tc_search = tb->tc_ptr + b->search_offset;
+    for (i = 0; i < 2; i++) {
+        tb->tb_next_offset[i] = b->next_offset[i];
+        tb->tb_jmp_offset[i] = b->jmp_offset[i];
+    }
+    tb_link_restored(tb, phys_pc, phys_page2);
+    return TB_CACHE_LOADED;
+}
+
+/* Runs on the vCPU thread, before it first executes guest code */
+static void tb_cache_load(void *opaque)
+{
+    CPUState *cpu = opaque;
+    GByteArray *hdr;
+    TBCacheReader r;
+    TBCacheEntry *e;
+    TBCacheBlock b;
+    const uint8_t *start;
+    GError *err = NULL;
+    gchar *buf;
+    gsize len;
+    uint32_t count, i;
+    int loaded = 0, stale = 0, res;
+    bool can_load;
+
+    if (!g_file_get_contents(tb_cache_file, &buf, &len, &err)) {
+        if (g_error_matches(err, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+            /* First run, the file is created at exit */
+            tb_cache_loaded = true;
+        } else {
+            error_report("Cannot read TB cache: %s", err->message);
+        }
+        g_error_free(err);
+        return;
+    }
+    tb_cache_loaded = true;
+
+    hdr = tb_cache_header(cpu);
+    if (!hdr) {
+        g_free(buf);
+        return;
+    }
+    if (len < hdr->len || memcmp(buf, hdr->data, hdr->len)) {
+        /* Another QEMU build, host or CPU model, start over */
+        g_byte_array_free(hdr, TRUE);
+        g_free(buf);
+        return;
+    }
+    r.p = (const uint8_t *)buf + hdr->len;
+    r.left = len - hdr->len;
+    r.error = false;
+    g_byte_array_free(hdr, TRUE);
+    count = tb_cache_get(&r, 4);
+
+    /* Breakpoints inserted before the start change the code to generate */
+    can_load = !cpu->singlestep_enabled && QTAILQ_EMPTY(&cpu->breakpoints);
+
+    qemu_thread_jit_write();
+    for (i = 0; i < count; i++) {
+        e = g_new(TBCacheEntry, 1);
+        start = r.p;
+        if (!tb_cache_parse(&r, e, &b)) {
+            /* Nothing after a damaged block can be trusted either */
+            error_report("TB cache '%s' is truncated or damaged",
+                         tb_cache_file);
+            g_free(e);
+            break;
+        }
+        res = can_load ? tb_cache_load_one(cpu, e, &b) : TB_CACHE_SKIPPED;
+        if (res == TB_CACHE_STALE) {
+            stale++;
+            g_free(e);
+            continue;
+        }
+        if (res == TB_CACHE_FULL) {
+            /* Keep the rest for the next run */
+            can_load = false;
+        }
+        loaded += res == TB_CACHE_LOADED;
+        e->data = g_byte_array_sized_new(r.p - start);
+        g_byte_array_append(e->data, start, r.p - start);
+        g_hash_table_replace(tb_cache_entries, e, e);
+    }
+    qemu_thread_jit_execute();
+    g_free(buf);
+
+    qemu_log_mask(CPU_LOG_EXEC, "TB cache: %d blocks loaded, %d stale\n",
+                  loaded, stale);
+}
+
+static void tb_cache_vm_state_change(void *opaque, int running,
+                                     RunState state)
+{
+    if (!running || !first_cpu) {
+        return;
+    }
+    /* Only once, with the machine reset and its images loaded */
+    qemu_del_vm_change_state_handler(tb_cache_vmstate);
+    tb_cache_vmstate = NULL;
+    async_run_on_cpu(first_cpu, tb_cache_load, first_cpu);
+}
+
+static void tb_cache_save(Notifier *n, void *data)
+{
+    GHashTableIter iter;
+    TBCacheEntry *e;
+    GByteArray *out;
+    GError *err = NULL;
+
+    if (!tb_cache_file || !tb_cache_loaded || !first_cpu) {
+        return;
+    }
+
+    out = tb_cache_header(first_cpu);
+    if (!out) {
+        return;
+    }
+    tb_cache_put(out, g_hash_table_size(tb_cache_entries), 4);
+    g_hash_table_iter_init(&iter, tb_cache_entries);
+    while (g_hash_table_iter_next(&iter, (gpointer *)&e, NULL)) {
+        g_byte_array_append(out, e->data->data, e->data->len);
+    }
+
+    /* Written to a temporary file and renamed, so that concurrent
+     * instances sharing the file never see it half written */
+    if (!g_file_set_contents(tb_cache_file, (const gchar *)out->data,
+                             out->len, &err)) {
+        error_report("Cannot write TB cache: %s", err->message);
+        g_error_free(err);
+    }
+    g_byte_array_free(out, TRUE);
+}
+
+/* In a pebble-fork child.  The file is only written by the process that
+ * loaded it, the clones would all replace it with the same blocks. */
+void tb_cache_after_fork(void)
+{
+    tb_cache_file = NULL;
+    tb_cache_enabled = false;
+    g_free(tcg_ctx.host_relocs);
+    tcg_ctx.host_relocs = NULL;
+}
+
+void tb_cache_init(const char *filename)
+{
+    tb_cache_file = filename;
+    tb_cache_entries = g_hash_table_new_full(tb_cache_entry_hash,
+                                             tb_cache_entry_equal,
+                                             tb_cache_entry_free, NULL);
+    tb_cache_vmstate = qemu_add_vm_change_state_handler(
+        tb_cache_vm_state_change, NULL);
+    tb_cache_exit_notifier.notify = tb_cache_save;
+    qemu_add_exit_notifier(&tb_cache_exit_notifier);
+    tcg_ctx.host_relocs = g_new(TCGHostReloc, TCG_MAX_HOST_RELOCS);
+    tb_cache_enabled = true;
+}
+
+#else
+
+void tb_cache_record(CPUState *cpu, TranslationBlock *tb)
+{
+}
+
+void tb_cache_after_fork(void)
+{
+}
+
+void tb_cache_init(const char *filename)
+{
+    error_report("-tb-cache is not supported on this host");
+    exit(1);
+}
+
+#endif
@@ -660,9 +660,10 @@ static void tcg_out_movi(TCGContext *s, TCGType type,
         return;
     }
 
-    /* Try a 7 byte pc-relative lea before the 10 byte movq.  */
+    /* Try a 7 byte pc-relative lea before the 10 byte movq.  Not when
+       the code may be moved by tb-cache.c: the constant would change.  */
     diff = arg - ((uintptr_t)s->code_ptr + 7);
-    if (diff == (int32_t)diff) {
+    if (diff == (int32_t)diff && !s->host_relocs) {
         tcg_out_opc(s, OPC_LEA | P_REXW, ret, 0, 0);
         tcg_out8(s, (LOWREGMASK(ret) << 3) | 5);
         tcg_out32(s, diff);
@@ -673,6 +674,19 @@ static void tcg_out_movi(TCGContext *s, TCGType type,
     tcg_out64(s, arg);
 }
 
+/* Load a host address, in the relocatable 10 byte form if the code may be
+   saved by tb-cache.c.  */
+static void tcg_out_movi_host(TCGContext *s, TCGReg ret, uintptr_t arg)
+{
+    if (TCG_TARGET_REG_BITS == 64 && s->host_relocs) {
+        tcg_out_opc(s, OPC_MOVL_Iv + P_REXW + LOWREGMASK(ret), 0, ret, 0);
+        tcg_out64(s, arg);
+        tcg_note_host_reloc(s, s->code_ptr - 8, TCG_HOST_RELOC_ABS64, arg);
+    } else {
+        tcg_out_movi(s, TCG_TYPE_PTR, ret, arg);
+    }
+}
+
 static inline void tcg_out_pushi(TCGContext *s, tcg_target_long val)
 {
     if (val == (int8_t)val) {
@@ -1106,8 +1120,10 @@ static void tcg_out_branch(TCGContext *s, int call, tcg_insn_unit *dest)
     if (disp == (int32_t)disp) {
         tcg_out_opc(s, call ? OPC_CALL_Jz : OPC_JMP_long, 0, 0, 0);
         tcg_out32(s, disp);
+        tcg_note_host_reloc(s, s->code_ptr - 4, TCG_HOST_RELOC_REL32,
+                            (uintptr_t)dest);
     } else {
-        tcg_out_movi(s, TCG_TYPE_PTR, TCG_REG_R10, (uintptr_t)dest);
+        tcg_out_movi_host(s, TCG_REG_R10, (uintptr_t)dest);
         tcg_out_modrm(s, OPC_GRP5,
                       call ? EXT5_CALLN_Ev : EXT5_JMPN_Ev, TCG_REG_R10);
     }
@@ -1314,8 +1330,8 @@ static void tcg_out_qemu_ld_slow_path(TCGContext *s, TCGLabelQemuLdst *l)
         tcg_out_mov(s, TCG_TYPE_PTR, tcg_target_call_iarg_regs[0], TCG_AREG0);
         /* The second argument is already loaded with addrlo.  */
         tcg_out_movi(s, TCG_TYPE_I32, tcg_target_call_iarg_regs[2], oi);
-        tcg_out_movi(s, TCG_TYPE_PTR, tcg_target_call_iarg_regs[3],
-                     (uintptr_t)l->raddr);
+        tcg_out_movi_host(s, tcg_target_call_iarg_regs[3],
+                          (uintptr_t)l->raddr);
     }
 
     tcg_out_call(s, qemu_ld_helpers[opc & (MO_BSWAP | MO_SIZE)]);
@@ -1413,10 +1429,10 @@ static void tcg_out_qemu_st_slow_path(TCGContext *s, TCGLabelQemuLdst *l)
 
         if (ARRAY_SIZE(tcg_target_call_iarg_regs) > 4) {
             retaddr = tcg_target_call_iarg_regs[4];
-            tcg_out_movi(s, TCG_TYPE_PTR, retaddr, (uintptr_t)l->raddr);
+            tcg_out_movi_host(s, retaddr, (uintptr_t)l->raddr);
         } else {
             retaddr = TCG_REG_RAX;
-            tcg_out_movi(s, TCG_TYPE_PTR, retaddr, (uintptr_t)l->raddr);
+            tcg_out_movi_host(s, retaddr, (uintptr_t)l->raddr);
             tcg_out_st(s, TCG_TYPE_PTR, retaddr, TCG_REG_ESP,
                        TCG_TARGET_CALL_STACK_OFFSET);
         }
@@ -1771,7 +1787,12 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
 
     switch(opc) {
     case INDEX_op_exit_tb:
-        tcg_out_movi(s, TCG_TYPE_PTR, TCG_REG_EAX, args[0]);
+        /* A non-zero value is the address of the TB */
+        if (args[0]) {
+            tcg_out_movi_host(s, TCG_REG_EAX, args[0]);
+        } else {
+            tcg_out_movi(s, TCG_TYPE_PTR, TCG_REG_EAX, 0);
+        }
         tcg_out_jmp(s, tb_ret_addr);
         break;
     case INDEX_op_goto_tb:
@@ -1787,6 +1808,10 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
         }
         s->tb_next_offset[args[0]] = tcg_current_code_size(s);
         break;
+    case INDEX_op_goto_ptr:
+        /* jmp to the given host address (could be epilogue) */
+        tcg_out_modrm(s, OPC_GRP5, EXT5_JMPN_Ev, args[0]);
+        break;
     case INDEX_op_br:
         tcg_out_jxx(s, JCC_JMP, arg_label(args[0]), 0);
         break;
@@ -2112,6 +2137,7 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
 static const TCGTargetOpDef x86_op_defs[] = {
     { INDEX_op_exit_tb, { } },
     { INDEX_op_goto_tb, { } },
+    { INDEX_op_goto_ptr, { "r" } },
     { INDEX_op_br, { } },
     { INDEX_op_ld8u_i32, { "r", "r" } },
     { INDEX_op_ld8s_i32, { "r", "r" } },
@@ -2307,6 +2333,11 @@ static void tcg_target_qemu_prologue(TCGContext *s)
     tcg_out_modrm(s, OPC_GRP5, EXT5_JMPN_Ev, tcg_target_call_iarg_regs[1]);
 #endif
 
+    /* Return path for goto_ptr. Set return value to 0, a-la exit_tb,
+       and fall through to the rest of the epilogue.  */
+    s->code_gen_epilogue = s->code_ptr;
+    tcg_out_movi(s, TCG_TYPE_REG, TCG_REG_EAX, 0);
+
     /* TB epilogue */
     tb_ret_addr = s->code_ptr;
 
@@ -2358,6 +2389,9 @@ static void tcg_target_init(TCGContext *s)
     }
 #endif
 
+    s->host_code_features = have_cmov | have_movbe << 1 | have_bmi1 << 2
+                            | have_bmi2 << 3;
+
     if (TCG_TARGET_REG_BITS == 64) {
         tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_I32], 0, 0xffff);
         tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_I64], 0, 0xffff);
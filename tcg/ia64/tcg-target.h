@@ -155,6 +155,7 @@ typedef enum {
 #define TCG_TARGET_HAS_mulu2_i32        0
 #define TCG_TARGET_HAS_mulu2_i64        0
 #define TCG_TARGET_HAS_muls2_i32        0
+#define TCG_TARGET_HAS_goto_ptr         0
 #define TCG_TARGET_HAS_muls2_i64        0
 #define TCG_TARGET_HAS_muluh_i32        0
 #define TCG_TARGET_HAS_muluh_i64        0
@@ -755,6 +755,11 @@ static inline void tcg_gen_exit_tb(uintptr_t val)
 
 void tcg_gen_goto_tb(unsigned idx);
 
+static inline void tcg_gen_goto_ptr(TCGv_ptr ptr)
+{
+    tcg_gen_op1i(INDEX_op_goto_ptr, GET_TCGV_PTR(ptr));
+}
+
 #if TARGET_LONG_BITS == 32
 #define TCGv TCGv_i32
 #define tcg_temp_new() tcg_temp_new_i32()
@@ -435,6 +435,28 @@ void tcg_func_start(TCGContext *s)
     s->gen_next_parm_idx = 0;
 
     s->be = tcg_malloc(sizeof(TCGBackendData));
+
+    s->nb_host_relocs = 0;
+    s->host_code_uncacheable = false;
+}
+
+/* Record that the code at FIELD refers to the host address TARGET.  */
+void tcg_note_host_reloc(TCGContext *s, void *field, TCGHostRelocType type,
+                         uintptr_t target)
+{
+    TCGHostReloc *r;
+
+    if (!s->host_relocs) {
+        return;
+    }
+    if (s->nb_host_relocs == TCG_MAX_HOST_RELOCS) {
+        s->host_code_uncacheable = true;
+        return;
+    }
+    r = &s->host_relocs[s->nb_host_relocs++];
+    r->offset = tcg_ptr_byte_diff(field, s->code_buf);
+    r->type = type;
+    r->target = target;
 }
 
 static inline void tcg_temp_alloc(TCGContext *s, int n)
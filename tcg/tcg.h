@@ -491,6 +491,20 @@ QEMU_BUILD_BUG_ON(NB_OPS > 0xff);
 QEMU_BUILD_BUG_ON(OPC_BUF_SIZE >= 0x7fff);
 QEMU_BUILD_BUG_ON(OPPARAM_BUF_SIZE >= 0x7fff);
 
+/* A host address embedded in generated code, see tb-cache.c.  */
+typedef enum TCGHostRelocType {
+    TCG_HOST_RELOC_REL32,       /* 32-bit displacement from the field end */
+    TCG_HOST_RELOC_ABS64,       /* 64-bit absolute address */
+} TCGHostRelocType;
+
+typedef struct TCGHostReloc {
+    uint32_t offset;            /* of the field, from the start of the TB */
+    TCGHostRelocType type;
+    uintptr_t target;
+} TCGHostReloc;
+
+#define TCG_MAX_HOST_RELOCS 1024
+
 struct TCGContext {
     uint8_t *pool_cur, *pool_end;
     TCGPool *pool_first, *pool_current, *pool_first_large;
@@ -557,6 +571,7 @@ struct TCGContext {
        extension that allows arithmetic on void*.  */
     int code_gen_max_blocks;
     void *code_gen_prologue;
+    void *code_gen_epilogue;
     void *code_gen_buffer;
     size_t code_gen_buffer_size;
     void *code_gen_ptr;
@@ -564,6 +579,15 @@ struct TCGContext {
     /* Threshold to flush the translated code buffer.  */
     void *code_gen_highwater;
 
+    /* Host addresses embedded in the code of the current TB, recorded by
+       the backend while host_relocs is non-NULL so that the code can be
+       saved and loaded into another process.  */
+    TCGHostReloc *host_relocs;
+    int nb_host_relocs;
+    bool host_code_uncacheable;
+    /* Optional host CPU features the backend generates code for.  */
+    uint32_t host_code_features;
+
     TBContext tb_ctx;
 
     /* The TCGBackendData structure is private to tcg-target.c.  */
@@ -765,6 +789,9 @@ void tcg_add_target_add_op_defs(const TCGTargetOpDef *tdefs);
 #define tcg_temp_free_ptr(T) tcg_temp_free_i64(TCGV_PTR_TO_NAT(T))
 #endif
 
+void tcg_note_host_reloc(TCGContext *s, void *field, TCGHostRelocType type,
+                         uintptr_t target);
+
 void tcg_gen_callN(TCGContext *s, void *func,
                    TCGArg ret, int nargs, TCGArg *args);
 
@@ -780,6 +807,14 @@ TCGv_i64 tcg_const_i64(int64_t val);
 TCGv_i32 tcg_const_local_i32(int32_t val);
 TCGv_i64 tcg_const_local_i64(int64_t val);
 
+/* A pointer into this QEMU process, such as a coprocessor register
+   descriptor, whose code cannot be saved for another process.  */
+static inline TCGv_ptr tcg_const_host_ptr(const void *p)
+{
+    tcg_ctx.host_code_uncacheable = true;
+    return tcg_const_ptr(p);
+}
+
 TCGLabel *gen_new_label(void);
 
 /**
@@ -0,0 +1,146 @@
+/*
+ * QTest testcase for the STM32F2xx peripherals of the Pebble machines
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+#include "libqtest.h"
+
+#include <stdio.h>
+#include <glib.h>
+#include <unistd.h>
+
+#define SRAM_ADDR 0x20000000
+#define CRC_BASE_ADDR 0x40023000
+#define DMA2_BASE_ADDR 0x40026400
+
+#define CRC_DR 0x00
+#define CRC_CR 0x08
+#define CRC_CR_RESET 0x00000001
+
+#define DMA_LISR 0x00
+#define DMA_LIFCR 0x08
+#define DMA_LISR_TCIF0 (1 << 5)
+#define DMA_S0CR 0x10
+#define DMA_S0NDTR 0x14
+#define DMA_S0PAR 0x18
+#define DMA_S0M0AR 0x1c
+#define DMA_SxCR_EN 0x00000001
+#define DMA_SxCR_DIR_M2M (2 << 6)
+#define DMA_SxCR_PINC 0x00000200
+#define DMA_SxCR_PSIZE_WORD (2 << 11)
+#define DMA_SxCR_MSIZE_WORD (2 << 13)
+
+#define CRC_WORDS 64
+
+const char *dummy_kernel_path = "tests/test-stm32f2xx-dummy-kernel.bin";
+const uint32_t dummy_kernel_data = 0x12345678;
+
+static void write_dummy_kernel_bin(void)
+{
+    FILE *kernel_file = fopen(dummy_kernel_path, "wb");
+    g_assert(kernel_file);
+
+    size_t write_size = fwrite(&dummy_kernel_data, 4, 1, kernel_file);
+    g_assert(write_size == 1);
+
+    int close_result = fclose(kernel_file);
+    g_assert(close_result == 0);
+}
+
+// Firmware checksums a buffer by pointing a memory-to-memory DMA2 stream at
+// CRC_DR: PAR is the incrementing source, M0AR the fixed destination.
+static void test_crc_dma_m2m(void)
+{
+    uint32_t expected;
+    int i;
+
+    writel(CRC_BASE_ADDR + CRC_CR, CRC_CR_RESET);
+    for (i = 0; i < CRC_WORDS; i++) {
+        uint32_t word = 0x01020304 * (i + 1) ^ (i << 24);
+
+        writel(SRAM_ADDR + i * 4, word);
+        writel(CRC_BASE_ADDR + CRC_DR, word);
+    }
+    expected = readl(CRC_BASE_ADDR + CRC_DR);
+
+    writel(CRC_BASE_ADDR + CRC_CR, CRC_CR_RESET);
+    writel(DMA2_BASE_ADDR + DMA_LIFCR, 0x3d);
+    writel(DMA2_BASE_ADDR + DMA_S0PAR, SRAM_ADDR);
+    writel(DMA2_BASE_ADDR + DMA_S0M0AR, CRC_BASE_ADDR + CRC_DR);
+    writel(DMA2_BASE_ADDR + DMA_S0NDTR, CRC_WORDS);
+    writel(DMA2_BASE_ADDR + DMA_S0CR, DMA_SxCR_DIR_M2M | DMA_SxCR_PINC |
+           DMA_SxCR_PSIZE_WORD | DMA_SxCR_MSIZE_WORD | DMA_SxCR_EN);
+    clock_step(1000000);
+
+    g_assert_cmphex(readl(DMA2_BASE_ADDR + DMA_LISR) & DMA_LISR_TCIF0, ==,
+                    DMA_LISR_TCIF0);
+    g_assert_cmphex(readl(DMA2_BASE_ADDR + DMA_S0CR) & DMA_SxCR_EN, ==, 0);
+    g_assert_cmphex(readl(DMA2_BASE_ADDR + DMA_S0NDTR), ==, 0);
+    g_assert_cmphex(readl(CRC_BASE_ADDR + CRC_DR), ==, expected);
+
+    // The source buffer is only read
+    g_assert_cmphex(readl(SRAM_ADDR), ==, 0x01020304);
+}
+
+// The unit only takes whole words, so the usual "123456789" check value
+// cannot be fed to it. Use the CRC-32/MPEG-2 of "12345678" instead, sent as
+// two words with the first character in the most significant byte.
+static void test_crc_known_answer(void)
+{
+    static const uint32_t words[] = { 0x31323334, 0x35363738 };
+    int i;
+
+    writel(CRC_BASE_ADDR + CRC_CR, CRC_CR_RESET);
+    writel(CRC_BASE_ADDR + CRC_DR, 0x12345678);
+    g_assert_cmphex(readl(CRC_BASE_ADDR + CRC_DR), ==, 0xdf8a8a2b);
+
+    writel(CRC_BASE_ADDR + CRC_CR, CRC_CR_RESET);
+    for (i = 0; i < 2; i++) {
+        writel(CRC_BASE_ADDR + CRC_DR, words[i]);
+    }
+    g_assert_cmphex(readl(CRC_BASE_ADDR + CRC_DR), ==, 0x49e3c2fb);
+
+    for (i = 0; i < 2; i++) {
+        writel(SRAM_ADDR + i * 4, words[i]);
+    }
+    writel(CRC_BASE_ADDR + CRC_CR, CRC_CR_RESET);
+    writel(DMA2_BASE_ADDR + DMA_LIFCR, 0x3d);
+    writel(DMA2_BASE_ADDR + DMA_S0PAR, SRAM_ADDR);
+    writel(DMA2_BASE_ADDR + DMA_S0M0AR, CRC_BASE_ADDR + CRC_DR);
+    writel(DMA2_BASE_ADDR + DMA_S0NDTR, 2);
+    writel(DMA2_BASE_ADDR + DMA_S0CR, DMA_SxCR_DIR_M2M | DMA_SxCR_PINC |
+           DMA_SxCR_PSIZE_WORD | DMA_SxCR_MSIZE_WORD | DMA_SxCR_EN);
+    clock_step(1000000);
+
+    g_assert_cmphex(readl(DMA2_BASE_ADDR + DMA_S0NDTR), ==, 0);
+    g_assert_cmphex(readl(CRC_BASE_ADDR + CRC_DR), ==, 0x49e3c2fb);
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    write_dummy_kernel_bin();
+
+    gchar *qemu_args = g_strdup_printf("-display none "
+                                       "-machine pebble-bb2 "
+                                       "-kernel %s",
+                                       dummy_kernel_path);
+    qtest_start(qemu_args);
+
+    qtest_add_func("/stm32f2xx/crc/known-answer", test_crc_known_answer);
+    qtest_add_func("/stm32f2xx/crc/dma-m2m", test_crc_dma_m2m);
+
+    ret = g_test_run();
+
+    qtest_end();
+
+    unlink(dummy_kernel_path);
+    g_free(qemu_args);
+
+    return ret;
+}
@@ -311,6 +311,26 @@ ThreadPool *thread_pool_new(AioContext *ctx)
     return pool;
 }
 
+/* Only the forking thread exists in a child process, so the workers are
+ * gone.  The pool must have been idle (e.g. after bdrv_drain_all()); forget
+ * about the old threads and let new ones be spawned on demand. */
+void thread_pool_after_fork(ThreadPool *pool)
+{
+    if (!pool) {
+        return;
+    }
+
+    assert(QTAILQ_EMPTY(&pool->request_list));
+
+    qemu_mutex_init(&pool->lock);
+    qemu_cond_init(&pool->worker_stopped);
+    qemu_sem_init(&pool->sem, 0);
+    pool->cur_threads = 0;
+    pool->idle_threads = 0;
+    pool->new_threads = 0;
+    pool->pending_threads = 0;
+}
+
 void thread_pool_free(ThreadPool *pool)
 {
     if (!pool) {
@@ -780,6 +780,7 @@ static TranslationBlock *tb_alloc(target_ulong pc)
     tb = &tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs++];
     tb->pc = pc;
     tb->cflags = 0;
+    tb->exec_count = 0;
     return tb;
 }
 
@@ -1175,9 +1176,46 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         phys_page2 = get_page_addr_code(env, virt_page2);
     }
     tb_link_page(tb, phys_pc, phys_page2);
+#ifndef CONFIG_USER_ONLY
+    if (tb_cache_enabled) {
+        tb_cache_record(cpu, tb);
+    }
+#endif
     return tb;
 }
 
+#ifndef CONFIG_USER_ONLY
+/* Allocate a TB for PC with CODE_SIZE bytes of the code buffer, for host
+ * code saved by an earlier run (see tb-cache.c) that the caller copies in
+ * and relocates.  Returns NULL if the buffer is full.  The TB is dropped
+ * again with tb_free(), or made visible with tb_link_restored().
+ */
+TranslationBlock *tb_alloc_restored(target_ulong pc, size_t code_size)
+{
+    TranslationBlock *tb;
+
+    if (tcg_ctx.code_gen_ptr + code_size > tcg_ctx.code_gen_highwater) {
+        return NULL;
+    }
+    tb = tb_alloc(pc);
+    if (!tb) {
+        return NULL;
+    }
+    tb->tc_ptr = tcg_ctx.code_gen_ptr;
+    tcg_ctx.code_gen_ptr = (void *)
+        ROUND_UP((uintptr_t)tb->tc_ptr + code_size, CODE_GEN_ALIGN);
+    return tb;
+}
+
+void tb_link_restored(TranslationBlock *tb, tb_page_addr_t phys_pc,
+                      tb_page_addr_t phys_page2)
+{
+    flush_icache_range((uintptr_t)tb->tc_ptr,
+                       (uintptr_t)tcg_ctx.code_gen_ptr);
+    tb_link_page(tb, phys_pc, phys_page2);
+}
+#endif
+
 /*
  * Invalidate all TBs which intersect with the target physical address range
  * [start;end[. NOTE: start and end may refer to *different* physical pages.
@@ -3867,6 +3867,9 @@ int main(int argc, char **argv, char **envp)
                     tcg_tb_size = 0;
                 }
                 break;
+            case QEMU_OPTION_tb_cache:
+                tcg_tb_cache = optarg;
+                break;
             case QEMU_OPTION_icount:
                 icount_opts = qemu_opts_parse_noisily(qemu_find_opts("icount"),
                                                       optarg, true);
@@ -3874,6 +3877,11 @@ int main(int argc, char **argv, char **envp)
                     exit(1);
                 }
                 break;
+            case QEMU_OPTION_idle_warp:
+                configure_idle_warp();
+                /* Let the RTC follow the warped clock as well */
+                rtc_clock = QEMU_CLOCK_VIRTUAL;
+                break;
             case QEMU_OPTION_incoming:
                 if (!incoming) {
                     runstate_set(RUN_STATE_INMIGRATE);